@@ -0,0 +1,49 @@
+#ifndef _ab_h__
+#define _ab_h__
+
+#include <stdint.h>
+
+/* Interface of the firmware libraries (base.so, new.so). Each one holds
+ * a build of the firmware, the simulated chip and the virtual Wiimote of
+ * sil, and runs once: the firmware state cannot be reset. */
+
+#define AB_ENTRY			"ab_run"
+#define AB_MAX_REPORT		32
+
+struct ab_config {
+	const char *script; // input trace, sil script format
+	int64_t shift_ns; // added to the script times, earlier ones become 0
+	const uint64_t *polls; // poll start times, NULL for period_ns
+	int num_polls;
+	uint64_t period_ns;
+	uint64_t byte_ns;
+	int read_len;
+	int mode, profile; // written during the handshake, see master_init
+	uint64_t end_ns;
+};
+
+struct ab_report {
+	uint64_t t; // end of the read
+	int len;
+	unsigned char data[AB_MAX_REPORT];
+};
+
+// one line of the script, after the shift
+struct ab_event {
+	uint64_t t;
+	uint8_t state; // INPUT_* (see sil/input.h)
+};
+
+/* Filled by ab_run, the arrays are allocated with malloc */
+struct ab_result {
+	struct ab_report *reports;
+	int num_reports;
+	struct ab_event *events;
+	int num_events;
+	uint64_t nacks; // polls the firmware did not acknowledge
+	int halted; // fw_main returned
+};
+
+typedef int (*ab_run_fn)(const struct ab_config *c, struct ab_result *r);
+
+#endif // _ab_h__
@@ -0,0 +1,151 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sil/hw.h"
+#include "../sil/master.h"
+#include "../sil/input.h"
+#include "../sil/probe.h"
+#include "ab.h"
+
+/* Built into each firmware library, see ab.h. The loop is the one of
+ * sil in fast mode. */
+
+static int core_grow(void **p, int *cap, int n, size_t size)
+{
+	void *np;
+
+	if (n < *cap)
+		return 0;
+
+	*cap = *cap ? *cap * 2 : 1024;
+	np = realloc(*p, *cap * size);
+	if (!np) {
+		perror("realloc");
+		return -1;
+	}
+	*p = np;
+	return 0;
+}
+
+static int core_cap, core_failed;
+
+static void onReport(const unsigned char *data, int len, uint64_t t, void *ctx)
+{
+	struct ab_result *r = ctx;
+	struct ab_report *rep;
+
+	if (core_failed || core_grow((void **)&r->reports, &core_cap, r->num_reports, sizeof(struct ab_report))) {
+		core_failed = 1;
+		return;
+	}
+
+	rep = &r->reports[r->num_reports++];
+	rep->t = t;
+	rep->len = len < AB_MAX_REPORT ? len : AB_MAX_REPORT;
+	memcpy(rep->data, data, rep->len);
+}
+
+static int core_loadEvents(struct input *in, const struct ab_config *c, struct ab_result *r)
+{
+	int i;
+
+	for (i = 0; i < in->script_len; i++) {
+		int64_t t = in->script[i].t + c->shift_ns;
+
+		in->script[i].t = t > 0 ? t : 0;
+	}
+
+	r->events = malloc(in->script_len * sizeof(struct ab_event));
+	if (!r->events) {
+		perror("malloc");
+		return -1;
+	}
+	for (i = 0; i < in->script_len; i++) {
+		r->events[i].t = in->script[i].t;
+		r->events[i].state = in->script[i].state;
+	}
+	r->num_events = in->script_len;
+
+	return 0;
+}
+
+__attribute__((visibility("default")))
+int ab_run(const struct ab_config *c, struct ab_result *r)
+{
+	struct master master;
+	struct input input;
+	uint64_t t_next;
+
+	memset(r, 0, sizeof(struct ab_result));
+
+	input_init(&input);
+	if (input_loadScript(&input, c->script, 0))
+		return -1;
+	if (core_loadEvents(&input, c, r))
+		return -1;
+
+	if (hw_init(NULL))
+		return -1;
+
+	master_init(&master, c->period_ns, c->byte_ns, c->read_len, c->mode, c->profile);
+	if (c->polls)
+		master_setSchedule(&master, c->polls, c->num_polls);
+	master.on_report = onReport;
+	master.ctx = r;
+
+	sil_now = 0;
+
+	// script lines at 0 are the state at power-up
+	input_scriptRun(&input);
+	hw_run();
+
+	while (!core_failed)
+	{
+		t_next = master.next;
+		if (hw_state() == HW_DELAY && hw_deadline() < t_next)
+			t_next = hw_deadline();
+		if (input_scriptNext(&input) < t_next)
+			t_next = input_scriptNext(&input);
+		if (hw_timerNext() < t_next)
+			t_next = hw_timerNext();
+
+		if (t_next > c->end_ns)
+			break;
+
+		sil_now = t_next;
+
+		hw_timer();
+
+		input_scriptRun(&input);
+		if (master.next <= sil_now)
+			master_step(&master);
+		if (hw_state() == HW_RUNNING || (hw_state() == HW_DELAY && hw_deadline() <= sil_now))
+			hw_run();
+		if (hw_state() == HW_HALTED) {
+			r->halted = 1;
+			break;
+		}
+	}
+
+	r->nacks = probe.nacks;
+	input_close(&input);
+
+	return core_failed ? -1 : 0;
+}
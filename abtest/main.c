@@ -0,0 +1,474 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <limits.h>
+
+#include "../classic.h"
+#include "../sil/input.h"
+#include "../sil/output.h"
+#include "ab.h"
+
+// the first poll of a schedule is moved here, after the handshake
+#define FIRST_POLL_NS		20000000ULL
+#define MAX_DIFFS_SHOWN		10
+#define NOT_SEEN			UINT64_MAX
+
+#define BASE	0
+#define NEW		1
+
+static const char *names[2] = { "base", "new" };
+
+// a change of the trigger or of the sensor
+struct edge {
+	uint64_t t;
+	int bit; // INPUT_*
+	int value;
+	uint64_t limit; // the input has this value again from here
+	uint64_t lat[2]; // to the first read showing it, or NOT_SEEN
+};
+
+static void usage(void)
+{
+	printf("Usage: ./abtest [options] base.so new.so\n");
+	printf("\n");
+	printf("Replays an input trace and a poll schedule through two builds of the\n");
+	printf("firmware (see the Makefile) and compares the latency of every trigger\n");
+	printf("and sensor change to the first report showing it.\n");
+	printf("\n");
+	printf("  -S file    Input trace, in the sil script format (required)\n");
+	printf("  -s file    Poll schedule: busdecode -v listing, or one time in ms per line\n");
+	printf("  -p ms      Poll period, without -s (default: 5)\n");
+	printf("  -b us      Time per bus event, address or byte (default: 60)\n");
+	printf("  -l bytes   Bytes per report read (default: 21)\n");
+	printf("  -m mode    Report format written to 0xFE: 1, 2 or 3 (default: none)\n");
+	printf("  -P n       Gun profile to select (default: none)\n");
+	printf("  -t sec     Stop after this much virtual time (default: 10ms after the\n");
+	printf("             last poll of the schedule, or 10s)\n");
+	printf("  -T ms      Mean latency difference counted as the same (default: 0.05)\n");
+	printf("  -v         List every change and every differing report\n");
+	printf("  -h         Prints this help\n");
+	printf("\n");
+	printf("Exit status: 0 when new is faster or the same, 2 when it is slower.\n");
+}
+
+/* A poll starts with the write of the report address (00) to 0x52.
+ * busdecode lines: "<s> 52(W) [1] 00 ...". Other lines: "<ms>". */
+static int loadPolls(const char *path, uint64_t **polls)
+{
+	char line[256];
+	uint64_t *p = NULL;
+	int n = 0, cap = 0, lineno = 0, listing = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		unsigned int addr, data;
+		int nbytes;
+		char rw, extra;
+		double t;
+		uint64_t t_ns;
+
+		lineno++;
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == 0)
+			continue;
+
+		if (sscanf(line, "%lf %x(%c) [%d] %x", &t, &addr, &rw, &nbytes, &data) >= 3) {
+			listing = 1;
+			if (addr != 0x52 || rw != 'W' || nbytes != 1 || data != 0)
+				continue;
+			t_ns = t * 1e9;
+		} else if (listing) {
+			// the statistics after the listing
+			continue;
+		} else if (sscanf(line, "%lf %c", &t, &extra) == 1) {
+			t_ns = t * 1e6;
+		} else {
+			fprintf(stderr, "%s:%d: expected a busdecode transfer or <ms>\n", path, lineno);
+			goto error;
+		}
+
+		if (t < 0 || (n && t_ns < p[n - 1])) {
+			fprintf(stderr, "%s:%d: time goes backwards\n", path, lineno);
+			goto error;
+		}
+
+		if (n == cap) {
+			uint64_t *np;
+
+			cap = cap ? cap * 2 : 1024;
+			np = realloc(p, cap * sizeof(uint64_t));
+			if (!np) {
+				perror("realloc");
+				goto error;
+			}
+			p = np;
+		}
+		p[n++] = t_ns;
+	}
+	fclose(fp);
+
+	if (!n) {
+		fprintf(stderr, "%s: no polls\n", path);
+		free(p);
+		return -1;
+	}
+
+	*polls = p;
+	return n;
+
+error:
+	fclose(fp);
+	free(p);
+	return -1;
+}
+
+static int runLib(const char *path, const struct ab_config *c, struct ab_result *r)
+{
+	static void *prev;
+	char local[PATH_MAX];
+	ab_run_fn run;
+	void *lib;
+
+	// without a slash, dlopen would search the library path
+	if (!strchr(path, '/')) {
+		snprintf(local, sizeof(local), "./%s", path);
+		path = local;
+	}
+
+	// local: each library keeps its own firmware, chip and master
+	lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!lib) {
+		fprintf(stderr, "%s\n", dlerror());
+		return -1;
+	}
+	// the same file is loaded once, and the firmware runs once
+	if (lib == prev) {
+		fprintf(stderr, "%s: already loaded, copy it to compare a build with itself\n", path);
+		return -1;
+	}
+	prev = lib;
+	run = (ab_run_fn)dlsym(lib, AB_ENTRY);
+	if (!run) {
+		fprintf(stderr, "%s: %s\n", path, dlerror());
+		return -1;
+	}
+
+	if (run(c, r)) {
+		fprintf(stderr, "%s: run failed\n", path);
+		return -1;
+	}
+	if (r->halted)
+		fprintf(stderr, "%s: the firmware main loop returned\n", path);
+
+	return 0;
+}
+
+static int findEdges(const struct ab_result *r, struct edge **edges)
+{
+	struct edge *e;
+	int i, j, n = 0, state = 0;
+
+	e = malloc(r->num_events * 2 * sizeof(struct edge));
+	if (!e) {
+		perror("malloc");
+		return -1;
+	}
+
+	for (i = 0; i < r->num_events; i++) {
+		int bit;
+
+		for (bit = INPUT_TRIGGER; bit <= INPUT_SENSOR; bit <<= 1) {
+			if (!((r->events[i].state ^ state) & bit))
+				continue;
+			e[n].t = r->events[i].t;
+			e[n].bit = bit;
+			e[n].value = !!(r->events[i].state & bit);
+			e[n].limit = NOT_SEEN;
+			n++;
+		}
+		state = r->events[i].state;
+	}
+
+	// the second next change of the same input restores the value
+	for (i = 0; i < n; i++) {
+		int changes = 0;
+
+		for (j = i + 1; j < n; j++) {
+			if (e[j].bit == e[i].bit && ++changes == 2) {
+				e[i].limit = e[j].t;
+				break;
+			}
+		}
+	}
+
+	*edges = e;
+	return n;
+}
+
+static int showsInput(const struct ab_report *rep, int mode, int bit)
+{
+	struct classic_state s;
+
+	if (classic_decode(rep->data, rep->len, mode, &s))
+		return -1;
+
+	// gun.c: the trigger is A, the sensor is B
+	return !!(s.buttons & (bit == INPUT_TRIGGER ? CPAD_BTN_A : CPAD_BTN_B));
+}
+
+/* The first read ending after the change and showing the new value,
+ * before the input takes that value again. */
+static uint64_t latency(const struct edge *e, const struct ab_result *r, int mode)
+{
+	int lo = 0, hi = r->num_reports, i;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (r->reports[mid].t <= e->t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (i = lo; i < r->num_reports && r->reports[i].t < e->limit; i++) {
+		if (showsInput(&r->reports[i], mode, e->bit) == e->value)
+			return r->reports[i].t - e->t;
+	}
+
+	return NOT_SEEN;
+}
+
+static int cmpU64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(uint64_t *v, int n, double p)
+{
+	if (!n)
+		return 0;
+	qsort(v, n, sizeof(uint64_t), cmpU64);
+	return v[(int)(p * (n - 1) + 0.5)] / 1e6;
+}
+
+static void printEdge(const struct edge *e, int64_t shift_ns)
+{
+	int k;
+
+	printf("%12.3f  %c%c ", (int64_t)e->t - shift_ns < 0 ? 0 : ((int64_t)e->t - shift_ns) / 1e6,
+		e->bit == INPUT_TRIGGER ? 'T' : 'S', e->value ? '+' : '-');
+	for (k = BASE; k <= NEW; k++) {
+		if (e->lat[k] == NOT_SEEN)
+			printf(" %9s", "dropped");
+		else
+			printf(" %9.3f", e->lat[k] / 1e6);
+	}
+	if (e->lat[BASE] != NOT_SEEN && e->lat[NEW] != NOT_SEEN)
+		printf(" %+9.3f", ((double)e->lat[NEW] - e->lat[BASE]) / 1e6);
+	printf("\n");
+}
+
+static void printReport(const char *name, const struct ab_report *rep)
+{
+	int i;
+
+	printf("    %-5s", name);
+	for (i = 0; i < rep->len; i++)
+		printf(" %02x", rep->data[i]);
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct ab_config c;
+	struct ab_result res[2];
+	struct edge *edges;
+	uint64_t *polls = NULL, *lat[2];
+	const char *schedule = NULL;
+	double period_ms = 5, byte_us = 60, duration_s = -1, tolerance_ms = 0.05;
+	double sum[2] = { 0, 0 }, delta_sum = 0;
+	int mode = 0, profile = -1, read_len = 21, verbose = 0;
+	int num_edges, measured = 0, both = 0, dropped[2] = { 0, 0 }, early = 0;
+	int diffs = 0, shown = 0, num_polls = 0, classic_mode;
+	int opt, i, k;
+	const char *verdict;
+
+	memset(&c, 0, sizeof(c));
+
+	while ((opt = getopt(argc, argv, "S:s:p:b:l:m:P:t:T:vh")) != -1) {
+		switch (opt)
+		{
+			case 'S': c.script = optarg; break;
+			case 's': schedule = optarg; break;
+			case 'p': period_ms = atof(optarg); break;
+			case 'b': byte_us = atof(optarg); break;
+			case 'l': read_len = atoi(optarg); break;
+			case 'm': mode = atoi(optarg); break;
+			case 'P': profile = atoi(optarg); break;
+			case 't': duration_s = atof(optarg); break;
+			case 'T': tolerance_ms = atof(optarg); break;
+			case 'v': verbose = 1; break;
+			case 'h': usage(); return 0;
+			default:
+				fprintf(stderr, "Unknown argument. Try -h\n");
+				return 1;
+		}
+	}
+
+	if (argc - optind != 2 || !c.script) {
+		usage();
+		return 1;
+	}
+	if (period_ms <= 0 || byte_us <= 0 || read_len < 1 || read_len > AB_MAX_REPORT || mode < 0 || mode > 3) {
+		fprintf(stderr, "Invalid Wiimote parameters\n");
+		return 1;
+	}
+
+	if (schedule) {
+		num_polls = loadPolls(schedule, &polls);
+		if (num_polls < 0)
+			return 1;
+
+		// the trace and the schedule share their time origin
+		c.shift_ns = (int64_t)FIRST_POLL_NS - (int64_t)polls[0];
+		for (i = 0; i < num_polls; i++)
+			polls[i] += c.shift_ns;
+		c.polls = polls;
+		c.num_polls = num_polls;
+	}
+
+	c.period_ns = period_ms * 1e6;
+	c.byte_ns = byte_us * 1e3;
+	c.read_len = read_len;
+	c.mode = mode;
+	c.profile = profile + 1;
+	if (duration_s >= 0)
+		c.end_ns = duration_s * 1e9;
+	else if (schedule)
+		c.end_ns = polls[num_polls - 1] + 10000000ULL;
+	else
+		c.end_ns = 10000000000ULL;
+
+	for (k = BASE; k <= NEW; k++) {
+		if (runLib(argv[optind + k], &c, &res[k]))
+			return 1;
+	}
+
+	num_edges = findEdges(&res[BASE], &edges);
+	if (num_edges < 0)
+		return 1;
+	lat[BASE] = malloc((num_edges + 1) * sizeof(uint64_t));
+	lat[NEW] = malloc((num_edges + 1) * sizeof(uint64_t));
+	if (!lat[BASE] || !lat[NEW]) {
+		perror("malloc");
+		return 1;
+	}
+
+	// reg 0xFE values, see main() in the firmware
+	classic_mode = mode == 2 ? CLASSIC_MODE_2 : mode == 3 ? CLASSIC_MODE_3 : CLASSIC_MODE_1;
+
+	if (verbose)
+		printf("%12s  %3s %9s %9s %9s\n", "trace ms", "in", "base ms", "new ms", "delta");
+
+	for (i = 0; i < num_edges; i++) {
+		struct edge *e = &edges[i];
+
+		// before the first read, or after the end: nothing to compare
+		if (!res[BASE].num_reports || e->t < res[BASE].reports[0].t || e->t > c.end_ns) {
+			early++;
+			continue;
+		}
+		measured++;
+
+		for (k = BASE; k <= NEW; k++) {
+			e->lat[k] = latency(e, &res[k], classic_mode);
+			if (e->lat[k] == NOT_SEEN)
+				dropped[k]++;
+		}
+		if (e->lat[BASE] != NOT_SEEN && e->lat[NEW] != NOT_SEEN) {
+			for (k = BASE; k <= NEW; k++) {
+				lat[k][both] = e->lat[k];
+				sum[k] += e->lat[k];
+			}
+			delta_sum += (double)e->lat[NEW] - e->lat[BASE];
+			both++;
+		}
+
+		if (verbose)
+			printEdge(e, c.shift_ns);
+	}
+
+	for (i = 0; i < res[BASE].num_reports && i < res[NEW].num_reports; i++) {
+		const struct ab_report *a = &res[BASE].reports[i], *b = &res[NEW].reports[i];
+
+		if (a->len == b->len && !memcmp(a->data, b->data, a->len))
+			continue;
+		diffs++;
+		if (verbose && shown < MAX_DIFFS_SHOWN) {
+			if (!shown)
+				printf("\nDiffering reports (read number, trace ms):\n");
+			printf("%6d %12.3f\n", i, ((int64_t)a->t - c.shift_ns) / 1e6);
+			printReport(names[BASE], a);
+			printReport(names[NEW], b);
+			shown++;
+		}
+	}
+	if (verbose)
+		printf("\n");
+
+	printf("%d input changes, %d measured, %d before the first read\n", num_edges, measured, early);
+	printf("%-22s %10s %10s %10s\n", "", names[BASE], names[NEW], "delta");
+	if (both) {
+		printf("%-22s %10.3f %10.3f %+10.3f\n", "latency mean (ms)",
+			sum[BASE] / both / 1e6, sum[NEW] / both / 1e6, delta_sum / both / 1e6);
+		printf("%-22s %10.3f %10.3f\n", "latency median (ms)",
+			percentile(lat[BASE], both, 0.5), percentile(lat[NEW], both, 0.5));
+		printf("%-22s %10.3f %10.3f\n", "latency 99% (ms)",
+			percentile(lat[BASE], both, 0.99), percentile(lat[NEW], both, 0.99));
+		printf("%-22s %10.3f %10.3f\n", "latency max (ms)",
+			percentile(lat[BASE], both, 1), percentile(lat[NEW], both, 1));
+	}
+	printf("%-22s %10d %10d %+10d\n", "dropped changes", dropped[BASE], dropped[NEW], dropped[NEW] - dropped[BASE]);
+	printf("%-22s %10d %10d %+10d\n", "reports read", res[BASE].num_reports, res[NEW].num_reports,
+		res[NEW].num_reports - res[BASE].num_reports);
+	printf("%-22s %10llu %10llu\n", "polls not acknowledged",
+		(unsigned long long)res[BASE].nacks, (unsigned long long)res[NEW].nacks);
+	printf("%-22s %10d\n", "differing reports", diffs);
+
+	if (dropped[NEW] > dropped[BASE] || (both && delta_sum / both / 1e6 > tolerance_ms))
+		verdict = "slower";
+	else if (dropped[NEW] < dropped[BASE] || (both && delta_sum / both / 1e6 < -tolerance_ms))
+		verdict = "faster";
+	else
+		verdict = "the same";
+
+	printf("\nnew is %s %s base\n", verdict, strcmp(verdict, "the same") ? "than" : "as");
+
+	return !strcmp(verdict, "slower") ? 2 : 0;
+}
@@ -0,0 +1,500 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+
+/* Chunks per thread, so that a slow chunk does not hold everybody */
+#define CAP_CHUNKS_PER_THREAD	4
+#define CAP_MIN_CHUNK			(1 << 20)
+
+#define CAP_MAX_COLS			64
+
+/* A part of the capture, decoded by one thread.
+ *
+ * A chunk owns the transfers that start after its first sample and up
+ * to the first sample of the next chunk (end), included. The first
+ * sample only gives the initial state of the lines. Decoding continues
+ * past end until the transfer in progress is complete. */
+struct cap_chunk {
+	size_t begin, end; // samples (binary) or byte offsets (csv)
+	uint64_t first_index; // csv: sample number of the first line
+	uint64_t lines;
+	struct i2c_list out;
+};
+
+struct cap_job {
+	struct capture *c;
+	struct cap_chunk *chunks;
+	int num_chunks;
+	int next;
+	void (*func)(struct capture *c, struct cap_chunk *k);
+};
+
+/***** Input files *****/
+
+static int cap_parseRate(const char *s, double *rate)
+{
+	char *e;
+	double v = strtod(s, &e);
+
+	while (*e == ' ')
+		e++;
+	if (!strncasecmp(e, "GHz", 3)) v *= 1e9;
+	else if (!strncasecmp(e, "MHz", 3)) v *= 1e6;
+	else if (!strncasecmp(e, "kHz", 3)) v *= 1e3;
+	else if (strncasecmp(e, "Hz", 2)) return -1;
+
+	*rate = v;
+	return 0;
+}
+
+static int cap_matchCol(const char *name, int len, const char *want)
+{
+	return strlen(want) == len && !strncasecmp(name, want, len);
+}
+
+static int cap_isIndex(const char *s)
+{
+	if (!*s)
+		return 0;
+	for (; *s; s++) {
+		if (!isdigit((unsigned char)*s))
+			return 0;
+	}
+	return 1;
+}
+
+/* Sigrok CSV: comments starting with ';', an optional header line, then
+ * one line per sample. */
+static int cap_csvHeader(struct capture *c)
+{
+	const char *p = (const char *)c->map;
+	const char *end = p + c->size;
+	const char *eol, *f;
+	char line[1024];
+	int col, len;
+
+	c->time_col = -1;
+	c->scl_col = -1;
+	c->sda_col = -1;
+	if (cap_isIndex(c->scl_name)) c->scl_col = atoi(c->scl_name);
+	if (cap_isIndex(c->sda_name)) c->sda_col = atoi(c->sda_name);
+
+	while (p < end) {
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		len = eol - p;
+		if (len > sizeof(line) - 1)
+			len = sizeof(line) - 1;
+		memcpy(line, p, len);
+		line[len] = 0;
+
+		if (line[0] == ';' || line[0] == '#') {
+			char *r = strcasestr(line, "samplerate:");
+
+			if (r && c->samplerate == 0) {
+				cap_parseRate(r + 11, &c->samplerate);
+			}
+			p = eol + 1;
+			continue;
+		}
+
+		// data
+		if (isdigit((unsigned char)line[0]) || line[0] == '-' || line[0] == '.')
+			break;
+
+		// header line
+		for (col = 0, f = line; col < CAP_MAX_COLS; col++) {
+			const char *fe = strchr(f, ',');
+
+			len = fe ? fe - f : strlen(f);
+			while (len && isspace((unsigned char)f[len - 1]))
+				len--;
+
+			if (!strncasecmp(f, "time", 4) || !strncasecmp(f, "\"time", 5)) {
+				c->time_col = col;
+			}
+			else if (c->scl_col < 0 && cap_matchCol(f, len, c->scl_name)) {
+				c->scl_col = col;
+			}
+			else if (c->sda_col < 0 && cap_matchCol(f, len, c->sda_name)) {
+				c->sda_col = col;
+			}
+
+			if (!fe)
+				break;
+			f = fe + 1;
+		}
+		p = eol + 1;
+		break;
+	}
+
+	if (p > end)
+		p = end;
+	c->data_start = p - (const char *)c->map;
+
+	// without names, the first two data columns
+	if (c->scl_col < 0 || c->sda_col < 0) {
+		int first = c->time_col == 0 ? 1 : 0;
+
+		fprintf(stderr, "%s: columns %s/%s not found, using columns %d and %d\n",
+			c->path, c->scl_name, c->sda_name, first, first + 1);
+		c->scl_col = first;
+		c->sda_col = first + 1;
+	}
+
+	if (c->time_col < 0 && c->samplerate <= 0) {
+		fprintf(stderr, "%s: no time column and no sample rate, use -r\n", c->path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int cap_open(struct capture *c, const char *path)
+{
+	struct stat st;
+	int fd;
+
+	c->path = path;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror(path);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		perror("fstat");
+		close(fd);
+		return -1;
+	}
+	c->size = st.st_size;
+	if (!c->size) {
+		fprintf(stderr, "%s: empty\n", path);
+		close(fd);
+		return -1;
+	}
+
+	c->map = mmap(NULL, c->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (c->map == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	madvise((void *)c->map, c->size, MADV_SEQUENTIAL);
+
+	if (c->format == CAP_CSV)
+		return cap_csvHeader(c);
+
+	if (c->samplerate <= 0) {
+		fprintf(stderr, "%s: the sample rate is needed for binary captures, use -r\n", path);
+		return -1;
+	}
+	if (c->scl_bit >= c->unitsize * 8 || c->sda_bit >= c->unitsize * 8) {
+		fprintf(stderr, "Channel out of range for %d byte samples\n", c->unitsize);
+		return -1;
+	}
+
+	return 0;
+}
+
+void cap_close(struct capture *c)
+{
+	if (c->map && c->map != MAP_FAILED)
+		munmap((void *)c->map, c->size);
+	c->map = NULL;
+}
+
+/***** Binary decoding *****/
+
+static uint32_t cap_sample(const unsigned char *p, int unitsize)
+{
+	switch (unitsize)
+	{
+		case 1: return p[0];
+		case 2: return p[0] | (p[1] << 8);
+		default: return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+}
+
+static void cap_decodeBinary(struct capture *c, struct cap_chunk *k)
+{
+	const unsigned char *p = c->map;
+	size_t n = c->size / c->unitsize;
+	size_t i = k->begin;
+	double ns_per_sample = 1e9 / c->samplerate;
+	uint32_t mask = (1 << c->scl_bit) | (1 << c->sda_bit);
+	uint64_t rep_unit, mask8;
+	uint32_t last = ~0;
+	struct i2c_dec d;
+
+	// 8 bytes of samples equal to the last one: nothing to do
+	rep_unit = c->unitsize == 1 ? 0x0101010101010101ULL :
+			   c->unitsize == 2 ? 0x0001000100010001ULL : 0x0000000100000001ULL;
+	mask8 = mask * rep_unit;
+
+	i2c_init(&d, &k->out);
+
+	while (i < n) {
+		uint32_t v = cap_sample(p + i * c->unitsize, c->unitsize) & mask;
+
+		if (v != last) {
+			if (i > k->end && !d.active)
+				break;
+
+			i2c_sample(&d, (uint64_t)(i * ns_per_sample),
+				(v >> c->scl_bit) & 1, (v >> c->sda_bit) & 1, i <= k->end);
+			last = v;
+		}
+		i++;
+
+		if ((i * c->unitsize) % 8 == 0) {
+			uint64_t rep = last * rep_unit;
+
+			while (i * c->unitsize + 8 <= c->size) {
+				uint64_t w;
+
+				memcpy(&w, p + i * c->unitsize, 8);
+				if ((w ^ rep) & mask8)
+					break;
+				i += 8 / c->unitsize;
+			}
+		}
+	}
+
+	i2c_finish(&d, (uint64_t)(i * ns_per_sample));
+}
+
+/***** CSV decoding *****/
+
+/* strtod() could read past the end of the mapping */
+static const char *cap_parseTime(const char *s, const char *end, uint64_t *ns)
+{
+	double v = 0, scale = 1;
+	int neg = 0, exp = 0, eneg = 0;
+
+	if (s < end && *s == '-') { neg = 1; s++; }
+	while (s < end && isdigit((unsigned char)*s))
+		v = v * 10 + (*s++ - '0');
+	if (s < end && *s == '.') {
+		s++;
+		while (s < end && isdigit((unsigned char)*s)) {
+			scale /= 10;
+			v += (*s++ - '0') * scale;
+		}
+	}
+	if (s < end && (*s == 'e' || *s == 'E')) {
+		s++;
+		if (s < end && (*s == '-' || *s == '+')) eneg = *s++ == '-';
+		while (s < end && isdigit((unsigned char)*s))
+			exp = exp * 10 + (*s++ - '0');
+		while (exp--)
+			v = eneg ? v / 10 : v * 10;
+	}
+
+	*ns = neg ? 0 : (uint64_t)(v * 1e9 + 0.5);
+	return s;
+}
+
+static void cap_countLines(struct capture *c, struct cap_chunk *k)
+{
+	const char *p = (const char *)c->map + k->begin;
+	const char *end = (const char *)c->map + k->end;
+
+	k->lines = 0;
+	while (p < end && (p = memchr(p, '\n', end - p))) {
+		k->lines++;
+		p++;
+	}
+}
+
+static void cap_decodeCsv(struct capture *c, struct cap_chunk *k)
+{
+	const char *base = (const char *)c->map;
+	const char *p = base + k->begin;
+	const char *end = base + c->size;
+	const char *line_end;
+	double ns_per_sample = c->samplerate > 0 ? 1e9 / c->samplerate : 0;
+	uint64_t idx = k->first_index;
+	uint64_t t = 0;
+	struct i2c_dec d;
+
+	i2c_init(&d, &k->out);
+
+	for (; p < end; p = line_end + 1, idx++) {
+		int col = 0, scl = 0, sda = 0;
+		const char *f = p;
+
+		line_end = memchr(p, '\n', end - p);
+		if (!line_end)
+			line_end = end;
+
+		if (p - base > k->end && !d.active)
+			break;
+
+		if (c->time_col < 0)
+			t = idx * ns_per_sample;
+
+		while (f < line_end) {
+			if (col == c->time_col) {
+				cap_parseTime(f, line_end, &t);
+			} else if (col == c->scl_col) {
+				scl = *f == '1';
+			} else if (col == c->sda_col) {
+				sda = *f == '1';
+			}
+
+			f = memchr(f, ',', line_end - f);
+			if (!f)
+				break;
+			f++;
+			col++;
+		}
+
+		i2c_sample(&d, t, scl, sda, p - base <= k->end);
+	}
+
+	i2c_finish(&d, t);
+}
+
+/***** Threads *****/
+
+static void *cap_worker(void *arg)
+{
+	struct cap_job *job = arg;
+	int k;
+
+	while ((k = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->num_chunks) {
+		job->func(job->c, &job->chunks[k]);
+	}
+
+	return NULL;
+}
+
+static int cap_run(struct cap_job *job, int nthreads)
+{
+	pthread_t threads[nthreads];
+	int i, started = 0;
+
+	job->next = 0;
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, cap_worker, job)) {
+			perror("pthread_create");
+			break;
+		}
+		started++;
+	}
+
+	// the chunks are picked from a shared counter, whatever number of
+	// threads started is fine
+	if (!started)
+		cap_worker(job);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	return 0;
+}
+
+int cap_decode(struct capture *c, int nthreads, struct i2c_list *out)
+{
+	struct cap_job job;
+	struct cap_chunk *chunks;
+	size_t first, total, chunk_size;
+	int i, n;
+
+	if (c->format == CAP_CSV) {
+		first = c->data_start;
+		total = c->size;
+	} else {
+		first = 0;
+		total = c->size / c->unitsize;
+	}
+
+	n = nthreads * CAP_CHUNKS_PER_THREAD;
+	if ((total - first) * (c->format == CAP_CSV ? 1 : c->unitsize) / n < CAP_MIN_CHUNK)
+		n = (total - first) * (c->format == CAP_CSV ? 1 : c->unitsize) / CAP_MIN_CHUNK;
+	if (n < 1)
+		n = 1;
+
+	chunks = calloc(n, sizeof(struct cap_chunk));
+	if (!chunks) {
+		perror("calloc");
+		return -1;
+	}
+
+	chunk_size = (total - first) / n;
+	for (i = 0; i < n; i++) {
+		chunks[i].begin = first + chunk_size * i;
+		chunks[i].end = i == n - 1 ? total : first + chunk_size * (i + 1);
+	}
+
+	// CSV chunks start on a line
+	if (c->format == CAP_CSV) {
+		for (i = 1; i < n; i++) {
+			const char *p = (const char *)c->map + chunks[i].begin;
+			const char *nl = memchr(p, '\n', c->size - chunks[i].begin);
+
+			chunks[i].begin = nl ? nl + 1 - (const char *)c->map : c->size;
+			if (chunks[i].begin < chunks[i - 1].begin)
+				chunks[i].begin = chunks[i - 1].begin;
+			chunks[i - 1].end = chunks[i].begin;
+		}
+	}
+
+	job.c = c;
+	job.chunks = chunks;
+	job.num_chunks = n;
+
+	// without a time column, the sample number of each line is needed
+	if (c->format == CAP_CSV && c->time_col < 0) {
+		uint64_t lines = 0;
+
+		job.func = cap_countLines;
+		cap_run(&job, nthreads);
+		for (i = 0; i < n; i++) {
+			chunks[i].first_index = lines;
+			lines += chunks[i].lines;
+		}
+	}
+
+	job.func = c->format == CAP_CSV ? cap_decodeCsv : cap_decodeBinary;
+	cap_run(&job, nthreads);
+
+	for (i = 0; i < n; i++) {
+		size_t j;
+
+		for (j = 0; j < chunks[i].out.n; j++)
+			i2c_listAdd(out, &chunks[i].out.x[j]);
+		i2c_listFree(&chunks[i].out);
+	}
+	free(chunks);
+
+	return 0;
+}
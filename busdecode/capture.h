@@ -0,0 +1,38 @@
+#ifndef _capture_h__
+#define _capture_h__
+
+#include <stddef.h>
+#include "i2c.h"
+
+#define CAP_BINARY	0	// one sample per unitsize bytes, channel n in bit n
+#define CAP_CSV		1	// one sample per line
+
+struct capture {
+	const char *path;
+	const unsigned char *map;
+	size_t size;
+
+	int format;
+	double samplerate; // Hz, unused with a time column
+
+	// binary
+	int unitsize;
+	int scl_bit, sda_bit;
+
+	// csv
+	size_t data_start;
+	int time_col; // -1 when there is none
+	int scl_col, sda_col;
+	const char *scl_name, *sda_name;
+};
+
+/* Map the file. For CSV files, the header is read to find the columns
+ * and the sample rate. */
+int cap_open(struct capture *c, const char *path);
+void cap_close(struct capture *c);
+
+/* Decode the capture with nthreads threads. The transfers are returned
+ * in capture order. */
+int cap_decode(struct capture *c, int nthreads, struct i2c_list *out);
+
+#endif // _capture_h__
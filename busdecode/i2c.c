@@ -0,0 +1,182 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i2c.h"
+
+int i2c_listAdd(struct i2c_list *l, const struct i2c_xfer *x)
+{
+	if (l->n == l->cap) {
+		size_t cap = l->cap ? l->cap * 2 : 1024;
+		struct i2c_xfer *nx = realloc(l->x, cap * sizeof(struct i2c_xfer));
+
+		if (!nx) {
+			perror("realloc");
+			return -1;
+		}
+		l->x = nx;
+		l->cap = cap;
+	}
+	l->x[l->n++] = *x;
+	return 0;
+}
+
+void i2c_listFree(struct i2c_list *l)
+{
+	free(l->x);
+	memset(l, 0, sizeof(struct i2c_list));
+}
+
+void i2c_init(struct i2c_dec *d, struct i2c_list *out)
+{
+	memset(d, 0, sizeof(struct i2c_dec));
+	d->out = out;
+}
+
+static void i2c_end(struct i2c_dec *d, uint64_t t_ns, int flags)
+{
+	struct i2c_xfer *x = &d->cur;
+
+	x->end_ns = t_ns;
+	x->flags |= flags;
+	// A stop or a repeated start begins with SCL rising, like a data bit
+	if (d->bit != 0 && d->bit != 9 && !(d->bit == 1 && (flags & (I2C_F_STOP | I2C_F_RESTART))))
+		x->flags |= I2C_F_ERROR;
+	if (d->nbyte > 0)
+		x->nbytes = d->nbyte - 1;
+	else
+		x->flags |= I2C_F_ERROR;
+
+	if (d->low_count)
+		x->low_ns = d->low_sum / d->low_count;
+	if (d->period_count)
+		x->period_ns = d->period_sum / d->period_count;
+
+	i2c_listAdd(d->out, x);
+	d->active = 0;
+}
+
+static void i2c_begin(struct i2c_dec *d, uint64_t t_ns)
+{
+	memset(&d->cur, 0, sizeof(struct i2c_xfer));
+	d->cur.start_ns = t_ns;
+	d->active = 1;
+	d->bit = 0;
+	d->shift = 0;
+	d->nbyte = 0;
+	d->after_ack = 0;
+	d->fall_ns = 0;
+	d->rise_ns = 0;
+	d->low_sum = d->period_sum = 0;
+	d->low_count = d->period_count = 0;
+}
+
+static void i2c_sclRise(struct i2c_dec *d, uint64_t t_ns, int sda)
+{
+	struct i2c_xfer *x = &d->cur;
+
+	if (d->fall_ns) {
+		uint64_t low = t_ns - d->fall_ns;
+
+		if (d->after_ack) {
+			if (d->nbyte - 1 < I2C_MAX_DATA)
+				x->stretch_ns[d->nbyte - 1] = low;
+		}
+		else {
+			d->low_sum += low;
+			d->low_count++;
+			if (d->rise_ns) {
+				d->period_sum += t_ns - d->rise_ns;
+				d->period_count++;
+			}
+		}
+	}
+	d->rise_ns = t_ns;
+
+	if (d->bit < 8) {
+		d->shift = (d->shift << 1) | sda;
+		d->bit++;
+		return;
+	}
+
+	// ack bit
+	if (d->nbyte == 0) {
+		x->addr = d->shift >> 1;
+		x->read = d->shift & 1;
+		if (sda)
+			x->flags |= I2C_F_NACK;
+	}
+	else if (d->nbyte - 1 < I2C_MAX_DATA) {
+		x->data[d->nbyte - 1] = d->shift;
+	}
+	d->nbyte++;
+	d->bit = 9;
+}
+
+int i2c_sample(struct i2c_dec *d, uint64_t t_ns, int scl, int sda, int may_start)
+{
+	int ev = I2C_EV_NONE;
+
+	if (!d->started) {
+		d->scl = scl;
+		d->sda = sda;
+		d->started = 1;
+		return ev;
+	}
+
+	if (scl && d->scl && sda != d->sda) {
+		if (!sda) {
+			// start, or repeated start
+			if (d->active) {
+				i2c_end(d, t_ns, I2C_F_RESTART);
+				ev = I2C_EV_DONE;
+			}
+			if (may_start) {
+				i2c_begin(d, t_ns);
+				ev = I2C_EV_START;
+			}
+		}
+		else if (d->active) {
+			i2c_end(d, t_ns, I2C_F_STOP);
+			ev = I2C_EV_DONE;
+		}
+	}
+	else if (d->active && scl != d->scl) {
+		if (scl) {
+			i2c_sclRise(d, t_ns, sda);
+		}
+		else {
+			d->fall_ns = t_ns;
+			d->after_ack = d->bit == 9;
+			if (d->bit == 9)
+				d->bit = 0;
+		}
+	}
+
+	d->scl = scl;
+	d->sda = sda;
+
+	return ev;
+}
+
+void i2c_finish(struct i2c_dec *d, uint64_t t_ns)
+{
+	if (d->active)
+		i2c_end(d, t_ns, I2C_F_TRUNC);
+}
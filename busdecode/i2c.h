@@ -0,0 +1,79 @@
+#ifndef _i2c_h__
+#define _i2c_h__
+
+#include <stdint.h>
+
+/* Data bytes kept per transfer. Longer transfers are counted but the
+ * extra bytes are not stored. */
+#define I2C_MAX_DATA	32
+
+#define I2C_F_STOP		0x01	// ended by a stop condition
+#define I2C_F_RESTART	0x02	// ended by a repeated start
+#define I2C_F_NACK		0x04	// address not acknowledged
+#define I2C_F_ERROR		0x08	// ended in the middle of a byte
+#define I2C_F_TRUNC		0x10	// the capture ended first
+
+struct i2c_xfer {
+	uint64_t start_ns, end_ns;
+
+	// Mean SCL low time and period, for bits not following an ACK.
+	// What the master does when nobody stretches the clock.
+	uint32_t low_ns;
+	uint32_t period_ns;
+
+	// SCL low time following the ACK of the address (0) and of each
+	// data byte. This is where a slave stretches the clock.
+	uint32_t stretch_ns[I2C_MAX_DATA];
+
+	uint8_t addr;
+	uint8_t read;
+	uint8_t flags;
+	uint16_t nbytes; // data bytes, may be more than I2C_MAX_DATA
+	uint8_t data[I2C_MAX_DATA];
+};
+
+struct i2c_list {
+	struct i2c_xfer *x;
+	size_t n, cap;
+};
+
+int i2c_listAdd(struct i2c_list *l, const struct i2c_xfer *x);
+void i2c_listFree(struct i2c_list *l);
+
+/* Decoder state for one stream of samples */
+struct i2c_dec {
+	int scl, sda;
+	int started; // first sample seen
+	int active; // inside a transfer
+
+	int bit; // 0-7 data bits, 8 ack, 9 ack sampled
+	uint8_t shift;
+	int nbyte; // 0: address byte
+	int after_ack;
+
+	uint64_t fall_ns;
+	uint64_t rise_ns;
+	uint64_t low_sum, period_sum;
+	uint32_t low_count, period_count;
+
+	struct i2c_xfer cur;
+	struct i2c_list *out;
+};
+
+void i2c_init(struct i2c_dec *d, struct i2c_list *out);
+
+#define I2C_EV_NONE		0
+#define I2C_EV_START	1
+#define I2C_EV_DONE		2	// a transfer was completed
+
+/* Feed a sample. Call on every change, calling it for unchanged samples
+ * is allowed but useless.
+ *
+ * When may_start is 0, a start condition completes the current transfer
+ * but does not begin a new one. */
+int i2c_sample(struct i2c_dec *d, uint64_t t_ns, int scl, int sda, int may_start);
+
+/* The capture ended */
+void i2c_finish(struct i2c_dec *d, uint64_t t_ns);
+
+#endif // _i2c_h__
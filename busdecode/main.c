@@ -0,0 +1,149 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "capture.h"
+#include "report.h"
+
+static double parseRate(const char *s)
+{
+	char *e;
+	double v = strtod(s, &e);
+
+	switch (*e)
+	{
+		case 'k': case 'K': v *= 1e3; break;
+		case 'm': case 'M': v *= 1e6; break;
+		case 'g': case 'G': v *= 1e9; break;
+	}
+	return v;
+}
+
+static void usage(void)
+{
+	printf("Usage: ./busdecode [options] capture\n");
+	printf("\n");
+	printf("Decodes a logic analyzer capture of the extension port I2C bus.\n");
+	printf("\n");
+	printf("Options:\n");
+	printf("  -c         CSV capture (default for .csv files)\n");
+	printf("  -b         Binary capture, one sample per unit (default otherwise)\n");
+	printf("  -u bytes   Binary: bytes per sample (default: 1)\n");
+	printf("  -r rate    Sample rate, ex: 24M. Needed unless the capture says\n");
+	printf("  -C ch      SCL channel: bit number (binary), column name or number (CSV)\n");
+	printf("  -D ch      SDA channel (defaults: bits 0 and 1, columns SCL and SDA)\n");
+	printf("  -a addr    Extension address (default: 0x52)\n");
+	printf("  -j n       Decoding threads (default: one per CPU)\n");
+	printf("  -n bytes   Bytes listed in the clock stretch statistics (default: 21)\n");
+	printf("  -v         List the transfers\n");
+	printf("\n");
+	printf("Example: sigrok-cli -d fx2lafw -c samplerate=4M --time 10s -O csv -o cap.csv\n");
+	printf("         ./busdecode -C D0 -D D1 cap.csv\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct capture cap;
+	struct report_opts ro;
+	struct i2c_list xfers;
+	struct timespec t0, t1;
+	const char *scl = NULL, *sda = NULL;
+	int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int format = -1;
+	int opt;
+	size_t len;
+
+	memset(&cap, 0, sizeof(cap));
+	memset(&xfers, 0, sizeof(xfers));
+	memset(&ro, 0, sizeof(ro));
+	cap.unitsize = 1;
+	ro.addr = 0x52;
+	ro.max_stretch_bytes = 21;
+
+	while ((opt = getopt(argc, argv, "cbu:r:C:D:a:j:n:vh")) != -1) {
+		switch (opt)
+		{
+			case 'c': format = CAP_CSV; break;
+			case 'b': format = CAP_BINARY; break;
+			case 'u':
+				cap.unitsize = atoi(optarg);
+				if (cap.unitsize != 1 && cap.unitsize != 2 && cap.unitsize != 4) {
+					fprintf(stderr, "Sample size must be 1, 2 or 4\n");
+					return 1;
+				}
+				break;
+			case 'r': cap.samplerate = parseRate(optarg); break;
+			case 'C': scl = optarg; break;
+			case 'D': sda = optarg; break;
+			case 'a': ro.addr = strtol(optarg, NULL, 0); break;
+			case 'j': nthreads = atoi(optarg); break;
+			case 'n': ro.max_stretch_bytes = atoi(optarg); break;
+			case 'v': ro.verbose = 1; break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage();
+		return 1;
+	}
+	if (nthreads < 1)
+		nthreads = 1;
+
+	if (format < 0) {
+		len = strlen(argv[optind]);
+		format = len > 4 && !strcasecmp(argv[optind] + len - 4, ".csv") ? CAP_CSV : CAP_BINARY;
+	}
+	cap.format = format;
+
+	if (format == CAP_CSV) {
+		cap.scl_name = scl ? scl : "SCL";
+		cap.sda_name = sda ? sda : "SDA";
+	} else {
+		cap.scl_bit = scl ? atoi(scl) : 0;
+		cap.sda_bit = sda ? atoi(sda) : 1;
+	}
+
+	if (cap_open(&cap, argv[optind])) {
+		cap_close(&cap);
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (cap_decode(&cap, nthreads, &xfers)) {
+		cap_close(&cap);
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	fprintf(stderr, "%s: %.1f MB decoded in %.3f s with %d threads\n", argv[optind],
+		cap.size / 1e6, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9, nthreads);
+
+	report(stdout, &xfers, &ro);
+
+	i2c_listFree(&xfers);
+	cap_close(&cap);
+
+	return 0;
+}
@@ -0,0 +1,316 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "report.h"
+
+/***** Value series and percentiles *****/
+
+struct series {
+	uint64_t *v;
+	size_t n, cap;
+};
+
+static void series_add(struct series *s, uint64_t v)
+{
+	if (s->n == s->cap) {
+		size_t cap = s->cap ? s->cap * 2 : 256;
+		uint64_t *nv = realloc(s->v, cap * sizeof(uint64_t));
+
+		if (!nv) {
+			perror("realloc");
+			return;
+		}
+		s->v = nv;
+		s->cap = cap;
+	}
+	s->v[s->n++] = v;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t series_pct(const struct series *s, double p)
+{
+	size_t i = p / 100.0 * (s->n - 1) + 0.5;
+
+	return s->v[i];
+}
+
+/* Values in ns, printed in us */
+static void series_print(FILE *fp, const char *label, struct series *s)
+{
+	if (!s->n) {
+		fprintf(fp, "  %-26s %9d\n", label, 0);
+		return;
+	}
+
+	qsort(s->v, s->n, sizeof(uint64_t), cmp_u64);
+	fprintf(fp, "  %-26s %9zu %10.1f %10.1f %10.1f %10.1f %10.1f\n", label, s->n,
+		s->v[0] / 1e3, series_pct(s, 50) / 1e3, series_pct(s, 90) / 1e3,
+		series_pct(s, 99) / 1e3, s->v[s->n - 1] / 1e3);
+}
+
+static void series_header(FILE *fp, const char *title)
+{
+	fprintf(fp, "\n%-28s %9s %10s %10s %10s %10s %10s\n", title, "count",
+		"min", "p50", "p90", "p99", "max");
+}
+
+static void series_free(struct series *s)
+{
+	free(s->v);
+	memset(s, 0, sizeof(struct series));
+}
+
+/***** Register map *****/
+
+static const char *regName(int reg)
+{
+	if (reg >= REG_KEY && reg < REG_KEY + 0x10)
+		return "key";
+	if (reg >= REG_CALIB && reg < REG_CALIB + 0x10)
+		return "calibration";
+	if (reg < 0x20)
+		return "report";
+
+	switch (reg)
+	{
+		case REG_INIT1: return "init/encryption";
+		case REG_INIT2: return "init 2";
+		case REG_FORMAT: return "data format";
+		case REG_ID: return "id";
+	}
+	return "";
+}
+
+/* Handshake steps, in the order a console does them */
+enum {
+	HS_INIT1,
+	HS_INIT2,
+	HS_FORMAT,
+	HS_KEY,
+	HS_ID,
+	HS_CALIB,
+	HS_POLL,
+	HS_STEPS
+};
+
+static const char *hs_names[HS_STEPS] = {
+	"F0", "FB", "FE", "key", "id", "cal", "poll"
+};
+
+struct handshake {
+	uint64_t t[HS_STEPS]; // 0: not done
+};
+
+static void printXfer(FILE *fp, const struct i2c_xfer *x, int reg)
+{
+	int i, n = x->nbytes < I2C_MAX_DATA ? x->nbytes : I2C_MAX_DATA;
+
+	fprintf(fp, "%14.6f %02x(%c) [%d]", x->start_ns / 1e9, x->addr, x->read ? 'R' : 'W', x->nbytes);
+	for (i = 0; i < n; i++)
+		fprintf(fp, " %02x", x->data[i]);
+	if (n < x->nbytes)
+		fprintf(fp, " ...");
+
+	if (reg >= 0)
+		fprintf(fp, "   << %s", regName(reg));
+	if (x->flags & I2C_F_NACK)
+		fprintf(fp, "   NACK");
+	if (x->flags & I2C_F_ERROR)
+		fprintf(fp, "   ERROR");
+	if (x->flags & I2C_F_TRUNC)
+		fprintf(fp, "   TRUNCATED");
+	fprintf(fp, "\n");
+}
+
+void report(FILE *fp, const struct i2c_list *l, const struct report_opts *o)
+{
+	struct series poll_period = { 0 }, poll_len = { 0 }, write_len = { 0 };
+	struct series scl_period = { 0 }, stretch_all = { 0 };
+	struct series stretch[I2C_MAX_DATA];
+	struct series hs_total = { 0 };
+	struct handshake hs[REPORT_MAX_HANDSHAKES];
+	struct handshake *cur = NULL;
+	unsigned long poll_sizes[I2C_MAX_DATA + 1];
+	unsigned long others = 0, nacked = 0, errors = 0, restarts = 0, num_hs = 0;
+	uint64_t last_poll = 0;
+	int ptr = -1;
+	size_t i;
+	int j, k;
+
+	memset(stretch, 0, sizeof(stretch));
+	memset(poll_sizes, 0, sizeof(poll_sizes));
+
+	for (i = 0; i < l->n; i++) {
+		const struct i2c_xfer *x = &l->x[i];
+		int n = x->nbytes < I2C_MAX_DATA ? x->nbytes : I2C_MAX_DATA;
+		int reg = -1;
+
+		if (x->addr != o->addr) {
+			others++;
+			if (o->verbose)
+				printXfer(fp, x, -1);
+			continue;
+		}
+
+		if (x->flags & I2C_F_RESTART)
+			restarts++;
+		if (x->flags & (I2C_F_ERROR | I2C_F_TRUNC))
+			errors++;
+		if (x->flags & I2C_F_NACK) {
+			// also how a console polls an empty port
+			nacked++;
+			if (o->verbose)
+				printXfer(fp, x, -1);
+			continue;
+		}
+
+		if (x->period_ns)
+			series_add(&scl_period, x->period_ns);
+
+		if (!x->read) {
+			series_add(&write_len, x->end_ns - x->start_ns);
+
+			if (n >= 1) {
+				ptr = x->data[0];
+				reg = ptr;
+			}
+
+			// register writes
+			for (j = 1; j < n; j++) {
+				int r = (ptr + j - 1) & 0xff;
+
+				if (r == REG_INIT1) {
+					if (num_hs < REPORT_MAX_HANDSHAKES) {
+						cur = &hs[num_hs];
+						memset(cur, 0, sizeof(struct handshake));
+						cur->t[HS_INIT1] = x->start_ns;
+					} else {
+						cur = NULL;
+					}
+					num_hs++;
+				}
+				else if (cur && r == REG_INIT2 && !cur->t[HS_INIT2]) {
+					cur->t[HS_INIT2] = x->start_ns;
+				}
+				else if (cur && r == REG_FORMAT && !cur->t[HS_FORMAT]) {
+					cur->t[HS_FORMAT] = x->start_ns;
+				}
+				else if (cur && r >= REG_KEY && r < REG_KEY + 0x10 && !cur->t[HS_KEY]) {
+					cur->t[HS_KEY] = x->start_ns;
+				}
+			}
+			if (n > 1)
+				ptr = (ptr + n - 1) & 0xff;
+		}
+		else if (ptr >= 0) {
+			reg = ptr;
+
+			if (ptr == REG_REPORT) {
+				if (last_poll)
+					series_add(&poll_period, x->start_ns - last_poll);
+				last_poll = x->start_ns;
+
+				series_add(&poll_len, x->end_ns - x->start_ns);
+				poll_sizes[x->nbytes < I2C_MAX_DATA ? x->nbytes : I2C_MAX_DATA]++;
+
+				// time we held SCL low before each byte, beyond what
+				// the master needs
+				for (k = 0; k < n; k++) {
+					uint64_t s = x->stretch_ns[k] > x->low_ns ? x->stretch_ns[k] - x->low_ns : 0;
+
+					series_add(&stretch[k], s);
+					series_add(&stretch_all, s);
+				}
+
+				if (cur && !cur->t[HS_POLL]) {
+					cur->t[HS_POLL] = x->start_ns;
+					series_add(&hs_total, x->start_ns - cur->t[HS_INIT1]);
+				}
+			}
+			else if (ptr == REG_ID && cur && !cur->t[HS_ID]) {
+				cur->t[HS_ID] = x->start_ns;
+			}
+			else if (ptr == REG_CALIB && cur && !cur->t[HS_CALIB]) {
+				cur->t[HS_CALIB] = x->start_ns;
+			}
+
+			ptr = (ptr + x->nbytes) & 0xff;
+		}
+
+		if (o->verbose)
+			printXfer(fp, x, reg);
+	}
+
+	fprintf(fp, "\n%zu transfers, %lu to other addresses, %lu not acknowledged, "
+		"%lu repeated starts, %lu errors\n", l->n, others, nacked, restarts, errors);
+
+	series_header(fp, "Timing (us)");
+	series_print(fp, "SCL period", &scl_period);
+	series_print(fp, "poll period", &poll_period);
+	series_print(fp, "poll read duration", &poll_len);
+	series_print(fp, "write duration", &write_len);
+	series_print(fp, "handshake (F0 to poll)", &hs_total);
+
+	fprintf(fp, "\nPoll read sizes:");
+	for (j = 0; j <= I2C_MAX_DATA; j++) {
+		if (poll_sizes[j])
+			fprintf(fp, " %d%s bytes: %lu,", j, j == I2C_MAX_DATA ? "+" : "", poll_sizes[j]);
+	}
+	fprintf(fp, "\n");
+
+	series_header(fp, "Clock stretch (us)");
+	series_print(fp, "all bytes", &stretch_all);
+	for (k = 0; k < I2C_MAX_DATA && k < o->max_stretch_bytes; k++) {
+		char label[32];
+
+		if (!stretch[k].n)
+			break;
+		snprintf(label, sizeof(label), k ? "before byte %d" : "after address", k);
+		series_print(fp, label, &stretch[k]);
+	}
+
+	fprintf(fp, "\nHandshakes: %lu\n", num_hs);
+	for (i = 0; i < num_hs && i < REPORT_MAX_HANDSHAKES; i++) {
+		fprintf(fp, "  %14.6f s:", hs[i].t[HS_INIT1] / 1e9);
+		for (j = 1; j < HS_STEPS; j++) {
+			if (hs[i].t[j])
+				fprintf(fp, "  %s +%.3f", hs_names[j], (hs[i].t[j] - hs[i].t[HS_INIT1]) / 1e6);
+			else
+				fprintf(fp, "  %s -", hs_names[j]);
+		}
+		fprintf(fp, " (ms)\n");
+	}
+
+	series_free(&poll_period);
+	series_free(&poll_len);
+	series_free(&write_len);
+	series_free(&scl_period);
+	series_free(&stretch_all);
+	series_free(&hs_total);
+	for (k = 0; k < I2C_MAX_DATA; k++)
+		series_free(&stretch[k]);
+}
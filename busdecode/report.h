@@ -0,0 +1,28 @@
+#ifndef _report_h__
+#define _report_h__
+
+#include <stdio.h>
+#include "i2c.h"
+
+/* Extension controller registers, as served by wiimote.c */
+#define REG_REPORT		0x00
+#define REG_CALIB		0x20
+#define REG_KEY			0x40
+#define REG_INIT1		0xF0	// 0x55: disable encryption, 0xAA: enable
+#define REG_ID			0xFA
+#define REG_INIT2		0xFB
+#define REG_FORMAT		0xFE
+
+#define REPORT_MAX_HANDSHAKES	16
+
+struct report_opts {
+	int addr; // 7 bit device address
+	int verbose; // list the transfers
+	int max_stretch_bytes; // per byte clock stretch lines
+};
+
+/* Decode the transfers against the extension register map and print
+ * the poll, transfer, clock stretch and handshake statistics. */
+void report(FILE *fp, const struct i2c_list *l, const struct report_opts *o);
+
+#endif // _report_h__
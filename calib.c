@@ -0,0 +1,195 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2014  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Sensor calibration mode.
+ *
+ * The gun is first pointed away from the screen, or at a dark one, and
+ * the trigger pulled. Then it is pointed at a flashing target (a white
+ * screen blinking every few frames, for instance) and the trigger pulled
+ * again. During each phase the sensor pin is followed by polling it
+ * against the time base, interrupts off, before the Wiimote is served.
+ *
+ * A flash is a burst of pulses: a CRT, or a display with a PWM
+ * backlight, lights the sensor in several pieces. Edges less than
+ * CALIB_MERGE_TICKS apart belong to the same flash. For each one:
+ *
+ *   rise: first edge to the last time the sensor lit up again
+ *   width: first edge to the sensor going dark for good
+ *
+ * and from one flash to the next, the period and its jitter. The pulses
+ * seen in the dark phase are the noise floor.
+ *
+ * A pulse that ends before both the noise and the rise of a flash is
+ * rejected: the latch waits confirm_ticks after the first edge and takes
+ * the flash only if the sensor is still lit (see PCINT2_vect in gun.c).
+ * The wait is a quarter of the way from there to the shortest flash,
+ * so the latch stays as early as possible. */
+#include <avr/io.h>
+#include <string.h>
+#include "gun.h"
+#include "eeprom.h"
+#include "calib.h"
+
+#ifdef GUN_SENSOR_CALIB
+
+#define CALIB_MERGE_TICKS		(TIMEBASE_TICKS_PER_MS / 10)		// 100us
+#define CALIB_PULL_TICKS		(TIMEBASE_TICKS_PER_MS * 20)		// shorter trigger presses are bounces
+#define CALIB_PHASE_TICKS		(TIMEBASE_TICKS_PER_MS * 10000L)	// give up after 10 seconds
+#define CALIB_MIN_FLASHES		20
+#define CALIB_MARGIN_TICKS		(TIMEBASE_TICKS_PER_MS / 100)		// 10us
+
+struct pulses {
+	unsigned char count;
+	unsigned short width_min, width_max;
+	unsigned long width_sum;
+	unsigned short rise_max;
+	unsigned char periods;
+	unsigned long period_min, period_max, period_sum;
+};
+
+struct detector {
+	char lit, in_flash, have_prev;
+	// rise and fall of the light, not of the pin (active low)
+	unsigned long start, last_rise, last_fall, prev_start;
+};
+
+static unsigned short clampTicks(unsigned long t)
+{
+	return t > 0xFFFF ? 0xFFFF : t;
+}
+
+static unsigned short clampUs(unsigned long ticks)
+{
+	unsigned long us = TIMEBASE_TICKS_TO_US(ticks);
+
+	return us > 0xFFFF ? 0xFFFF : us;
+}
+
+static void addFlash(struct pulses *p, unsigned short width, unsigned short rise, unsigned long period)
+{
+	if (p->count == 0xFF)
+		return;
+
+	if (!p->count || width < p->width_min)
+		p->width_min = width;
+	if (width > p->width_max)
+		p->width_max = width;
+	if (rise > p->rise_max)
+		p->rise_max = rise;
+	p->width_sum += width;
+	p->count++;
+
+	if (!period)
+		return;
+	if (!p->periods || period < p->period_min)
+		p->period_min = period;
+	if (period > p->period_max)
+		p->period_max = period;
+	p->period_sum += period;
+	p->periods++;
+}
+
+static void followSensor(struct detector *d, struct pulses *p, unsigned long t, char lit)
+{
+	if (lit && !d->lit) {
+		if (!d->in_flash) {
+			d->in_flash = 1;
+			d->start = t;
+		}
+		d->last_rise = t;
+	} else if (!lit && d->lit) {
+		d->last_fall = t;
+	}
+	d->lit = lit;
+
+	// dark long enough: the flash is over
+	if (d->in_flash && !lit && t - d->last_fall >= CALIB_MERGE_TICKS) {
+		d->in_flash = 0;
+		addFlash(p, clampTicks(d->last_fall - d->start), clampTicks(d->last_rise - d->start),
+				d->have_prev ? d->start - d->prev_start : 0);
+		d->prev_start = d->start;
+		d->have_prev = 1;
+	}
+}
+
+/* Measure the sensor until the trigger is pulled and released. Returns 0
+ * after CALIB_PHASE_TICKS without a pull. The trigger and sensor masks
+ * are the pin bits (see gun.c). */
+static char measure(struct pulses *p)
+{
+	struct detector d;
+	unsigned long t, start, pressed_at = 0;
+	unsigned char pins;
+	char pressed = 0;
+
+	memset(&d, 0, sizeof(d));
+	memset(p, 0, sizeof(*p));
+
+	start = timebase_time();
+	do {
+		pins = ~PIND;
+		t = timebase_time();
+
+		followSensor(&d, p, t, pins & GUN_BTN_SENSOR);
+
+		if (pins & GUN_BTN_TRIGGER) {
+			if (!pressed) {
+				pressed = 1;
+				pressed_at = t;
+			}
+		} else if (pressed) {
+			pressed = 0;
+			if (t - pressed_at >= CALIB_PULL_TICKS)
+				return 1;
+		}
+	} while (t - start < CALIB_PHASE_TICKS);
+
+	return 0;
+}
+
+char calibrateSensor(void)
+{
+	struct pulses noise, flashes;
+	struct sensor_calib *c = &g_current_config.calib;
+	unsigned long lo;
+	char ok = 0;
+
+	if (measure(&noise) && measure(&flashes) && flashes.count >= CALIB_MIN_FLASHES) {
+		lo = noise.width_max > flashes.rise_max ? noise.width_max : flashes.rise_max;
+		lo += CALIB_MARGIN_TICKS;
+
+		// the noise is not shorter than the flashes: keep the old values
+		if (lo < flashes.width_min) {
+			c->confirm_us = TIMEBASE_TICKS_TO_US(lo + (flashes.width_min - lo) / 4);
+			c->width_min = TIMEBASE_TICKS_TO_US(flashes.width_min);
+			c->width_avg = TIMEBASE_TICKS_TO_US(flashes.width_sum / flashes.count);
+			c->rise_max = TIMEBASE_TICKS_TO_US(flashes.rise_max);
+			c->noise_max = TIMEBASE_TICKS_TO_US(noise.width_max);
+			c->period_avg = flashes.periods ? clampUs(flashes.period_sum / flashes.periods) : 0;
+			c->jitter = clampUs(flashes.period_max - flashes.period_min);
+			sync_config();
+			ok = 1;
+		}
+	}
+
+	// what the pin change interrupt saw meanwhile is not a shot
+	PCIFR = _BV(PCIF2);
+
+	return ok;
+}
+
+#endif // GUN_SENSOR_CALIB
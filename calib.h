@@ -0,0 +1,9 @@
+#ifndef _calib_h__
+#define _calib_h__
+
+/* Sensor calibration mode, entered at power-up (see main.c). Returns 1
+ * if the sensor was characterised and the results stored, 0 if the
+ * measurement was abandoned or did not allow a filter. */
+char calibrateSensor(void);
+
+#endif // _calib_h__
@@ -55,6 +55,10 @@
  *   'F' | 'C'    NES
  *   'G' | 'N'    NES Lightgun (Zapper)
  *
+ *  Zapper data: 0 buttons (see gamepads.h), 1 sensor peak intensity with
+ *  the analog sensor, 2 to 4 the last shot event with WITH_SHOT_EVENTS
+ *  (see shot.h).
+ *
  * Writing at byte 6 might one day control the rumble motor. Rumbles on when non-zero.
  */
 void pack_classic_data_mode1(classic_pad_data *src, unsigned char dst[PACKED_CLASSIC_DATA_SIZE], int analog_style)
@@ -163,6 +167,11 @@ void dataToClassic(const gamepad_data *src, classic_pad_data *dst, char first_re
 	// gun
 	dst->controller_id[0] = 'G';
 	dst->controller_id[1] = 'N';
+
+	// initial report, nothing pressed
+	if (src == NULL)
+		return;
+
 	memcpy(dst->controller_raw_data, src->gun.raw_data, GUN_RAW_SIZE);
 
 	if (src->gun.buttons & GUN_BTN_TRIGGER) { dst->buttons |= CPAD_BTN_A; }
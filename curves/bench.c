@@ -0,0 +1,153 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CURVES_LIST
+#include "curves_all.h"
+
+#define NUM_INPUTS	(1 << 20)
+#define ROUNDS		16
+
+/* AVR cost model, from the instructions avr-gcc emits at -Os for each
+ * lookup (address computation, lpm, compare). These are estimates to
+ * compare the representations, not measurements. */
+#define AVR_FULL_CYCLES			7	// address, lpm
+#define AVR_CLAMP_CYCLES		3	// cpi, brlo, ldi
+#define AVR_STEP_CYCLES			11	// address, lpm, cp, set bit
+#define AVR_LINEAR_SETUP		5
+#define AVR_LINEAR_ENTRY		6	// lpm Z+, cp, brlo
+#define AVR_FULL_CODE			14
+#define AVR_STEP_CODE			12
+#define AVR_LINEAR_CODE			16
+
+static unsigned char inputs[NUM_INPUTS];
+static volatile unsigned char sink;
+
+// What the firmware did with the old lut.c output: scan the breakpoints
+static unsigned char linearLookup(const struct curves_entry *c, unsigned char x, int *iterations)
+{
+	int i;
+
+	for (i = 1; i < c->num_bp; i++) {
+		if (c->bp_in[i] > x)
+			break;
+	}
+	if (iterations)
+		*iterations += i;
+
+	return c->bp_out[i - 1];
+}
+
+static double nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int check(const struct curves_entry *c)
+{
+	int x;
+
+	for (x = 0; x < 256; x++) {
+		unsigned char ref = c->table[x < c->size ? x : c->size - 1];
+
+		if (c->full(x) != ref || c->bp(x) != ref || linearLookup(c, x, NULL) != ref) {
+			fprintf(stderr, "%s: mismatch at %d: table %d, full %d, bp %d, linear %d\n",
+				c->name, x, ref, c->full(x), c->bp(x), linearLookup(c, x, NULL));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static double timeFunc(unsigned char (*f)(unsigned char))
+{
+	unsigned char acc = 0;
+	double t0 = nowNs();
+	int r, i;
+
+	for (r = 0; r < ROUNDS; r++)
+		for (i = 0; i < NUM_INPUTS; i++)
+			acc += f(inputs[i] ^ acc);
+	sink = acc;
+
+	return (nowNs() - t0) / ((double)ROUNDS * NUM_INPUTS);
+}
+
+static double timeLinear(const struct curves_entry *c)
+{
+	unsigned char acc = 0;
+	double t0 = nowNs();
+	int r, i;
+
+	for (r = 0; r < ROUNDS; r++)
+		for (i = 0; i < NUM_INPUTS; i++)
+			acc += linearLookup(c, inputs[i] ^ acc, NULL);
+	sink = acc;
+
+	return (nowNs() - t0) / ((double)ROUNDS * NUM_INPUTS);
+}
+
+int main(void)
+{
+	int n = sizeof(curves_list) / sizeof(curves_list[0]);
+	int i, k, x;
+
+	srand(1);
+	for (i = 0; i < NUM_INPUTS; i++)
+		inputs[i] = rand();
+
+	printf("%-10s %4s %4s | %-18s | %-18s | %-18s | %-18s\n", "", "", "",
+		"   full table", "   breakpoints", "   linear scan", "   host ns/lookup");
+	printf("%-10s %4s %4s | %5s %5s %6s | %5s %5s %6s | %5s %5s %6s | %5s %5s %6s\n",
+		"curve", "size", "bp",
+		"flash", "code", "cycles",
+		"flash", "code", "cycles",
+		"flash", "code", "cycles",
+		"full", "bp", "linear");
+
+	for (k = 0; k < n; k++) {
+		const struct curves_entry *c = &curves_list[k];
+		int full_cycles = AVR_FULL_CYCLES + (c->size < 256 ? AVR_CLAMP_CYCLES : 0);
+		int iterations = 0;
+
+		if (check(c))
+			return 1;
+
+		// average over the inputs the curve accepts
+		for (x = 0; x < c->size; x++)
+			linearLookup(c, x, &iterations);
+
+		printf("%-10s %4d %4d | %5d %5d %6d | %5d %5d %6d | %5d %5d %6.1f | %5.2f %5.2f %6.2f\n",
+			c->name, c->size, c->num_bp,
+			c->size, AVR_FULL_CODE, full_cycles,
+			c->bp_size * 2, AVR_STEP_CODE * c->steps + AVR_FULL_CODE,
+			AVR_STEP_CYCLES * c->steps + AVR_FULL_CYCLES,
+			c->num_bp * 2, AVR_LINEAR_CODE,
+			AVR_LINEAR_SETUP + AVR_LINEAR_ENTRY * (double)iterations / c->size,
+			timeFunc(c->full), timeFunc(c->bp), timeLinear(c));
+	}
+
+	printf("\nflash and code in bytes. AVR cycles and code size are estimates (see bench.c).\n");
+
+	return 0;
+}
@@ -0,0 +1,384 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <libgen.h>
+
+#include "curve.h"
+
+#define MAX_POINTS		64
+#define MAX_AXES		64
+
+struct curve_src {
+	const char *path;
+	int line;
+
+	int have_table, table_len;
+	int num_points;
+	int px[MAX_POINTS], py[MAX_POINTS];
+	double deadzone, reach, gamma;
+	int have_reach;
+};
+
+static int cv_error(struct curve_src *s, const char *msg)
+{
+	fprintf(stderr, "%s:%d: %s\n", s->path, s->line, msg);
+	return -1;
+}
+
+static int cv_cmpDouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Measured ranges, as in joysticks.txt:
+ *
+ *   ------- SECTION -------
+ *   Horizontal: -82 to 79
+ *   Vertical..: -85 to 83
+ *   Observed resting positions:
+ *      -4. -8
+ *
+ * Each axis reaches the smallest of its two extremes in both directions.
+ * The deadzone covers the largest resting offset. */
+static int cv_fit(struct curve_src *s, struct curve *c, const char *file,
+					const char *section, double coverage)
+{
+	char path[512], line[256], *dir, *dup;
+	double reaches[MAX_AXES];
+	int num = 0, in_section = 0, in_rest = 0;
+	double rest = 0;
+	FILE *fp;
+
+	// relative to the curve file
+	dup = strdup(s->path);
+	dir = dirname(dup);
+	if (file[0] == '/')
+		snprintf(path, sizeof(path), "%s", file);
+	else
+		snprintf(path, sizeof(path), "%s/%s", dir, file);
+	free(dup);
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		char *p = line + strspn(line, " \t");
+		int lo, hi;
+		double a, b;
+
+		if (!strncmp(p, "---", 3)) {
+			char *name = p + strspn(p, "- ");
+			int len = strcspn(name, " -\r\n");
+
+			in_section = len == strlen(section) && !strncasecmp(name, section, len);
+			in_rest = 0;
+			continue;
+		}
+		if (!in_section)
+			continue;
+
+		if (!strncmp(p, "*****", 5)) {
+			in_rest = 0;
+			continue;
+		}
+		if (strstr(p, "resting")) {
+			in_rest = 1;
+			continue;
+		}
+
+		if (in_rest && sscanf(p, "%lf%*[., ]%lf", &a, &b) == 2) {
+			if (fabs(a) > rest) rest = fabs(a);
+			if (fabs(b) > rest) rest = fabs(b);
+			continue;
+		}
+
+		p = strchr(p, ':');
+		if (p && sscanf(p + 1, "%d to %d", &lo, &hi) == 2 && lo < 0 && hi > 0) {
+			if (num < MAX_AXES)
+				reaches[num++] = -lo < hi ? -lo : hi;
+			in_rest = 0;
+		}
+	}
+	fclose(fp);
+
+	if (num == 0) {
+		fprintf(stderr, "%s: no ranges in section %s\n", path, section);
+		return -1;
+	}
+
+	qsort(reaches, num, sizeof(double), cv_cmpDouble);
+
+	s->reach = reaches[(int)((1.0 - coverage) * (num - 1) + 0.5)];
+	s->have_reach = 1;
+	s->deadzone = rest ? rest + 1 : 0;
+
+	c->fit_axes = num;
+	c->fit_deadzone = s->deadzone;
+	c->fit_reach = s->reach;
+
+	return 0;
+}
+
+static int cv_parseValues(struct curve_src *s, struct curve *c, char *p)
+{
+	char *e;
+
+	while (*p) {
+		long v;
+
+		p += strspn(p, " \t,\r\n");
+		if (!*p || *p == '#')
+			break;
+
+		v = strtol(p, &e, 0);
+		if (e == p)
+			return cv_error(s, "expected a number");
+		if (v < 0 || v > 255)
+			return cv_error(s, "value out of range");
+		if (s->table_len == CURVE_MAX_SIZE)
+			return cv_error(s, "too many values");
+		c->values[s->table_len++] = v;
+		p = e;
+	}
+
+	return 0;
+}
+
+static void cv_build(struct curve_src *s, struct curve *c)
+{
+	int x;
+
+	if (s->num_points) {
+		int i = 0;
+
+		for (x = 0; x < c->size; x++) {
+			double y;
+
+			while (i + 1 < s->num_points && s->px[i + 1] <= x)
+				i++;
+			if (x <= s->px[0])
+				y = s->py[0];
+			else if (i + 1 >= s->num_points)
+				y = s->py[s->num_points - 1];
+			else
+				y = s->py[i] + (double)(s->py[i + 1] - s->py[i]) * (x - s->px[i]) / (s->px[i + 1] - s->px[i]);
+			c->values[x] = y + 0.5;
+		}
+		return;
+	}
+
+	for (x = 0; x < c->size; x++) {
+		double t;
+
+		if (x <= s->deadzone)
+			t = 0;
+		else if (x >= s->reach)
+			t = 1;
+		else
+			t = pow((x - s->deadzone) / (s->reach - s->deadzone), s->gamma);
+		c->values[x] = t * c->max + 0.5;
+	}
+}
+
+static int cv_check(struct curve_src *s, struct curve *c)
+{
+	int x;
+
+	s->line = 0;
+
+	if (!c->name[0])
+		return cv_error(s, "no name");
+	if (s->have_table && s->table_len != c->size)
+		return cv_error(s, "the table length differs from size");
+
+	for (x = 0; x < c->size; x++) {
+		if (c->values[x] > c->max)
+			return cv_error(s, "value above max");
+		if (x && c->values[x] < c->values[x - 1])
+			return cv_error(s, "the curve decreases");
+	}
+
+	// reverse lookup, as lut.c used to print
+	c->num_bp = 0;
+	for (x = 0; x < c->size; x++) {
+		if (x == 0 || c->values[x] > c->values[x - 1]) {
+			c->bp_in[c->num_bp] = x;
+			c->bp_out[c->num_bp] = c->values[x];
+			c->num_bp++;
+		}
+	}
+
+	return 0;
+}
+
+int curve_load(struct curve *c, const char *path)
+{
+	struct curve_src s;
+	char line[1024];
+	int in_table = 0;
+	FILE *fp;
+
+	memset(c, 0, sizeof(struct curve));
+	c->size = 256;
+	c->max = 255;
+
+	memset(&s, 0, sizeof(s));
+	s.path = path;
+	s.gamma = 1;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		char key[32], *arg;
+		int n;
+
+		s.line++;
+		arg = line + strspn(line, " \t");
+		if (*arg == '#' || *arg == '\n' || *arg == '\r' || !*arg)
+			continue;
+
+		// table continuation lines start with a digit
+		if (in_table && isdigit((unsigned char)*arg)) {
+			if (cv_parseValues(&s, c, arg))
+				goto fail;
+			continue;
+		}
+		in_table = 0;
+
+		if (sscanf(arg, "%31s %n", key, &n) != 1) {
+			cv_error(&s, "syntax error");
+			goto fail;
+		}
+		arg += n;
+		arg[strcspn(arg, "#\r\n")] = 0;
+
+		if (!strcmp(key, "name")) {
+			if (sscanf(arg, "%31[A-Za-z0-9_]", c->name) != 1) {
+				cv_error(&s, "the name must be a C identifier");
+				goto fail;
+			}
+		}
+		else if (!strcmp(key, "size")) {
+			c->size = atoi(arg);
+			if (c->size < 2 || c->size > CURVE_MAX_SIZE) {
+				cv_error(&s, "size out of range");
+				goto fail;
+			}
+		}
+		else if (!strcmp(key, "max")) {
+			c->max = atoi(arg);
+			if (c->max < 1 || c->max > 255) {
+				cv_error(&s, "max out of range");
+				goto fail;
+			}
+		}
+		else if (!strcmp(key, "table")) {
+			s.have_table = 1;
+			in_table = 1;
+			if (cv_parseValues(&s, c, arg))
+				goto fail;
+		}
+		else if (!strcmp(key, "points")) {
+			char *tok;
+
+			for (tok = strtok(arg, " \t"); tok; tok = strtok(NULL, " \t")) {
+				if (s.num_points == MAX_POINTS) {
+					cv_error(&s, "too many points");
+					goto fail;
+				}
+				if (sscanf(tok, "%d:%d", &s.px[s.num_points], &s.py[s.num_points]) != 2) {
+					cv_error(&s, "expected x:y");
+					goto fail;
+				}
+				if (s.num_points && s.px[s.num_points] <= s.px[s.num_points - 1]) {
+					cv_error(&s, "points must be in increasing x order");
+					goto fail;
+				}
+				s.num_points++;
+			}
+		}
+		else if (!strcmp(key, "deadzone")) {
+			s.deadzone = atof(arg);
+		}
+		else if (!strcmp(key, "reach")) {
+			s.reach = atof(arg);
+			s.have_reach = 1;
+		}
+		else if (!strcmp(key, "gamma")) {
+			s.gamma = atof(arg);
+			if (s.gamma <= 0) {
+				cv_error(&s, "gamma must be positive");
+				goto fail;
+			}
+		}
+		else if (!strcmp(key, "fit")) {
+			char file[256], section[64];
+			double coverage = 0.9;
+
+			if (sscanf(arg, "%255s %63s %lf", file, section, &coverage) < 2 || coverage <= 0 || coverage > 1) {
+				cv_error(&s, "expected fit <file> <section> [coverage]");
+				goto fail;
+			}
+			if (cv_fit(&s, c, file, section, coverage))
+				goto fail;
+		}
+		else {
+			cv_error(&s, "unknown keyword");
+			goto fail;
+		}
+	}
+	fclose(fp);
+
+	if (!s.have_reach || s.reach > c->size - 1)
+		s.reach = c->size - 1;
+	if (s.deadzone >= s.reach) {
+		cv_error(&s, "deadzone beyond the reach");
+		return -1;
+	}
+
+	if (!s.have_table)
+		cv_build(&s, c);
+
+	return cv_check(&s, c);
+
+fail:
+	fclose(fp);
+	return -1;
+}
+
+int curve_bpSteps(const struct curve *c)
+{
+	int steps = 0;
+
+	while ((1 << steps) < c->num_bp)
+		steps++;
+
+	return steps;
+}
@@ -0,0 +1,52 @@
+#ifndef _curve_h__
+#define _curve_h__
+
+#include <stdio.h>
+
+#define CURVE_MAX_SIZE		256
+#define CURVE_NAME_LEN		32
+
+/* A curve maps an input from 0 to size-1 to an output from 0 to max.
+ * It must never decrease, so that it can be stored as breakpoints.
+ *
+ * A .curve file holds one curve. Keywords, one per line (# starts a
+ * comment):
+ *
+ *   name <identifier>          required
+ *   size <n>                   number of inputs, up to 256 (default: 256)
+ *   max <n>                    highest output, up to 255 (default: 255)
+ *   table <v>,<v>,...          explicit values, may span several lines
+ *   points <x>:<y> ...         piecewise linear through these points
+ *   deadzone <x>               output 0 up to this input (default: 0)
+ *   reach <x>                  input giving the full output (default: size-1)
+ *   gamma <g>                  shape between deadzone and reach (default: 1)
+ *   fit <file> <section> [coverage]
+ *                              deadzone and reach from measured ranges, see
+ *                              joysticks.txt. The reach is chosen so that
+ *                              a fraction 'coverage' (default: 0.9) of the
+ *                              measured axes get to the full output.
+ *
+ * Without table or points, the curve is built from deadzone, reach and
+ * gamma. */
+struct curve {
+	char name[CURVE_NAME_LEN];
+	int size;
+	int max;
+	unsigned char values[CURVE_MAX_SIZE];
+
+	// breakpoints: input where each new output starts, and that output
+	int num_bp;
+	unsigned char bp_in[CURVE_MAX_SIZE];
+	unsigned char bp_out[CURVE_MAX_SIZE];
+
+	// from fit, for the header comment
+	int fit_axes;
+	double fit_deadzone, fit_reach;
+};
+
+int curve_load(struct curve *c, const char *path);
+
+/* Number of steps of the breakpoint search, and the padded table size */
+int curve_bpSteps(const struct curve *c);
+
+#endif // _curve_h__
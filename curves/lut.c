@@ -1,111 +1,233 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-unsigned char data[127] = {
-// 0,1,2,3,3,3,4,4,4,4,4,4,5,5,5,5,5,5,6,6,6,6,6,7,7,7,7,7,8,8,8,8,8,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,10,10,10,10,10,10,10,10,10,10,10,10,10,10,10,11,11,11,11,11,11,11,11,11,12,12,12,12,12,12,12,13,13,13,13,13,14,14,14,15,15,15,16,16,16,17,17,17,18,18,19,19,20,20,21,22,22,22,23,23,23,24,24,24,25,25,26,26,27,31,31,31,31,31,31,31
-//
-//0,1,2,3,3,3,4,4,4,4,4,4,5,5,5,5,5,5,6,6,6,6,6,7,7,7,7,7,8,8,8,8,8,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,10,10,10,10,10,10,10,10,10,10,10,10,10,10,10,11,11,11,11,11,11,11,11,11,11,11,11,11,11,12,12,12,12,12,12,12,12,13,13,13,13,13,13,14,14,14,14,14,14,15,15,15,15,16,16,16,17,17,17,18,18,19,19,20,21,22,23,24,25,26,27,31,31,31,31,31
+#include "curve.h"
 
-// this one had good precision, but tends to accelerate too early
-//0,1,2,3,3,3,4,4,4,4,4,4,5,5,5,5,5,5,6,6,6,6,6,7,7,7,7,7,8,8,8,8,8,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,10,10,10,10,10,10,11,11,11,11,11,11,11,11,12,12,12,12,13,13,13,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31
-
-
-//0,1,2,3,3,3,4,4,4,4,4,4,5,5,5,5,5,5,6,6,6,6,6,7,7,7,7,7,8,8,8,8,8,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,10,10,10,10,10,10,11,11,11,11,11,11,11,11,12,12,12,12,13,13,13,13,14,14,15,15,16,16,17,18,18,19,20,21,22,23,24,25,26,27,28,29,30,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31
-
-//0,1,2,3,3,3,4,4,4,4,4,4,5,5,5,5,5,5,6,6,6,6,6,7,7,7,7,7,8,8,8,8,8,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,10,10,10,10,10,10,11,11,11,11,11,11,11,11,12,12,12,12,12,12,13,13,13,13,13,14,14,14,14,14,15,15,16,17,18,19,21,23,25,27,29,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31
-
-//0,1,2,3,3,3,4,4,4,4,4,4,5,5,5,5,5,5,6,6,6,6,6,7,7,7,7,7,8,8,8,8,8,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,10,10,10,10,10,10,10,10,10,10,10,10,11,11,11,11,11,11,11,11,12,12,12,12,13,13,13,14,14,14,15,15,16,17,18,19,21,23,25,27,29,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31
-
-//0,1,2,3,3,3,4,4,4,4,4,4,5,5,5,5,5,5,6,6,6,6,6,7,7,7,7,7,7,7,7,7,7,7,8,8,8,8,8,8,8,8,8,8,8,8,8,9,9,9,9,9,9,9,9,9,9,9,9,9,10,10,10,10,10,10,10,11,11,11,11,12,12,12,12,13,13,13,14,14,14,15,15,16,17,18,19,21,23,25,27,29,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31
-
-//0,1,2,3,3,3,4,4,4,4,4,4,5,5,5,5,5,5,6,6,6,6,6,7,7,7,7,7,7,7,7,7,7,7,8,8,8,8,8,8,8,8,8,8,8,8,8,9,9,9,9,9,9,9,9,9,9,9,9,9,10,10,10,10,10,10,10,11,11,11,11,12,12,12,12,13,13,13,14,14,14,15,15,16,17,18,20,22,24,26,28,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31
-
-//0,1,2,3,3,3,4,4,4,4,4,4,5,5,5,5,5,5,6,6,6,6,6,7,7,7,7,7,7,7,7,7,7,7,8,8,8,8,8,8,8,8,8,8,8,8,8,9,9,9,9,9,9,9,9,9,9,9,9,9,10,10,10,10,10,10,10,11,11,11,11,12,12,12,12,13,13,13,14,14,14,15,15,16,17,18,23,26,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31
-
-
-// V1.1
-0,1,2,3,3,3,4,4,4,4,4,4,5,5,5,5,5,5,6,6,6,6,6,7,7,7,7,7,7,7,7,7,7,7,8,8,8,8,8,8,8,8,8,8,8,8,8,9,9,9,9,9,9,9,9,9,9,9,9,9,10,10,10,10,10,10,10,11,11,11,11,12,12,12,12,13,13,13,14,14,14,15,15,16,17,24,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31
+#define MAX_CURVES	64
 
+static void printBytes(FILE *fp, const unsigned char *v, int n)
+{
+	int i;
 
+	for (i = 0; i < n; i++) {
+		if (i % 16 == 0)
+			fprintf(fp, "\n\t");
+		fprintf(fp, "%d,", v[i]);
+	}
+	fprintf(fp, "\n");
+}
 
-};
+/* Breakpoint tables are padded to a power of two. The padding inputs are
+ * 255, with the last output: an input of 255 landing there still gets
+ * the right value. */
+static void emitCurve(FILE *fp, const struct curve *c)
+{
+	int steps = curve_bpSteps(c), padded = 1 << steps;
+	unsigned char bp_in[CURVE_MAX_SIZE], bp_out[CURVE_MAX_SIZE];
+	int i;
 
-// V1.4, better fit for worn controllers
-unsigned char data_v1_4[127] = {
-	0,1,2,3,3,3,4,4,4,4,4,4,5,5,5,5,5,5,6,6,6,6,7,7,7,7,7,7,7,7,7,8,8,8,8,8,8,8,8,8,9,9,9,9,9,9,9,9,9,9,10,10,10,10,10,10,11,11,11,11,12,12,12,12,13,13,13,14,14,15,16,17,21,26,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31
+	memcpy(bp_in, c->bp_in, c->num_bp);
+	memcpy(bp_out, c->bp_out, c->num_bp);
+	for (i = c->num_bp; i < padded; i++) {
+		bp_in[i] = 255;
+		bp_out[i] = c->bp_out[c->num_bp - 1];
+	}
 
-};
+	fprintf(fp, "/* %s: %d inputs, outputs 0 to %d, %d breakpoints.\n", c->name, c->size, c->max, c->num_bp);
+	if (c->fit_axes)
+		fprintf(fp, " * Fitted to %d axes: deadzone %g, reach %g.\n", c->fit_axes, c->fit_deadzone, c->fit_reach);
+	fprintf(fp, " * Full table: %d bytes. Breakpoints: %d bytes, %d steps. */\n", c->size, padded * 2, steps);
 
-/*
-unsigned char data_v1_5[127] = {
-	0,	1,	2,	3,	4,	4,	5,	5,	6,	6,	6,	7,	7,	7,	8,	8,	9,	9,	9,	10,	10,	10,	11,	11,	12,	12,	12,	13,	13,	14,	14,	14,	15,	15,	15,	16,	16,	17,	17,	17,	18,	18,	18,	19,	19,	20,	20,	20,	21,	21,	21,	22,	22,	23,	23,	23,	24,	24,	25,	25,	25,	26,	26,	26,	27,	27,	28,	28,	28,	29,	29,	29,	30,	30,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31,	31
+	fprintf(fp, "#define CURVE_%s_SIZE\t%d\n\n", c->name, c->size);
 
-};
-*/
+	fprintf(fp, "static const unsigned char curve_%s_table[%d] PROGMEM = {", c->name, c->size);
+	printBytes(fp, c->values, c->size);
+	fprintf(fp, "};\n\n");
 
-// For Zelda.
-//
-// This one raises quickly to 10 (walk), then rises slowly to 17 for good speed control
-// 
-// 0 no movement
-// 6 orientation
-// 10 walk
-// 13 walk faster (I don't see a difference between 11 and 12..)
-// 14 faster
-// 15 event faster
-// 16 almost running
-// 17 running full speed
-//
-unsigned char data_v1_5[127] = {
-0,1,2,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,11,11,11,11,11,12,12,12,12,12,12,12,13,13,13,13,13,13,14,14,14,14,14,14,15,15,15,15,15,15,15,15,16,16,16,16,16,16,16,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31
-};
+	fprintf(fp, "static const unsigned char curve_%s_bp_in[%d] PROGMEM = {", c->name, padded);
+	printBytes(fp, bp_in, padded);
+	fprintf(fp, "};\n\n");
 
-/*unsigned char data_v1_5[127] = {
-	0,1,2,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,11,11,11,11,11,12,12,12,12,12,12,12,13,13,13,13,13,13,14,14,14,14,14,14,15,15,15,15,15,15,15,16,16,16,16,16,16,17,17,17,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31,31
-};*/
+	fprintf(fp, "static const unsigned char curve_%s_bp_out[%d] PROGMEM = {", c->name, padded);
+	printBytes(fp, bp_out, padded);
+	fprintf(fp, "};\n\n");
 
+	fprintf(fp, "static inline unsigned char curve_%s_full(unsigned char x)\n", c->name);
+	fprintf(fp, "{\n");
+	if (c->size < 256) {
+		fprintf(fp, "\tif (x > %d)\n", c->size - 1);
+		fprintf(fp, "\t\tx = %d;\n", c->size - 1);
+	}
+	fprintf(fp, "\treturn pgm_read_byte(&curve_%s_table[x]);\n", c->name);
+	fprintf(fp, "}\n\n");
+
+	// Each step halves the range. The comparison result is shifted into
+	// the index instead of branching, so every input takes the same time.
+	fprintf(fp, "static inline unsigned char curve_%s_bp(unsigned char x)\n", c->name);
+	fprintf(fp, "{\n");
+	fprintf(fp, "\tunsigned char i = 0;\n\n");
+	for (i = steps - 1; i >= 0; i--)
+		fprintf(fp, "\ti |= (pgm_read_byte(&curve_%s_bp_in[i | %d]) <= x) << %d;\n", c->name, 1 << i, i);
+	fprintf(fp, "\n\treturn pgm_read_byte(&curve_%s_bp_out[i]);\n", c->name);
+	fprintf(fp, "}\n\n");
+
+	fprintf(fp, "#ifdef CURVES_BREAKPOINTS\n");
+	fprintf(fp, "#define curve_%s(x)\tcurve_%s_bp(x)\n", c->name, c->name);
+	fprintf(fp, "#else\n");
+	fprintf(fp, "#define curve_%s(x)\tcurve_%s_full(x)\n", c->name, c->name);
+	fprintf(fp, "#endif\n\n");
+}
 
-unsigned char data_gc1[127] = {
-	/*
-	0,1,1,2,2,3,3,4,4,5,5,5,6,6,6,7,7,7,8,8,8,8,9,9,9,9,10,10,10,10,11,11,11,11,11,12,12,12,12,12,12,13,13,13,13,13,13,13,13,14,14,14,14,14,15,15,15,15,15,16,16,16,16,16,17,17,17,17,17,18,18,18,19,19,19,20,20,20,21,21,21,22,22,22,23,23,23,24,24,24,25,25,26,26,27,27,28,28,29,30,31*/
-/*
-0,1,1,2,2,3,3,4,4,5,5,5,6,6,6,7,7,7,8,8,8,8,9,9,9,9,10,10,10,10,11,11,11,11,11,12,12,12,12,12,12,12,12,12,12,12,13,13,13,13,13,13,13,13,13,14,14,14,14,14,14,14,14,14,15,15,15,15,15,16,16,16,16,16,17,17,17,17,17,18,18,18,18,19,19,19,20,20,20,21,21,21,22,22,23,23,24,25,26,28,31*/
+static void emitHeader(FILE *fp, struct curve *curves, int num, char **files)
+{
+	int i;
 
-0,1,1,1,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,6,6,6,6,7,7,7,7,8,8,8,8,9,9,9,9,9,9,10,10,10,10,10,10,11,11,11,11,11,11,11,12,12,12,12,12,12,12,13,13,13,13,13,13,14,14,14,14,14,14,15,15,15,15,16,16,16,16,17,17,17,18,18,18,19,19,19,20,20,20,21,21,21,22,22,23,23,24,25,26,28,31
+	fprintf(fp, "/* Generated by curves/lut from");
+	for (i = 0; i < num; i++)
+		fprintf(fp, " %s", files[i]);
+	fprintf(fp, ".\n * Do not edit, edit the .curve files instead.\n");
+	fprintf(fp, " *\n");
+	fprintf(fp, " * curve_<name>_full(x) reads a table with one byte per input.\n");
+	fprintf(fp, " * curve_<name>_bp(x) searches a table with one input/output pair per\n");
+	fprintf(fp, " * breakpoint, in a fixed number of steps.\n");
+	fprintf(fp, " * curve_<name>(x) is the first one, or the second one when\n");
+	fprintf(fp, " * CURVES_BREAKPOINTS is defined. */\n");
+	fprintf(fp, "#ifndef _curves_h__\n");
+	fprintf(fp, "#define _curves_h__\n\n");
+	fprintf(fp, "#ifdef __AVR__\n");
+	fprintf(fp, "#include <avr/pgmspace.h>\n");
+	fprintf(fp, "#elif !defined(pgm_read_byte)\n");
+	fprintf(fp, "#define PROGMEM\n");
+	fprintf(fp, "#define pgm_read_byte(addr)\t(*(const unsigned char *)(addr))\n");
+	fprintf(fp, "#endif\n\n");
+
+	for (i = 0; i < num; i++)
+		emitCurve(fp, &curves[i]);
+
+	// for bench.c
+	fprintf(fp, "#ifdef CURVES_LIST\n");
+	fprintf(fp, "static const struct curves_entry {\n");
+	fprintf(fp, "\tconst char *name;\n");
+	fprintf(fp, "\tint size, num_bp, bp_size, steps;\n");
+	fprintf(fp, "\tconst unsigned char *table, *bp_in, *bp_out;\n");
+	fprintf(fp, "\tunsigned char (*full)(unsigned char x);\n");
+	fprintf(fp, "\tunsigned char (*bp)(unsigned char x);\n");
+	fprintf(fp, "} curves_list[] = {\n");
+	for (i = 0; i < num; i++) {
+		const struct curve *c = &curves[i];
+		int steps = curve_bpSteps(c);
+
+		fprintf(fp, "\t{ \"%s\", %d, %d, %d, %d, curve_%s_table, curve_%s_bp_in, curve_%s_bp_out, curve_%s_full, curve_%s_bp },\n",
+			c->name, c->size, c->num_bp, 1 << steps, steps,
+			c->name, c->name, c->name, c->name, c->name);
+	}
+	fprintf(fp, "};\n");
+	fprintf(fp, "#endif\n\n");
 
-};
+	fprintf(fp, "#endif // _curves_h__\n");
+}
 
-int arrayToRlut(unsigned char *data, int n)
+// The old output of this program: inputs where the output increases
+static void printBreakpoints(const struct curve *c)
 {
 	int i;
-	int c = -1;
 
-	for (i=0; i<n; i++) {
-		if (data[i] > c) {
-			printf("%d,",i);
-			c = data[i];
-		}
+	printf("%s table:\n", c->name);
+	for (i = 0; i < c->num_bp; i++)
+		printf("%d,", c->bp_in[i]);
+	printf("\n\n");
+}
 
-	}
+static void usage(void)
+{
+	printf("Usage: ./lut [options] file.curve...\n");
+	printf("\n");
+	printf("Generates a header with lookup tables for the firmware. The format\n");
+	printf("of the .curve files is described in curve.h.\n");
+	printf("\n");
+	printf("  -o file    Output header (default: stdout)\n");
+	printf("  -p         Print the breakpoints only\n");
+	printf("  -h         Prints this help\n");
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
-	printf("n64 V1.1 Table:\n");
-	arrayToRlut(data, sizeof(data));
-	printf("\n\n");
+	static struct curve curves[MAX_CURVES];
+	const char *out = NULL;
+	int print_bp = 0;
+	int opt, i, j, num;
+	FILE *fp;
+
+	while ((opt = getopt(argc, argv, "o:ph")) != -1) {
+		switch (opt)
+		{
+			case 'o': out = optarg; break;
+			case 'p': print_bp = 1; break;
+			case 'h': usage(); return 0;
+			default:
+				fprintf(stderr, "Unknown argument. Try -h\n");
+				return 1;
+		}
+	}
 
-	printf("n64 V1.4 Table:\n");
-	arrayToRlut(data_v1_4, sizeof(data_v1_4));
-	printf("\n\n");
+	num = argc - optind;
+	if (num < 1) {
+		usage();
+		return 1;
+	}
+	if (num > MAX_CURVES) {
+		fprintf(stderr, "Too many curves\n");
+		return 1;
+	}
 
-	printf("n64 V1.5 Table:\n");
-	arrayToRlut(data_v1_5, sizeof(data_v1_5));
-	printf("\n\n");
+	for (i = 0; i < num; i++) {
+		if (curve_load(&curves[i], argv[optind + i]))
+			return 1;
+		for (j = 0; j < i; j++) {
+			if (!strcmp(curves[i].name, curves[j].name)) {
+				fprintf(stderr, "%s: name %s already used\n", argv[optind + i], curves[i].name);
+				return 1;
+			}
+		}
+	}
 
+	if (print_bp) {
+		for (i = 0; i < num; i++)
+			printBreakpoints(&curves[i]);
+		return 0;
+	}
 
-	printf("gc1 table:\n");
-	arrayToRlut(data_gc1, sizeof(data_gc1));
-	printf("\n\n");
+	fp = out ? fopen(out, "w") : stdout;
+	if (!fp) {
+		perror(out);
+		return 1;
+	}
 
+	emitHeader(fp, curves, num, argv + optind);
+
+	if (out && fclose(fp)) {
+		perror(out);
+		unlink(out);
+		return 1;
+	}
 
+	return 0;
 }
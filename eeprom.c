@@ -16,11 +16,26 @@
  */
 
 #include <avr/eeprom.h>
+#include <avr/pgmspace.h>
 #include <string.h>
 #include "eeprom.h"
+// generated by hitwindow
+#include "sensor_profiles.h"
+
+/* Display the gun is used with, for the default sensor hold (see
+ * hitwindow/README). Can be set from the Makefile. */
+#ifndef GUN_SENSOR_PROFILE
+#define GUN_SENSOR_PROFILE		SENSOR_PROFILE_LCD_GAME
+#endif
+
+static const unsigned char sensor_profile_holds[SENSOR_NUM_PROFILES] PROGMEM = SENSOR_PROFILE_HOLDS;
 
 static struct eeprom_data_struct g_eeprom_data;
 
+// next byte of g_eeprom_data to compare and write, if commit_pending
+static unsigned char commit_pos;
+static char commit_pending;
+
 static void eeprom_commit(void)
 {
 	eeprom_busy_wait();
@@ -31,7 +46,7 @@ static void eeprom_commit(void)
 // return 1 if eeprom was blank
 static char eeprom_init(void)
 {
-	char *magic = "EXTENMOT2";
+	char *magic = "EXTENGUN4";
 
 	eeprom_busy_wait();
 	eeprom_read_block(&g_eeprom_data, EEPROM_BASE_PTR, sizeof(struct eeprom_data_struct));
@@ -49,35 +64,81 @@ static char eeprom_init(void)
 }
 
 struct eeprom_data_struct g_current_config = {
-	.magic = { 'E','X','T','E','N','M','O','T','2' },
-	.g_n64_mapping_mode = 0,
-	.g_n64_curve_id = 0,
+	.magic = { 'E','X','T','E','N','G','U','N','4' },
+	.active_profile = PROFILE_DEFAULT,
+};
 
-	.g_gc_mapping_mode = 0,
+/* The sensor hold depends on the display more than on the game, all
+ * profiles start with the one of the display the firmware was built for. */
+static void default_profiles(void)
+{
+	unsigned char hold = pgm_read_byte(&sensor_profile_holds[GUN_SENSOR_PROFILE]);
+	unsigned char i;
 
-	.g_snes_nes_mode = 0,
-	.g_snes_analog_dpad = 0,
-	.merge_zl_zr = 0,
-};
+	for (i = 0; i < NUM_PROFILES; i++) {
+		struct gun_profile *p = &g_current_config.profiles[i];
+
+		p->delay_a_ticks = DELAY_A_TICKS;
+		p->sensor_hold = hold;
+		p->trigger_debounce = 0;
+		p->reserved = 0;
+	}
+
+	g_current_config.profiles[PROFILE_DEBOUNCE].trigger_debounce = 1;
+}
 
 void sync_config()
 {
 	memcpy(&g_eeprom_data, &g_current_config, sizeof(struct eeprom_data_struct));
-	eeprom_commit();
+	commit_pos = 0;
+	commit_pending = 1;
+}
+
+/* An EEPROM write takes about 3.3ms, during which the next one would
+ * wait. Write only when the previous one is done, and skip the bytes
+ * that did not change. */
+void config_task(void)
+{
+	unsigned char *data = (unsigned char *)&g_eeprom_data;
+	unsigned char *addr = (unsigned char *)EEPROM_BASE_PTR;
+
+	if (!commit_pending || !eeprom_is_ready())
+		return;
+
+	while (commit_pos < sizeof(struct eeprom_data_struct)) {
+		unsigned char i = commit_pos++;
+
+		if (eeprom_read_byte(addr + i) != data[i]) {
+			eeprom_update_byte(addr + i, data[i]);
+			return;
+		}
+	}
+
+	commit_pending = 0;
 }
 
 void init_config()
 {
 	if (eeprom_init()) {
 		// If 1 is returned, the eeprom was blank. Commit our default values.
-		sync_config();
+		default_profiles();
+		memcpy(&g_eeprom_data, &g_current_config, sizeof(struct eeprom_data_struct));
+		eeprom_commit();
 	}
 	else {
 		// otherwise, previously stored values have been loaded. make them active.
 		memcpy(&g_current_config, &g_eeprom_data, sizeof(struct eeprom_data_struct));
+		if (g_current_config.active_profile >= NUM_PROFILES) {
+			g_current_config.active_profile = PROFILE_DEFAULT;
+		}
 	}
 }
 
+const struct gun_profile *activeProfile(void)
+{
+	return &g_current_config.profiles[g_current_config.active_profile];
+}
+
 char disable_config = 0;
 
 void chgMap(unsigned char *cfg_ptr, unsigned char new_value)
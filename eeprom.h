@@ -17,41 +17,43 @@
 #ifndef _eeprom_h__
 #define _eeprom_h__
 
-#define EEPROM_MAGIC_SIZE		9 /* EXTENMOTE */
+#include "gun.h"
+
+#define EEPROM_MAGIC_SIZE		9 /* EXTENGUN4 */
 #define EEPROM_BASE_PTR			((void*)0x0000)
 
+/* Gun settings, one set active at a time. Duck Hunt, Hogan's Alley and
+ * Trick Shooting all get along with the default profile, which reports
+ * the trigger at once. The second one debounces it for a switch that
+ * bounces, at the cost of a poll of latency. The others start as copies
+ * of the default one for custom settings. */
+#define PROFILE_DEFAULT			0
+#define PROFILE_DEBOUNCE		1
+#define PROFILE_CUSTOM1			2
+#define PROFILE_CUSTOM2			3
+#define PROFILE_CUSTOM3			4
+#define PROFILE_CUSTOM4			5
+#define PROFILE_CUSTOM5			6
+#define PROFILE_CUSTOM6			7
+#define NUM_PROFILES			8
+
 struct eeprom_data_struct {
 	unsigned char magic[EEPROM_MAGIC_SIZE];
-	unsigned char g_n64_mapping_mode;
-	unsigned char g_n64_curve_id;
-	unsigned char g_gc_mapping_mode;
-	unsigned char g_snes_nes_mode;
-	unsigned char g_snes_analog_dpad;
-	unsigned char merge_zl_zr;
+	unsigned char active_profile;
+	struct gun_profile profiles[NUM_PROFILES];
+	struct sensor_calib calib; // all zero until calibrated, see calib.c
 };
 
 extern struct eeprom_data_struct g_current_config;
 
+/* sync_config only schedules the write. config_task writes one byte per
+ * call, when the EEPROM is ready, so it never waits: call it from the
+ * main loop. */
 void sync_config(void);
 void init_config(void);
+void config_task(void);
 
-#define MODE_N64_STANDARD		0
-#define MODE_MARIOKART64		1
-#define MODE_OCARINA			2
-#define MODE_SSMB				3
-#define MODE_SIN_AND_PUNISHMENT	4
-#define MODE_OGRE_BATTLE		5
-#define MODE_F_ZERO_X			6
-#define MODE_YOSHI_STORY		7
-#define MODE_TEST				8
-#define MODE_ODYSSEY			9
-
-#define MODE_GC_STANDARD		0
-#define MODE_GC_SNES			1
-#define MODE_GC_ZLR				2
-#define MODE_GC_ASR				3 // Sega all stars racing transformed
-#define MODE_GC_DEV				4
-#define MODE_GC_EXTRA1			5
+const struct gun_profile *activeProfile(void);
 
 extern char disable_config;
 void chgMap(unsigned char *cfg_ptr, unsigned char new_value);
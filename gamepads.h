@@ -27,7 +27,14 @@
 #define PAD_TYPE_SMS		7
 #define PAD_TYPE_GUN		8
 
+#ifdef WITH_SHOT_EVENTS
+#define GUN_RAW_SHOT		2	// offset of the shot event (see shot.h)
+#define GUN_RAW_SIZE		5	// buttons, sensor peak intensity or 0, shot event
+#elif defined(WITH_ANALOG_SENSOR)
+#define GUN_RAW_SIZE		2	// buttons, sensor peak intensity
+#else
 #define GUN_RAW_SIZE		1	
+#endif
 #define NES_RAW_SIZE		1	
 #define SNES_RAW_SIZE		2
 #define N64_RAW_SIZE		4
@@ -33,14 +33,95 @@
 #include <string.h>
 #include "gamepads.h"
 #include "gun.h"
+#include "shot.h"
 
+#ifdef WITH_ANALOG_SENSOR
+// generated from curves/sensor.curve
+#include "curves/curves.h"
+
+#define GAMEPAD_BYTES	2
+#else
 #define GAMEPAD_BYTES	1
+#endif
 
 /******** IO port definitions **************/
 #define GUN_8_BUTTONS_DDR  DDRD
 #define GUN_8_BUTTONS_PORT PORTD
 #define GUN_8_BUTTONS_PIN  PIND
 
+#ifdef WITH_ANALOG_SENSOR
+/* In analog mode the light sensor is sampled by the ADC instead of
+ * being read as a digital bit on PD6. Only the trigger is read from PORTD. */
+#define GUN_DIGITAL_MASK		0x80
+
+#define GUN_SENSOR_ADC_CHANNEL	0	// ADC0 / PC0
+#define GUN_SENSOR_ADC_PORT		PORTC
+
+/* The Zapper sensor output goes low when light is detected (same polarity
+ * as the digital input). Define as 0 for sensors that go high. */
+#ifndef GUN_SENSOR_ACTIVE_LOW
+#define GUN_SENSOR_ACTIVE_LOW	1
+#endif
+
+/* A hit is a rise above the ambient baseline of at least
+ * GUN_SENSOR_MIN_RISE counts plus 1/4 of the baseline itself. */
+#define GUN_SENSOR_MIN_RISE		24
+#define GUN_SENSOR_REL_SHIFT	2
+
+/* In a bright room the baseline is high, and the threshold is lowered
+ * so that a flash can still reach it: base + threshold stays
+ * GUN_SENSOR_HEADROOM counts below full scale. It never goes below
+ * GUN_SENSOR_MIN_THRESHOLD, or noise would be taken for hits. */
+#define GUN_SENSOR_HEADROOM		16
+#define GUN_SENSOR_MIN_THRESHOLD	8
+
+/* The baseline is updated every 4th sample with a 1/256 weight. At
+ * ~7kHz this gives a time constant of about 140ms, slow enough not
+ * to follow a 1-2 frame flash but fast enough for ambient changes. */
+#define GUN_BASELINE_DECIMATE	4
+
+#if F_CPU > 8000000L
+#define GUN_ADC_PRESCALER		(_BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0))	// /128
+#define GUN_ADC_DIVIDER			128
+#else
+#define GUN_ADC_PRESCALER		(_BV(ADPS2) | _BV(ADPS1))	// /64
+#define GUN_ADC_DIVIDER			64
+#endif
+
+/* The baseline is frozen during a flash, but a rise longer than 4 frames
+ * is a change of the ambient light (room light switched on, gun moved to
+ * a brighter area): the baseline restarts from the sample, or the sensor
+ * would stay reported. Free running, a conversion takes 13 ADC clocks. */
+#define GUN_SENSOR_MAX_FLASH_MS	67
+#define GUN_SENSOR_MAX_FLASH_SAMPLES	(F_CPU / GUN_ADC_DIVIDER / 13 * GUN_SENSOR_MAX_FLASH_MS / 1000)
+
+#else
+#define GUN_DIGITAL_MASK		0xC0
+#endif
+
+/* Digital sensors, active low. A CRT lights the sensor for a millisecond
+ * or two per frame, which a read at sampling time mostly misses: where
+ * pin change interrupts exist, flashes are latched between samples. */
+#ifdef WITH_ANALOG_SENSOR
+#define GUN_LATCH_MASK			0
+#else
+#define GUN_LATCH_MASK			0x40	// PD6 / PCINT22
+#endif
+#ifdef GUN_HAVE_GUN2
+#define GUN2_LATCH_MASK			0x10	// PD4 / PCINT20
+#else
+#define GUN2_LATCH_MASK			0
+#endif
+
+#if defined(PCMSK2) && (GUN_LATCH_MASK | GUN2_LATCH_MASK)
+#define GUN_SENSOR_LATCH
+#endif
+
+/* The shots are timed from the sensor edges, where they interrupt. */
+#if defined(WITH_SHOT_EVENTS) && defined(GUN_SENSOR_LATCH) && defined(HAVE_TIMEBASE)
+#define GUN_SHOT_EDGES
+#endif
+
 /*********** prototypes *************/
 static char gunInit(void);
 static char gunUpdate(void);
@@ -53,6 +134,321 @@ static unsigned char last_reported_controller_bytes[GAMEPAD_BYTES];
 
 static char nes_mode = 0;
 
+// from the active profile (see gunSetProfile)
+static unsigned char sensor_hold_polls; // 0: level only, no latch
+static unsigned char trigger_debounce;
+
+static unsigned char sensor_remaining;
+static unsigned char trigger_state, trigger_count;
+
+#ifdef GUN_SENSOR_LATCH
+// one bit per sensor pin, cleared when taken by the update functions
+static volatile unsigned char sensor_latched;
+
+#ifdef GUN_SENSOR_CALIB
+// time base ticks, see gunSetCalibration
+static unsigned short sensor_confirm;
+/* Pin bits, for the filter below: lit for sensor_confirm ticks, until
+ * they go dark; timed by the compare running; and waiting for it. */
+static volatile unsigned char sensor_confirmed;
+static unsigned char sensor_timed, sensor_queued;
+#endif
+
+#ifdef GUN_SHOT_EDGES
+static const unsigned char shot_masks[2] = { GUN_LATCH_MASK, GUN2_LATCH_MASK };
+/* Per gun, in time base ticks: start of the last flash, with the wraps
+ * so that a sensor lit for long is not taken for a new flash, and length
+ * of the last one over, saturated. */
+static volatile unsigned long flash_start[2];
+static volatile unsigned short flash_width[2];
+static volatile unsigned char sensor_lit;
+
+static inline unsigned short flashTicks(unsigned long now, unsigned long start)
+{
+	return now - start > 0xFFFF ? 0xFFFF : now - start;
+}
+
+// before the filter below: the time of a flash is the time of its first edge
+static inline void shotEdges(unsigned char lit)
+{
+	unsigned long now;
+	unsigned char g;
+
+	// the wraps only for the shot sensors, the other pins return at once
+	if (!((lit ^ sensor_lit) & (GUN_LATCH_MASK | GUN2_LATCH_MASK)))
+		return;
+	now = timebase_time();
+
+	for (g = 0; g < 2; g++) {
+		if (lit & ~sensor_lit & shot_masks[g])
+			flash_start[g] = now;
+		if (~lit & sensor_lit & shot_masks[g])
+			flash_width[g] = flashTicks(now, flash_start[g]);
+	}
+	sensor_lit = lit;
+}
+#endif
+
+ISR(PCINT2_vect)
+{
+	unsigned char lit = ~GUN_8_BUTTONS_PIN & (GUN_LATCH_MASK | GUN2_LATCH_MASK);
+
+#ifdef GUN_SHOT_EDGES
+	shotEdges(lit);
+#endif
+
+#ifdef GUN_SENSOR_CALIB
+	/* Pulses shorter than a flash are noise: a sensor is latched only
+	 * if still lit sensor_confirm ticks after its flash starts. A flash
+	 * starting while the compare runs for the other gun waits for the
+	 * next one. */
+	if (sensor_confirm) {
+		unsigned char fresh;
+
+		sensor_confirmed &= lit;
+		sensor_timed &= lit;
+		sensor_queued &= lit;
+
+		fresh = lit & ~(sensor_confirmed | sensor_timed | sensor_queued);
+		if (fresh) {
+			if (TIMSK1 & _BV(OCIE1A)) {
+				sensor_queued |= fresh;
+			} else {
+				sensor_timed = fresh;
+				OCR1A = TCNT1 + sensor_confirm;
+				TIFR1 = _BV(OCF1A);
+				TIMSK1 |= _BV(OCIE1A);
+			}
+		}
+		lit &= sensor_confirmed;
+	}
+#endif
+
+	sensor_latched |= lit;
+}
+
+#ifdef GUN_SENSOR_CALIB
+ISR(TIMER1_COMPA_vect)
+{
+	unsigned char lit = ~GUN_8_BUTTONS_PIN & sensor_timed;
+
+	sensor_confirmed |= lit;
+	sensor_latched |= lit;
+
+	sensor_timed = sensor_queued & ~GUN_8_BUTTONS_PIN;
+	sensor_queued = 0;
+	if (sensor_timed)
+		OCR1A = TCNT1 + sensor_confirm;
+	else
+		TIMSK1 &= ~_BV(OCIE1A);
+}
+#endif
+#endif
+
+static unsigned char takeLatched(unsigned char mask)
+{
+#ifdef GUN_SENSOR_LATCH
+	unsigned char sreg, latched;
+
+	sreg = SREG;
+	cli();
+	latched = sensor_latched & mask;
+	sensor_latched &= ~mask;
+	SREG = sreg;
+
+	return latched;
+#else
+	return 0;
+#endif
+}
+
+#ifndef WITH_ANALOG_SENSOR
+/* The level of a sensor, read at the update. With the filter above, only
+ * once its flash is confirmed: the unfiltered pin would let the noise
+ * through. */
+static unsigned char sensorLevel(unsigned char level, unsigned char mask)
+{
+#ifdef GUN_SENSOR_CALIB
+	if (sensor_confirm && !(sensor_confirmed & mask))
+		return 0;
+#endif
+	return level;
+}
+#endif
+
+#ifndef WITH_SHOT_EVENTS
+/* Called once per poll. Returns non-zero if the sensor is to be
+ * reported. A flash keeps it reported for sensor_hold_polls polls, so
+ * that the game still sees it if the display shows it late. */
+static char sensorHeld(unsigned char *remaining, char level, char latched)
+{
+	if (!sensor_hold_polls)
+		return level;
+
+	if (level || latched)
+		*remaining = sensor_hold_polls;
+
+	if (*remaining) {
+		(*remaining)--;
+		return 1;
+	}
+
+	return 0;
+}
+#else
+static struct shot shots[2]; // per gun
+
+/* Called once per sample. Returns non-zero if the sensor is to be
+ * reported: only in the sample deciding a hit (see shot.h). */
+static char gunShot(unsigned char gun, unsigned char trigger, unsigned char flash)
+{
+	unsigned long now = 0, start = 0;
+	unsigned short width = 0;
+
+#ifdef HAVE_TIMEBASE
+	now = timebase_time();
+#endif
+#ifdef GUN_SHOT_EDGES
+	if (flash) {
+		unsigned char sreg;
+
+		sreg = SREG;
+		cli();
+		start = flash_start[gun];
+		width = (sensor_lit & shot_masks[gun]) ? flashTicks(now, start) : flash_width[gun];
+		SREG = sreg;
+	}
+#endif
+
+	return shot_sample(&shots[gun], now, trigger ? 1 : 0, flash ? 1 : 0, start, width);
+}
+#endif // WITH_SHOT_EVENTS
+
+/* Called once per poll. A change of the trigger is reported once it
+ * has been seen on trigger_debounce+1 consecutive polls. */
+static unsigned char debounceTrigger(unsigned char *state, unsigned char *count, unsigned char pressed)
+{
+	if (pressed == *state) {
+		*count = 0;
+	} else if (++*count > trigger_debounce) {
+		*state = pressed;
+		*count = 0;
+	}
+
+	return *state;
+}
+
+// Called from the main loop, between two updates
+void gunSetProfile(const struct gun_profile *profile)
+{
+	sensor_hold_polls = profile->sensor_hold;
+	trigger_debounce = profile->trigger_debounce;
+}
+
+void gunSetCalibration(const struct sensor_calib *calib)
+{
+#ifdef GUN_SENSOR_CALIB
+	unsigned long ticks = TIMEBASE_US_TO_TICKS(calib->confirm_us);
+	unsigned char sreg;
+
+	sreg = SREG;
+	cli();
+	sensor_confirm = ticks > 0xFFFF ? 0xFFFF : ticks;
+	SREG = sreg;
+#endif
+}
+
+#ifdef WITH_ANALOG_SENSOR
+// ambient level, 8.8 fixed point
+static unsigned short sensor_baseline;
+static unsigned char sensor_decimate;
+// consecutive samples above the threshold
+static unsigned short sensor_rise_samples;
+// set by the ADC interrupt, cleared when read by gunUpdate
+static volatile unsigned char sensor_hit;
+static volatile unsigned char sensor_peak;
+
+static void gunSensorInit(void)
+{
+	// no pull-up on the analog input
+	GUN_SENSOR_ADC_PORT &= ~_BV(GUN_SENSOR_ADC_CHANNEL);
+#ifdef DIDR0
+	DIDR0 |= _BV(GUN_SENSOR_ADC_CHANNEL);
+#endif
+
+	sensor_baseline = 0;
+	sensor_decimate = 0;
+	sensor_rise_samples = 0;
+	sensor_hit = 0;
+	sensor_peak = 0;
+
+	// AVcc reference, left adjusted (8 bit result in ADCH)
+	ADMUX = _BV(REFS0) | _BV(ADLAR) | GUN_SENSOR_ADC_CHANNEL;
+
+	// free running, interrupt driven
+#ifdef ADATE
+	ADCSRB = 0;
+	ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | GUN_ADC_PRESCALER;
+#else
+	ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADFR) | _BV(ADIE) | GUN_ADC_PRESCALER;
+#endif
+}
+
+ISR(ADC_vect)
+{
+	unsigned char sample = ADCH;
+	unsigned char base;
+	unsigned char threshold;
+
+#if GUN_SENSOR_ACTIVE_LOW
+	sample = ~sample;
+#endif
+
+	// first sample after power-up: start from the current ambient level
+	if (sensor_baseline == 0) {
+		sensor_baseline = (sample << 8) | 0x80;
+	}
+
+	base = sensor_baseline >> 8;
+	threshold = GUN_SENSOR_MIN_RISE + (base >> GUN_SENSOR_REL_SHIFT);
+	if (base + threshold > 255 - GUN_SENSOR_HEADROOM) {
+		if (base > 255 - GUN_SENSOR_HEADROOM - GUN_SENSOR_MIN_THRESHOLD)
+			threshold = GUN_SENSOR_MIN_THRESHOLD;
+		else
+			threshold = 255 - GUN_SENSOR_HEADROOM - base;
+	}
+
+	if (sample > base && (unsigned char)(sample - base) >= threshold) {
+		unsigned char rise = sample - base;
+
+		if (++sensor_rise_samples > GUN_SENSOR_MAX_FLASH_SAMPLES) {
+			sensor_rise_samples = 0;
+			sensor_baseline = (sample << 8) | 0x80;
+			return;
+		}
+
+		// hit. The baseline is frozen so the flash is not absorbed.
+		sensor_hit = 1;
+		if (rise > sensor_peak) {
+			sensor_peak = rise;
+		}
+		return;
+	}
+	sensor_rise_samples = 0;
+
+	if (++sensor_decimate >= GUN_BASELINE_DECIMATE) {
+		sensor_decimate = 0;
+		unsigned short target = (unsigned short)sample << 8;
+
+		if (target > sensor_baseline) {
+			sensor_baseline += (target - sensor_baseline) >> 8;
+		} else {
+			sensor_baseline -= (sensor_baseline - target) >> 8;
+		}
+	}
+}
+#endif
+
 static char gunInit(void)
 {
 	unsigned char sreg;
@@ -65,6 +461,29 @@ static char gunInit(void)
 	// 8 NES buttons are normally high - all bits one
 	GUN_8_BUTTONS_PORT = 0xFF;
 
+	sensor_remaining = 0;
+	trigger_state = 0;
+	trigger_count = 0;
+#ifdef WITH_SHOT_EVENTS
+	shot_init(&shots[0]);
+	shot_init(&shots[1]);
+#endif
+
+#ifdef GUN_SENSOR_LATCH
+	sensor_latched = 0;
+#ifdef GUN_SHOT_EDGES
+	sensor_lit = ~GUN_8_BUTTONS_PIN & (GUN_LATCH_MASK | GUN2_LATCH_MASK);
+	flash_start[0] = flash_start[1] = timebase_time();
+#endif
+	PCMSK2 |= GUN_LATCH_MASK | GUN2_LATCH_MASK;
+	PCIFR = _BV(PCIF2);
+	PCICR |= _BV(PCIE2);
+#endif
+
+#ifdef WITH_ANALOG_SENSOR
+	gunSensorInit();
+#endif
+
 	gunUpdate();
 
 	SREG = sreg;
@@ -94,8 +513,44 @@ static char gunUpdate(void)
 	unsigned char tmp=0;
 
 	tmp = ~GUN_8_BUTTONS_PIN;
-	last_read_controller_bytes[0] = tmp & 0xC0;
-	
+	last_read_controller_bytes[0] = tmp & GUN_DIGITAL_MASK & ~GUN_BTN_TRIGGER;
+	last_read_controller_bytes[0] |= debounceTrigger(&trigger_state, &trigger_count, tmp & GUN_BTN_TRIGGER);
+
+#ifndef WITH_ANALOG_SENSOR
+	last_read_controller_bytes[0] &= ~GUN_BTN_SENSOR;
+#ifdef WITH_SHOT_EVENTS
+	if (gunShot(0, trigger_state, sensorLevel(tmp & GUN_BTN_SENSOR, GUN_LATCH_MASK) | takeLatched(GUN_LATCH_MASK))) {
+#else
+	if (sensorHeld(&sensor_remaining, sensorLevel(tmp & GUN_BTN_SENSOR, GUN_LATCH_MASK), takeLatched(GUN_LATCH_MASK))) {
+#endif
+		last_read_controller_bytes[0] |= GUN_BTN_SENSOR;
+	}
+#else
+	{
+		unsigned char sreg, hit, peak;
+
+		// take the hit latched since the previous update
+		sreg = SREG;
+		cli();
+		hit = sensor_hit;
+		peak = sensor_peak;
+		sensor_hit = 0;
+		sensor_peak = 0;
+		SREG = sreg;
+
+		// the ADC interrupt already latches
+#ifdef WITH_SHOT_EVENTS
+		if (gunShot(0, trigger_state, hit)) {
+#else
+		if (sensorHeld(&sensor_remaining, hit, hit)) {
+#endif
+			last_read_controller_bytes[0] |= GUN_BTN_SENSOR;
+		}
+		// shaped: weak flashes are expanded
+		last_read_controller_bytes[1] = curve_sensor(peak);
+	}
+#endif
+
 	return 0;
 }
 
@@ -115,9 +570,17 @@ static void gunGetReport(gamepad_data *dst)
 
 		// in this version we compile it as GUN
 		nes_mode = 0;
+		memset(dst->gun.raw_data, 0, GUN_RAW_SIZE);
 		dst->gun.pad_type = PAD_TYPE_GUN;
 		dst->gun.buttons = l;
 		dst->gun.raw_data[0] = l;
+#ifdef WITH_ANALOG_SENSOR
+		// peak intensity above the ambient baseline
+		dst->gun.raw_data[1] = last_read_controller_bytes[1];
+#endif
+#ifdef WITH_SHOT_EVENTS
+		memcpy(dst->gun.raw_data + GUN_RAW_SHOT, shots[0].event, SHOT_EVENT_SIZE);
+#endif
 	}
 	memcpy(last_reported_controller_bytes,
 			last_read_controller_bytes,
@@ -135,3 +598,73 @@ Gamepad *gunGetGamepad(void)
 {
 	return &GunGamepad;
 }
+
+#ifdef GUN_HAVE_GUN2
+/* Second gun: trigger on PD5 and sensor on PD4, always digital. It is
+ * reported with the same bit positions as the first gun. */
+#define GUN2_SHIFT	2
+
+static unsigned char last_read_gun2_byte;
+static unsigned char last_reported_gun2_byte;
+static unsigned char sensor2_remaining;
+static unsigned char trigger2_state, trigger2_count;
+
+static char gun2Update(void)
+{
+	unsigned char tmp;
+
+	tmp = (~GUN_8_BUTTONS_PIN << GUN2_SHIFT);
+	last_read_gun2_byte = debounceTrigger(&trigger2_state, &trigger2_count, tmp & GUN_BTN_TRIGGER);
+
+	// polled by the second wiimote channel, it has its own hold
+#ifdef WITH_SHOT_EVENTS
+	if (gunShot(1, last_read_gun2_byte, sensorLevel(tmp & GUN_BTN_SENSOR, GUN2_LATCH_MASK) | takeLatched(GUN2_LATCH_MASK))) {
+#else
+	if (sensorHeld(&sensor2_remaining, sensorLevel(tmp & GUN_BTN_SENSOR, GUN2_LATCH_MASK), takeLatched(GUN2_LATCH_MASK))) {
+#endif
+		last_read_gun2_byte |= GUN_BTN_SENSOR;
+	}
+
+	return 0;
+}
+
+static char gun2Init(void)
+{
+	// the port is already configured by gunInit
+	gun2Update();
+
+	return 0;
+}
+
+static char gun2Changed(void)
+{
+	return last_read_gun2_byte != last_reported_gun2_byte;
+}
+
+static void gun2GetReport(gamepad_data *dst)
+{
+	if (dst != NULL)
+	{
+		memset(dst->gun.raw_data, 0, GUN_RAW_SIZE);
+		dst->gun.pad_type = PAD_TYPE_GUN;
+		dst->gun.buttons = last_read_gun2_byte;
+		dst->gun.raw_data[0] = last_read_gun2_byte;
+#ifdef WITH_SHOT_EVENTS
+		memcpy(dst->gun.raw_data + GUN_RAW_SHOT, shots[1].event, SHOT_EVENT_SIZE);
+#endif
+	}
+	last_reported_gun2_byte = last_read_gun2_byte;
+}
+
+static Gamepad Gun2Gamepad = {
+	.init		= gun2Init,
+	.update		= gun2Update,
+	.changed	= gun2Changed,
+	.getReport	= gun2GetReport
+};
+
+Gamepad *gun2GetGamepad(void)
+{
+	return &Gun2Gamepad;
+}
+#endif
@@ -1,3 +1,57 @@
+#ifndef _gun_h__
+#define _gun_h__
+
 #include "gamepads.h"
+#include "timebase.h"
+
+/* Delay A (see main loop) is counted in small steps so that each
+ * channel keeps its own phase when several Wiimotes poll independently.
+ * 46 steps plus loop overhead is about 2.35ms. DELAY_A_TICKS is the
+ * default, the profiles can change it. */
+#define DELAY_TICK_US			50
+#define DELAY_A_TICKS			46
+
+/* Timing settings for a game, stored in EEPROM (see eeprom.h) */
+struct gun_profile {
+	unsigned char delay_a_ticks; // sample phase: ticks from the poll to the sample (see main.c)
+	unsigned char sensor_hold; // polls the sensor stays reported, 0: not latched (see sensor_profiles.h). Not with shot events, see shot.h
+	unsigned char trigger_debounce; // extra polls a trigger change must last, 0: reported at once
+	unsigned char reserved; // 0, keeps the EEPROM layout. The report format is always the console's choice (register 0xFE)
+};
+
+/* The sensor of the first gun can be characterised by the calibration
+ * mode (see calib.c), timed with the time base. The pulse filter it
+ * sets applies to the sensors of both guns. Not with the analog
+ * sensor, which has its own threshold. */
+#if defined(PCMSK2) && defined(HAVE_TIMEBASE) && !defined(WITH_ANALOG_SENSOR)
+#define GUN_SENSOR_CALIB
+#endif
+
+/* Measured by the calibration mode, in microseconds. Stored in EEPROM. */
+struct sensor_calib {
+	unsigned short confirm_us; // a flash is latched if still seen this long after it starts, 0: at once
+	unsigned short width_min, width_avg; // flash, first edge to the sensor going dark
+	unsigned short rise_max; // first edge to the sensor staying lit
+	unsigned short period_avg, jitter; // from one flash to the next
+	unsigned short noise_max; // longest pulse seen without a flash
+};
 
 Gamepad *gunGetGamepad(void);
+
+// sensor hold and debounce, for both guns
+void gunSetProfile(const struct gun_profile *profile);
+
+// sensor filter, for both guns
+void gunSetCalibration(const struct sensor_calib *calib);
+
+/* A second gun (trigger on PD5, sensor on PD4) for the second Wiimote
+ * channel, served by the software slave or by the second TWI unit. */
+#if defined(WITH_SOFT_TWI) || defined(WITH_DUAL_TWI)
+#define GUN_HAVE_GUN2
+#endif
+
+#ifdef GUN_HAVE_GUN2
+Gamepad *gun2GetGamepad(void);
+#endif
+
+#endif // _gun_h__
@@ -0,0 +1,232 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "model.h"
+
+#define MAX_DISPLAYS	32
+
+static void usage(void)
+{
+	printf("Usage: ./hitwindow [options]\n");
+	printf("\n");
+	printf("Models the display lag, the poll cadence and the sensor sampling of the\n");
+	printf("firmware, and finds for each display how many polls the sensor should\n");
+	printf("stay reported after a flash.\n");
+	printf("\n");
+	printf("  -D file    Display profiles (default: displays.txt)\n");
+	printf("  -c frames  Frames the game checks the sensor for (default: 6)\n");
+	printf("  -T frames  Frames the target is shown for (default: 1)\n");
+	printf("  -O ms      Frame start to the frame being sent, for every display\n");
+	printf("             (default: out_ms of displays.txt)\n");
+	printf("  -r ms      Frame start to the game reading the gun (default: 0)\n");
+	printf("  -p ms      Poll period (default: 5)\n");
+	printf("  -a ms      Delay A (default: 2.35)\n");
+	printf("  -S pct     Highest acceptable spill to the next target (default: 1)\n");
+	printf("  -n trials  Shots per display (default: 100000)\n");
+	printf("  -s seed    Random seed (default: 1)\n");
+	printf("  -v         Print the results for every hold\n");
+	printf("  -o file    Write the holds as a header for the firmware\n");
+	printf("  -h         Prints this help\n");
+}
+
+static double pct(uint64_t n, uint64_t total)
+{
+	return total ? 100.0 * n / total : 0;
+}
+
+static void printHolds(const struct model_result *r)
+{
+	int h;
+
+	printf("   hold:");
+	for (h = 0; h <= MODEL_MAX_HOLD; h++)
+		printf(" %5d", h);
+	printf("\n    hit:");
+	for (h = 0; h <= MODEL_MAX_HOLD; h++)
+		printf(" %5.1f", pct(r->hits[h], r->trials));
+	printf("\n  spill:");
+	for (h = 0; h <= MODEL_MAX_HOLD; h++)
+		printf(" %5.1f", pct(r->spills[h], r->trials));
+	printf("\n\n");
+}
+
+static int writeHeader(const char *path, const struct display *d, const struct model_result *r,
+					const int *best, int n, const struct game *g, double max_spill)
+{
+	FILE *fp;
+	int i, j;
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	fprintf(fp, "/* Generated by hitwindow. Do not edit, see hitwindow/README.\n");
+	fprintf(fp, " *\n");
+	fprintf(fp, " * Polls the light sensor stays reported after a flash, per display.\n");
+	fprintf(fp, " * 0: not latched, the sensor is read when the gun is sampled.\n");
+	fprintf(fp, " * Model: %.2f ms polls, %d frame check window, %d frame target.\n",
+		g->poll_ms, g->check_frames, g->target_frames);
+	fprintf(fp, " * A display where every hold spills more than %.1f%% is unsupported:\n", max_spill);
+	fprintf(fp, " * its SENSOR_PROFILE_ is not defined, its entry is a placeholder. */\n");
+	fprintf(fp, "#ifndef _sensor_profiles_h__\n");
+	fprintf(fp, "#define _sensor_profiles_h__\n\n");
+
+	for (i = 0; i < n; i++) {
+		char name[MODEL_NAME_LEN];
+
+		for (j = 0; d[i].name[j]; j++)
+			name[j] = toupper((unsigned char)d[i].name[j]);
+		name[j] = 0;
+
+		if (best[i] < 0) {
+			fprintf(fp, "// SENSOR_PROFILE_%s\t%d\tunsupported, hold 0: hit %.1f%%, spill %.1f%%\n",
+				name, i, pct(r[i].hits[0], r[i].trials), pct(r[i].spills[0], r[i].trials));
+			continue;
+		}
+		fprintf(fp, "#define SENSOR_PROFILE_%s\t%d\t// hold %d: hit %.1f%%, spill %.1f%%\n",
+			name, i, best[i], pct(r[i].hits[best[i]], r[i].trials),
+			pct(r[i].spills[best[i]], r[i].trials));
+	}
+	fprintf(fp, "#define SENSOR_NUM_PROFILES\t%d\n\n", n);
+
+	fprintf(fp, "#define SENSOR_PROFILE_HOLDS\t{");
+	for (i = 0; i < n; i++)
+		fprintf(fp, " %d%s", best[i] < 0 ? 0 : best[i], i < n - 1 ? "," : " }\n");
+	fprintf(fp, "\n#endif // _sensor_profiles_h__\n");
+
+	if (fclose(fp)) {
+		perror(path);
+		unlink(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static struct display displays[MAX_DISPLAYS];
+	static struct model_result results[MAX_DISPLAYS];
+	int best[MAX_DISPLAYS];
+	struct game g;
+	const char *displays_file = "displays.txt";
+	const char *out = NULL;
+	double max_spill = 1;
+	double out_ms = -1;
+	int trials = 100000;
+	uint64_t seed = 1;
+	int verbose = 0;
+	int opt, i, n;
+
+	model_defaults(&g);
+
+	while ((opt = getopt(argc, argv, "D:c:T:O:r:p:a:S:n:s:vo:h")) != -1) {
+		int err = 0;
+
+		switch (opt)
+		{
+			case 'D': displays_file = optarg; break;
+			case 'c': g.check_frames = atoi(optarg); err = g.check_frames < 1; break;
+			case 'T': g.target_frames = atoi(optarg); err = g.target_frames < 1; break;
+			case 'O': out_ms = atof(optarg); err = out_ms < 0; break;
+			case 'r': g.read_ms = atof(optarg); break;
+			case 'p': g.poll_ms = atof(optarg); err = g.poll_ms < 1; break;
+			case 'a': g.delay_a_ms = atof(optarg); break;
+			case 'S': max_spill = atof(optarg); break;
+			case 'n': trials = atoi(optarg); err = trials < 1; break;
+			case 's': seed = strtoull(optarg, NULL, 0); break;
+			case 'v': verbose = 1; break;
+			case 'o': out = optarg; break;
+			case 'h': usage(); return 0;
+			default: err = 1; break;
+		}
+		if (err) {
+			usage();
+			return 1;
+		}
+	}
+
+	n = model_loadDisplays(displays_file, displays, MAX_DISPLAYS);
+	if (n < 0)
+		return 1;
+	if (n == 0) {
+		fprintf(stderr, "%s: no displays\n", displays_file);
+		return 1;
+	}
+	if (out_ms >= 0) {
+		for (i = 0; i < n; i++)
+			displays[i].out_ms = out_ms;
+	}
+
+	printf("light: target drawn to the sensor seeing it, in frames.\n");
+	printf("hit: target A saw the light. spill: target B saw it too. hold 0: not latched.\n\n");
+	if (!verbose)
+		printf("%-12s %6s | %5s %6s %6s | %6s %6s\n", "display", "light", "hold", "hit%", "spill%", "level%", "max%");
+
+	for (i = 0; i < n; i++) {
+		struct model_result *r = &results[i];
+		uint64_t max_hits = 0;
+		int h;
+
+		// same seed for every display: the polls and positions are the same
+		model_run(&displays[i], &g, seed, trials, r);
+		best[i] = model_bestHold(r, max_spill / 100);
+
+		for (h = 0; h <= MODEL_MAX_HOLD; h++) {
+			if (r->hits[h] > max_hits)
+				max_hits = r->hits[h];
+		}
+
+		if (verbose) {
+			printf("%s: light %.2f frames, ", displays[i].name, r->light_sum / r->trials / g.frame_ms);
+			if (best[i] < 0)
+				printf("unsupported\n");
+			else
+				printf("best hold %d\n", best[i]);
+			printHolds(r);
+		} else if (best[i] < 0) {
+			printf("%-12s %6.2f | %5s %6s %6s | %6.1f %6.1f\n", displays[i].name,
+				r->light_sum / r->trials / g.frame_ms, "-", "-", "-",
+				pct(r->hits[0], r->trials), pct(max_hits, r->trials));
+		} else {
+			printf("%-12s %6.2f | %5d %6.1f %6.1f | %6.1f %6.1f\n", displays[i].name,
+				r->light_sum / r->trials / g.frame_ms, best[i],
+				pct(r->hits[best[i]], r->trials), pct(r->spills[best[i]], r->trials),
+				pct(r->hits[0], r->trials), pct(max_hits, r->trials));
+		}
+
+		if (best[i] < 0) {
+			fprintf(stderr, "%s: every hold spills to the next target more than %.1f%% of the time, unsupported\n",
+				displays[i].name, max_spill);
+		} else if (pct(max_hits, r->trials) < 50) {
+			fprintf(stderr, "%s: the light arrives too late for a %d frame check window\n",
+				displays[i].name, g.check_frames);
+		}
+	}
+
+	if (out && writeHeader(out, displays, results, best, n, &g, max_spill))
+		return 1;
+
+	return 0;
+}
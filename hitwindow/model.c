@@ -0,0 +1,216 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "model.h"
+#include "../loopsim/rng.h"
+
+#define MAX_POLLS		512
+#define MAX_LIGHTS		16
+#define NEVER			1000000
+
+void model_defaults(struct game *g)
+{
+	g->frame_ms = 1000.0 / 60;
+	g->read_ms = 0;
+	g->scan_frac = 0.93;
+	g->y_min = 0.15;
+	g->y_max = 0.85;
+	g->target_frames = 1;
+	g->check_frames = 6;
+
+	g->poll_ms = 5;
+	g->poll_jitter_ms = 0.05;
+	g->transfer_ms = 1.2;
+	g->delay_a_ms = 2.35;
+}
+
+struct light {
+	double start, end;
+};
+
+static int litAt(const struct light *l, int n, double t)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (t >= l[i].start && t < l[i].end)
+			return 1;
+	}
+	return 0;
+}
+
+static int litDuring(const struct light *l, int n, double from, double to)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (l[i].start < to && l[i].end > from)
+			return 1;
+	}
+	return 0;
+}
+
+/* For the reads of frames first to first+count-1: the smallest distance,
+ * in polls, from a read report to the last sample that caught light. A
+ * hold longer than that shows the light to the game. Level is set when a
+ * read report sampled light directly. */
+static int checkFrames(const struct game *g, const double *polls, int npolls,
+				const int *last_latch, const char *level, int first, int count, int *seen_level)
+{
+	int k, i = 0, best = NEVER;
+
+	for (k = first; k < first + count; k++) {
+		double t = k * g->frame_ms + g->read_ms;
+
+		// latest report available at t: sample i, read by poll i+1
+		while (i + 2 < npolls && polls[i + 2] + g->transfer_ms <= t)
+			i++;
+		if (polls[i + 1] + g->transfer_ms > t)
+			continue;
+
+		if (level[i])
+			*seen_level = 1;
+		if (last_latch[i] >= 0 && i - last_latch[i] < best)
+			best = i - last_latch[i];
+	}
+
+	return best;
+}
+
+void model_run(const struct display *d, const struct game *g, uint64_t seed, int trials, struct model_result *r)
+{
+	static double polls[MAX_POLLS];
+	static int last_latch[MAX_POLLS];
+	static char level[MAX_POLLS];
+	struct light lights[MAX_LIGHTS];
+	struct rng rng;
+	int a = 1, b = 1 + g->check_frames;
+	double end = (b + g->check_frames) * g->frame_ms + g->read_ms;
+	int n, h;
+
+	rng_seed(&rng, seed, 0);
+
+	for (n = 0; n < trials; n++) {
+		double y = rng_range(&rng, g->y_min, g->y_max);
+		double lag = rng_normal(&rng, d->lag_ms, d->lag_sd_ms);
+		double t, prev_sample;
+		int nlights = 0, npolls = 0, i, f;
+		int dist_a, dist_b, level_a = 0, level_b = 0;
+
+		if (lag < 0)
+			lag = 0;
+
+		// the light of target A, once per frame it is shown
+		for (f = a; f < a + g->target_frames && nlights < MAX_LIGHTS; f++) {
+			lights[nlights].start = f * g->frame_ms + d->out_ms + y * g->scan_frac * g->frame_ms + lag + d->rise_ms;
+			lights[nlights].end = lights[nlights].start + d->persist_ms;
+			nlights++;
+		}
+		r->light_sum += lights[0].start - a * g->frame_ms;
+
+		// polls, from well before the trigger frame to the last check
+		t = -3 * g->poll_ms + rng_range(&rng, 0, g->poll_ms);
+		while (t < end && npolls < MAX_POLLS) {
+			polls[npolls++] = t;
+			t += rng_normal(&rng, g->poll_ms, g->poll_jitter_ms);
+		}
+
+		prev_sample = polls[0];
+		for (i = 0; i < npolls; i++) {
+			double sample = polls[i] + g->delay_a_ms;
+
+			level[i] = litAt(lights, nlights, sample);
+			if (litDuring(lights, nlights, prev_sample, sample))
+				last_latch[i] = i;
+			else
+				last_latch[i] = i ? last_latch[i - 1] : -1;
+			prev_sample = sample;
+		}
+
+		dist_a = checkFrames(g, polls, npolls, last_latch, level, a, g->check_frames, &level_a);
+		dist_b = checkFrames(g, polls, npolls, last_latch, level, b, g->check_frames, &level_b);
+
+		r->trials++;
+		r->hits[0] += level_a;
+		r->spills[0] += level_b;
+		for (h = 1; h <= MODEL_MAX_HOLD; h++) {
+			r->hits[h] += dist_a < h;
+			r->spills[h] += dist_b < h;
+		}
+	}
+}
+
+int model_bestHold(const struct model_result *r, double max_spill)
+{
+	uint64_t best_hits = 0;
+	int h, best = -1;
+
+	for (h = 0; h <= MODEL_MAX_HOLD; h++) {
+		if (r->spills[h] > max_spill * r->trials)
+			continue;
+		// a longer hold must do noticeably better
+		if (best < 0 || r->hits[h] > best_hits + r->trials / 1000) {
+			best_hits = r->hits[h];
+			best = h;
+		}
+	}
+
+	return best;
+}
+
+/* One display per line: name out_ms lag_ms lag_sd_ms persist_ms rise_ms */
+int model_loadDisplays(const char *path, struct display *d, int max)
+{
+	char line[256];
+	FILE *fp;
+	int n = 0, lineno = 0;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		char *c = strchr(line, '#');
+		char extra;
+
+		lineno++;
+		if (c)
+			*c = 0;
+		if (strspn(line, " \t\r\n") == strlen(line))
+			continue;
+
+		if (n >= max) {
+			fprintf(stderr, "%s: too many displays\n", path);
+			break;
+		}
+		if (sscanf(line, "%15s %lf %lf %lf %lf %lf %c", d[n].name, &d[n].out_ms, &d[n].lag_ms,
+					&d[n].lag_sd_ms, &d[n].persist_ms, &d[n].rise_ms, &extra) != 6) {
+			fprintf(stderr, "%s:%d: expected name out lag lag_sd persist rise\n", path, lineno);
+			fclose(fp);
+			return -1;
+		}
+		n++;
+	}
+
+	fclose(fp);
+
+	return n;
+}
@@ -0,0 +1,69 @@
+#ifndef _model_h__
+#define _model_h__
+
+#include <stdint.h>
+
+#define MODEL_NAME_LEN		16
+#define MODEL_MAX_HOLD		12
+
+/* What happens to the light of a frame. The console sends it out_ms
+ * after the frame starts. The target area starts to light the sensor
+ * lag_ms after its scan line is sent, plus rise_ms, and stays lit for
+ * persist_ms. A CRT lights a spot for a millisecond or two per frame, an
+ * LCD for the whole frame. */
+struct display {
+	char name[MODEL_NAME_LEN];
+	double out_ms; // console output, and any converter in front of the display
+	double lag_ms, lag_sd_ms; // scaler and processing, per shot
+	double persist_ms;
+	double rise_ms;
+};
+
+/* The console, the game and the firmware. Times in ms.
+ *
+ * The game reads the gun once per frame, read_ms after the frame starts.
+ * The frame is sent top to bottom over scan_frac of the frame, see
+ * struct display for when. One frame after seeing the trigger, the game
+ * draws target A for target_frames frames and checks the sensor for
+ * check_frames frames from the first one. Target B follows, check_frames
+ * later, and is checked the same way.
+ *
+ * The firmware samples delay_a_ms after a poll, and the report is read
+ * by the next poll. See sensorHeld() in gun.c. */
+struct game {
+	double frame_ms;
+	double read_ms;
+	double scan_frac;
+	double y_min, y_max; // target position, fraction of the screen height
+	int target_frames;
+	int check_frames;
+
+	double poll_ms, poll_jitter_ms;
+	double transfer_ms; // poll start to the report being available
+	double delay_a_ms;
+};
+
+void model_defaults(struct game *g);
+
+/* Index 0 is the sensor read at the sample time, without latching.
+ * Index n is the sensor latched between samples and reported for n
+ * polls. */
+struct model_result {
+	uint64_t trials;
+	uint64_t hits[MODEL_MAX_HOLD + 1]; // target A saw the light
+	uint64_t spills[MODEL_MAX_HOLD + 1]; // target B saw it too
+	double light_sum; // trigger frame start to the first light
+};
+
+/* Shoot at target A 'trials' times, aiming away from target B. All the
+ * holds see the same random draws. */
+void model_run(const struct display *d, const struct game *g, uint64_t seed, int trials, struct model_result *r);
+
+/* The shortest hold with the best hit rate, among those reporting light
+ * to target B at most max_spill of the time. -1 if none qualifies: the
+ * display is not supported. */
+int model_bestHold(const struct model_result *r, double max_spill);
+
+int model_loadDisplays(const char *path, struct display *d, int max);
+
+#endif // _model_h__
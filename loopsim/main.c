@@ -0,0 +1,301 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "sim.h"
+#include "pool.h"
+
+#define MAX_VALUES	256
+
+struct task {
+	const struct sim_params *params;
+	uint64_t seed;
+	uint64_t stream;
+	struct sim_result *result;
+	int failed;
+};
+
+/* "a,b,c" or "first:last:step" */
+static int parseList(const char *s, double *values)
+{
+	double first, last, step;
+	int n = 0;
+
+	if (sscanf(s, "%lf:%lf:%lf", &first, &last, &step) == 3 && step > 0) {
+		for (; first <= last + step / 1000 && n < MAX_VALUES; first += step)
+			values[n++] = first;
+		return n;
+	}
+
+	while (*s && n < MAX_VALUES) {
+		char *e;
+
+		values[n++] = strtod(s, &e);
+		if (e == s)
+			return -1;
+		s = *e == ',' ? e + 1 : e;
+	}
+
+	return n;
+}
+
+/* Fill up to n doubles from "a,b,c". Missing ones keep their value. */
+static int parseFields(const char *s, double **fields, int n)
+{
+	double v[MAX_VALUES];
+	int i, got = parseList(s, v);
+
+	if (got < 0 || got > n)
+		return -1;
+	for (i = 0; i < got; i++)
+		*fields[i] = v[i];
+	return 0;
+}
+
+static void runTask(void *arg)
+{
+	struct task *t = arg;
+
+	t->failed = sim_run(t->params, t->seed, t->stream, t->result);
+}
+
+static void usage(void)
+{
+	printf("Usage: ./loopsim [options]\n");
+	printf("\n");
+	printf("Simulates the main loop scheduling (delay A, gun sampling, report update)\n");
+	printf("against Wiimote polls, and reports input latency and missed events.\n");
+	printf("\n");
+	printf("Sweep (lists: a,b,c or first:last:step):\n");
+	printf("  -f MHz     CPU clock (default: 12)\n");
+	printf("  -d ticks   Delay A, in %g us ticks (default: 46)\n", 50.0);
+	printf("  -p ms      Poll period (default: 5)\n");
+	printf("\n");
+	printf("Model:\n");
+	printf("  -J ms      Poll period jitter, standard deviation (default: 0.05)\n");
+	printf("  -m list    Transfer durations in ms: menu,menu_sd,game,game_sd,write\n");
+	printf("             (default: 1.2,0.05,1.5,0.1,0.15)\n");
+	printf("  -g frac    Fraction of the time in game (default: 0.8)\n");
+	printf("  -c list    Cycles: gun,classic,pack,newaction,isr_per_byte,tick_overhead\n");
+	printf("             (default: 60,350,450,200,90,40)\n");
+	printf("  -e list    Events in ms: trigger_interval,min,max,sensor_interval,min,max\n");
+	printf("             (default: 500,30,150,700,1,17)\n");
+	printf("\n");
+	printf("Run:\n");
+	printf("  -t sec     Simulated time per task (default: 30)\n");
+	printf("  -n tasks   Tasks per configuration (default: 16)\n");
+	printf("  -j n       Threads (default: one per CPU)\n");
+	printf("  -s seed    Random seed (default: 1)\n");
+	printf("  -o csv     Output format: table or csv (default: table)\n");
+	printf("\n");
+	printf("Example: ./loopsim -f 8,12 -d 0:60:4 -p 5,16.7\n");
+}
+
+static void printTable(const struct sim_params *p, const struct sim_result *r, int header)
+{
+	if (header) {
+		printf("%5s %6s %5s %7s | %7s %7s | %7s %7s %6s | %7s %7s %6s | %6s %6s %6s %6s\n",
+			"MHz", "period", "ticks", "delayA",
+			"age50", "age99",
+			"trig50", "trig99", "miss%",
+			"sens50", "sens99", "miss%",
+			"torn%", "stale%", "rest%", "late%");
+	}
+
+	printf("%5.1f %6.2f %5d %7.3f | %7.3f %7.3f | %7.3f %7.3f %6.2f | %7.3f %7.3f %6.2f | %6.2f %6.2f %6.2f %6.2f\n",
+		p->f_cpu / 1e6, p->poll_period_ms, p->delay_ticks,
+		r->delay_a_count ? r->delay_a_sum / r->delay_a_count * 1e3 : 0,
+		sim_histPct(&r->age, 50) * 1e3, sim_histPct(&r->age, 99) * 1e3,
+		sim_histPct(&r->trig_latency, 50) * 1e3, sim_histPct(&r->trig_latency, 99) * 1e3,
+		r->trig_events ? 100.0 * r->trig_missed / r->trig_events : 0,
+		sim_histPct(&r->sensor_latency, 50) * 1e3, sim_histPct(&r->sensor_latency, 99) * 1e3,
+		r->sensor_events ? 100.0 * r->sensor_missed / r->sensor_events : 0,
+		r->polls ? 100.0 * r->torn / r->polls : 0,
+		r->polls ? 100.0 * r->stale / r->polls : 0,
+		r->polls ? 100.0 * r->restarts / r->polls : 0,
+		r->polls ? 100.0 * r->late_wakes / r->polls : 0);
+}
+
+static void printCsv(const struct sim_params *p, const struct sim_result *r, int header)
+{
+	if (header) {
+		printf("mhz,period_ms,ticks,delay_a_ms,age_p50_ms,age_p99_ms,"
+			"trig_p50_ms,trig_p99_ms,trig_events,trig_missed,"
+			"sensor_p50_ms,sensor_p99_ms,sensor_events,sensor_missed,"
+			"polls,torn,stale,restarts,late_wakes\n");
+	}
+
+	printf("%g,%g,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%llu,%llu,%.4f,%.4f,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+		p->f_cpu / 1e6, p->poll_period_ms, p->delay_ticks,
+		r->delay_a_count ? r->delay_a_sum / r->delay_a_count * 1e3 : 0,
+		sim_histPct(&r->age, 50) * 1e3, sim_histPct(&r->age, 99) * 1e3,
+		sim_histPct(&r->trig_latency, 50) * 1e3, sim_histPct(&r->trig_latency, 99) * 1e3,
+		(unsigned long long)r->trig_events, (unsigned long long)r->trig_missed,
+		sim_histPct(&r->sensor_latency, 50) * 1e3, sim_histPct(&r->sensor_latency, 99) * 1e3,
+		(unsigned long long)r->sensor_events, (unsigned long long)r->sensor_missed,
+		(unsigned long long)r->polls, (unsigned long long)r->torn,
+		(unsigned long long)r->stale, (unsigned long long)r->restarts,
+		(unsigned long long)r->late_wakes);
+}
+
+int main(int argc, char **argv)
+{
+	struct sim_params base, *configs;
+	struct sim_result *results, *merged;
+	struct task *tasks;
+	struct pool pool;
+	struct timespec t0, t1;
+	double mhz[MAX_VALUES] = { 12 }, ticks[MAX_VALUES] = { 46 }, periods[MAX_VALUES] = { 5 };
+	int num_mhz = 1, num_ticks = 1, num_periods = 1;
+	int tasks_per_config = 16;
+	int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t seed = 1;
+	int csv = 0;
+	int opt, i, j, k, n, num_configs, num_tasks, failed = 0;
+
+	sim_defaults(&base);
+
+	while ((opt = getopt(argc, argv, "f:d:p:J:m:g:c:e:t:n:j:s:o:h")) != -1) {
+		int err = 0;
+
+		switch (opt)
+		{
+			case 'f': err = (num_mhz = parseList(optarg, mhz)) < 1; break;
+			case 'd': err = (num_ticks = parseList(optarg, ticks)) < 1; break;
+			case 'p': err = (num_periods = parseList(optarg, periods)) < 1; break;
+			case 'J': base.poll_jitter_ms = atof(optarg); break;
+			case 'g': base.game_fraction = atof(optarg); break;
+			case 'm':
+				{
+					double *f[] = { &base.menu_ms, &base.menu_sd_ms, &base.game_ms,
+									&base.game_sd_ms, &base.write_ms };
+					err = parseFields(optarg, f, 5);
+				}
+				break;
+			case 'c':
+				{
+					double v[6] = { base.gun_cycles, base.classic_cycles, base.pack_cycles,
+									base.newaction_cycles, base.isr_cycles, base.tick_cycles };
+					double *f[] = { &v[0], &v[1], &v[2], &v[3], &v[4], &v[5] };
+
+					err = parseFields(optarg, f, 6);
+					base.gun_cycles = v[0];
+					base.classic_cycles = v[1];
+					base.pack_cycles = v[2];
+					base.newaction_cycles = v[3];
+					base.isr_cycles = v[4];
+					base.tick_cycles = v[5];
+				}
+				break;
+			case 'e':
+				{
+					double *f[] = { &base.trig_interval_ms, &base.trig_min_ms, &base.trig_max_ms,
+									&base.sensor_interval_ms, &base.sensor_min_ms, &base.sensor_max_ms };
+					err = parseFields(optarg, f, 6);
+				}
+				break;
+			case 't': base.duration_s = atof(optarg); err = base.duration_s < 1; break;
+			case 'n': tasks_per_config = atoi(optarg); err = tasks_per_config < 1; break;
+			case 'j': nthreads = atoi(optarg); err = nthreads < 1; break;
+			case 's': seed = strtoull(optarg, NULL, 0); break;
+			case 'o': csv = !strcmp(optarg, "csv"); break;
+			default: err = 1; break;
+		}
+		if (err) {
+			usage();
+			return 1;
+		}
+	}
+
+	num_configs = num_mhz * num_ticks * num_periods;
+	num_tasks = num_configs * tasks_per_config;
+
+	configs = calloc(num_configs, sizeof(struct sim_params));
+	merged = calloc(num_configs, sizeof(struct sim_result));
+	results = calloc(num_tasks, sizeof(struct sim_result));
+	tasks = calloc(num_tasks, sizeof(struct task));
+	if (!configs || !merged || !results || !tasks) {
+		perror("calloc");
+		return 1;
+	}
+
+	n = 0;
+	for (i = 0; i < num_mhz; i++) {
+		for (j = 0; j < num_periods; j++) {
+			for (k = 0; k < num_ticks; k++) {
+				configs[n] = base;
+				configs[n].f_cpu = mhz[i] * 1e6;
+				configs[n].poll_period_ms = periods[j];
+				configs[n].delay_ticks = ticks[k];
+				n++;
+			}
+		}
+	}
+
+	if (pool_init(&pool, nthreads))
+		return 1;
+
+	// The stream depends on the poll period and the task number only:
+	// every clock and delay value sees the same polls and events.
+	for (i = 0; i < num_configs; i++) {
+		for (j = 0; j < tasks_per_config; j++) {
+			struct task *t = &tasks[i * tasks_per_config + j];
+
+			t->params = &configs[i];
+			t->seed = seed;
+			t->stream = ((uint64_t)(configs[i].poll_period_ms * 1000) << 20) + j;
+			t->result = &results[i * tasks_per_config + j];
+			pool_add(&pool, runTask, t);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	pool_run(&pool);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	fprintf(stderr, "%d tasks, %.0f s simulated in %.2f s, %d threads, %lu steals\n",
+		num_tasks, num_tasks * base.duration_s,
+		(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9, nthreads, pool.steals);
+
+	for (i = 0; i < num_tasks; i++) {
+		failed |= tasks[i].failed;
+		sim_merge(&merged[i / tasks_per_config], &results[i]);
+	}
+
+	if (!csv) {
+		printf("Times in ms. age: sample to the read delivering it. trig/sens: input latency, "
+			"event start to the read reporting it.\n");
+	}
+	for (i = 0; i < num_configs; i++) {
+		if (csv)
+			printCsv(&configs[i], &merged[i], i == 0);
+		else
+			printTable(&configs[i], &merged[i], i == 0);
+	}
+
+	pool_free(&pool);
+	free(tasks);
+	free(results);
+	free(merged);
+	free(configs);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,171 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+struct pool_worker {
+	struct pool *p;
+	int id;
+	unsigned long steals;
+};
+
+int pool_init(struct pool *p, int num_workers)
+{
+	int i;
+
+	memset(p, 0, sizeof(struct pool));
+	p->num_workers = num_workers;
+	p->deques = calloc(num_workers, sizeof(struct pool_deque));
+	if (!p->deques) {
+		perror("calloc");
+		return -1;
+	}
+
+	for (i = 0; i < num_workers; i++)
+		pthread_mutex_init(&p->deques[i].lock, NULL);
+
+	return 0;
+}
+
+int pool_add(struct pool *p, void (*func)(void *arg), void *arg)
+{
+	struct pool_deque *d = &p->deques[p->next_push];
+
+	p->next_push = (p->next_push + 1) % p->num_workers;
+
+	if (d->tail == d->cap) {
+		int cap = d->cap ? d->cap * 2 : 64;
+		struct pool_task *t = realloc(d->tasks, cap * sizeof(struct pool_task));
+
+		if (!t) {
+			perror("realloc");
+			return -1;
+		}
+		d->tasks = t;
+		d->cap = cap;
+	}
+	d->tasks[d->tail].func = func;
+	d->tasks[d->tail].arg = arg;
+	d->tail++;
+
+	return 0;
+}
+
+static int pool_popBottom(struct pool_deque *d, struct pool_task *t)
+{
+	int ok = 0;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->tail > d->head) {
+		*t = d->tasks[--d->tail];
+		ok = 1;
+	}
+	pthread_mutex_unlock(&d->lock);
+
+	return ok;
+}
+
+static int pool_stealTop(struct pool_deque *d, struct pool_task *t)
+{
+	int ok = 0;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->tail > d->head) {
+		*t = d->tasks[d->head++];
+		ok = 1;
+	}
+	pthread_mutex_unlock(&d->lock);
+
+	return ok;
+}
+
+static void *pool_worker(void *arg)
+{
+	struct pool_worker *w = arg;
+	struct pool *p = w->p;
+	struct pool_task t = { NULL, NULL };
+	int i, victim;
+
+	while (1)
+	{
+		if (pool_popBottom(&p->deques[w->id], &t)) {
+			t.func(t.arg);
+			continue;
+		}
+
+		// Own deque empty: try the others, starting with the next one.
+		// No task is ever added while running, so when every deque is
+		// empty the work is done.
+		for (i = 1; i < p->num_workers; i++) {
+			victim = (w->id + i) % p->num_workers;
+			if (pool_stealTop(&p->deques[victim], &t))
+				break;
+		}
+		if (i == p->num_workers)
+			break;
+
+		w->steals++;
+		t.func(t.arg);
+	}
+
+	return NULL;
+}
+
+void pool_run(struct pool *p)
+{
+	pthread_t threads[p->num_workers];
+	struct pool_worker workers[p->num_workers];
+	int i;
+
+	for (i = 0; i < p->num_workers; i++) {
+		workers[i].p = p;
+		workers[i].id = i;
+		workers[i].steals = 0;
+	}
+
+	// worker 0 is this thread
+	for (i = 1; i < p->num_workers; i++) {
+		if (pthread_create(&threads[i], NULL, pool_worker, &workers[i])) {
+			perror("pthread_create");
+			// its tasks will be stolen by the others
+			workers[i].p = NULL;
+		}
+	}
+	pool_worker(&workers[0]);
+
+	for (i = 1; i < p->num_workers; i++) {
+		if (workers[i].p)
+			pthread_join(threads[i], NULL);
+	}
+
+	for (i = 0; i < p->num_workers; i++)
+		p->steals += workers[i].steals;
+}
+
+void pool_free(struct pool *p)
+{
+	int i;
+
+	for (i = 0; i < p->num_workers; i++) {
+		pthread_mutex_destroy(&p->deques[i].lock);
+		free(p->deques[i].tasks);
+	}
+	free(p->deques);
+}
@@ -0,0 +1,37 @@
+#ifndef _pool_h__
+#define _pool_h__
+
+#include <pthread.h>
+
+/* Work-stealing thread pool. Each worker has its own deque: it takes its
+ * tasks from the bottom, and when it runs out, steals from the top of the
+ * other deques. Tasks are queued before pool_run and do not spawn other
+ * tasks. */
+struct pool_task {
+	void (*func)(void *arg);
+	void *arg;
+};
+
+struct pool_deque {
+	pthread_mutex_t lock;
+	struct pool_task *tasks;
+	int head, tail; // head: steal end, tail: owner end
+	int cap;
+};
+
+struct pool {
+	int num_workers;
+	struct pool_deque *deques;
+	int next_push;
+
+	// statistics
+	unsigned long steals;
+};
+
+int pool_init(struct pool *p, int num_workers);
+int pool_add(struct pool *p, void (*func)(void *arg), void *arg);
+/* Run all the queued tasks and wait for them. */
+void pool_run(struct pool *p);
+void pool_free(struct pool *p);
+
+#endif // _pool_h__
@@ -0,0 +1,87 @@
+#ifndef _rng_h__
+#define _rng_h__
+
+#include <stdint.h>
+#include <math.h>
+
+/* xoshiro256** seeded with splitmix64. Every task seeds its own
+ * generator from the global seed and the task number, so results do not
+ * depend on which thread runs what. */
+struct rng {
+	uint64_t s[4];
+};
+
+static inline uint64_t rng_splitmix(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static inline void rng_seed(struct rng *r, uint64_t seed, uint64_t stream)
+{
+	uint64_t x = seed ^ (stream * 0xd1342543de82ef95ULL);
+	int i;
+
+	for (i = 0; i < 4; i++)
+		r->s[i] = rng_splitmix(&x);
+}
+
+static inline uint64_t rng_rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(struct rng *r)
+{
+	uint64_t *s = r->s;
+	uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rng_rotl(s[3], 45);
+
+	return result;
+}
+
+// [0, 1)
+static inline double rng_uniform(struct rng *r)
+{
+	return (rng_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline double rng_range(struct rng *r, double lo, double hi)
+{
+	return lo + (hi - lo) * rng_uniform(r);
+}
+
+static inline double rng_exp(struct rng *r, double mean)
+{
+	return -mean * log(1.0 - rng_uniform(r));
+}
+
+// Normal distribution, clipped to 3 standard deviations
+static inline double rng_normal(struct rng *r, double mean, double sd)
+{
+	double u, v, s;
+
+	do {
+		u = rng_uniform(r) * 2 - 1;
+		v = rng_uniform(r) * 2 - 1;
+		s = u * u + v * v;
+	} while (s >= 1 || s == 0);
+
+	s = u * sqrt(-2 * log(s) / s);
+	if (s > 3) s = 3;
+	if (s < -3) s = -3;
+
+	return mean + sd * s;
+}
+
+#endif // _rng_h__
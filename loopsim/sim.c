@@ -0,0 +1,474 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "rng.h"
+
+/* Nothing is measured before this, so that the loop is in its steady
+ * state, nor in the last 200ms where events could not be reported. */
+#define SIM_WARMUP		0.05
+#define SIM_TAIL		0.2
+
+void sim_defaults(struct sim_params *p)
+{
+	memset(p, 0, sizeof(struct sim_params));
+
+	p->f_cpu = 12000000;
+
+	// Wii, classic controller (see the diagram in main.c)
+	p->poll_period_ms = 5;
+	p->poll_jitter_ms = 0.05;
+	p->write_ms = 0.15;
+	p->menu_ms = 1.2;
+	p->menu_sd_ms = 0.05;
+	p->game_ms = 1.5;
+	p->game_sd_ms = 0.1;
+	p->game_fraction = 0.8;
+	p->mode_mean_s = 10;
+	p->bus_bytes = 25;
+
+	p->delay_ticks = 46;
+	p->tick_us = 50;
+	p->tick_cycles = 40;
+	p->wake_cycles = 20;
+	p->isr_cycles = 90;
+	p->gun_cycles = 60;
+	p->classic_cycles = 350;
+	p->pack_cycles = 450;
+	p->newaction_cycles = 200;
+
+	p->trig_interval_ms = 500;
+	p->trig_min_ms = 30;
+	p->trig_max_ms = 150;
+	p->sensor_interval_ms = 700;
+	p->sensor_min_ms = 1;
+	p->sensor_max_ms = 17;
+
+	p->duration_s = 30;
+}
+
+void sim_histAdd(struct sim_hist *h, double seconds)
+{
+	long b = seconds * (1e6 / SIM_HIST_US);
+
+	if (b < 0)
+		b = 0;
+	h->count++;
+	h->sum += seconds;
+	if (b >= SIM_HIST_BINS)
+		h->over++;
+	else
+		h->bins[b]++;
+}
+
+double sim_histPct(const struct sim_hist *h, double p)
+{
+	uint64_t target, n = 0;
+	int b;
+
+	if (!h->count)
+		return 0;
+
+	target = p / 100.0 * h->count;
+	if (target >= h->count)
+		target = h->count - 1;
+
+	for (b = 0; b < SIM_HIST_BINS; b++) {
+		n += h->bins[b];
+		if (n > target)
+			return (b + 0.5) * SIM_HIST_US * 1e-6;
+	}
+	return SIM_HIST_BINS * SIM_HIST_US * 1e-6;
+}
+
+static void sim_histMerge(struct sim_hist *into, const struct sim_hist *h)
+{
+	int b;
+
+	into->count += h->count;
+	into->over += h->over;
+	into->sum += h->sum;
+	for (b = 0; b < SIM_HIST_BINS; b++)
+		into->bins[b] += h->bins[b];
+}
+
+void sim_merge(struct sim_result *into, const struct sim_result *r)
+{
+	sim_histMerge(&into->age, &r->age);
+	sim_histMerge(&into->trig_latency, &r->trig_latency);
+	sim_histMerge(&into->sensor_latency, &r->sensor_latency);
+
+	into->trig_events += r->trig_events;
+	into->trig_missed += r->trig_missed;
+	into->sensor_events += r->sensor_events;
+	into->sensor_missed += r->sensor_missed;
+	into->polls += r->polls;
+	into->samples += r->samples;
+	into->torn += r->torn;
+	into->stale += r->stale;
+	into->restarts += r->restarts;
+	into->late_wakes += r->late_wakes;
+	into->delay_a_sum += r->delay_a_sum;
+	into->delay_a_count += r->delay_a_count;
+}
+
+/***** Bus activity *****/
+
+struct sim_poll {
+	double p; // transfer start
+	double q; // report read start: pollfunc
+	double e; // transfer end
+	double irq_step; // time between ISRs
+	double speed; // main loop speed left by the ISRs
+};
+
+struct sim_sample {
+	double s; // gunUpdate
+	double u; // wm_newaction starts
+	double r; // report ready
+};
+
+struct sim_ctx {
+	const struct sim_params *prm;
+	struct rng rng;
+
+	struct sim_poll *polls;
+	int num_polls;
+	int win; // first transfer not over, for sim_advance
+
+	struct sim_sample *samples;
+	int num_samples, cap_samples;
+};
+
+static int sim_genPolls(struct sim_ctx *c)
+{
+	const struct sim_params *p = c->prm;
+	double t = SIM_WARMUP / 2, next_change, dur;
+	int in_game, cap, n = 0;
+
+	cap = p->duration_s / (p->poll_period_ms * 1e-3) * 1.1 + 16;
+	c->polls = malloc(cap * sizeof(struct sim_poll));
+	if (!c->polls) {
+		perror("malloc");
+		return -1;
+	}
+
+	in_game = rng_uniform(&c->rng) < p->game_fraction;
+	next_change = rng_exp(&c->rng, p->mode_mean_s);
+
+	while (t < p->duration_s) {
+		struct sim_poll *pl;
+
+		if (n == cap) {
+			struct sim_poll *np;
+
+			cap *= 2;
+			np = realloc(c->polls, cap * sizeof(struct sim_poll));
+			if (!np) {
+				perror("realloc");
+				return -1;
+			}
+			c->polls = np;
+		}
+		pl = &c->polls[n++];
+
+		if (t >= next_change) {
+			in_game = rng_uniform(&c->rng) < p->game_fraction;
+			next_change = t + rng_exp(&c->rng, p->mode_mean_s);
+		}
+
+		if (in_game)
+			dur = rng_normal(&c->rng, p->game_ms, p->game_sd_ms) * 1e-3;
+		else
+			dur = rng_normal(&c->rng, p->menu_ms, p->menu_sd_ms) * 1e-3;
+		if (dur < p->write_ms * 1e-3 + 50e-6)
+			dur = p->write_ms * 1e-3 + 50e-6;
+
+		pl->p = t;
+		pl->q = t + p->write_ms * 1e-3;
+		pl->e = t + dur;
+		pl->irq_step = dur / p->bus_bytes;
+		pl->speed = 1.0 - p->isr_cycles * p->bus_bytes / p->f_cpu / dur;
+		if (pl->speed < 0.05)
+			pl->speed = 0.05;
+
+		t += rng_normal(&c->rng, p->poll_period_ms, p->poll_jitter_ms) * 1e-3;
+		if (t < pl->e + 20e-6)
+			t = pl->e + 20e-6;
+	}
+	c->num_polls = n;
+
+	return 0;
+}
+
+/* Time when the main loop is done executing 'cycles' from t, with the
+ * ISRs taking their share while the bus is busy. */
+static double sim_advance(struct sim_ctx *c, double t, double cycles)
+{
+	double left = cycles / c->prm->f_cpu;
+
+	while (left > 0) {
+		const struct sim_poll *w;
+		double room;
+
+		while (c->win < c->num_polls && c->polls[c->win].e <= t)
+			c->win++;
+		if (c->win >= c->num_polls)
+			return t + left;
+		w = &c->polls[c->win];
+
+		if (t < w->p) {
+			if (t + left <= w->p)
+				return t + left;
+			left -= w->p - t;
+			t = w->p;
+		}
+
+		room = (w->e - t) * w->speed;
+		if (left <= room)
+			return t + left / w->speed;
+		left -= room;
+		t = w->e;
+	}
+
+	return t;
+}
+
+/* Next TWI interrupt after t, to wake the CPU from sleep */
+static double sim_nextIrq(struct sim_ctx *c, double t)
+{
+	int i = c->win;
+	const struct sim_poll *w;
+	double k;
+
+	while (i < c->num_polls && c->polls[i].e <= t)
+		i++;
+	if (i >= c->num_polls)
+		return -1;
+	w = &c->polls[i];
+
+	if (t < w->p)
+		return w->p + w->irq_step;
+
+	k = (long)((t - w->p) / w->irq_step) + 1;
+	return w->p + k * w->irq_step;
+}
+
+static int sim_addSample(struct sim_ctx *c, double s, double u, double r)
+{
+	if (c->num_samples == c->cap_samples) {
+		int cap = c->cap_samples ? c->cap_samples * 2 : 4096;
+		struct sim_sample *ns = realloc(c->samples, cap * sizeof(struct sim_sample));
+
+		if (!ns) {
+			perror("realloc");
+			return -1;
+		}
+		c->samples = ns;
+		c->cap_samples = cap;
+	}
+	c->samples[c->num_samples].s = s;
+	c->samples[c->num_samples].u = u;
+	c->samples[c->num_samples].r = r;
+	c->num_samples++;
+
+	return 0;
+}
+
+/* The main loop of main.c, one channel */
+static int sim_mainLoop(struct sim_ctx *c, struct sim_result *res)
+{
+	const struct sim_params *p = c->prm;
+	double tick = p->tick_us * 1e-6 * p->f_cpu + p->tick_cycles;
+	double compute = p->gun_cycles + p->classic_cycles + p->pack_cycles;
+	double t = 0, delay_start = 0, s, u;
+	int next = 0; // first poll not seen by the main loop yet
+	int sample_due = 0;
+
+	while (next < c->num_polls) {
+		if (!sample_due) {
+			if (c->polls[next].q <= t) {
+				// performupdate was set while we were busy, but
+				// sleep_cpu() waits for the next interrupt anyway
+				t = sim_nextIrq(c, t);
+				if (t < 0)
+					break;
+				if (t > SIM_WARMUP)
+					res->late_wakes++;
+			}
+			else {
+				t = c->polls[next].q;
+			}
+			t = sim_advance(c, t, p->wake_cycles);
+		}
+
+		// waitSampleTime()
+		while (1) {
+			if (next < c->num_polls && c->polls[next].q <= t) {
+				if (sample_due > 1 && t > SIM_WARMUP)
+					res->restarts++;
+				while (next < c->num_polls && c->polls[next].q <= t)
+					next++;
+				sample_due = p->delay_ticks + 1;
+				delay_start = t;
+			}
+			if (sample_due == 1) {
+				sample_due = 0;
+				break;
+			}
+			t = sim_advance(c, t, tick);
+			if (sample_due > 1)
+				sample_due--;
+		}
+
+		s = t;
+		if (s > SIM_WARMUP) {
+			res->delay_a_sum += s - delay_start;
+			res->delay_a_count++;
+		}
+		u = sim_advance(c, s, compute);
+		t = sim_advance(c, u, p->newaction_cycles);
+
+		if (sim_addSample(c, s, u, t))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Sample time of the report each poll delivers, -1 if none yet */
+static double *sim_deliveries(struct sim_ctx *c, struct sim_result *res)
+{
+	double *ds = malloc(c->num_polls * sizeof(double));
+	int j, k = -1, last_k = -2, t;
+
+	if (!ds) {
+		perror("malloc");
+		return NULL;
+	}
+
+	for (j = 0; j < c->num_polls; j++) {
+		const struct sim_poll *w = &c->polls[j];
+
+		while (k + 1 < c->num_samples && c->samples[k + 1].r <= w->q)
+			k++;
+		ds[j] = k >= 0 ? c->samples[k].s : -1;
+
+		if (w->p < SIM_WARMUP || w->p > c->prm->duration_s - SIM_TAIL)
+			continue;
+
+		res->polls++;
+		if (k == last_k)
+			res->stale++;
+		if (k >= 0)
+			sim_histAdd(&res->age, w->q - c->samples[k].s);
+
+		// a copy overlapping the read
+		for (t = k + 1; t < c->num_samples && c->samples[t].u < w->e; t++) {
+			if (c->samples[t].r > w->q) {
+				res->torn++;
+				break;
+			}
+		}
+		last_k = k;
+	}
+
+	return ds;
+}
+
+/* First poll delivering a sample taken after 'start' */
+static int sim_firstAfter(const double *ds, int n, double start)
+{
+	int lo = 0, hi = n;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (ds[mid] < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void sim_events(struct sim_ctx *c, const double *ds, double interval_ms,
+	double min_ms, double max_ms, uint64_t *events, uint64_t *missed, struct sim_hist *lat)
+{
+	const struct sim_params *p = c->prm;
+	double t = SIM_WARMUP;
+
+	while (1) {
+		double start, end;
+		int j;
+
+		t += rng_exp(&c->rng, interval_ms * 1e-3);
+		if (t > p->duration_s - SIM_TAIL)
+			break;
+
+		start = t;
+		end = t + rng_range(&c->rng, min_ms, max_ms) * 1e-3;
+
+		(*events)++;
+		j = sim_firstAfter(ds, c->num_polls, start);
+		if (j < c->num_polls && ds[j] < end) {
+			sim_histAdd(lat, c->polls[j].q - start);
+		}
+		else {
+			(*missed)++;
+		}
+	}
+}
+
+int sim_run(const struct sim_params *p, uint64_t seed, uint64_t stream, struct sim_result *r)
+{
+	struct sim_ctx c;
+	double *ds = NULL;
+	int res = -1;
+
+	memset(&c, 0, sizeof(c));
+	c.prm = p;
+	rng_seed(&c.rng, seed, stream);
+
+	if (sim_genPolls(&c))
+		goto done;
+	if (sim_mainLoop(&c, r))
+		goto done;
+
+	r->samples += c.num_samples;
+
+	ds = sim_deliveries(&c, r);
+	if (!ds)
+		goto done;
+
+	sim_events(&c, ds, p->trig_interval_ms, p->trig_min_ms, p->trig_max_ms,
+		&r->trig_events, &r->trig_missed, &r->trig_latency);
+	sim_events(&c, ds, p->sensor_interval_ms, p->sensor_min_ms, p->sensor_max_ms,
+		&r->sensor_events, &r->sensor_missed, &r->sensor_latency);
+
+	res = 0;
+
+done:
+	free(ds);
+	free(c.polls);
+	free(c.samples);
+
+	return res;
+}
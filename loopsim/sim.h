@@ -0,0 +1,84 @@
+#ifndef _sim_h__
+#define _sim_h__
+
+#include <stdint.h>
+
+/* Virtual time model of the main loop in main.c, for one Wiimote
+ * channel. Times are in seconds, costs in CPU cycles.
+ *
+ * Each poll starts with the pointer write. pollfunc runs when the report
+ * read starts, write_ms later. The main loop then wakes up, counts delay A,
+ * samples the gun and builds the report. The report is ready when
+ * wm_newaction's copy is done. The ISR steals cycles from the main loop
+ * while the bus is busy. */
+struct sim_params {
+	double f_cpu;
+
+	// polls
+	double poll_period_ms;
+	double poll_jitter_ms; // standard deviation
+	double write_ms; // pointer write, up to the start of the report read
+	double menu_ms, menu_sd_ms; // whole transfer, in menus
+	double game_ms, game_sd_ms; // whole transfer, in game
+	double game_fraction; // of the time spent in game
+	double mode_mean_s; // mean time between menu/game changes
+	int bus_bytes; // bytes per poll, one ISR each
+
+	// main loop
+	int delay_ticks; // DELAY_A_TICKS
+	double tick_us; // DELAY_TICK_US
+	int tick_cycles; // waitSampleTime loop overhead per tick
+	int wake_cycles; // sleep to main loop
+	int isr_cycles; // per byte
+	int gun_cycles, classic_cycles, pack_cycles, newaction_cycles;
+
+	// inputs
+	double trig_interval_ms, trig_min_ms, trig_max_ms;
+	double sensor_interval_ms, sensor_min_ms, sensor_max_ms;
+
+	double duration_s; // per task
+};
+
+void sim_defaults(struct sim_params *p);
+
+#define SIM_HIST_US		10
+#define SIM_HIST_BINS	20000 // up to 200ms
+
+struct sim_hist {
+	uint64_t count;
+	uint64_t over;
+	double sum;
+	uint32_t bins[SIM_HIST_BINS];
+};
+
+void sim_histAdd(struct sim_hist *h, double seconds);
+/* In seconds. Resolution SIM_HIST_US. */
+double sim_histPct(const struct sim_hist *h, double p);
+
+struct sim_result {
+	struct sim_hist age; // sample to the start of the read delivering it
+	struct sim_hist trig_latency; // press to the start of the read reporting it
+	struct sim_hist sensor_latency;
+
+	uint64_t trig_events, trig_missed;
+	uint64_t sensor_events, sensor_missed;
+
+	uint64_t polls;
+	uint64_t samples;
+	uint64_t torn; // report copied while the console was reading it
+	uint64_t stale; // poll delivering the same sample as the previous one
+	uint64_t restarts; // delay A restarted by a poll
+	uint64_t late_wakes; // poll flagged before sleeping, woke up later
+
+	double delay_a_sum; // wake to sample
+	uint64_t delay_a_count;
+};
+
+/* Simulate p->duration_s seconds. The random numbers depend only on
+ * seed and stream. Results are added to r. */
+int sim_run(const struct sim_params *p, uint64_t seed, uint64_t stream, struct sim_result *r);
+
+/* Merging is a sum: the order does not matter */
+void sim_merge(struct sim_result *into, const struct sim_result *r);
+
+#endif // _sim_h__
@@ -18,10 +18,14 @@
 #include <avr/io.h>
 #include <avr/sleep.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <math.h>
 #include "wiimote.h"
 #include "gun.h"
 #include "eeprom.h"
+#include "calib.h"
+#include "timebase.h"
+#include "prof.h"
 #include "classic.h"
 #include "analog.h"
 
@@ -35,7 +39,7 @@ static unsigned char adapter_nes_id[6] = { 0x00, 0x00, 0xA4, 0x20, 0x52, 0x08 };
 // e1 1b 7e  ea 1b 83  e5 1b 82  e4 16 80  26 22  9b f0
 //
 
-static unsigned char cal_data[32] = { 
+static const unsigned char cal_data[32] PROGMEM = {
 		0xE0, 0x20, 0x80, // Left stick: Max X, Min X, Center X
 		0xE0, 0x20, 0x80, // Left stick: Max Y, Min Y, Center Y
 		0xE0, 0x20, 0x80, // Right stick: Max X, Min X, Center X
@@ -49,7 +53,29 @@ static unsigned char cal_data[32] = {
 		0x00, 0x00, 0, 0,	// Shoulder Max? Min? checksum?
 };
 
-static volatile char performupdate;
+// one bit per wiimote channel
+static volatile unsigned char performupdate;
+
+// steps remaining before sampling, plus one. 0 when idle.
+static unsigned char sample_due[WM_NUM_CHANNELS];
+
+#ifdef WITH_SOFT_TWI
+/* The software slave runs its transfers with the interrupts off, for
+ * 1.6ms at 400kHz: counted in delay loops, the steps would take up to
+ * twice as long, and a channel polled again before its sample is never
+ * sampled. They are counted on the time base from the poll instead. */
+static volatile unsigned short poll_time[WM_NUM_CHANNELS];
+#endif
+
+/* Writing n to this register selects profile n-1 (see eeprom.h). The
+ * Wiimote does not use it. */
+#define WM_REG_GUN_PROFILE		0xF8
+
+// from the active profile
+static unsigned char delay_a_ticks = DELAY_A_TICKS;
+
+// last value seen in WM_REG_GUN_PROFILE, per channel
+static unsigned char profile_reg[WM_NUM_CHANNELS];
 
 static void hwInit(void)
 {
@@ -82,9 +108,218 @@ static void hwInit(void)
 	DDRB = 0x00;
 }
 
-static void pollfunc(void)
+#ifdef WITH_PROFILING
+// time of the last poll, per channel
+static unsigned long poll_time[WM_NUM_CHANNELS];
+// last value seen in WM_REG_PROF_SITE, per channel
+static unsigned char prof_reg[WM_NUM_CHANNELS];
+
+// from the interrupt handlers
+static void profPoll(unsigned char channel)
+{
+	unsigned long now = timebase_time();
+
+	if (channel == 0 && poll_time[0] && now - poll_time[0] <= 0xFFFF)
+		prof_record(PROF_POLL_PERIOD, now - poll_time[0]);
+	poll_time[channel] = now;
+}
+
+static void profSample(unsigned char channel)
+{
+	unsigned long poll;
+
+	cli();
+	poll = poll_time[channel];
+	sei();
+
+	prof_record(PROF_DELAY_A, timebase_time() - poll);
+}
+
+/* The site selected through WM_REG_PROF_SITE is shown in the register
+ * window, refreshed once per sample (see prof.h). */
+static void profWindow(void)
+{
+	unsigned char win[PROF_WIN_SIZE];
+	unsigned char ch, v;
+
+	for (ch = 0; ch < WM_NUM_CHANNELS; ch++) {
+		v = wm_getReg(ch, WM_REG_PROF_SITE);
+		if (v != prof_reg[ch] && v == PROF_CLEAR)
+			prof_clear();
+		prof_reg[ch] = v;
+
+		if (v >= 1 && v <= PROF_NUM_SITES) {
+			prof_window(v - 1, win);
+			wm_setRegs(ch, WM_REG_PROF_WINDOW, win, PROF_WIN_SIZE);
+		}
+	}
+}
+#endif
+
+// with the software TWI, the handlers of the two channels can nest
+static void pollfunc(unsigned char channel)
+{
+	unsigned char sreg;
+
+#ifdef WITH_PROFILING
+	profPoll(channel);
+#endif
+#ifdef WITH_SOFT_TWI
+	// set before the bit in performupdate (see waitSampleTime)
+	poll_time[channel] = timebase_now();
+#endif
+	sreg = SREG;
+	cli();
+	performupdate |= 1 << channel;
+	SREG = sreg;
+}
+
+static char samplePending(void)
+{
+	unsigned char ch;
+
+	for (ch = 0; ch < WM_NUM_CHANNELS; ch++) {
+		if (sample_due[ch])
+			return 1;
+	}
+	return 0;
+}
+
+// Wait until the next channel is due for sampling and return it.
+static unsigned char waitSampleTime(void)
+{
+	unsigned char ch, pending;
+
+	while (1)
+	{
+		cli();
+		pending = performupdate;
+		performupdate = 0;
+		sei();
+
+		for (ch = 0; ch < WM_NUM_CHANNELS; ch++) {
+			if (pending & (1 << ch)) {
+				sample_due[ch] = delay_a_ticks + 1;
+			}
+		}
+
+		for (ch = 0; ch < WM_NUM_CHANNELS; ch++) {
+			if (sample_due[ch] == 1) {
+				sample_due[ch] = 0;
+				return ch;
+			}
+		}
+
+		_delay_us(DELAY_TICK_US);
+
+		for (ch = 0; ch < WM_NUM_CHANNELS; ch++) {
+			if (sample_due[ch] > 1) {
+#ifdef WITH_SOFT_TWI
+				/* A poll changing poll_time while it is read here is
+				 * also in performupdate, and restarts the count */
+				unsigned short elapsed = timebase_now() - poll_time[ch];
+
+				if (elapsed >= delay_a_ticks * (unsigned short)TIMEBASE_US_TO_TICKS(DELAY_TICK_US))
+					sample_due[ch] = 1;
+#else
+				sample_due[ch]--;
+#endif
+			}
+		}
+	}
+}
+
+static void applyProfile(void)
+{
+	const struct gun_profile *p = activeProfile();
+
+	delay_a_ticks = p->delay_a_ticks;
+
+	// both guns share the same settings, one call is enough
+	gunSetProfile(p);
+	gunSetCalibration(&g_current_config.calib);
+}
+
+/* Switching takes effect at the next sample. Storing the choice in
+ * EEPROM is left to config_task, polls are not delayed. */
+static void checkProfileRequest(void)
+{
+	unsigned char ch, v;
+
+	for (ch = 0; ch < WM_NUM_CHANNELS; ch++) {
+		v = wm_getReg(ch, WM_REG_GUN_PROFILE);
+		if (v == profile_reg[ch])
+			continue;
+		profile_reg[ch] = v;
+
+		if (v >= 1 && v <= NUM_PROFILES && v - 1 != g_current_config.active_profile) {
+			g_current_config.active_profile = v - 1;
+			applyProfile();
+			sync_config();
+		}
+	}
+}
+
+static char triggerPressed(Gamepad *gun)
+{
+	gamepad_data data;
+
+	gun->update();
+	gun->getReport(&data);
+
+	return (data.gun.buttons & GUN_BTN_TRIGGER) ? 1 : 0;
+}
+
+// 10ms steps
+#define CALIB_HOLD_STEPS		300
+
+/* Holding the trigger at power-up selects a profile: release it, then
+ * pull it once for the first profile, twice for the second, etc. The
+ * selection ends one second after the last pull. Held for 3 seconds
+ * or more, the sensor calibration mode starts instead at the release
+ * (see calib.c). This runs before the Wiimote interface is started, no
+ * poll is missed. */
+static void selectProfileAtPowerUp(Gamepad *gun)
 {
-	performupdate = 1;
+	unsigned char pulls = 0, idle = 0, last = 0, pressed;
+	unsigned short held = 0;
+
+	if (!triggerPressed(gun))
+		return;
+
+	while (triggerPressed(gun)) {
+		_delay_ms(10);
+		if (held < CALIB_HOLD_STEPS)
+			held++;
+	}
+
+#ifdef GUN_SENSOR_CALIB
+	if (held >= CALIB_HOLD_STEPS) {
+		calibrateSensor();
+		return;
+	}
+#endif
+
+	while (idle < 100)
+	{
+		_delay_ms(10);
+
+		pressed = triggerPressed(gun);
+		if (pressed && !last) {
+			pulls++;
+		}
+		if (pressed) {
+			idle = 0;
+		} else {
+			idle++;
+		}
+		last = pressed;
+	}
+
+	if (pulls >= 1 && pulls <= NUM_PROFILES) {
+		g_current_config.active_profile = pulls - 1;
+		sync_config();
+	}
 }
 
 #define ERROR_THRESHOLD			10
@@ -94,7 +329,9 @@ static void pollfunc(void)
 
 int main(void)
 {
+	Gamepad *guns[WM_NUM_CHANNELS];
 	Gamepad *gun_gamepad = NULL;
+	unsigned char ch;
 	unsigned char analog_style = ANALOG_STYLE_DEFAULT;
 	gamepad_data lastReadData;
 	classic_pad_data classicData;
@@ -104,9 +341,21 @@ int main(void)
 	int detect_time = 0;
 
 	hwInit();
+#ifdef HAVE_TIMEBASE
+	timebase_init();
+#endif
 	init_config();
 
-	gun_gamepad = gunGetGamepad();
+	guns[0] = gunGetGamepad();
+#if WM_NUM_CHANNELS > 1
+	guns[1] = gun2GetGamepad();
+#endif
+	for (ch = 0; ch < WM_NUM_CHANNELS; ch++) {
+		guns[ch]->init();
+	}
+
+	selectProfileAtPowerUp(guns[0]);
+	applyProfile();
 
 	dataToClassic(NULL, &classicData, 0);
 	pack_classic_data(&classicData, current_report, ANALOG_STYLE_DEFAULT, CLASSIC_MODE_1);
@@ -124,16 +373,54 @@ int main(void)
 
 	while(1)
 	{
-		// Adapter without sleep: 4mA
-		// Adapter with sleep: 1.6mA
+		if (!samplePending())
+		{
+			// Adapter without sleep: 4mA
+			// Adapter with sleep: 1.6mA
 
-		set_sleep_mode(SLEEP_MODE_EXT_STANDBY);
-		sleep_enable();
-		sleep_cpu();
-		sleep_disable();
+#ifdef WITH_ANALOG_SENSOR
+			// The ADC clock is stopped in extended standby. Idle keeps the
+			// free running sensor conversion going.
+			set_sleep_mode(SLEEP_MODE_IDLE);
+#else
+			set_sleep_mode(SLEEP_MODE_EXT_STANDBY);
+#ifdef GUN_SENSOR_CALIB
+			// Timer1 times the sensor filter, and stops in extended standby
+			if (g_current_config.calib.confirm_us)
+				set_sleep_mode(SLEEP_MODE_IDLE);
+#endif
+#endif
+#ifdef WITH_PROFILING
+			// the time base must run through the sleep, for delay A
+			set_sleep_mode(SLEEP_MODE_IDLE);
+#endif
+#if defined(WITH_SHOT_EVENTS) && defined(HAVE_TIMEBASE)
+			// and to time the shots (see shot.h)
+			set_sleep_mode(SLEEP_MODE_IDLE);
+#endif
+#ifdef WITH_SOFT_TWI
+			// The software slave must hold SCL within 1.9us of its start
+			// (see swtwi.c): no start-up time from a standby mode, and no
+			// section with interrupts off to delay its vector. Idle also
+			// keeps the transfer timeout running.
+			set_sleep_mode(SLEEP_MODE_IDLE);
+			sleep_enable();
+#else
+			// A transfer may still be going on: its timeout runs on
+			// Timer1 too (see wiimote.c). Checked with interrupts off:
+			// the instruction after sei, the sleep, runs before any
+			// interrupt.
+			cli();
+			if (wm_busBusy())
+				set_sleep_mode(SLEEP_MODE_IDLE);
+			sleep_enable();
+			sei();
+#endif
+			sleep_cpu();
+			sleep_disable();
 
-		while (!performupdate) { }
-		performupdate = 0;
+			while (!performupdate) { }
+		}
 
 		// With this delay, the controller read is postponed until just before
 		// the next I2C read from the wiimote. This is to reduce latency to a
@@ -146,7 +433,7 @@ int main(void)
 		//
 		// This is why I chose to maintain a margin.
 		//
-		_delay_ms(2.35); // delay A
+		ch = waitSampleTime(); // delay A
 
 		//                                        |<----------- E ----------->|
 		//                               C  -->|  |<--
@@ -164,16 +451,25 @@ int main(void)
 		// D = 1.2ms, 1.1ms, 1.5ms (Wiimote I2C communication time. Varies [menu/game])
 		// E = 2.34ms (menu), 2.84ms (in game)
 		//
+		// Built with -DWITH_PROFILING, A, B and D are measured along with each
+		// step below (see prof.h).
+		//
+
+#ifdef WITH_PROFILING
+		profSample(ch);
+#endif
 
-		gun_gamepad = gunGetGamepad();
+		gun_gamepad = guns[ch];
+		PROF_START(t_update);
 		gun_gamepad->update();
+		PROF_END(PROF_GUN_UPDATE, t_update);
 		gun_gamepad->getReport(&lastReadData);
 
-		if (!wm_altIdEnabled())
+		if (!wm_altIdEnabled(ch))
 		{
 			unsigned char mode;
 
-			switch(wm_getReg(0xFE))
+			switch(wm_getReg(ch, 0xFE))
 			{
 				default:
 				case 0x01: mode = CLASSIC_MODE_1; break;
@@ -181,17 +477,31 @@ int main(void)
 				case 0x02: mode = CLASSIC_MODE_2; break;
 			}
 
+			PROF_START(t_classic);
 			dataToClassic(&lastReadData, &classicData, first_controller_read);
+			PROF_END(PROF_DATA_TO_CLASSIC, t_classic);
+
+			PROF_START(t_pack);
 			pack_classic_data(&classicData, current_report, analog_style, mode);
-			wm_newaction(current_report, PACKED_CLASSIC_DATA_SIZE);
+			PROF_END(PROF_PACK_CLASSIC, t_pack);
+
+			PROF_START(t_newaction);
+			wm_newaction(ch, current_report, PACKED_CLASSIC_DATA_SIZE);
+			PROF_END(PROF_NEWACTION, t_newaction);
 		}
 		else
 		{
 			unsigned char raw[8];
 
 			memcpy(raw, lastReadData.gun.raw_data, sizeof(lastReadData.gun.raw_data));
-			wm_newaction(raw, sizeof(lastReadData.gun.raw_data));
+			wm_newaction(ch, raw, sizeof(lastReadData.gun.raw_data));
 		}
+
+		checkProfileRequest();
+#ifdef WITH_PROFILING
+		profWindow();
+#endif
+		config_task();
 	}
 
 	return 0;
@@ -27,10 +27,21 @@
 
 #include <linux/joystick.h>
 
+#include "monitor.h"
+#include "stats.h"
+#include "selftest.h"
+#include "render.h"
+#include "record.h"
+
 char joyname[256];
 
 int (*displayer)(int num_axes, short *axes, int num_buttons, short *buttons) = NULL;
 
+// the screen displayers draw here
+static struct render rd;
+static int fps = 60;
+static int redraw;
+
 int event_displayer(int num_axes, short *axes, int num_buttons, short *buttons)
 {
 	return 0;
@@ -44,6 +55,8 @@ static int generic_displayer(int num_axes, short *axes, int num_buttons, short *
 	int i;
 	char *comment;
 
+	rd_home(&rd);
+
 	for (i=0; i<num_axes; i++) {
 		comment = "";
 		if (i==0) {
@@ -53,12 +66,12 @@ static int generic_displayer(int num_axes, short *axes, int num_buttons, short *
 			if (axes[i]<0) comment = "up";
 			if (axes[i]>0) comment = "down";
 		}
-		printf("Axe %02d: %-6d  (%s)\n", i, axes[i], comment);
+		rd_printf(&rd, "Axe %02d: %-6d  (%s)\n", i, axes[i], comment);
 	}
 	for (i=0; i<num_buttons; i++) {
-		printf("Button %02d: %d\n", i, buttons[i]);
+		rd_printf(&rd, "Button %02d: %d\n", i, buttons[i]);
 	}
-	printf("-----------------------\n");
+	rd_printf(&rd, "-----------------------\n");
 	return 0;
 }
 
@@ -93,7 +106,7 @@ static const char *axePairToName(int h_axe, int v_axe)
 
 static void printButton(const char *caption, int id, short *buttons)
 {
-	printf("%s %s\n", caption, buttons[id] ? "On" : "__");
+	rd_printf(&rd, "%s %s\n", caption, buttons[id] ? "On" : "__");
 }
 
 static int wii_classic_displayer(int num_axes, short *axes, int num_buttons, short *buttons)
@@ -124,16 +137,16 @@ static int wii_classic_displayer(int num_axes, short *axes, int num_buttons, sho
 		4,3,2,1,5,6,12,7,8,9,10,11,0,13,14
 	};
 
-	printf("\033[0;0H");
+	rd_home(&rd);
 	
-	printf(" - %s (Wii classic controller)\n", joyname);
+	rd_printf(&rd, " - %s (Wii classic controller)\n", joyname);
 
-	printf("\n");
+	rd_printf(&rd, "\n");
 
-	printf("Left stick  : %6d,%6d    %3s\n", axes[0], axes[1], axePairToName(axes[0],axes[1]));
+	rd_printf(&rd, "Left stick  : %6d,%6d    %3s\n", axes[0], axes[1], axePairToName(axes[0],axes[1]));
 	
-	printf("Right stick : %6d,%6d    %3s\n", axes[2], axes[3], axePairToName(axes[2],axes[3]));
-	printf("                             \n");
+	rd_printf(&rd, "Right stick : %6d,%6d    %3s\n", axes[2], axes[3], axePairToName(axes[2],axes[3]));
+	rd_printf(&rd, "                             \n");
 	
 	for (i=0; i<disp_buttons; i++) {
 		int d;
@@ -192,15 +205,15 @@ static int wii_classic_displayer2(int num_axes, short *axes, int num_buttons, sh
 		return -1;
 	}
 
-	printf("\033[0;0H");
+	rd_home(&rd);
 
-	printf(" - %s (Wii classic controller)\n", joyname);
+	rd_printf(&rd, " - %s (Wii classic controller)\n", joyname);
 
-	printf("\n");
+	rd_printf(&rd, "\n");
 
-	printf("Left stick  : %6d,%6d    %3s\n", axes[0], axes[1], axePairToName(axes[0],axes[1]));
-	printf("Right stick : %6d,%6d    %3s\n", axes[3], axes[4], axePairToName(axes[3],axes[4]));
-	printf("                             \n");
+	rd_printf(&rd, "Left stick  : %6d,%6d    %3s\n", axes[0], axes[1], axePairToName(axes[0],axes[1]));
+	rd_printf(&rd, "Right stick : %6d,%6d    %3s\n", axes[3], axes[4], axePairToName(axes[3],axes[4]));
+	rd_printf(&rd, "                             \n");
 
 	for (i=0; i<disp_buttons; i++) {
 		int d;
@@ -218,186 +231,419 @@ static int wii_classic_displayer2(int num_axes, short *axes, int num_buttons, sh
 }
 
 
-int main(int argc, char **argv)
+static struct monitor mon;
+static int offset_buttons = 0;
+
+static struct stats *stats;
+static int stats_period_ms;
+static struct timespec stats_last_print;
+static struct selftest selftest;
+static int selftest_seen;
+
+static struct recorder rec;
+
+static const char *eventName(const struct mt_event *ev)
 {
-	int fd;
-	int offset_buttons = 0;
-	char *jdev=NULL;
-	int num_buttons=0, num_axes=0;
+	if (ev->init)
+		return "Init";
+	return ev->type == MT_EV_BUTTON ? "Button" : "Axis";
+}
 
-	short *axes=NULL, *buttons=NULL;
+static void single_open(struct monitor *m, struct mt_device *d)
+{
+	printf("\007\007\007"); fflush(stdout);
 
-	if (argc<2) {
-		printf("Usage: ./maptest device\n");
-		printf("\n");
-		printf("Example: ./maptest /dev/input/js0\n");
-		return 1;
-	}
-	
-	jdev = argv[1];
-	printf("Using joystick device \"%s\"\n", jdev);
-	
-	while (1)
-	{
-reopen:
-		fd = open(jdev, O_RDWR);
-		if (fd==-1) {
-			
-			if (errno == EAGAIN) {
-				usleep(250000);
-				continue;
+	strcpy(joyname, d->name);
+
+	printf("Joystick name: %s\n", joyname);
+	printf("Axes: %d\n", d->num_axes);
+	printf("Buttons: %d\n", d->num_buttons);
+
+	printf("\n\n************************\n");
+
+	if (displayer == NULL) {
+		do 
+		{
+			printf("Select displayer:\n");
+			printf("A - Generic (page mode)\n");
+			printf("B - Generic (event mode)\n");
+			printf("C - Mapping tester (with old raphnet wusbmote)\n");
+			printf("D - Mapping tester (with wusbmote v2)\n");
+			fflush(stdout);
+
+			switch(getchar())
+			{
+				case 'a':
+				case 'A':
+					displayer = generic_displayer;
+					break;
+
+				case 'b':
+				case 'B':
+					displayer = event_displayer;
+					break;
+
+				case 'C':
+				case 'c':
+					displayer = wii_classic_displayer;
+					break;
+
+				case 'D':
+				case 'd':
+					displayer = wii_classic_displayer2;
+					break;
+
+
+				default:
+					break;
 			}
 
-			perror("open");
+		} while (!displayer);
+	}
+
+	printf("\033[2J");
+	fflush(stdout);
 
-			break;
+	// the terminal was cleared, start over with a full frame
+	rd_init(&rd, STDOUT_FILENO, fps);
+	redraw = 1;
+}
+
+static int single_event(struct monitor *m, struct mt_device *d, const struct mt_event *ev)
+{
+	if (displayer == event_displayer) {
+		if (ev->type == MT_EV_AXIS && ev->number >= 4) {
+			return 0; // ignore L/R gamecube axis
 		}
 
-		printf("\007\007\007"); fflush(stdout);
+		printf("%ld.%06ld : %6s -> id=%-2d val=%d\n",
+			(long)ev->ts.tv_sec, ev->ts.tv_nsec / 1000, eventName(ev), ev->number, ev->value);
+		return 0;
+	}
 
-		memset(joyname, 0, sizeof(joyname));
-		ioctl(fd, JSIOCGNAME(sizeof(joyname)), joyname);
+	// The state is already in d, the screen is drawn by single_idle
+	redraw = 1;
+	return 0;
+}
 
-		ioctl(fd, JSIOCGAXES, &num_axes);
-		ioctl(fd, JSIOCGBUTTONS, &num_buttons);
+static int single_idle(struct monitor *m)
+{
+	struct mt_device *d = &m->dev[0];
+	int res, wait;
 
-		printf("Joystick name: %s\n", joyname);
-		printf("Axes: %d\n", num_axes);
-		printf("Buttons: %d\n", num_buttons);
+	fflush(stdout);
 
+	if (!redraw || displayer == event_displayer)
+		return 0;
 
-		printf("\n\n************************\n");
+	// too early for a new frame, come back when it is time
+	wait = rd_wait(&rd);
+	if (wait) {
+		m->idle_ms = wait;
+		return 0;
+	}
 
-		if (displayer == NULL) {
-			do 
-			{
-				printf("Select displayer:\n");
-				printf("A - Generic (page mode)\n");
-				printf("B - Generic (event mode)\n");
-				printf("C - Mapping tester (with old raphnet wusbmote)\n");
-				printf("D - Mapping tester (with wusbmote v2)\n");
-
-				switch(getchar())
-				{
-					case 'a':
-					case 'A':
-						displayer = generic_displayer;
-						break;
-
-					case 'b':
-					case 'B':
-						displayer = event_displayer;
-						break;
-
-					case 'C':
-					case 'c':
-						displayer = wii_classic_displayer;
-						break;
-
-					case 'D':
-					case 'd':
-						displayer = wii_classic_displayer2;
-						break;
-
-
-					default:
-						break;
-				}
+	if (offset_buttons) {
+		res = displayer(d->num_axes, d->axes, d->num_buttons-1, d->buttons+1);
+	} else {
+		res = displayer(d->num_axes, d->axes, d->num_buttons, d->buttons);
+	}
+	if (res)
+		return res;
 
-			} while (!displayer);
-		}
+	redraw = 0;
+	m->idle_ms = -1;
 
-		axes = calloc(1, 2*num_axes);
-		if (!num_axes) {
-			perror("calloc");
-			goto shdn;
-		}
+	return rd_flush(&rd) < 0;
+}
 
-		buttons = calloc(1, 2*num_buttons);
-		if (!num_buttons) {
-			perror("calloc");
-			goto shdn;
+static void multi_open(struct monitor *m, struct mt_device *d)
+{
+	printf("[%d] %s: \"%s\" (%s), %d axes, %d buttons\n", (int)(d - m->dev),
+		d->path, d->name, d->evdev ? "evdev" : "joystick", d->num_axes, d->num_buttons);
+}
+
+static int multi_event(struct monitor *m, struct mt_device *d, const struct mt_event *ev)
+{
+	printf("%ld.%06ld [%d] %6s -> id=%-2d val=%d\n",
+		(long)ev->ts.tv_sec, ev->ts.tv_nsec / 1000, ev->dev, eventName(ev), ev->number, ev->value);
+	return 0;
+}
+
+static int flush_output(struct monitor *m)
+{
+	fflush(stdout);
+	return 0;
+}
+
+static int stats_event(struct monitor *m, struct mt_device *d, const struct mt_event *ev)
+{
+	int64_t latency = -1;
+
+	// kernel to userspace, only evdev devices have a kernel timestamp
+	if (d->evdev) {
+		latency = ts_diff_ns(&ev->rx, &ev->ts);
+	}
+	stats_add(stats, ev, latency);
+
+	return 0;
+}
+
+static int stats_idle(struct monitor *m)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (ts_diff_ns(&now, &stats_last_print) >= stats_period_ms * 1000000LL) {
+		stats_last_print = now;
+		stats_print(stats, stdout);
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+static int selftest_event(struct monitor *m, struct mt_device *d, const struct mt_event *ev)
+{
+	int64_t latency = -1;
+
+	// Presses: from the write to /dev/uinput to the kernel timestamp
+	if (!ev->init && ev->type == MT_EV_BUTTON && ev->value) {
+		if (selftest_seen < __atomic_load_n(&selftest.emitted, __ATOMIC_ACQUIRE)) {
+			latency = ts_diff_ns(&ev->ts, &selftest.emit_times[selftest_seen]);
 		}
+		selftest_seen++;
+	}
+	else if (!ev->init) {
+		latency = ts_diff_ns(&ev->rx, &ev->ts);
+	}
+	stats_add(stats, ev, latency);
 
-		printf("\033[2J");
+	return 0;
+}
 
-		while(1)
-		{
-			struct js_event ev;
-			char *name = "?";
-
-			if (read(fd, &ev, sizeof(struct js_event))<=0) {
-				perror("read");
-				close(fd);
-				fd = -1;
-				goto reopen;
-			}
+static int selftest_idle(struct monitor *m)
+{
+	static struct timespec done_at;
+	struct timespec now;
 
+	if (!selftest.done)
+		return 0;
 
-			switch(ev.type)
-			{
-				case JS_EVENT_BUTTON:
-					name = "Button";
-					if (ev.number>num_buttons) {
-						fprintf(stderr, "Out of range button event!\n");
-						break;
-					}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!done_at.tv_sec) {
+		done_at = now;
+	}
 
-					buttons[ev.number] = ev.value;
+	// everything received, or give up after a second
+	return selftest_seen >= selftest.count || ts_diff_ns(&now, &done_at) > 1000000000LL;
+}
 
-					break;
-				case JS_EVENT_AXIS:
-					name = "Axis";
-					if (ev.number > num_axes) {
-						fprintf(stderr, "Out of range axis event!\n");
-						break;
-					}
-					
-					axes[ev.number] = ev.value;
+static int run_selftest(int period_us, int count)
+{
+	const struct st_channel *c;
+	char *path;
+	uint64_t p50;
+	int ok = 1;
 
-					break;
-				case JS_EVENT_INIT:
-					name = "Init";
-					break;
-			}
+	printf("Self-test: %d presses, %d us period\n", count, period_us);
+	fflush(stdout);
+
+	if (selftest_create(&selftest, period_us, count)) {
+		fprintf(stderr, "Could not create the uinput device (permissions?)\n");
+		selftest_destroy(&selftest);
+		return 1;
+	}
+	path = selftest.devpath;
+
+	stats = stats_new();
+	if (!stats || mon_init(&mon, &path, 1)) {
+		selftest_destroy(&selftest);
+		return 1;
+	}
+	mon.on_open = multi_open;
+	mon.on_event = selftest_event;
+	mon.on_idle = selftest_idle;
+	mon.idle_ms = 100;
 
-			if (displayer == event_displayer) {
-				time_t t = time(NULL);
-				struct tm tm;
-				char timestamp[64];
-				struct timespec ts;
-				
+	selftest_start(&selftest);
+	mon_run(&mon);
 
-				if (ev.type == JS_EVENT_AXIS && ev.number >= 4) {
-					continue; // ignore L/R gamecube axis
+	stats_print(stats, stdout);
+
+	c = stats_get(stats, 0, MT_EV_BUTTON, 0);
+	if (!c || c->count != count) {
+		printf("FAIL: %llu presses received, %d expected\n",
+			c ? (unsigned long long)c->count : 0ULL, count);
+		ok = 0;
+	}
+	else {
+		// the median interval must be the emitted period, within 10%
+		p50 = st_histPercentile(&c->interval, 50);
+		if (p50 < period_us * 900ULL || p50 > period_us * 1100ULL) {
+			printf("FAIL: median interval %.3f ms, %.3f ms expected\n", p50 / 1e6, period_us / 1e3);
+			ok = 0;
+		}
+	}
+
+	printf("Self-test %s\n", ok ? "passed" : "failed");
+
+	mon_close(&mon);
+	selftest_destroy(&selftest);
+	stats_free(stats);
+
+	return !ok;
+}
+
+static void usage(void)
+{
+	printf("Usage: ./maptest [options] device [device...]\n");
+	printf("       ./maptest [options] -r file\n");
+	printf("\n");
+	printf("Options:\n");
+	printf("  -m      Monitor mode: print the events of all devices (default with more than one device)\n");
+	printf("  -f fps  Maximum screen refresh rate, 0 for no limit (default: %d)\n", fps);
+	printf("  -s sec  Statistics mode: interval and latency percentiles per button and axis,\n");
+	printf("          printed every sec seconds\n");
+	printf("  -w file Record the events to a session log (appended if it exists)\n");
+	printf("  -r file Replay a session log instead of reading devices\n");
+	printf("  -p x    Replay at x times the recorded speed (default: as fast as possible)\n");
+	printf("  -T      Self-test: create a uinput joystick with a known event schedule and\n");
+	printf("          check the statistics (needs access to /dev/uinput)\n");
+	printf("\n");
+	printf("Joystick (/dev/input/js*) and evdev (/dev/input/event*) devices are supported.\n");
+	printf("Evdev devices provide kernel timestamps.\n");
+	printf("\n");
+	printf("Example: ./maptest /dev/input/js0\n");
+	printf("         ./maptest -m /dev/input/event5 /dev/input/event6\n");
+	printf("         ./maptest -w session.log /dev/input/event5\n");
+	printf("         ./maptest -s 10 -r session.log\n");
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	int multi = 0;
+	int res;
+	int num_devices;
+	char *record_file = NULL;
+	char *replay_file = NULL;
+	double speed = 0;
+
+	while ((opt = getopt(argc, argv, "mf:s:w:r:p:Th")) != -1) {
+		switch (opt)
+		{
+			case 'm':
+				multi = 1;
+				break;
+			case 'f':
+				fps = atoi(optarg);
+				if (fps < 0) {
+					usage();
+					return 1;
+				}
+				break;
+			case 's':
+				stats_period_ms = atof(optarg) * 1000;
+				if (stats_period_ms <= 0) {
+					usage();
+					return 1;
 				}
+				break;
+			case 'w':
+				record_file = optarg;
+				break;
+			case 'r':
+				replay_file = optarg;
+				break;
+			case 'p':
+				speed = atof(optarg);
+				if (speed <= 0) {
+					usage();
+					return 1;
+				}
+				break;
+			case 'T':
+				return run_selftest(10000, 200);
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if (replay_file) {
+		num_devices = rec_numDevices(replay_file);
+		if (num_devices < 0) {
+			return 1;
+		}
+	} else {
+		num_devices = argc - optind;
+		if (num_devices < 1) {
+			usage();
+			return 1;
+		}
+		if (mon_init(&mon, argv + optind, num_devices)) {
+			return 1;
+		}
+	}
 
-				localtime_r(&t, &tm);
-				clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (num_devices > 1) {
+		multi = 1;
+	}
 
-				strftime(timestamp, 64, "%T", &tm);				
+	if (record_file) {
+		if (rec_open(&rec, record_file, num_devices)) {
+			return 1;
+		}
+		mon.rec = &rec;
+	}
 
-				printf("%s.%3ld : %5s -> id=%-2d val=%d\n", 
-					timestamp, ts.tv_nsec / 1000 / 1000, name, ev.number, ev.value);
-				continue;
-			}
+	// output is flushed once per batch of events
+	setvbuf(stdout, NULL, _IOFBF, 65536);
 
-			if (offset_buttons) {
-				if (displayer(num_axes, axes, num_buttons-1, buttons+1))
-					break;
-			} else {
-				if (displayer(num_axes, axes, num_buttons, buttons))
-					break;
-			}
+	mon.idle_ms = -1;
+	mon.on_idle = flush_output;
+
+	if (stats_period_ms) {
+		stats = stats_new();
+		if (!stats) {
+			perror("calloc");
+			return 1;
 		}
+		clock_gettime(CLOCK_MONOTONIC, &stats_last_print);
+		mon.on_open = multi_open;
+		mon.on_event = stats_event;
+		mon.on_idle = stats_idle;
+		mon.idle_ms = stats_period_ms;
+	} else if (multi) {
+		mon.on_open = multi_open;
+		mon.on_event = multi_event;
+	} else {
+		printf("Using joystick device \"%s\"\n", replay_file ? replay_file : argv[optind]);
+		mon.on_open = single_open;
+		mon.on_event = single_event;
+		mon.on_idle = single_idle;
+	}
+
+	if (replay_file) {
+		res = rec_replay(&mon, replay_file, speed);
 
+		// the last frame may have been held back by the rate limit
+		if (!res && mon.on_idle == single_idle && redraw) {
+			rd.frame_ms = 0;
+			res = single_idle(&mon);
+		}
+		if (!res && stats) {
+			stats_print(stats, stdout);
+		}
+		fflush(stdout);
+	} else {
+		res = mon_run(&mon);
+		mon_close(&mon);
 	}
 
-shdn:
-	free(axes);
-	free(buttons);
-	close(fd);
+	rec_close(&rec);
+	stats_free(stats);
 
-	return 0;
+	return res < 0;
 }
-
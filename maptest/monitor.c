@@ -0,0 +1,448 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/joystick.h>
+#include <linux/input.h>
+
+#include "monitor.h"
+#include "record.h"
+
+/* Events read per syscall */
+#define MT_BATCH		64
+/* Batches read from one device before giving the others a chance */
+#define MT_MAX_BATCHES	4
+/* Retry interval for devices that went away */
+#define MT_REOPEN_MS	250
+
+#define NBITS(x)		((((x)-1)/(8*sizeof(long)))+1)
+#define TEST_BIT(b, a)	(((a)[(b)/(8*sizeof(long))] >> ((b)%(8*sizeof(long)))) & 1)
+
+static void mon_now(struct timespec *ts)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+static long mon_msSince(const struct timespec *ts)
+{
+	struct timespec now;
+
+	mon_now(&now);
+	return (now.tv_sec - ts->tv_sec) * 1000 + (now.tv_nsec - ts->tv_nsec) / 1000000;
+}
+
+/* Scale an evdev axis to -32767..32767, like the joystick interface does */
+static short mon_scaleAbs(const struct input_absinfo *a, int v)
+{
+	long range = (long)a->maximum - a->minimum;
+	long r;
+
+	if (range <= 0)
+		return v;
+
+	r = ((long)(v - a->minimum) * 65534) / range - 32767;
+	if (r < -32767) r = -32767;
+	if (r > 32767) r = 32767;
+
+	return r;
+}
+
+int mon_emit(struct monitor *m, struct mt_device *d, struct mt_event *ev)
+{
+	if (m->rec)
+		rec_event(m->rec, ev);
+
+	if (ev->type == MT_EV_BUTTON) {
+		if (ev->number >= d->num_buttons) {
+			fprintf(stderr, "Out of range button event!\n");
+		} else {
+			d->buttons[ev->number] = ev->value;
+		}
+	}
+	else {
+		if (ev->number >= d->num_axes) {
+			fprintf(stderr, "Out of range axis event!\n");
+		} else {
+			d->axes[ev->number] = ev->value;
+		}
+	}
+
+	if (m->on_event)
+		return m->on_event(m, d, ev);
+
+	return 0;
+}
+
+/* Read the complete evdev state and report it as init events. Used
+ * when opening, and when the kernel dropped events. */
+static int mon_evdevSync(struct monitor *m, struct mt_device *d)
+{
+	unsigned long keystate[NBITS(KEY_CNT)];
+	struct mt_event ev;
+	int i;
+
+	memset(&ev, 0, sizeof(ev));
+	mon_now(&ev.rx);
+	ev.ts = ev.rx;
+	ev.dev = d - m->dev;
+	ev.init = 1;
+
+	memset(keystate, 0, sizeof(keystate));
+	ioctl(d->fd, EVIOCGKEY(sizeof(keystate)), keystate);
+
+	for (i = 0; i < KEY_CNT; i++) {
+		if (d->key_map[i] < 0)
+			continue;
+		ev.type = MT_EV_BUTTON;
+		ev.number = d->key_map[i];
+		ev.value = TEST_BIT(i, keystate);
+		if (mon_emit(m, d, &ev))
+			return 1;
+	}
+
+	for (i = 0; i < ABS_CNT; i++) {
+		if (d->abs_map[i] < 0)
+			continue;
+		ioctl(d->fd, EVIOCGABS(i), &d->absinfo[i]);
+		ev.type = MT_EV_AXIS;
+		ev.number = d->abs_map[i];
+		ev.value = mon_scaleAbs(&d->absinfo[i], d->absinfo[i].value);
+		if (mon_emit(m, d, &ev))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void mon_evdevSetup(struct mt_device *d)
+{
+	unsigned long keybits[NBITS(KEY_CNT)];
+	unsigned long absbits[NBITS(ABS_CNT)];
+	int clk = CLOCK_MONOTONIC;
+	int i;
+
+	ioctl(d->fd, EVIOCGNAME(sizeof(d->name)), d->name);
+
+	// kernel timestamps on the same clock as ours
+	ioctl(d->fd, EVIOCSCLOCKID, &clk);
+
+	memset(keybits, 0, sizeof(keybits));
+	memset(absbits, 0, sizeof(absbits));
+	ioctl(d->fd, EVIOCGBIT(EV_KEY, sizeof(keybits)), keybits);
+	ioctl(d->fd, EVIOCGBIT(EV_ABS, sizeof(absbits)), absbits);
+
+	// Same numbering as the joystick interface: joystick buttons first,
+	// then the other buttons from BTN_MISC.
+	memset(d->key_map, 0xff, sizeof(d->key_map));
+	d->num_buttons = 0;
+	for (i = BTN_JOYSTICK; i < KEY_CNT; i++) {
+		if (TEST_BIT(i, keybits))
+			d->key_map[i] = d->num_buttons++;
+	}
+	for (i = BTN_MISC; i < BTN_JOYSTICK; i++) {
+		if (TEST_BIT(i, keybits))
+			d->key_map[i] = d->num_buttons++;
+	}
+
+	memset(d->abs_map, 0xff, sizeof(d->abs_map));
+	d->num_axes = 0;
+	for (i = 0; i < ABS_CNT; i++) {
+		if (TEST_BIT(i, absbits))
+			d->abs_map[i] = d->num_axes++;
+	}
+}
+
+static int mon_openDevice(struct monitor *m, struct mt_device *d)
+{
+	struct epoll_event ee;
+	int version;
+
+	d->fd = open(d->path, O_RDONLY | O_NONBLOCK);
+	if (d->fd == -1)
+		return -1;
+
+	memset(d->name, 0, sizeof(d->name));
+	memset(d->axes, 0, sizeof(d->axes));
+	memset(d->buttons, 0, sizeof(d->buttons));
+
+	if (ioctl(d->fd, EVIOCGVERSION, &version) == 0) {
+		d->evdev = 1;
+		mon_evdevSetup(d);
+	}
+	else {
+		unsigned char n;
+
+		d->evdev = 0;
+		ioctl(d->fd, JSIOCGNAME(sizeof(d->name)), d->name);
+		n = 0;
+		ioctl(d->fd, JSIOCGAXES, &n);
+		d->num_axes = n;
+		n = 0;
+		ioctl(d->fd, JSIOCGBUTTONS, &n);
+		d->num_buttons = n;
+	}
+
+	memset(&ee, 0, sizeof(ee));
+	ee.events = EPOLLIN;
+	ee.data.ptr = d;
+	if (epoll_ctl(m->epfd, EPOLL_CTL_ADD, d->fd, &ee)) {
+		perror("epoll_ctl");
+		close(d->fd);
+		d->fd = -1;
+		return -1;
+	}
+	m->num_open++;
+
+	if (m->rec)
+		rec_device(m->rec, d - m->dev, d);
+	if (m->on_open)
+		m->on_open(m, d);
+
+	// the joystick interface sends init events by itself
+	if (d->evdev)
+		mon_evdevSync(m, d);
+
+	return 0;
+}
+
+static void mon_closeDevice(struct monitor *m, struct mt_device *d)
+{
+	epoll_ctl(m->epfd, EPOLL_CTL_DEL, d->fd, NULL);
+	close(d->fd);
+	d->fd = -1;
+	m->num_open--;
+}
+
+static int mon_readJs(struct monitor *m, struct mt_device *d, int *gone)
+{
+	struct js_event buf[MT_BATCH];
+	struct mt_event ev;
+	int i, n, b;
+
+	for (b = 0; b < MT_MAX_BATCHES; b++) {
+		n = read(d->fd, buf, sizeof(buf));
+		if (n <= 0) {
+			if (n < 0 && (errno == EAGAIN || errno == EINTR))
+				return 0;
+			*gone = 1;
+			return 0;
+		}
+
+		// one timestamp per batch, the joystick interface has no better
+		memset(&ev, 0, sizeof(ev));
+		mon_now(&ev.rx);
+		ev.ts = ev.rx;
+		ev.dev = d - m->dev;
+
+		for (i = 0; i < n / (int)sizeof(struct js_event); i++) {
+			ev.init = (buf[i].type & JS_EVENT_INIT) != 0;
+			switch (buf[i].type & ~JS_EVENT_INIT)
+			{
+				case JS_EVENT_BUTTON: ev.type = MT_EV_BUTTON; break;
+				case JS_EVENT_AXIS: ev.type = MT_EV_AXIS; break;
+				default: continue;
+			}
+			ev.number = buf[i].number;
+			ev.value = buf[i].value;
+			if (mon_emit(m, d, &ev))
+				return 1;
+		}
+
+		if (n < sizeof(buf))
+			break;
+	}
+
+	return 0;
+}
+
+static int mon_readEvdev(struct monitor *m, struct mt_device *d, int *gone)
+{
+	struct input_event buf[MT_BATCH];
+	struct mt_event ev;
+	int i, n, b;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.dev = d - m->dev;
+
+	for (b = 0; b < MT_MAX_BATCHES; b++) {
+		n = read(d->fd, buf, sizeof(buf));
+		if (n <= 0) {
+			if (n < 0 && (errno == EAGAIN || errno == EINTR))
+				return 0;
+			*gone = 1;
+			return 0;
+		}
+		mon_now(&ev.rx);
+
+		for (i = 0; i < n / (int)sizeof(struct input_event); i++) {
+			struct input_event *ie = &buf[i];
+
+			ev.ts.tv_sec = ie->input_event_sec;
+			ev.ts.tv_nsec = ie->input_event_usec * 1000;
+
+			switch (ie->type)
+			{
+				case EV_KEY:
+					if (ie->code >= KEY_CNT || d->key_map[ie->code] < 0 || ie->value > 1)
+						continue;
+					ev.type = MT_EV_BUTTON;
+					ev.number = d->key_map[ie->code];
+					ev.value = ie->value;
+					break;
+
+				case EV_ABS:
+					if (ie->code >= ABS_CNT || d->abs_map[ie->code] < 0)
+						continue;
+					ev.type = MT_EV_AXIS;
+					ev.number = d->abs_map[ie->code];
+					ev.value = mon_scaleAbs(&d->absinfo[ie->code], ie->value);
+					break;
+
+				case EV_SYN:
+					if (ie->code == SYN_DROPPED) {
+						// the kernel buffer overflowed
+						if (mon_evdevSync(m, d))
+							return 1;
+					}
+					continue;
+
+				default:
+					continue;
+			}
+
+			if (mon_emit(m, d, &ev))
+				return 1;
+		}
+
+		if (n < sizeof(buf))
+			break;
+	}
+
+	return 0;
+}
+
+int mon_init(struct monitor *m, char **paths, int n)
+{
+	int i;
+
+	if (n > MT_MAX_DEVICES) {
+		fprintf(stderr, "Too many devices (max %d)\n", MT_MAX_DEVICES);
+		return -1;
+	}
+
+	m->epfd = epoll_create1(0);
+	if (m->epfd == -1) {
+		perror("epoll_create1");
+		return -1;
+	}
+
+	m->num_devices = n;
+	m->num_open = 0;
+	for (i = 0; i < n; i++) {
+		m->dev[i].path = paths[i];
+		m->dev[i].fd = -1;
+	}
+
+	return 0;
+}
+
+int mon_run(struct monitor *m)
+{
+	struct epoll_event evs[MT_MAX_DEVICES];
+	struct timespec last_reopen;
+	int i, n, timeout;
+
+	// all devices must be there at startup
+	for (i = 0; i < m->num_devices; i++) {
+		while (mon_openDevice(m, &m->dev[i])) {
+			if (errno == EAGAIN) {
+				usleep(MT_REOPEN_MS * 1000);
+				continue;
+			}
+			perror(m->dev[i].path);
+			return -1;
+		}
+	}
+	mon_now(&last_reopen);
+
+	while (1)
+	{
+		timeout = m->idle_ms;
+		if (m->num_open < m->num_devices) {
+			if (timeout < 0 || timeout > MT_REOPEN_MS)
+				timeout = MT_REOPEN_MS;
+		}
+
+		n = epoll_wait(m->epfd, evs, MT_MAX_DEVICES, timeout);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			return -1;
+		}
+
+		for (i = 0; i < n; i++) {
+			struct mt_device *d = evs[i].data.ptr;
+			int gone = 0;
+			int stop;
+
+			if (d->evdev) {
+				stop = mon_readEvdev(m, d, &gone);
+			} else {
+				stop = mon_readJs(m, d, &gone);
+			}
+			if (stop)
+				return 1;
+
+			if (gone || (evs[i].events & (EPOLLERR | EPOLLHUP))) {
+				fprintf(stderr, "%s: device lost\n", d->path);
+				mon_closeDevice(m, d);
+			}
+		}
+
+		// hot-plug: try to reopen devices that went away
+		if (m->num_open < m->num_devices && mon_msSince(&last_reopen) >= MT_REOPEN_MS) {
+			for (i = 0; i < m->num_devices; i++) {
+				if (m->dev[i].fd == -1)
+					mon_openDevice(m, &m->dev[i]);
+			}
+			mon_now(&last_reopen);
+		}
+
+		if (m->rec)
+			rec_flush(m->rec);
+		if (m->on_idle && m->on_idle(m))
+			return 1;
+	}
+}
+
+void mon_close(struct monitor *m)
+{
+	int i;
+
+	for (i = 0; i < m->num_devices; i++) {
+		if (m->dev[i].fd != -1)
+			mon_closeDevice(m, &m->dev[i]);
+	}
+	close(m->epfd);
+}
@@ -0,0 +1,73 @@
+#ifndef _monitor_h__
+#define _monitor_h__
+
+#include <time.h>
+#include <linux/input.h>
+
+#define MT_MAX_DEVICES	16
+#define MT_MAX_AXES		ABS_CNT
+#define MT_MAX_BUTTONS	KEY_CNT
+
+#define MT_EV_BUTTON	1
+#define MT_EV_AXIS		2
+
+/* An event from a joystick (/dev/input/js*) or evdev (/dev/input/event*)
+ * device. Buttons and axes are numbered the way the joystick interface
+ * does it, so the displayers work with both. */
+struct mt_event {
+	struct timespec ts; // CLOCK_MONOTONIC. Kernel timestamp for evdev devices.
+	struct timespec rx; // CLOCK_MONOTONIC. When the event was read.
+	int dev;
+	int type; // MT_EV_*
+	int number;
+	int value;
+	int init; // initial state, not an actual event
+};
+
+struct mt_device {
+	const char *path;
+	int fd;
+	int evdev;
+	char name[256];
+
+	int num_axes;
+	int num_buttons;
+	short axes[MT_MAX_AXES];
+	short buttons[MT_MAX_BUTTONS];
+
+	// evdev only: code to axis/button number, and ranges for scaling
+	short key_map[KEY_CNT];
+	short abs_map[ABS_CNT];
+	struct input_absinfo absinfo[ABS_CNT];
+};
+
+struct monitor {
+	struct mt_device dev[MT_MAX_DEVICES];
+	int num_devices;
+	int epfd;
+	int num_open;
+
+	// Called when a device is (re)opened.
+	void (*on_open)(struct monitor *m, struct mt_device *d);
+	// Called for every event. Returning non-zero stops mon_run.
+	int (*on_event)(struct monitor *m, struct mt_device *d, const struct mt_event *ev);
+	// Called after each batch of events, and at least every idle_ms when
+	// idle_ms is not -1. Returning non-zero stops mon_run.
+	int (*on_idle)(struct monitor *m);
+	int idle_ms;
+
+	// When set, everything is also written to this session log
+	struct recorder *rec;
+
+	void *ctx;
+};
+
+int mon_init(struct monitor *m, char **paths, int n);
+int mon_run(struct monitor *m);
+void mon_close(struct monitor *m);
+
+/* Update the device state and pass the event to on_event. Used by the
+ * readers, and by the log replay. */
+int mon_emit(struct monitor *m, struct mt_device *d, struct mt_event *ev);
+
+#endif // _monitor_h__
@@ -0,0 +1,347 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "monitor.h"
+#include "record.h"
+
+_Static_assert(sizeof(struct rec_event) == 24, "rec_event size");
+_Static_assert(sizeof(struct rec_device) <= REC_DEVICE_RECORDS * sizeof(struct rec_event), "rec_device size");
+
+/* Records passed to the callbacks between on_idle calls */
+#define REC_BATCH			64
+/* Already replayed pages are dropped every REC_DROP_BYTES */
+#define REC_DROP_BYTES		(16 << 20)
+/* Paced replay: longer pauses are shortened to this */
+#define REC_MAX_GAP_NS		1000000000LL
+
+static uint64_t rec_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static void rec_timespec(struct timespec *ts, uint64_t ns)
+{
+	ts->tv_sec = ns / 1000000000ULL;
+	ts->tv_nsec = ns % 1000000000ULL;
+}
+
+int rec_open(struct recorder *r, const char *path, int num_devices)
+{
+	struct rec_header h;
+	long size;
+
+	memset(r, 0, sizeof(struct recorder));
+
+	r->fp = fopen(path, "a+b");
+	if (!r->fp) {
+		perror(path);
+		return -1;
+	}
+	setvbuf(r->fp, NULL, _IOFBF, 65536);
+
+	fseek(r->fp, 0, SEEK_END);
+	size = ftell(r->fp);
+
+	if (size == 0) {
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, REC_MAGIC, sizeof(h.magic));
+		h.num_devices = num_devices;
+		h.record_size = sizeof(struct rec_event);
+		fwrite(&h, sizeof(h), 1, r->fp);
+		return 0;
+	}
+
+	// appending to a previous session
+	rewind(r->fp);
+	if (fread(&h, sizeof(h), 1, r->fp) != 1 || memcmp(h.magic, REC_MAGIC, sizeof(h.magic))) {
+		fprintf(stderr, "%s: not a maptest log\n", path);
+		goto fail;
+	}
+	if (h.num_devices != num_devices || h.record_size != sizeof(struct rec_event)) {
+		fprintf(stderr, "%s: recorded with %d devices, cannot append\n", path, h.num_devices);
+		goto fail;
+	}
+
+	// drop what a crash may have left of a record
+	size -= (size - sizeof(h)) % sizeof(struct rec_event);
+	if (ftruncate(fileno(r->fp), size)) {
+		perror("ftruncate");
+		goto fail;
+	}
+	fseek(r->fp, 0, SEEK_END);
+
+	return 0;
+
+fail:
+	fclose(r->fp);
+	r->fp = NULL;
+	return -1;
+}
+
+void rec_device(struct recorder *r, int dev, const struct mt_device *d)
+{
+	struct rec_event recs[1 + REC_DEVICE_RECORDS];
+	struct rec_device *rd = (struct rec_device *)&recs[1];
+	struct timespec now;
+
+	memset(recs, 0, sizeof(recs));
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	recs[0].ts_ns = rec_ns(&now);
+	recs[0].dev = dev;
+	recs[0].type = REC_OPEN;
+	recs[0].number = REC_DEVICE_RECORDS;
+
+	rd->num_axes = d->num_axes;
+	rd->num_buttons = d->num_buttons;
+	rd->evdev = d->evdev;
+	memcpy(rd->name, d->name, REC_NAME_LEN - 1);
+
+	fwrite(recs, sizeof(recs), 1, r->fp);
+	r->records += 1 + REC_DEVICE_RECORDS;
+}
+
+void rec_event(struct recorder *r, const struct mt_event *ev)
+{
+	struct rec_event rec;
+	int64_t rx;
+
+	rec.ts_ns = rec_ns(&ev->ts);
+	rx = rec_ns(&ev->rx) - rec.ts_ns;
+	rec.rx_ns = rx < 0 || rx >= REC_RX_UNKNOWN ? REC_RX_UNKNOWN : rx;
+	rec.value = ev->value;
+	rec.number = ev->number;
+	rec.dev = ev->dev;
+	rec.type = ev->type | (ev->init ? REC_INIT : 0);
+	rec.reserved = 0;
+
+	fwrite(&rec, sizeof(rec), 1, r->fp);
+	r->records++;
+}
+
+int rec_flush(struct recorder *r)
+{
+	if (fflush(r->fp)) {
+		perror("log");
+		return -1;
+	}
+	return 0;
+}
+
+void rec_close(struct recorder *r)
+{
+	if (r->fp) {
+		rec_flush(r);
+		fclose(r->fp);
+		r->fp = NULL;
+	}
+}
+
+int rec_numDevices(const char *path)
+{
+	struct rec_header h;
+	FILE *fp;
+	int ok;
+
+	fp = fopen(path, "rb");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+	ok = fread(&h, sizeof(h), 1, fp) == 1 && !memcmp(h.magic, REC_MAGIC, sizeof(h.magic));
+	fclose(fp);
+
+	if (!ok || h.num_devices < 1 || h.num_devices > MT_MAX_DEVICES) {
+		fprintf(stderr, "%s: not a maptest log\n", path);
+		return -1;
+	}
+
+	return h.num_devices;
+}
+
+static void rec_openDevice(struct monitor *m, struct mt_device *d, const struct rec_device *rd)
+{
+	memset(d->name, 0, sizeof(d->name));
+	memcpy(d->name, rd->name, REC_NAME_LEN);
+	d->name[REC_NAME_LEN - 1] = 0;
+	d->num_axes = rd->num_axes;
+	d->num_buttons = rd->num_buttons;
+	d->evdev = rd->evdev;
+	memset(d->axes, 0, sizeof(d->axes));
+	memset(d->buttons, 0, sizeof(d->buttons));
+
+	if (m->rec)
+		rec_device(m->rec, d - m->dev, d);
+	if (m->on_open)
+		m->on_open(m, d);
+}
+
+/* Paced replay: wait until the record is due */
+static void rec_pace(uint64_t ts, uint64_t *prev_ts, uint64_t *due, double speed)
+{
+	struct timespec t;
+	int64_t gap = ts - *prev_ts;
+
+	// another session appended to the log, or a long idle period
+	if (gap < 0)
+		gap = 0;
+	if (gap > REC_MAX_GAP_NS)
+		gap = REC_MAX_GAP_NS;
+
+	*due += gap / speed;
+	*prev_ts = ts;
+
+	rec_timespec(&t, *due);
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+}
+
+int rec_replay(struct monitor *m, const char *path, double speed)
+{
+	const struct rec_header *h;
+	const struct rec_event *recs;
+	struct timespec now;
+	struct stat st;
+	uint64_t n, i, prev_ts = 0, due = 0;
+	size_t dropped = 0;
+	unsigned char *map;
+	int fd, res = 0;
+	long page = sysconf(_SC_PAGESIZE);
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror(path);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		perror("fstat");
+		close(fd);
+		return -1;
+	}
+	if (st.st_size < sizeof(struct rec_header)) {
+		fprintf(stderr, "%s: not a maptest log\n", path);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	h = (const struct rec_header *)map;
+	if (memcmp(h->magic, REC_MAGIC, sizeof(h->magic)) || h->record_size != sizeof(struct rec_event) ||
+		h->num_devices < 1 || h->num_devices > MT_MAX_DEVICES)
+	{
+		fprintf(stderr, "%s: not a maptest log\n", path);
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	m->num_devices = h->num_devices;
+	m->num_open = 0;
+	for (i = 0; i < m->num_devices; i++) {
+		m->dev[i].path = path;
+		m->dev[i].fd = -1;
+	}
+
+	recs = (const struct rec_event *)(map + sizeof(struct rec_header));
+	n = (st.st_size - sizeof(struct rec_header)) / sizeof(struct rec_event);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	due = rec_ns(&now);
+	if (n)
+		prev_ts = recs[0].ts_ns;
+
+	for (i = 0; i < n; i++) {
+		const struct rec_event *r = &recs[i];
+		struct mt_device *d;
+		struct mt_event ev;
+
+		if (r->dev >= m->num_devices)
+			continue;
+		d = &m->dev[r->dev];
+
+		if (speed > 0) {
+			rec_pace(r->ts_ns, &prev_ts, &due, speed);
+		}
+
+		if (r->type == REC_OPEN) {
+			if (i + r->number >= n)
+				break;
+			if (r->number >= REC_DEVICE_RECORDS) {
+				rec_openDevice(m, d, (const struct rec_device *)&r[1]);
+			}
+			i += r->number;
+			continue;
+		}
+
+		memset(&ev, 0, sizeof(ev));
+		rec_timespec(&ev.ts, r->ts_ns);
+		rec_timespec(&ev.rx, r->ts_ns + (r->rx_ns == REC_RX_UNKNOWN ? 0 : r->rx_ns));
+		ev.dev = r->dev;
+		ev.type = r->type & REC_TYPE_MASK;
+		ev.number = r->number;
+		ev.value = r->value;
+		ev.init = (r->type & REC_INIT) != 0;
+
+		if (ev.type != MT_EV_BUTTON && ev.type != MT_EV_AXIS)
+			continue;
+
+		if (mon_emit(m, d, &ev)) {
+			res = 1;
+			break;
+		}
+
+		// paced: after every event, like a live batch
+		if (speed > 0 || (i % REC_BATCH) == REC_BATCH - 1) {
+			if (m->rec)
+				rec_flush(m->rec);
+			if (m->on_idle && m->on_idle(m)) {
+				res = 1;
+				break;
+			}
+		}
+
+		// Replayed pages will not be needed again. Dropping them keeps
+		// the memory use flat, however long the session.
+		if ((unsigned char *)r - map - dropped >= REC_DROP_BYTES) {
+			size_t end = ((unsigned char *)r - map) & ~(page - 1);
+
+			madvise(map + dropped, end - dropped, MADV_DONTNEED);
+			dropped = end;
+		}
+	}
+
+	if (!res && m->on_idle)
+		res = m->on_idle(m);
+
+	munmap(map, st.st_size);
+
+	return res;
+}
@@ -0,0 +1,77 @@
+#ifndef _record_h__
+#define _record_h__
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct monitor;
+struct mt_device;
+struct mt_event;
+
+/* Session log format
+ *
+ * A header followed by fixed size records, appended as the events
+ * arrive. A file can be appended to by later sessions with the same
+ * number of devices. All values are in host byte order.
+ *
+ * When a device is opened, a REC_OPEN record is written, followed by
+ * REC_DEVICE_RECORDS records holding a struct rec_device. */
+#define REC_MAGIC			"MTREC\x01\x00\x00"
+
+#define REC_TYPE_MASK		0x0f	// MT_EV_BUTTON or MT_EV_AXIS
+#define REC_INIT			0x80
+#define REC_OPEN			0x0f
+
+#define REC_RX_UNKNOWN		0xffffffff
+
+struct rec_header {
+	char magic[8];
+	uint32_t num_devices;
+	uint32_t record_size;
+};
+
+struct rec_event {
+	uint64_t ts_ns;		// CLOCK_MONOTONIC
+	uint32_t rx_ns;		// read time - ts_ns, or REC_RX_UNKNOWN
+	int32_t value;
+	uint16_t number;
+	uint8_t dev;
+	uint8_t type;		// REC_* and MT_EV_* flags
+	uint32_t reserved;
+};
+
+#define REC_NAME_LEN		64
+#define REC_DEVICE_RECORDS	3
+
+struct rec_device {
+	uint16_t num_axes;
+	uint16_t num_buttons;
+	uint8_t evdev;
+	uint8_t reserved[3];
+	char name[REC_NAME_LEN];
+};
+
+struct recorder {
+	FILE *fp;
+	uint64_t records;
+};
+
+/* Open for appending. Creates the file when it does not exist. */
+int rec_open(struct recorder *r, const char *path, int num_devices);
+void rec_device(struct recorder *r, int dev, const struct mt_device *d);
+void rec_event(struct recorder *r, const struct mt_event *ev);
+/* Write what is buffered. Called once per batch of events. */
+int rec_flush(struct recorder *r);
+void rec_close(struct recorder *r);
+
+/* Number of devices in a log, -1 if it cannot be read */
+int rec_numDevices(const char *path);
+
+/* Feed a log to the monitor callbacks, as if it came from the devices.
+ *
+ * speed: 0 as fast as possible, 1.0 in real time, 2.0 twice as fast...
+ *
+ * Returns like mon_run. */
+int rec_replay(struct monitor *m, const char *path, double speed);
+
+#endif // _record_h__
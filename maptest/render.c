@@ -0,0 +1,174 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+#include "render.h"
+
+/* Unchanged cells between two changed ones are rewritten rather than
+ * skipped when this is cheaper than a cursor move sequence. */
+#define RD_MERGE_GAP	8
+
+// worst case: a cursor move for every cell
+#define RD_OUT_SIZE		(RD_MAX_ROWS * RD_MAX_COLS * 12)
+
+static char rd_out[RD_OUT_SIZE];
+
+void rd_init(struct render *r, int fd, int fps)
+{
+	struct winsize ws;
+
+	memset(r, 0, sizeof(struct render));
+	r->fd = fd;
+	r->rows = RD_MAX_ROWS;
+	r->cols = RD_MAX_COLS;
+
+	// Stay inside the terminal. Writing the last column would wrap
+	// or scroll on some terminals.
+	if (ioctl(fd, TIOCGWINSZ, &ws) == 0 && ws.ws_row && ws.ws_col) {
+		if (ws.ws_row < r->rows)
+			r->rows = ws.ws_row;
+		if (ws.ws_col - 1 < r->cols)
+			r->cols = ws.ws_col - 1;
+	}
+
+	r->frame_ms = fps > 0 ? 1000 / fps : 0;
+
+	// the terminal is cleared by the first flush
+	memset(r->frame, ' ', sizeof(r->frame));
+	memset(r->shown, 0, sizeof(r->shown));
+}
+
+void rd_home(struct render *r)
+{
+	memset(r->frame, ' ', sizeof(r->frame));
+	r->row = 0;
+	r->col = 0;
+}
+
+void rd_printf(struct render *r, const char *fmt, ...)
+{
+	char tmp[RD_MAX_COLS * 2];
+	va_list ap;
+	int i, n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+	va_end(ap);
+
+	if (n > (int)sizeof(tmp) - 1)
+		n = sizeof(tmp) - 1;
+
+	for (i = 0; i < n; i++) {
+		if (tmp[i] == '\n') {
+			r->row++;
+			r->col = 0;
+			continue;
+		}
+		if (r->row < r->rows && r->col < r->cols)
+			r->frame[r->row][r->col] = tmp[i];
+		r->col++;
+	}
+}
+
+static int rd_msSince(const struct timespec *t)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t->tv_sec) * 1000 + (now.tv_nsec - t->tv_nsec) / 1000000;
+}
+
+int rd_wait(const struct render *r)
+{
+	int elapsed;
+
+	if (!r->frame_ms || !r->frames)
+		return 0;
+
+	elapsed = rd_msSince(&r->last_frame);
+	if (elapsed >= r->frame_ms)
+		return 0;
+
+	return r->frame_ms - elapsed;
+}
+
+int rd_flush(struct render *r)
+{
+	char *p = rd_out;
+	int y, x, end, len;
+	int written = 0;
+
+	if (!r->frames) {
+		p += sprintf(p, "\033[2J");
+		memset(r->shown, ' ', sizeof(r->shown));
+	}
+
+	for (y = 0; y < r->rows; y++) {
+		const char *f = r->frame[y];
+		char *s = r->shown[y];
+
+		x = 0;
+		while (x < r->cols) {
+			if (f[x] == s[x]) {
+				x++;
+				continue;
+			}
+
+			// extend the run over gaps shorter than a cursor move
+			end = x + 1;
+			while (end < r->cols) {
+				int gap = 0;
+
+				while (end + gap < r->cols && f[end + gap] == s[end + gap] && gap < RD_MERGE_GAP)
+					gap++;
+				if (end + gap >= r->cols || gap >= RD_MERGE_GAP)
+					break;
+				end += gap + 1;
+			}
+
+			p += sprintf(p, "\033[%d;%dH", y + 1, x + 1);
+			memcpy(p, f + x, end - x);
+			memcpy(s + x, f + x, end - x);
+			p += end - x;
+			x = end;
+		}
+	}
+
+	len = p - rd_out;
+	while (written < len) {
+		int n = write(r->fd, rd_out + written, len - written);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("write");
+			return -1;
+		}
+		written += n;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &r->last_frame);
+	r->frames++;
+	r->bytes += len;
+
+	return len;
+}
@@ -0,0 +1,41 @@
+#ifndef _render_h__
+#define _render_h__
+
+#include <time.h>
+
+#define RD_MAX_ROWS		64
+#define RD_MAX_COLS		128
+
+/* A model of the screen. Displayers draw a whole frame in memory with
+ * rd_home() and rd_printf(). rd_flush() then sends only the cells that
+ * differ from what the terminal shows, in a single write, and at most
+ * once per frame interval. */
+struct render {
+	int fd;
+	int rows, cols;
+
+	char frame[RD_MAX_ROWS][RD_MAX_COLS]; // being drawn
+	char shown[RD_MAX_ROWS][RD_MAX_COLS]; // on the terminal
+	int row, col;
+
+	int frame_ms; // minimum time between frames, 0 for no limit
+	struct timespec last_frame;
+
+	// statistics
+	unsigned long frames;
+	unsigned long bytes;
+};
+
+void rd_init(struct render *r, int fd, int fps);
+
+/* Start a new frame: blank model, cursor at the top left */
+void rd_home(struct render *r);
+void rd_printf(struct render *r, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/* Milliseconds before the next frame may be sent, 0 if now. */
+int rd_wait(const struct render *r);
+
+/* Send the changes. Returns the number of bytes written, -1 on error. */
+int rd_flush(struct render *r);
+
+#endif // _render_h__
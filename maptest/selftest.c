@@ -0,0 +1,202 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+
+#include "selftest.h"
+
+#define SELFTEST_NAME	"maptest self-test"
+
+static int st_emit(int fd, int type, int code, int value)
+{
+	struct input_event ie;
+
+	memset(&ie, 0, sizeof(ie));
+	ie.type = type;
+	ie.code = code;
+	ie.value = value;
+
+	return write(fd, &ie, sizeof(ie)) != sizeof(ie);
+}
+
+static void st_addNs(struct timespec *ts, long ns)
+{
+	ts->tv_nsec += ns;
+	while (ts->tv_nsec >= 1000000000L) {
+		ts->tv_nsec -= 1000000000L;
+		ts->tv_sec++;
+	}
+}
+
+/* The schedule: every period, press button 0 and move axis 0 to the
+ * other side. Release half a period later. */
+static void *st_emitter(void *arg)
+{
+	struct selftest *t = arg;
+	struct timespec next;
+	int k;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	st_addNs(&next, 100 * 1000000L); // let the reader settle
+
+	for (k = 0; k < t->count; k++) {
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		clock_gettime(CLOCK_MONOTONIC, &t->emit_times[k]);
+		__atomic_store_n(&t->emitted, k + 1, __ATOMIC_RELEASE);
+
+		st_emit(t->fd, EV_KEY, BTN_A, 1);
+		st_emit(t->fd, EV_ABS, ABS_X, k & 1 ? 32767 : -32767);
+		st_emit(t->fd, EV_SYN, SYN_REPORT, 0);
+
+		st_addNs(&next, t->period_us * 500L);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		st_emit(t->fd, EV_KEY, BTN_A, 0);
+		st_emit(t->fd, EV_SYN, SYN_REPORT, 0);
+
+		st_addNs(&next, t->period_us * 500L);
+	}
+
+	t->done = 1;
+
+	return NULL;
+}
+
+static int st_findNode(struct selftest *t)
+{
+	char sysname[64];
+	char path[128];
+	struct dirent *de;
+	DIR *dir;
+
+	if (ioctl(t->fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+		perror("UI_GET_SYSNAME");
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s", sysname);
+	dir = opendir(path);
+	if (!dir) {
+		perror(path);
+		return -1;
+	}
+
+	while ((de = readdir(dir))) {
+		if (!strncmp(de->d_name, "event", 5)) {
+			snprintf(t->devpath, sizeof(t->devpath), "/dev/input/%s", de->d_name);
+			break;
+		}
+	}
+	closedir(dir);
+
+	return t->devpath[0] ? 0 : -1;
+}
+
+int selftest_create(struct selftest *t, int period_us, int count)
+{
+	struct uinput_setup us;
+	struct uinput_abs_setup abs;
+	int i;
+
+	memset(t, 0, sizeof(struct selftest));
+	t->fd = -1;
+	t->period_us = period_us;
+	t->count = count;
+	t->emit_times = calloc(count, sizeof(struct timespec));
+	if (!t->emit_times) {
+		perror("calloc");
+		return -1;
+	}
+
+	t->fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+	if (t->fd == -1) {
+		perror("/dev/uinput");
+		return -1;
+	}
+
+	ioctl(t->fd, UI_SET_EVBIT, EV_KEY);
+	ioctl(t->fd, UI_SET_KEYBIT, BTN_A);
+	ioctl(t->fd, UI_SET_KEYBIT, BTN_B);
+	ioctl(t->fd, UI_SET_EVBIT, EV_ABS);
+	ioctl(t->fd, UI_SET_ABSBIT, ABS_X);
+	ioctl(t->fd, UI_SET_ABSBIT, ABS_Y);
+
+	memset(&us, 0, sizeof(us));
+	us.id.bustype = BUS_VIRTUAL;
+	us.id.vendor = 0x289b; // raphnet
+	us.id.product = 0xffff;
+	strcpy(us.name, SELFTEST_NAME);
+	if (ioctl(t->fd, UI_DEV_SETUP, &us)) {
+		perror("UI_DEV_SETUP");
+		return -1;
+	}
+
+	for (i = ABS_X; i <= ABS_Y; i++) {
+		memset(&abs, 0, sizeof(abs));
+		abs.code = i;
+		abs.absinfo.minimum = -32767;
+		abs.absinfo.maximum = 32767;
+		ioctl(t->fd, UI_ABS_SETUP, &abs);
+	}
+
+	if (ioctl(t->fd, UI_DEV_CREATE)) {
+		perror("UI_DEV_CREATE");
+		return -1;
+	}
+
+	if (st_findNode(t))
+		return -1;
+
+	// wait for udev to create the node
+	for (i = 0; i < 40; i++) {
+		if (access(t->devpath, R_OK) == 0)
+			return 0;
+		usleep(50000);
+	}
+
+	fprintf(stderr, "%s did not appear\n", t->devpath);
+	return -1;
+}
+
+int selftest_start(struct selftest *t)
+{
+	if (pthread_create(&t->thread, NULL, st_emitter, t)) {
+		perror("pthread_create");
+		return -1;
+	}
+	return 0;
+}
+
+void selftest_destroy(struct selftest *t)
+{
+	if (t->thread) {
+		pthread_join(t->thread, NULL);
+	}
+	if (t->fd != -1) {
+		ioctl(t->fd, UI_DEV_DESTROY);
+		close(t->fd);
+	}
+	free(t->emit_times);
+}
@@ -0,0 +1,28 @@
+#ifndef _selftest_h__
+#define _selftest_h__
+
+#include <pthread.h>
+#include <time.h>
+
+/* A local uinput joystick that emits a known schedule of button presses
+ * and axis moves, to check the statistics without an adapter. */
+struct selftest {
+	int fd;
+	char devpath[300];
+
+	int period_us;
+	int count;
+
+	// when each press was written, for latency
+	struct timespec *emit_times;
+	volatile int emitted;
+	volatile int done;
+
+	pthread_t thread;
+};
+
+int selftest_create(struct selftest *t, int period_us, int count);
+int selftest_start(struct selftest *t);
+void selftest_destroy(struct selftest *t);
+
+#endif // _selftest_h__
@@ -0,0 +1,199 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+static int st_bucket(uint64_t v)
+{
+	int msb, shift;
+
+	if (v < ST_SUB)
+		return v;
+
+	msb = 63 - __builtin_clzll(v);
+	shift = msb - ST_SUB_BITS;
+
+	return ((shift + 1) << ST_SUB_BITS) + ((v >> shift) & (ST_SUB - 1));
+}
+
+// lowest value of a bucket
+static uint64_t st_bucketLow(int b)
+{
+	int shift;
+
+	if (b < ST_SUB)
+		return b;
+
+	shift = (b >> ST_SUB_BITS) - 1;
+	return ((uint64_t)(ST_SUB + (b & (ST_SUB - 1)))) << shift;
+}
+
+void st_histAdd(struct st_hist *h, uint64_t v)
+{
+	if (!h->count || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->count++;
+	h->sum += v;
+	h->buckets[st_bucket(v)]++;
+}
+
+uint64_t st_histPercentile(const struct st_hist *h, double p)
+{
+	uint64_t target, n = 0;
+	int b;
+
+	if (!h->count)
+		return 0;
+
+	target = (uint64_t)(p / 100.0 * h->count + 0.5);
+	if (target < 1)
+		target = 1;
+
+	for (b = 0; b < ST_BUCKETS; b++) {
+		n += h->buckets[b];
+		if (n >= target) {
+			// middle of the bucket, within the observed range
+			uint64_t low = st_bucketLow(b);
+			uint64_t high = b + 1 < ST_BUCKETS ? st_bucketLow(b + 1) : low;
+			uint64_t v = low + (high - low) / 2;
+
+			if (v < h->min) v = h->min;
+			if (v > h->max) v = h->max;
+			return v;
+		}
+	}
+
+	return h->max;
+}
+
+int64_t ts_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+	return (int64_t)(a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+struct stats *stats_new(void)
+{
+	return calloc(1, sizeof(struct stats));
+}
+
+void stats_free(struct stats *st)
+{
+	int d, t, n;
+
+	if (!st)
+		return;
+
+	for (d = 0; d < MT_MAX_DEVICES; d++)
+		for (t = 0; t < 2; t++)
+			for (n = 0; n < MT_MAX_BUTTONS; n++)
+				free(st->chan[d][t][n]);
+	free(st);
+}
+
+void stats_add(struct stats *st, const struct mt_event *ev, int64_t latency_ns)
+{
+	struct st_channel *c;
+	int t = ev->type - 1;
+
+	if (ev->init || ev->dev >= MT_MAX_DEVICES || ev->number >= MT_MAX_BUTTONS)
+		return;
+
+	// Only presses count for buttons
+	if (ev->type == MT_EV_BUTTON && !ev->value)
+		return;
+
+	c = st->chan[ev->dev][t][ev->number];
+	if (!c) {
+		c = calloc(1, sizeof(struct st_channel));
+		if (!c) {
+			perror("calloc");
+			return;
+		}
+		st->chan[ev->dev][t][ev->number] = c;
+	}
+
+	c->count++;
+	if (c->have_last) {
+		int64_t d = ts_diff_ns(&ev->ts, &c->last);
+
+		if (d >= 0)
+			st_histAdd(&c->interval, d);
+	}
+	c->last = ev->ts;
+	c->have_last = 1;
+
+	if (latency_ns >= 0)
+		st_histAdd(&c->latency, latency_ns);
+
+	st->events++;
+}
+
+const struct st_channel *stats_get(const struct stats *st, int dev, int type, int number)
+{
+	if (dev >= MT_MAX_DEVICES || number >= MT_MAX_BUTTONS)
+		return NULL;
+	return st->chan[dev][type - 1][number];
+}
+
+static void st_printHist(FILE *fp, const struct st_hist *h)
+{
+	if (!h->count) {
+		fprintf(fp, " %8s %8s %8s %8s", "-", "-", "-", "-");
+		return;
+	}
+
+	fprintf(fp, " %8.3f %8.3f %8.3f %8.3f",
+		st_histPercentile(h, 50) / 1e6,
+		st_histPercentile(h, 90) / 1e6,
+		st_histPercentile(h, 99) / 1e6,
+		h->max / 1e6);
+}
+
+void stats_print(const struct stats *st, FILE *fp)
+{
+	int d, t, n;
+
+	fprintf(fp, "%-23s | %-35s  | %s\n", "", " interval (ms)", " latency (ms)");
+	fprintf(fp, "%-3s %-6s %3s %8s | %8s %8s %8s %8s  | %8s %8s %8s %8s\n",
+		"dev", "type", "id", "count",
+		"p50", "p90", "p99", "max",
+		"p50", "p90", "p99", "max");
+
+	for (d = 0; d < MT_MAX_DEVICES; d++) {
+		for (t = 0; t < 2; t++) {
+			for (n = 0; n < MT_MAX_BUTTONS; n++) {
+				const struct st_channel *c = st->chan[d][t][n];
+
+				if (!c)
+					continue;
+
+				fprintf(fp, "%-3d %-6s %3d %8llu |", d, t ? "axis" : "button", n,
+					(unsigned long long)c->count);
+				st_printHist(fp, &c->interval);
+				fprintf(fp, "  |");
+				st_printHist(fp, &c->latency);
+				fprintf(fp, "\n");
+			}
+		}
+	}
+	fprintf(fp, "%llu events\n\n", (unsigned long long)st->events);
+}
@@ -0,0 +1,54 @@
+#ifndef _stats_h__
+#define _stats_h__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "monitor.h"
+
+/* Log-linear histogram: each power of two is divided in 2^ST_SUB_BITS
+ * buckets, so values are kept with about 6% precision from 1ns up. */
+#define ST_SUB_BITS		4
+#define ST_SUB			(1 << ST_SUB_BITS)
+#define ST_BUCKETS		((64 - ST_SUB_BITS + 1) << ST_SUB_BITS)
+
+struct st_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min, max;
+	uint32_t buckets[ST_BUCKETS];
+};
+
+void st_histAdd(struct st_hist *h, uint64_t v);
+uint64_t st_histPercentile(const struct st_hist *h, double p);
+
+/* Per button or axis statistics.
+ *
+ * interval: between presses (buttons) or between events (axes).
+ * latency: from the reference time given to stats_add to the kernel
+ *          timestamp, or from the kernel timestamp to the read. */
+struct st_channel {
+	uint64_t count;
+	struct st_hist interval;
+	struct st_hist latency;
+	struct timespec last;
+	int have_last;
+};
+
+struct stats {
+	struct st_channel *chan[MT_MAX_DEVICES][2][MT_MAX_BUTTONS];
+	uint64_t events;
+};
+
+struct stats *stats_new(void);
+void stats_free(struct stats *st);
+
+/* Add an event. latency_ns is < 0 when unknown. Init events are ignored. */
+void stats_add(struct stats *st, const struct mt_event *ev, int64_t latency_ns);
+
+const struct st_channel *stats_get(const struct stats *st, int dev, int type, int number);
+
+void stats_print(const struct stats *st, FILE *fp);
+
+int64_t ts_diff_ns(const struct timespec *a, const struct timespec *b);
+
+#endif // _stats_h__
@@ -0,0 +1,82 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2014  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <string.h>
+#include "prof.h"
+
+#ifdef WITH_PROFILING
+
+static struct prof_site prof_sites[PROF_NUM_SITES];
+
+void prof_record(unsigned char site, unsigned short ticks)
+{
+	struct prof_site *s = &prof_sites[site];
+
+	// 0xFFFF durations of 0xFFFF ticks still fit in the sum
+	if (s->count == 0xFFFF)
+		return;
+
+	if (!s->count || ticks < s->min)
+		s->min = ticks;
+	if (ticks > s->max)
+		s->max = ticks;
+	s->sum += ticks;
+	s->count++;
+}
+
+void prof_clear(void)
+{
+	unsigned char sreg;
+
+	sreg = SREG;
+	cli();
+	memset(prof_sites, 0, sizeof(prof_sites));
+	SREG = sreg;
+}
+
+// win: PROF_WIN_SIZE bytes, see prof.h
+void prof_window(unsigned char site, unsigned char *win)
+{
+	struct prof_site s;
+	unsigned char sreg;
+
+	memset(win, 0, PROF_WIN_SIZE);
+	win[PROF_WIN_SITE] = site + 1;
+	win[PROF_WIN_NUM_SITES] = PROF_NUM_SITES;
+	win[PROF_WIN_MHZ] = F_CPU / 1000000L;
+	if (site >= PROF_NUM_SITES)
+		return;
+
+	sreg = SREG;
+	cli();
+	s = prof_sites[site];
+	SREG = sreg;
+
+	win[PROF_WIN_COUNT] = s.count;
+	win[PROF_WIN_COUNT + 1] = s.count >> 8;
+	win[PROF_WIN_MIN] = s.min;
+	win[PROF_WIN_MIN + 1] = s.min >> 8;
+	win[PROF_WIN_MAX] = s.max;
+	win[PROF_WIN_MAX + 1] = s.max >> 8;
+	win[PROF_WIN_SUM] = s.sum;
+	win[PROF_WIN_SUM + 1] = s.sum >> 8;
+	win[PROF_WIN_SUM + 2] = s.sum >> 16;
+	win[PROF_WIN_SUM + 3] = s.sum >> 24;
+}
+
+#endif // WITH_PROFILING
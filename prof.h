@@ -0,0 +1,76 @@
+#ifndef _prof_h__
+#define _prof_h__
+
+/* Hot path profiling, with -DWITH_PROFILING. Each site keeps the count,
+ * minimum, maximum and sum of its durations, in time base ticks (see
+ * timebase.h). Without WITH_PROFILING the macros are empty.
+ *
+ *	PROF_START(t);
+ *	...
+ *	PROF_END(PROF_GUN_UPDATE, t);
+ *
+ * The sites cover the steps timed in the comments of main.c. The TWI
+ * sites are the states of the TWI interrupt handler. */
+#define PROF_DELAY_A			0	// poll to sample (A)
+#define PROF_POLL_PERIOD		1	// between polls of channel 0 (B)
+#define PROF_TWI_READ			2	// read transfer, address to the last byte (D)
+#define PROF_GUN_UPDATE			3
+#define PROF_DATA_TO_CLASSIC	4
+#define PROF_PACK_CLASSIC		5
+#define PROF_NEWACTION			6
+#define PROF_GENTABS			7
+#define PROF_TWI_RX_START		8
+#define PROF_TWI_RX_BYTE		9
+#define PROF_TWI_RX_STOP		10
+#define PROF_TWI_TX_START		11
+#define PROF_TWI_TX_BYTE		12
+#define PROF_TWI_TX_END			13
+#define PROF_TWI_OTHER			14
+#define PROF_NUM_SITES			15
+
+#define PROF_SITE_NAMES	{ "delay A", "poll period", "TWI read", "gunUpdate", \
+	"dataToClassic", "pack_classic_data", "wm_newaction", "wm_gentabs", \
+	"TWI rx start", "TWI rx byte", "TWI rx stop", "TWI tx start", "TWI tx byte", \
+	"TWI tx end", "TWI other" }
+
+/* Register window, for reading the results over the Wiimote bus. The
+ * master writes n to WM_REG_PROF_SITE, and site n-1 is shown from
+ * WM_REG_PROF_WINDOW after the next sample, little endian. Writing 0xFF
+ * clears all the sites. */
+#define WM_REG_PROF_SITE		0xF9
+#define WM_REG_PROF_WINDOW		0xE0
+#define PROF_WIN_SITE			0	// n, as written
+#define PROF_WIN_NUM_SITES		1
+#define PROF_WIN_MHZ			2	// F_CPU, ticks are 8 clocks
+#define PROF_WIN_COUNT			3
+#define PROF_WIN_MIN			5
+#define PROF_WIN_MAX			7
+#define PROF_WIN_SUM			9
+#define PROF_WIN_SIZE			13
+#define PROF_CLEAR				0xFF
+
+#ifdef WITH_PROFILING
+#include "timebase.h"
+#ifndef HAVE_TIMEBASE
+#error WITH_PROFILING needs the time base (Timer1)
+#endif
+
+struct prof_site {
+	unsigned short count, min, max; // the count stops at 0xFFFF
+	unsigned long sum;
+};
+
+/* Safe from interrupt handlers, as long as a site is recorded from one
+ * context only. */
+void prof_record(unsigned char site, unsigned short ticks);
+void prof_clear(void);
+void prof_window(unsigned char site, unsigned char *win);
+
+#define PROF_START(t)			unsigned short t = timebase_now()
+#define PROF_END(site, t)		prof_record((site), timebase_now() - (t))
+#else
+#define PROF_START(t)
+#define PROF_END(site, t)
+#endif
+
+#endif // _prof_h__
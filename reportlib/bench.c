@@ -0,0 +1,188 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2014  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "reportlib.h"
+#include "../classic.h"
+#include "../analog.h"
+
+#define NUM_IMAGES	(1 << 20)
+#define ROUNDS		8
+#define CHECKS		200000
+
+static const char *mode_names[RL_NUM_MODES] = { "mode 1", "mode 2", "mode 3" };
+
+static uint8_t images[NUM_IMAGES][RL_IMAGE_SIZE];
+static struct rl_report reports[NUM_IMAGES];
+static volatile unsigned sink;
+
+static double nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void randomPad(classic_pad_data *p)
+{
+	int i;
+
+	memset(p, 0, sizeof(classic_pad_data));
+	p->pad_type = PAD_TYPE_CLASSIC;
+	p->lx = rand();
+	p->ly = rand();
+	p->rx = rand();
+	p->ry = rand();
+	p->lt = rand();
+	p->rt = rand();
+	p->buttons = rand();
+	p->controller_id[0] = 'G';
+	p->controller_id[1] = 'N';
+	for (i = 0; i < 8; i++)
+		p->controller_raw_data[i] = rand();
+}
+
+// what the firmware would have packed to send this report
+static void toPad(const struct rl_report *r, classic_pad_data *p)
+{
+	memset(p, 0, sizeof(classic_pad_data));
+	p->pad_type = PAD_TYPE_CLASSIC;
+	p->lx = r->lx;
+	p->ly = r->ly;
+	p->rx = r->rx;
+	p->ry = r->ry;
+	p->lt = r->lt;
+	p->rt = r->rt;
+	p->buttons = r->buttons;
+	memcpy(p->controller_id, r->id, 2);
+	memcpy(p->controller_raw_data, r->raw, RL_RAW_SIZE);
+}
+
+static void printImage(const char *label, const uint8_t *img, int n)
+{
+	int i;
+
+	fprintf(stderr, "  %-8s", label);
+	for (i = 0; i < n; i++)
+		fprintf(stderr, " %02x", img[i]);
+	fprintf(stderr, "\n");
+}
+
+/* Pack with classic.c, decode, and pack the decoded report again: the
+ * images must be the same. The batch decoder must agree with the
+ * single one. */
+static int check(int mode)
+{
+	static struct rl_report single[CHECKS];
+	classic_pad_data pad;
+	uint8_t again[PACKED_CLASSIC_DATA_SIZE];
+	int i, n = rl_imageBytes(mode);
+
+	for (i = 0; i < CHECKS; i++) {
+		randomPad(&pad);
+		pack_classic_data(&pad, images[i], ANALOG_STYLE_DEFAULT, mode);
+		rl_decode(images[i], mode, &single[i]);
+
+		toPad(&single[i], &pad);
+		pack_classic_data(&pad, again, ANALOG_STYLE_DEFAULT, mode);
+		if (memcmp(images[i], again, PACKED_CLASSIC_DATA_SIZE)) {
+			fprintf(stderr, "%s: round trip mismatch\n", mode_names[mode]);
+			printImage("packed", images[i], n);
+			printImage("again", again, n);
+			return -1;
+		}
+	}
+
+	rl_decodeBatch(images[0], RL_IMAGE_SIZE, CHECKS, mode, reports);
+	for (i = 0; i < CHECKS; i++) {
+		if (memcmp(&single[i], &reports[i], sizeof(struct rl_report))) {
+			fprintf(stderr, "%s: batch and single decoders differ\n", mode_names[mode]);
+			printImage("image", images[i], n);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static double timeSingle(int mode)
+{
+	double t0 = nowNs();
+	unsigned acc = 0;
+	int r, i;
+
+	for (r = 0; r < ROUNDS; r++) {
+		for (i = 0; i < NUM_IMAGES; i++) {
+			rl_decode(images[i], mode, &reports[i]);
+			acc += reports[i].buttons;
+		}
+	}
+	sink = acc;
+
+	return (nowNs() - t0) / ((double)ROUNDS * NUM_IMAGES);
+}
+
+static double timeBatch(int mode)
+{
+	double t0 = nowNs();
+	unsigned acc = 0;
+	int r;
+
+	for (r = 0; r < ROUNDS; r++) {
+		rl_decodeBatch(images[0], RL_IMAGE_SIZE, NUM_IMAGES, mode, reports);
+		acc += reports[r].buttons;
+	}
+	sink = acc;
+
+	return (nowNs() - t0) / ((double)ROUNDS * NUM_IMAGES);
+}
+
+int main(void)
+{
+	classic_pad_data pad;
+	int mode, i;
+
+	printf("%-8s | %-10s | %-17s | %-17s\n", "", "", "     single", "      batch");
+	printf("%-8s | %-10s | %7s %9s | %7s %9s\n", "format", "round trip", "ns", "M/s", "ns", "M/s");
+
+	for (mode = 0; mode < RL_NUM_MODES; mode++) {
+		double single, batch;
+
+		srand(1);
+		if (check(mode))
+			return 1;
+
+		for (i = 0; i < NUM_IMAGES; i++) {
+			randomPad(&pad);
+			pack_classic_data(&pad, images[i], ANALOG_STYLE_DEFAULT, mode);
+		}
+
+		single = timeSingle(mode);
+		batch = timeBatch(mode);
+		printf("%-8s | %-10s | %7.2f %9.1f | %7.2f %9.1f\n", mode_names[mode], "ok",
+			single, 1e3 / single, batch, 1e3 / batch);
+	}
+
+	printf("\n%d images of %d bytes per format, %d times. ns per report, millions of reports per second.\n",
+		NUM_IMAGES, RL_IMAGE_SIZE, ROUNDS);
+
+	return 0;
+}
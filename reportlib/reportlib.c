@@ -0,0 +1,204 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2014  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+
+#include "reportlib.h"
+#include "../shot.h"
+
+/* A field is the sum of up to 3 bit segments of the image, then scaled
+ * to 8 bits and centered: value = (bits << scale) - bias, xor flip. */
+#define RL_MAX_SEGS		3
+
+struct rl_seg {
+	uint8_t byte, shift, mask, to;
+};
+
+struct rl_field {
+	uint8_t nsegs;
+	struct rl_seg seg[RL_MAX_SEGS];
+	uint8_t scale;
+	int16_t bias;
+	uint16_t flip;
+};
+
+enum { F_LX, F_LY, F_RX, F_RY, F_LT, F_RT, F_BUTTONS, RL_NUM_FIELDS };
+
+#define STICK(b)		{ 1, { { b, 0, 0xFF, 0 } }, 0, 0x80, 0 }
+#define TRIGGER(b)		{ 1, { { b, 0, 0xFF, 0 } }, 0, 0, 0 }
+#define BUTTONS(hi, lo)	{ 2, { { hi, 0, 0xFF, 8 }, { lo, 0, 0xFF, 0 } }, 0, 0, 0xFFFF }
+
+/* The reverse of pack_classic_data_mode*() */
+static const struct rl_field rl_fields[RL_NUM_MODES][RL_NUM_FIELDS] = {
+	[RL_MODE_1] = {
+		[F_LX] = { 1, { { 0, 0, 0x3F, 0 } }, 2, 0x80, 0 },
+		[F_LY] = { 1, { { 1, 0, 0x3F, 0 } }, 2, 0x80, 0 },
+		[F_RX] = { 3, { { 0, 6, 0x03, 3 }, { 1, 6, 0x03, 1 }, { 2, 7, 0x01, 0 } }, 3, 0x80, 0 },
+		[F_RY] = { 1, { { 2, 0, 0x1F, 0 } }, 3, 0x80, 0 },
+		[F_LT] = { 2, { { 2, 5, 0x03, 3 }, { 3, 5, 0x07, 0 } }, 3, 0, 0 },
+		[F_RT] = { 1, { { 3, 0, 0x1F, 0 } }, 3, 0, 0 },
+		[F_BUTTONS] = BUTTONS(4, 5),
+	},
+	[RL_MODE_2] = {
+		[F_LX] = STICK(0), [F_RX] = STICK(1), [F_LY] = STICK(2), [F_RY] = STICK(3),
+		[F_LT] = TRIGGER(5), [F_RT] = TRIGGER(6),
+		[F_BUTTONS] = BUTTONS(7, 8),
+	},
+	[RL_MODE_3] = {
+		[F_LX] = STICK(0), [F_RX] = STICK(1), [F_LY] = STICK(2), [F_RY] = STICK(3),
+		[F_LT] = TRIGGER(4), [F_RT] = TRIGGER(5),
+		[F_BUTTONS] = BUTTONS(6, 7),
+	},
+};
+
+static const uint8_t rl_bytes[RL_NUM_MODES] = { RL_IMAGE_SIZE, 9, 8 };
+
+#define TAIL_MARK		6	// 'R'
+#define TAIL_ID			7
+#define TAIL_RAW		9
+
+// images per block of rl_decodeBatch
+#define BLOCK			64
+// the fields are in the first bytes of every format
+#define RL_FIELD_BYTES	9
+
+int rl_modeFromReg(uint8_t reg)
+{
+	switch (reg)
+	{
+		case 0x02: return RL_MODE_2;
+		case 0x03: return RL_MODE_3;
+	}
+	return RL_MODE_1;
+}
+
+int rl_imageBytes(int mode)
+{
+	return rl_bytes[mode];
+}
+
+static int rl_field(const struct rl_field *f, const uint8_t *img)
+{
+	unsigned v = 0;
+	int s;
+
+	for (s = 0; s < f->nsegs; s++)
+		v |= ((img[f->seg[s].byte] >> f->seg[s].shift) & f->seg[s].mask) << f->seg[s].to;
+
+	return (int)((v << f->scale) ^ f->flip) - f->bias;
+}
+
+static void rl_tail(const uint8_t *img, int mode, struct rl_report *r)
+{
+	r->mode = mode;
+	r->ext = mode == RL_MODE_1 && img[TAIL_MARK] == 'R';
+	if (r->ext) {
+		memcpy(r->id, img + TAIL_ID, 2);
+		memcpy(r->raw, img + TAIL_RAW, RL_RAW_SIZE);
+	} else {
+		memset(r->id, 0, 2);
+		memset(r->raw, 0, RL_RAW_SIZE);
+	}
+}
+
+void rl_decode(const uint8_t *img, int mode, struct rl_report *r)
+{
+	const struct rl_field *f = rl_fields[mode];
+
+	r->lx = rl_field(&f[F_LX], img);
+	r->ly = rl_field(&f[F_LY], img);
+	r->rx = rl_field(&f[F_RX], img);
+	r->ry = rl_field(&f[F_RY], img);
+	r->lt = rl_field(&f[F_LT], img);
+	r->rt = rl_field(&f[F_RT], img);
+	r->buttons = rl_field(&f[F_BUTTONS], img);
+	rl_tail(img, mode, r);
+}
+
+/* One field for a block of images, from the bytes of the block laid
+ * out by position. The segment loop is outside: the inner loops are the
+ * same operation on contiguous bytes. */
+static void rl_column(const struct rl_field *f, uint8_t bytes[][BLOCK], int n, int32_t *out)
+{
+	int s, i;
+
+	for (i = 0; i < n; i++)
+		out[i] = 0;
+
+	for (s = 0; s < f->nsegs; s++) {
+		const uint8_t *p = bytes[f->seg[s].byte];
+		unsigned shift = f->seg[s].shift, mask = f->seg[s].mask, to = f->seg[s].to;
+
+		for (i = 0; i < n; i++)
+			out[i] |= ((p[i] >> shift) & mask) << to;
+	}
+
+	for (i = 0; i < n; i++)
+		out[i] = ((out[i] << f->scale) ^ f->flip) - f->bias;
+}
+
+void rl_decodeBatch(const uint8_t *img, size_t stride, size_t n, int mode, struct rl_report *r)
+{
+	const struct rl_field *f = rl_fields[mode];
+	uint8_t bytes[RL_FIELD_BYTES][BLOCK];
+	int32_t col[RL_NUM_FIELDS][BLOCK];
+	int nbytes = rl_bytes[mode] < RL_FIELD_BYTES ? rl_bytes[mode] : RL_FIELD_BYTES;
+	size_t done;
+	int i, k, len;
+
+	for (done = 0; done < n; done += len) {
+		len = n - done < BLOCK ? n - done : BLOCK;
+
+		for (i = 0; i < len; i++) {
+			for (k = 0; k < nbytes; k++)
+				bytes[k][i] = img[i * stride + k];
+		}
+
+		for (k = 0; k < RL_NUM_FIELDS; k++)
+			rl_column(&f[k], bytes, len, col[k]);
+
+		for (i = 0; i < len; i++) {
+			r[i].lx = col[F_LX][i];
+			r[i].ly = col[F_LY][i];
+			r[i].rx = col[F_RX][i];
+			r[i].ry = col[F_RY][i];
+			r[i].lt = col[F_LT][i];
+			r[i].rt = col[F_RT][i];
+			r[i].buttons = col[F_BUTTONS][i];
+			rl_tail(img + i * stride, mode, &r[i]);
+		}
+
+		img += len * stride;
+		r += len;
+	}
+}
+
+int rl_gunShot(const struct rl_report *r, struct rl_shot *s)
+{
+	const uint8_t *ev = r->raw + 2;
+
+	if (!r->ext || r->id[0] != 'G' || r->id[1] != 'N')
+		return 0;
+	if ((ev[0] & SHOT_RESULT_MASK) == SHOT_RESULT_NONE)
+		return 0;
+
+	s->seq = ev[0] >> SHOT_SEQ_SHIFT;
+	s->result = ev[0] & SHOT_RESULT_MASK;
+	s->delay_ms = ev[1];
+	s->width_us = ev[2] * SHOT_WIDTH_UNIT_US;
+
+	return 1;
+}
@@ -0,0 +1,62 @@
+#ifndef _reportlib_h__
+#define _reportlib_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Decoder for the reports of the firmware, the reverse of
+ * pack_classic_data() (see classic.c). An image is the register file
+ * from 0x00, as the firmware packs it: the console reads the first 6, 8
+ * or 9 bytes, depending on the data format it selected (register 0xFE).
+ * Only the first format carries the 'R' tail: controller id and raw
+ * controller bytes. */
+#define RL_IMAGE_SIZE		17	// PACKED_CLASSIC_DATA_SIZE
+
+// same values as CLASSIC_MODE_* (see classic.h)
+#define RL_MODE_1			0	// 6 bytes, 6 and 5 bit axes, then the tail
+#define RL_MODE_2			1	// 9 bytes, 8 bit axes
+#define RL_MODE_3			2	// 8 bytes, 8 bit axes
+#define RL_NUM_MODES		3
+
+#define RL_RAW_SIZE			8
+
+/* Axes at the resolution of the format, scaled to 8 bits: the sticks
+ * from -128 to 127, the triggers from 0 to 255. The buttons are the
+ * CPAD_BTN_* bits of gamepads.h, set when pressed. */
+struct rl_report {
+	int16_t lx, ly, rx, ry;
+	int16_t lt, rt;
+	uint16_t buttons;
+	uint8_t mode;
+	uint8_t ext; // the 'R' tail is there: id and raw are valid
+	char id[2]; // 'G' 'N': the light gun (see classic.c)
+	uint8_t raw[RL_RAW_SIZE];
+};
+
+/* Data format register values (1 to 3) to RL_MODE_*, as main.c does it:
+ * anything else is the first format. */
+int rl_modeFromReg(uint8_t reg);
+
+void rl_decode(const uint8_t *img, int mode, struct rl_report *r);
+
+/* Decodes n images, stride bytes apart: RL_IMAGE_SIZE when stored back
+ * to back, at least rl_imageBytes(mode). Works field by field over
+ * blocks of images, loops the compiler can vectorise. */
+void rl_decodeBatch(const uint8_t *img, size_t stride, size_t n, int mode, struct rl_report *r);
+
+// bytes of an image used by a format, the tail included
+int rl_imageBytes(int mode);
+
+/* The shot event of a light gun built with WITH_SHOT_EVENTS, in raw
+ * bytes 2 to 4 (see shot.h). Returns 0 if the report has none, or no
+ * shot happened since power-up. */
+struct rl_shot {
+	uint8_t seq;
+	uint8_t result; // SHOT_RESULT_*
+	uint8_t delay_ms;
+	uint16_t width_us;
+};
+
+int rl_gunShot(const struct rl_report *r, struct rl_shot *s);
+
+#endif // _reportlib_h__
@@ -0,0 +1,21 @@
+/* Generated by hitwindow. Do not edit, see hitwindow/README.
+ *
+ * Polls the light sensor stays reported after a flash, per display.
+ * 0: not latched, the sensor is read when the gun is sampled.
+ * Model: 5.00 ms polls, 6 frame check window, 1 frame target.
+ * A display where every hold spills more than 1.0% is unsupported:
+ * its SENSOR_PROFILE_ is not defined, its entry is a placeholder. */
+#ifndef _sensor_profiles_h__
+#define _sensor_profiles_h__
+
+#define SENSOR_PROFILE_CRT	0	// hold 4: hit 100.0%, spill 0.0%
+#define SENSOR_PROFILE_CRT_SCALER	1	// hold 4: hit 100.0%, spill 0.0%
+#define SENSOR_PROFILE_LCD_GAME	2	// hold 1: hit 100.0%, spill 0.0%
+#define SENSOR_PROFILE_LCD	3	// hold 1: hit 100.0%, spill 0.4%
+// SENSOR_PROFILE_HDTV	4	unsupported, hold 0: hit 15.5%, spill 83.7%
+#define SENSOR_PROFILE_OLED	5	// hold 1: hit 100.0%, spill 0.0%
+#define SENSOR_NUM_PROFILES	6
+
+#define SENSOR_PROFILE_HOLDS	{ 4, 4, 1, 1, 0, 1 }
+
+#endif // _sensor_profiles_h__
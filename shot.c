@@ -0,0 +1,75 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2014  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include "shot.h"
+#include "timebase.h"
+
+#ifdef WITH_SHOT_EVENTS
+
+void shot_init(struct shot *s)
+{
+	memset(s, 0, sizeof(struct shot));
+}
+
+static unsigned char saturate(unsigned long v)
+{
+	return v > 0xFF ? 0xFF : v;
+}
+
+static void shot_publish(struct shot *s, unsigned char result, unsigned long delay_us, unsigned long width_us)
+{
+	s->seq = (s->seq + 1) & 0x0F;
+	s->event[0] = (s->seq << SHOT_SEQ_SHIFT) | result;
+	s->event[1] = saturate((delay_us + 500) / 1000);
+	s->event[2] = saturate((width_us + SHOT_WIDTH_UNIT_US / 2) / SHOT_WIDTH_UNIT_US);
+}
+
+char shot_sample(struct shot *s, unsigned long now, unsigned char trigger,
+				unsigned char flash, unsigned long flash_start, unsigned short flash_width)
+{
+	unsigned char pulled = trigger && !s->trigger;
+
+	s->trigger = trigger;
+
+	if (!s->armed) {
+		/* The game learns of the pull from the report of this sample: a
+		 * flash seen up to now cannot be its answer. */
+		if (pulled) {
+			s->armed = SHOT_WINDOW_POLLS;
+			s->trigger_time = now;
+		}
+		return 0;
+	}
+
+	if (!flash_start)
+		flash_start = now;
+
+	// without the time base, any flash in the window is taken
+	if (flash && (!now || flash_start - s->trigger_time < 0x80000000UL)) {
+		s->armed = 0;
+		shot_publish(s, SHOT_RESULT_HIT, TIMEBASE_TICKS_TO_US(flash_start - s->trigger_time),
+					TIMEBASE_TICKS_TO_US(flash_width));
+		return 1;
+	}
+
+	if (!--s->armed)
+		shot_publish(s, SHOT_RESULT_MISS, 0, 0);
+
+	return 0;
+}
+
+#endif // WITH_SHOT_EVENTS
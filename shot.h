@@ -0,0 +1,59 @@
+#ifndef _shot_h__
+#define _shot_h__
+
+/* Shot classifier, with -DWITH_SHOT_EVENTS. Run once per sample for
+ * each gun, it follows a shot from the trigger pull to the flash of the
+ * game (hit) or to the end of the sensor window (miss), and publishes
+ * the outcome as an event in the raw bytes of the report:
+ *
+ *	byte  | bit 7-4  | bit 3-2 | bit 1-0
+ *	------+----------+---------+---------
+ *	  0   | sequence |    0    | result
+ *	  1   | sensor delay, ms
+ *	  2   | pulse width, 0.1ms
+ *
+ * The sequence number changes with each event, the bytes stay the same
+ * until the next one. The delay runs from the sample reporting the
+ * trigger pull to the start of the flash. The width is the time the
+ * sensor stayed lit, up to the sample for a flash still going on. Both
+ * saturate at 255, and are 0 when not measured: without the time base
+ * (see timebase.h), or without the sensor edges for the width. */
+#define SHOT_EVENT_SIZE		3
+
+#define SHOT_RESULT_NONE	0	// no shot since power-up
+#define SHOT_RESULT_HIT		1
+#define SHOT_RESULT_MISS	2
+
+#define SHOT_SEQ_SHIFT		4
+#define SHOT_RESULT_MASK	0x03
+
+#define SHOT_WIDTH_UNIT_US	100
+
+/* Samples the sensor is watched for after the trigger pull: 160ms at
+ * the usual 5ms polls, room for a slow TV and the 6 frames a game
+ * checks the sensor for (see hitwindow). */
+#ifndef SHOT_WINDOW_POLLS
+#define SHOT_WINDOW_POLLS	32
+#endif
+
+struct shot {
+	unsigned char armed; // samples left in the sensor window, 0: idle
+	unsigned char trigger; // last trigger state
+	unsigned char seq;
+	unsigned long trigger_time;
+	unsigned char event[SHOT_EVENT_SIZE];
+};
+
+void shot_init(struct shot *s);
+
+/* Called once per sample. Times are in time base ticks: now (see
+ * timebase_time), flash_start, taken as now if 0, and flash_width,
+ * saturated at 0xFFFF, 0 if not known. flash is non-zero if the sensor
+ * saw light since the previous sample. A flash starting before the pull
+ * is reported, a sensor already lit then, is no answer to it. Returns 1
+ * when this sample decides a hit: the one report carrying the sensor
+ * bit. */
+char shot_sample(struct shot *s, unsigned long now, unsigned char trigger,
+				unsigned char flash, unsigned long flash_start, unsigned short flash_width);
+
+#endif // _shot_h__
@@ -0,0 +1,346 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ucontext.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+#include "hw.h"
+
+#define HW_STACK_SIZE	(256 * 1024)
+#define HW_EEPROM_SIZE	512 // atmega168
+
+uint64_t sil_now;
+
+/***** I/O registers *****/
+
+volatile uint8_t PINB = 0xff, DDRB, PORTB;
+volatile uint8_t PINC = 0xff, DDRC, PORTC;
+volatile uint8_t PIND = 0xff, DDRD, PORTD;
+volatile uint8_t SREG;
+volatile uint8_t TWBR, TWSR, TWAR, TWDR, TWCR;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB, ADCH, DIDR0;
+volatile uint8_t PCICR, PCIFR, PCMSK2;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+volatile uint16_t OCR1A, OCR1B;
+
+// defined by the firmware if it uses pin change interrupts
+void PCINT2_vect(void) __attribute__((weak));
+
+void hw_setPins(uint8_t pind)
+{
+	uint8_t changed = PIND ^ pind;
+
+	PIND = pind;
+
+	if ((PCICR & _BV(PCIE2)) && (changed & PCMSK2) && PCINT2_vect)
+		PCINT2_vect();
+}
+
+/***** Timer1 *****/
+
+/* Free running at F_CPU/8 (see timebase.h), from the virtual time. The
+ * compare and overflow handlers are called by the host at the tick
+ * they match (hw_timer), so the firmware never sees their flags set:
+ * its writes to TIFR1, which clear them, are ignored. */
+#define HW_TICK_NUM		8000ULL // ns * MHz per tick
+#define HW_TICK_DEN		(F_CPU / 1000000ULL)
+
+/* A loop polling the time (the calibration mode) would never see it
+ * move: after this many reads at the same virtual time, a read takes a
+ * tick. */
+#define HW_SPIN_READS	100
+
+// defined by the firmware if it uses them
+void TIMER1_OVF_vect(void) __attribute__((weak));
+void TIMER1_COMPA_vect(void) __attribute__((weak));
+void TIMER1_COMPB_vect(void) __attribute__((weak));
+
+static volatile uint16_t hw_tcnt1; // as last read, or written by the firmware
+static uint16_t hw_tcnt1_read, hw_tcnt1_offset;
+static uint64_t hw_timer_last; // ticks processed by hw_timer
+static uint64_t hw_spin_time;
+static int hw_spin_reads, hw_in_fw;
+
+static uint64_t hw_ticks(uint64_t ns)
+{
+	return ns * HW_TICK_DEN / HW_TICK_NUM;
+}
+
+// the first ns of a tick
+static uint64_t hw_tickStart(uint64_t ticks)
+{
+	return (ticks * HW_TICK_NUM + HW_TICK_DEN - 1) / HW_TICK_DEN;
+}
+
+static void hw_tcnt1Sync(void)
+{
+	// written since the last read: the count goes on from there
+	hw_tcnt1_offset += hw_tcnt1 - hw_tcnt1_read;
+	hw_tcnt1 = hw_tcnt1_read = hw_ticks(sil_now) + hw_tcnt1_offset;
+}
+
+static void hw_spin(void);
+
+volatile uint16_t *sil_tcnt1(void)
+{
+	hw_tcnt1Sync();
+	hw_spin();
+
+	return &hw_tcnt1;
+}
+
+/* Ticks after tick t at which the count is c: 1 to 65536. TOV1 is set
+ * when it wraps to 0. */
+static uint64_t hw_ticksTo(uint64_t t, uint16_t c)
+{
+	uint16_t now = t + hw_tcnt1_offset;
+
+	return (uint16_t)(c - now - 1) + 1ULL;
+}
+
+// the next enabled timer interrupt after tick t, or 0 if none
+static uint64_t hw_timerMatch(uint64_t t, void (**vector)(void))
+{
+	uint64_t d, best = 0;
+
+	*vector = NULL;
+	if ((TIMSK1 & _BV(TOIE1)) && TIMER1_OVF_vect) {
+		best = hw_ticksTo(t, 0);
+		*vector = TIMER1_OVF_vect;
+	}
+	if ((TIMSK1 & _BV(OCIE1A)) && TIMER1_COMPA_vect) {
+		d = hw_ticksTo(t, OCR1A);
+		if (!best || d < best) {
+			best = d;
+			*vector = TIMER1_COMPA_vect;
+		}
+	}
+	if ((TIMSK1 & _BV(OCIE1B)) && TIMER1_COMPB_vect) {
+		d = hw_ticksTo(t, OCR1B);
+		if (!best || d < best) {
+			best = d;
+			*vector = TIMER1_COMPB_vect;
+		}
+	}
+
+	return best ? t + best : 0;
+}
+
+void hw_timer(void)
+{
+	uint64_t now, t;
+	void (*vector)(void);
+
+	hw_tcnt1Sync();
+	now = hw_ticks(sil_now);
+
+	// in order, each handler can change what comes next
+	while ((t = hw_timerMatch(hw_timer_last, &vector)) && t <= now) {
+		hw_timer_last = t;
+		vector();
+		hw_tcnt1Sync();
+	}
+	hw_timer_last = now;
+	TIFR1 = 0;
+}
+
+uint64_t hw_timerNext(void)
+{
+	void (*vector)(void);
+	uint64_t t;
+
+	hw_tcnt1Sync();
+	t = hw_timerMatch(hw_timer_last, &vector);
+
+	return t ? hw_tickStart(t) : UINT64_MAX;
+}
+
+/***** EEPROM *****/
+
+static uint8_t hw_eeprom[HW_EEPROM_SIZE];
+static const char *hw_eeprom_file;
+
+static int hw_eepromAddr(const void *addr, size_t n)
+{
+	uintptr_t a = (uintptr_t)addr;
+
+	if (a + n > HW_EEPROM_SIZE) {
+		fprintf(stderr, "EEPROM access out of range: 0x%lx+%lu\n",
+			(unsigned long)a, (unsigned long)n);
+		exit(1);
+	}
+	return a;
+}
+
+uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+	return hw_eeprom[hw_eepromAddr(addr, 1)];
+}
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+	hw_eeprom[hw_eepromAddr(addr, 1)] = value;
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+	memcpy(dst, hw_eeprom + hw_eepromAddr(src, n), n);
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+	memcpy(hw_eeprom + hw_eepromAddr(dst, n), src, n);
+}
+
+void hw_saveEeprom(void)
+{
+	FILE *fp;
+
+	if (!hw_eeprom_file)
+		return;
+
+	fp = fopen(hw_eeprom_file, "wb");
+	if (!fp) {
+		perror(hw_eeprom_file);
+		return;
+	}
+	if (fwrite(hw_eeprom, HW_EEPROM_SIZE, 1, fp) != 1)
+		perror(hw_eeprom_file);
+	fclose(fp);
+}
+
+/***** CPU *****/
+
+int fw_main(void);
+
+static ucontext_t hw_host_ctx, hw_fw_ctx;
+static char *hw_stack;
+static int hw_cpu_state;
+static uint64_t hw_cpu_deadline;
+static int hw_poll_pending;
+
+static void hw_entry(void)
+{
+	fw_main();
+	fprintf(stderr, "firmware main returned\n");
+	hw_cpu_state = HW_HALTED;
+	// uc_link returns to the host
+}
+
+static void hw_yield(int state)
+{
+	hw_cpu_state = state;
+	swapcontext(&hw_fw_ctx, &hw_host_ctx);
+}
+
+void sil_delay_ns(unsigned long ns)
+{
+	hw_cpu_deadline = sil_now + ns;
+	hw_yield(HW_DELAY);
+}
+
+static void hw_spin(void)
+{
+	if (!hw_in_fw)
+		return;
+
+	if (hw_spin_time != sil_now) {
+		hw_spin_time = sil_now;
+		hw_spin_reads = 0;
+	}
+	if (++hw_spin_reads >= HW_SPIN_READS) {
+		sil_delay_ns(hw_tickStart(hw_ticks(sil_now) + 1) - sil_now);
+		hw_tcnt1Sync();
+	}
+}
+
+/* There is no yield between the sample and the next sleep (the pipeline
+ * takes no virtual time), so a poll is never pending here: the firmware
+ * always sleeps until the next one. */
+void sil_sleep(void)
+{
+	hw_poll_pending = 0;
+	hw_yield(HW_SLEEP);
+}
+
+void hw_pollRequest(void)
+{
+	hw_poll_pending = 1;
+}
+
+void hw_irq(void)
+{
+	if (hw_cpu_state == HW_SLEEP && hw_poll_pending)
+		hw_cpu_state = HW_RUNNING;
+}
+
+void hw_run(void)
+{
+	if (hw_cpu_state == HW_HALTED)
+		return;
+	hw_cpu_state = HW_RUNNING;
+	hw_in_fw = 1;
+	swapcontext(&hw_host_ctx, &hw_fw_ctx);
+	hw_in_fw = 0;
+}
+
+int hw_state(void)
+{
+	return hw_cpu_state;
+}
+
+uint64_t hw_deadline(void)
+{
+	return hw_cpu_deadline;
+}
+
+int hw_init(const char *eeprom_file)
+{
+	// erased
+	memset(hw_eeprom, 0xff, HW_EEPROM_SIZE);
+
+	hw_eeprom_file = eeprom_file;
+	if (eeprom_file) {
+		FILE *fp = fopen(eeprom_file, "rb");
+
+		if (fp) {
+			if (fread(hw_eeprom, 1, HW_EEPROM_SIZE, fp) != HW_EEPROM_SIZE)
+				fprintf(stderr, "%s: short EEPROM image, rest is erased\n", eeprom_file);
+			fclose(fp);
+		}
+	}
+
+	hw_stack = malloc(HW_STACK_SIZE);
+	if (!hw_stack) {
+		perror("malloc");
+		return -1;
+	}
+
+	getcontext(&hw_fw_ctx);
+	hw_fw_ctx.uc_stack.ss_sp = hw_stack;
+	hw_fw_ctx.uc_stack.ss_size = HW_STACK_SIZE;
+	hw_fw_ctx.uc_link = &hw_host_ctx;
+	makecontext(&hw_fw_ctx, hw_entry, 0);
+
+	hw_cpu_state = HW_RUNNING;
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef _hw_h__
+#define _hw_h__
+
+#include <stdint.h>
+
+/* The simulated chip: I/O registers, EEPROM, and the firmware running as
+ * a coroutine. The firmware runs in zero virtual time between two
+ * yields, which happen on delays and sleeps. Interrupts are called by
+ * the host between two firmware steps. */
+
+#define HW_RUNNING		0 // runnable now
+#define HW_DELAY		1 // in a _delay_us, until hw_deadline()
+#define HW_SLEEP		2 // until a poll wakes it up
+#define HW_HALTED		3 // fw_main returned
+
+// virtual time, in ns since the start. Set by the host.
+extern uint64_t sil_now;
+
+int hw_init(const char *eeprom_file);
+void hw_saveEeprom(void);
+
+/* Run the firmware until its next yield */
+void hw_run(void);
+int hw_state(void);
+uint64_t hw_deadline(void);
+
+/* Called after each interrupt. The firmware is woken up if the
+ * interrupt requested a sample (see hw_pollRequest). */
+void hw_irq(void);
+void hw_pollRequest(void);
+
+/* Timer1: call hw_timer() once the virtual time is set, it runs the
+ * handlers due since the previous call. hw_timerNext() is the time of
+ * the next one, UINT64_MAX if none is enabled. */
+void hw_timer(void);
+uint64_t hw_timerNext(void);
+
+/* Pin levels. Pressed buttons and a lit sensor read low. */
+void hw_setPins(uint8_t pind);
+
+#endif // _hw_h__
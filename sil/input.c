@@ -0,0 +1,235 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <linux/input.h>
+
+#include "input.h"
+#include "probe.h"
+#include "hw.h"
+
+// gun.c: trigger on PD7, sensor on PD6, both active low
+#define PIN_TRIGGER		0x80
+#define PIN_SENSOR		0x40
+
+void input_init(struct input *in)
+{
+	memset(in, 0, sizeof(struct input));
+	in->fd = -1;
+}
+
+static void in_recordState(struct input *in)
+{
+	fprintf(in->record, "%.3f\t%s%s%s\n", sil_now / 1e6,
+		in->state & INPUT_TRIGGER ? "T" : "",
+		in->state & INPUT_SENSOR ? "S" : "",
+		in->state ? "" : "-");
+}
+
+static void input_set(struct input *in, int state)
+{
+	uint8_t pind = 0xff;
+
+	if (state == in->state)
+		return;
+	in->state = state;
+
+	if (state & INPUT_TRIGGER)
+		pind &= ~PIN_TRIGGER;
+	if (state & INPUT_SENSOR)
+		pind &= ~PIN_SENSOR;
+
+	hw_setPins(pind);
+	probe_input(sil_now);
+
+	if (in->record)
+		in_recordState(in);
+}
+
+int input_openEvdev(struct input *in, const char *path, int trigger_code, int sensor_code)
+{
+	in->fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (in->fd == -1) {
+		perror(path);
+		return -1;
+	}
+	in->trigger_code = trigger_code;
+	in->sensor_code = sensor_code;
+
+	return 0;
+}
+
+int input_readEvdev(struct input *in)
+{
+	struct input_event evs[64];
+	int state = in->state;
+	int i, n;
+
+	n = read(in->fd, evs, sizeof(evs));
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		perror("read");
+		return -1;
+	}
+	if (n == 0)
+		return -1;
+
+	for (i = 0; i < n / sizeof(struct input_event); i++) {
+		int bit;
+
+		if (evs[i].type != EV_KEY || evs[i].value == 2) // no autorepeat
+			continue;
+
+		if (evs[i].code == in->trigger_code)
+			bit = INPUT_TRIGGER;
+		else if (evs[i].code == in->sensor_code)
+			bit = INPUT_SENSOR;
+		else
+			continue;
+
+		if (evs[i].value)
+			state |= bit;
+		else
+			state &= ~bit;
+	}
+
+	input_set(in, state);
+
+	return 0;
+}
+
+int input_loadScript(struct input *in, const char *path, int repeat)
+{
+	char line[256];
+	int cap = 0, lineno = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		char state_str[16];
+		double ms;
+		int state = 0;
+		char *c;
+
+		lineno++;
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == 0)
+			continue;
+
+		if (sscanf(line, "%lf %15s", &ms, state_str) != 2 || ms < 0) {
+			fprintf(stderr, "%s:%d: expected <ms> <state>\n", path, lineno);
+			fclose(fp);
+			return -1;
+		}
+		for (c = state_str; *c; c++) {
+			switch (*c)
+			{
+				case 'T': case 't': state |= INPUT_TRIGGER; break;
+				case 'S': case 's': state |= INPUT_SENSOR; break;
+				case '-': break;
+				default:
+					fprintf(stderr, "%s:%d: unknown state '%c'\n", path, lineno, *c);
+					fclose(fp);
+					return -1;
+			}
+		}
+
+		if (in->script_len == cap) {
+			struct script_entry *ns;
+
+			cap = cap ? cap * 2 : 64;
+			ns = realloc(in->script, cap * sizeof(struct script_entry));
+			if (!ns) {
+				perror("realloc");
+				fclose(fp);
+				return -1;
+			}
+			in->script = ns;
+		}
+		in->script[in->script_len].t = ms * 1e6;
+		in->script[in->script_len].state = state;
+		if (in->script_len && in->script[in->script_len].t < in->script[in->script_len - 1].t) {
+			fprintf(stderr, "%s:%d: time goes backwards\n", path, lineno);
+			fclose(fp);
+			return -1;
+		}
+		in->script_len++;
+	}
+	fclose(fp);
+
+	if (!in->script_len) {
+		fprintf(stderr, "%s: empty script\n", path);
+		return -1;
+	}
+
+	in->repeat = repeat;
+	// one millisecond after the last change, the script starts over
+	in->script_length = in->script[in->script_len - 1].t + 1000000;
+
+	return 0;
+}
+
+uint64_t input_scriptNext(const struct input *in)
+{
+	if (in->script_pos >= in->script_len)
+		return UINT64_MAX;
+	return in->script_base + in->script[in->script_pos].t;
+}
+
+void input_scriptRun(struct input *in)
+{
+	while (input_scriptNext(in) <= sil_now) {
+		input_set(in, in->script[in->script_pos].state);
+		in->script_pos++;
+
+		if (in->script_pos == in->script_len && in->repeat) {
+			in->script_pos = 0;
+			in->script_base += in->script_length;
+		}
+	}
+}
+
+int input_record(struct input *in, const char *path)
+{
+	in->record = fopen(path, "w");
+	if (!in->record) {
+		perror(path);
+		return -1;
+	}
+	fprintf(in->record, "# Recorded by sil\n");
+	in_recordState(in);
+
+	return 0;
+}
+
+void input_close(struct input *in)
+{
+	if (in->record)
+		fclose(in->record);
+	if (in->fd != -1)
+		close(in->fd);
+	free(in->script);
+}
@@ -0,0 +1,62 @@
+#ifndef _input_h__
+#define _input_h__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Trigger and light sensor, from an evdev device (real time) or from a
+ * script (virtual time).
+ *
+ * Script lines are "<ms> <state>", where the state lists what is active:
+ * T for the trigger, S for the sensor, - for nothing. Lines starting
+ * with # are ignored. Example: a shot with a 2 frame flash 10ms later:
+ *
+ *   0    -
+ *   500  T
+ *   510  TS
+ *   543  T
+ *   600  -
+ */
+
+#define INPUT_TRIGGER	0x01
+#define INPUT_SENSOR	0x02
+
+struct script_entry {
+	uint64_t t;
+	uint8_t state;
+};
+
+struct input {
+	int state; // INPUT_*
+
+	// evdev
+	int fd;
+	int trigger_code, sensor_code;
+
+	// script
+	struct script_entry *script;
+	int script_len, script_pos;
+	uint64_t script_base, script_length;
+	int repeat;
+
+	FILE *record;
+};
+
+void input_init(struct input *in);
+int input_openEvdev(struct input *in, const char *path, int trigger_code, int sensor_code);
+int input_loadScript(struct input *in, const char *path, int repeat);
+
+/* Time of the next scripted change, or UINT64_MAX */
+uint64_t input_scriptNext(const struct input *in);
+/* Apply the scripted changes due at sil_now */
+void input_scriptRun(struct input *in);
+/* Read the pending evdev events. Returns -1 when the device is gone. */
+int input_readEvdev(struct input *in);
+
+/* Write every change, from any source, to a script file. Replaying it
+ * with -S gives the same pin levels at the same times. */
+int input_record(struct input *in, const char *path);
+
+void input_close(struct input *in);
+
+#endif // _input_h__
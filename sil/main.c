@@ -0,0 +1,251 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <linux/input.h>
+
+#include "../classic.h"
+#include "hw.h"
+#include "master.h"
+#include "input.h"
+#include "output.h"
+#include "probe.h"
+
+static volatile int stop;
+
+static void sigHandler(int sig)
+{
+	stop = 1;
+}
+
+static uint64_t wallNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void onReport(const unsigned char *data, int len, uint64_t t, void *ctx)
+{
+	output_report(ctx, data, len, t);
+}
+
+static void usage(void)
+{
+	printf("Usage: ./sil [options]\n");
+	printf("\n");
+	printf("Runs the firmware on this machine, polled by a virtual Wiimote.\n");
+	printf("\n");
+	printf("Input:\n");
+	printf("  -i dev     Trigger and sensor from an evdev device\n");
+	printf("  -k t,s     Key codes for the trigger and the sensor (default: %d,%d)\n", BTN_LEFT, BTN_RIGHT);
+	printf("  -S file    Trigger and sensor from a script (see input.h)\n");
+	printf("  -R         Repeat the script\n");
+	printf("  -W file    Record the input changes as a script\n");
+	printf("\n");
+	printf("Output:\n");
+	printf("  -u         Create a uinput joystick\n");
+	printf("  -o file    Write the raw reports read by the Wiimote ('-' for stdout)\n");
+	printf("  -x         Print the reports in hex\n");
+	printf("\n");
+	printf("Wiimote:\n");
+	printf("  -p ms      Poll period (default: 5)\n");
+	printf("  -b us      Time per bus event, address or byte (default: 60)\n");
+	printf("  -l bytes   Bytes per report read (default: 21)\n");
+	printf("  -m mode    Report format written to 0xFE: 1, 2 or 3 (default: none)\n");
+	printf("  -P n       Gun profile to select, written to 0xF8 as n+1 (default: none)\n");
+	printf("\n");
+	printf("Run:\n");
+	printf("  -F         Fast: run the virtual time as fast as possible (script input only)\n");
+	printf("  -t sec     Stop after this much virtual time (default: until ^C, 10 with -F)\n");
+	printf("  -e file    EEPROM image, loaded at start and saved at exit\n");
+	printf("  -h         Prints this help\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct master master;
+	struct input input;
+	struct output output;
+	const char *evdev = NULL, *script = NULL, *raw = NULL, *eeprom = NULL, *record = NULL;
+	int trigger_code = BTN_LEFT, sensor_code = BTN_RIGHT;
+	int repeat = 0, use_uinput = 0, hex = 0, fast = 0;
+	double period_ms = 5, byte_us = 60, duration_s = -1;
+	int read_len = 21, mode = 0, profile = -1;
+	uint64_t start, end, t_next;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "i:k:S:RW:uo:xp:b:l:m:P:Ft:e:h")) != -1) {
+		switch (opt)
+		{
+			case 'i': evdev = optarg; break;
+			case 'k':
+				if (sscanf(optarg, "%i,%i", &trigger_code, &sensor_code) != 2) {
+					fprintf(stderr, "Invalid key codes\n");
+					return 1;
+				}
+				break;
+			case 'S': script = optarg; break;
+			case 'R': repeat = 1; break;
+			case 'W': record = optarg; break;
+			case 'u': use_uinput = 1; break;
+			case 'o': raw = optarg; break;
+			case 'x': hex = 1; break;
+			case 'p': period_ms = atof(optarg); break;
+			case 'b': byte_us = atof(optarg); break;
+			case 'l': read_len = atoi(optarg); break;
+			case 'm': mode = atoi(optarg); break;
+			case 'P': profile = atoi(optarg); break;
+			case 'F': fast = 1; break;
+			case 't': duration_s = atof(optarg); break;
+			case 'e': eeprom = optarg; break;
+			case 'h': usage(); return 0;
+			default:
+				fprintf(stderr, "Unknown argument. Try -h\n");
+				return 1;
+		}
+	}
+
+	if (period_ms <= 0 || byte_us <= 0 || read_len < 1 || read_len > 32 || mode < 0 || mode > 3) {
+		fprintf(stderr, "Invalid Wiimote parameters\n");
+		return 1;
+	}
+	if (evdev && script) {
+		fprintf(stderr, "Use -i or -S, not both\n");
+		return 1;
+	}
+	if (fast && evdev) {
+		fprintf(stderr, "-F needs a script for input\n");
+		return 1;
+	}
+	if (fast && duration_s < 0)
+		duration_s = 10;
+	if (raw && hex && !strcmp(raw, "-")) {
+		fprintf(stderr, "-o - and -x both use stdout\n");
+		return 1;
+	}
+
+	input_init(&input);
+	if (evdev && input_openEvdev(&input, evdev, trigger_code, sensor_code))
+		return 1;
+	if (script && input_loadScript(&input, script, repeat))
+		return 1;
+	if (record && input_record(&input, record))
+		return 1;
+
+	// reg 0xFE values, see main()
+	output_init(&output, mode == 2 ? CLASSIC_MODE_2 : mode == 3 ? CLASSIC_MODE_3 : CLASSIC_MODE_1);
+	if (use_uinput && output_openUinput(&output))
+		return 1;
+	if (raw && output_openRaw(&output, raw))
+		return 1;
+	if (hex)
+		output_setHex(&output, stdout);
+
+	if (hw_init(eeprom))
+		return 1;
+
+	master_init(&master, period_ms * 1e6, byte_us * 1e3, read_len, mode, profile + 1);
+	master.on_report = onReport;
+	master.ctx = &output;
+
+	signal(SIGINT, sigHandler);
+	signal(SIGTERM, sigHandler);
+
+	start = wallNow();
+	sil_now = 0;
+
+	// script lines at 0 are the state at power-up (trigger held...)
+	input_scriptRun(&input);
+
+	// boot, up to the first sleep
+	hw_run();
+
+	while (!stop)
+	{
+		t_next = master.next;
+		if (hw_state() == HW_DELAY && hw_deadline() < t_next)
+			t_next = hw_deadline();
+		if (input_scriptNext(&input) < t_next)
+			t_next = input_scriptNext(&input);
+		if (hw_timerNext() < t_next)
+			t_next = hw_timerNext();
+
+		if (duration_s >= 0 && t_next > duration_s * 1e9)
+			break;
+
+		if (!fast) {
+			uint64_t wall = wallNow() - start;
+
+			if (wall < t_next) {
+				struct pollfd pfd = { .fd = input.fd, .events = POLLIN };
+				struct timespec timeout;
+				uint64_t wait = t_next - wall;
+
+				timeout.tv_sec = wait / 1000000000ULL;
+				timeout.tv_nsec = wait % 1000000000ULL;
+
+				if (ppoll(&pfd, input.fd != -1, &timeout, NULL) > 0) {
+					// an input change happens now, before the next event
+					wall = wallNow() - start;
+					if (wall > sil_now)
+						sil_now = wall < t_next ? wall : t_next;
+					if (input_readEvdev(&input)) {
+						ret = 1;
+						break;
+					}
+				}
+				continue;
+			}
+		}
+
+		sil_now = t_next;
+
+		hw_timer();
+
+		input_scriptRun(&input);
+		if (master.next <= sil_now)
+			master_step(&master);
+		if (hw_state() == HW_RUNNING || (hw_state() == HW_DELAY && hw_deadline() <= sil_now))
+			hw_run();
+		if (hw_state() == HW_HALTED) {
+			ret = 1;
+			break;
+		}
+	}
+
+	end = wallNow();
+
+	fprintf(stderr, "\n");
+	probe_print(stderr);
+	fprintf(stderr, "%.3f s of virtual time in %.3f s (%.1fx), %.0f polls/s\n",
+		sil_now / 1e9, (end - start) / 1e9, (double)sil_now / (end - start),
+		probe.polls / ((end - start) / 1e9));
+
+	hw_saveEeprom();
+	output_close(&output);
+	input_close(&input);
+
+	return ret;
+}
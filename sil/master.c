@@ -0,0 +1,187 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include <util/twi.h>
+
+#include "master.h"
+#include "probe.h"
+#include "hw.h"
+
+#define WM_ADDRESS		0x52
+
+// wiimote.c
+void TWI_vect(void);
+
+// pseudo status: not presented to the ISR
+#define MS_READ_REPORT	0x01 // marks the start of a report read
+#define MS_END			0x02
+
+static int ms_write(struct master_step *s, int n, const unsigned char *data, int len)
+{
+	int i;
+
+	s[n++].status = TW_SR_SLA_ACK;
+	for (i = 0; i < len; i++) {
+		s[n].status = TW_SR_DATA_ACK;
+		s[n++].data = data[i];
+	}
+	s[n++].status = TW_SR_STOP;
+
+	return n;
+}
+
+static int ms_read(struct master_step *s, int n, int len)
+{
+	int i;
+
+	s[n++].status = TW_ST_SLA_ACK;
+	for (i = 1; i < len; i++)
+		s[n++].status = TW_ST_DATA_ACK;
+	s[n++].status = TW_ST_DATA_NACK;
+
+	return n;
+}
+
+void master_init(struct master *m, uint64_t period_ns, uint64_t byte_ns, int read_len, int mode, int profile)
+{
+	static const unsigned char disable_enc1[] = { 0xF0, 0x55 };
+	static const unsigned char disable_enc2[] = { 0xFB, 0x00 };
+	static const unsigned char id_ptr[] = { 0xFA };
+	static const unsigned char report_ptr[] = { 0x00 };
+	unsigned char set_mode[] = { 0xFE, mode };
+	unsigned char set_profile[] = { 0xF8, profile };
+	int n;
+
+	memset(m, 0, sizeof(struct master));
+	m->period_ns = period_ns;
+	m->byte_ns = byte_ns;
+	m->read_len = read_len;
+
+	// Unencrypted init, identification, and report format
+	n = ms_write(m->handshake, 0, disable_enc1, sizeof(disable_enc1));
+	n = ms_write(m->handshake, n, disable_enc2, sizeof(disable_enc2));
+	n = ms_write(m->handshake, n, id_ptr, sizeof(id_ptr));
+	n = ms_read(m->handshake, n, 6);
+	if (mode)
+		n = ms_write(m->handshake, n, set_mode, sizeof(set_mode));
+	if (profile)
+		n = ms_write(m->handshake, n, set_profile, sizeof(set_profile));
+	m->handshake[n++].status = MS_END;
+	m->num_handshake = n;
+
+	n = ms_write(m->poll, 0, report_ptr, sizeof(report_ptr));
+	m->poll[n++].status = MS_READ_REPORT;
+	n = ms_read(m->poll, n, read_len);
+	m->poll[n++].status = MS_END;
+	m->num_poll = n;
+
+	m->steps = m->handshake;
+	m->num_steps = m->num_handshake;
+	// let the firmware boot
+	m->next = 10 * 1000000ULL;
+	m->poll_start = m->next;
+}
+
+void master_setSchedule(struct master *m, const uint64_t *t, int n)
+{
+	m->schedule = t;
+	m->schedule_len = n;
+	m->schedule_pos = 0;
+}
+
+static void ms_next(struct master *m)
+{
+	if (m->steps[m->cur].status == MS_END) {
+		if (m->steps == m->poll && !m->nacked && m->on_report)
+			m->on_report(m->buf, m->got, sil_now, m->ctx);
+		if (m->steps == m->handshake)
+			memcpy(m->id, m->buf, 6);
+
+		m->steps = m->poll;
+		m->num_steps = m->num_poll;
+		m->cur = 0;
+		if (m->schedule) {
+			m->poll_start = m->schedule_pos < m->schedule_len ?
+				m->schedule[m->schedule_pos++] : UINT64_MAX;
+		} else {
+			m->poll_start += m->period_ns;
+		}
+		m->next = m->poll_start;
+		if (m->next < sil_now)
+			m->next = sil_now;
+		m->nacked = 0;
+		return;
+	}
+
+	// the pseudo steps take no time
+	if (m->steps[m->cur].status == MS_READ_REPORT)
+		m->next = sil_now;
+	else
+		m->next = sil_now + m->byte_ns;
+}
+
+void master_step(struct master *m)
+{
+	struct master_step *s = &m->steps[m->cur];
+
+	switch (s->status)
+	{
+		case MS_READ_REPORT:
+			if (!m->nacked)
+				probe_readStart(sil_now);
+			break;
+
+		case TW_SR_SLA_ACK:
+		case TW_ST_SLA_ACK:
+			// not started, or wrong address: nobody acknowledges
+			if (!(TWCR & _BV(TWEN)) || !(TWCR & _BV(TWEA)) || (TWAR >> 1) != WM_ADDRESS) {
+				if (!m->nacked)
+					probe.nacks++;
+				m->nacked = 1;
+			}
+			if (m->nacked)
+				break;
+			if (s->status == TW_ST_SLA_ACK)
+				m->got = 0;
+			// fall through
+		default:
+			if (m->nacked)
+				break;
+
+			TWSR = s->status;
+			if (s->status == TW_SR_DATA_ACK)
+				TWDR = s->data;
+			TWI_vect();
+			if (s->status == TW_ST_SLA_ACK || s->status == TW_ST_DATA_ACK) {
+				if (m->got < sizeof(m->buf))
+					m->buf[m->got++] = TWDR;
+			}
+			if (s->status == TW_ST_DATA_NACK && m->steps == m->poll)
+				probe_readEnd(sil_now);
+			hw_irq();
+			break;
+
+		case MS_END:
+			break;
+	}
+
+	ms_next(m);
+	if (s->status != MS_END)
+		m->cur++;
+}
@@ -0,0 +1,61 @@
+#ifndef _master_h__
+#define _master_h__
+
+#include <stdint.h>
+
+/* Virtual Wiimote: runs the extension handshake, then polls the report
+ * at a fixed period, or at the times of a recorded schedule. Every bus event (address, byte, stop) is one call to
+ * the TWI interrupt handler, byte_ns apart, so the firmware runs between
+ * them just as it would between two interrupts. */
+
+#define MASTER_MAX_STEPS	64
+
+struct master_step {
+	uint8_t status; // TW_* status presented to the ISR
+	uint8_t data; // byte written by the master
+};
+
+struct master {
+	uint64_t period_ns;
+	uint64_t byte_ns;
+	int read_len;
+
+	struct master_step handshake[MASTER_MAX_STEPS];
+	int num_handshake;
+	struct master_step poll[MASTER_MAX_STEPS];
+	int num_poll;
+
+	// current program
+	struct master_step *steps;
+	int num_steps, cur;
+	uint64_t next; // time of the next step
+	uint64_t poll_start;
+	int nacked;
+
+	// recorded poll start times, instead of period_ns
+	const uint64_t *schedule;
+	int schedule_len, schedule_pos;
+
+	unsigned char buf[256];
+	int got;
+	unsigned char id[6];
+
+	// called at the end of each report read
+	void (*on_report)(const unsigned char *data, int len, uint64_t t, void *ctx);
+	void *ctx;
+};
+
+/* mode: value written to register 0xFE (report format), 0 for none.
+ * profile: value written to register 0xF8 (gun profile + 1, see main.c
+ * in the firmware), 0 for none. */
+void master_init(struct master *m, uint64_t period_ns, uint64_t byte_ns, int read_len, int mode, int profile);
+
+/* Start the polls at these times (ns, increasing) instead of every
+ * period_ns. The polls stop after the last one. Polls due during the
+ * handshake or during the previous poll start as soon as possible. */
+void master_setSchedule(struct master *m, const uint64_t *t, int n);
+
+/* Run the step due at m->next */
+void master_step(struct master *m);
+
+#endif // _master_h__
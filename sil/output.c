@@ -0,0 +1,276 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+
+#include "../classic.h"
+#include "output.h"
+
+#define OUTPUT_NAME		"Extenmote SIL"
+
+static const struct {
+	uint16_t bit;
+	uint16_t code;
+} out_buttons[] = {
+	{ CPAD_BTN_A, BTN_A },
+	{ CPAD_BTN_B, BTN_B },
+	{ CPAD_BTN_X, BTN_X },
+	{ CPAD_BTN_Y, BTN_Y },
+	{ CPAD_BTN_TRIG_LEFT, BTN_TL },
+	{ CPAD_BTN_TRIG_RIGHT, BTN_TR },
+	{ CPAD_BTN_ZL, BTN_TL2 },
+	{ CPAD_BTN_ZR, BTN_TR2 },
+	{ CPAD_BTN_MINUS, BTN_SELECT },
+	{ CPAD_BTN_PLUS, BTN_START },
+	{ CPAD_BTN_HOME, BTN_MODE },
+	{ CPAD_BTN_DPAD_UP, BTN_DPAD_UP },
+	{ CPAD_BTN_DPAD_DOWN, BTN_DPAD_DOWN },
+	{ CPAD_BTN_DPAD_LEFT, BTN_DPAD_LEFT },
+	{ CPAD_BTN_DPAD_RIGHT, BTN_DPAD_RIGHT },
+};
+#define NUM_BUTTONS	(sizeof(out_buttons) / sizeof(out_buttons[0]))
+
+static const uint16_t out_axes[NUM_AXES] = { ABS_X, ABS_Y, ABS_RX, ABS_RY, ABS_Z, ABS_RZ };
+
+/* The reverse of pack_classic_data in classic.c */
+int classic_decode(const unsigned char *d, int len, int mode, struct classic_state *s)
+{
+	switch (mode)
+	{
+		default:
+		case CLASSIC_MODE_1:
+			if (len < 6)
+				return -1;
+			s->axes[AX_LX] = (d[0] & 0x3F) << 2;
+			s->axes[AX_LY] = (d[1] & 0x3F) << 2;
+			s->axes[AX_RX] = (((d[0] >> 3) & 0x18) | ((d[1] >> 5) & 0x06) | (d[2] >> 7)) << 3;
+			s->axes[AX_RY] = (d[2] & 0x1F) << 3;
+			s->axes[AX_LT] = (((d[2] >> 2) & 0x18) | (d[3] >> 5)) << 3;
+			s->axes[AX_RT] = (d[3] & 0x1F) << 3;
+			s->buttons = ~((d[4] << 8) | d[5]);
+			break;
+
+		case CLASSIC_MODE_2:
+			if (len < 9)
+				return -1;
+			s->axes[AX_LX] = d[0];
+			s->axes[AX_RX] = d[1];
+			s->axes[AX_LY] = d[2];
+			s->axes[AX_RY] = d[3];
+			s->axes[AX_LT] = d[5];
+			s->axes[AX_RT] = d[6];
+			s->buttons = ~((d[7] << 8) | d[8]);
+			break;
+
+		case CLASSIC_MODE_3:
+			if (len < 8)
+				return -1;
+			s->axes[AX_LX] = d[0];
+			s->axes[AX_RX] = d[1];
+			s->axes[AX_LY] = d[2];
+			s->axes[AX_RY] = d[3];
+			s->axes[AX_LT] = d[4];
+			s->axes[AX_RT] = d[5];
+			s->buttons = ~((d[6] << 8) | d[7]);
+			break;
+	}
+
+	return 0;
+}
+
+void output_init(struct output *o, int mode)
+{
+	memset(o, 0, sizeof(struct output));
+	o->mode = mode;
+	o->uinput_fd = -1;
+}
+
+static int out_findNode(struct output *o)
+{
+	char sysname[64];
+	char path[128];
+	struct dirent *de;
+	DIR *dir;
+
+	if (ioctl(o->uinput_fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+		perror("UI_GET_SYSNAME");
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s", sysname);
+	dir = opendir(path);
+	if (!dir) {
+		perror(path);
+		return -1;
+	}
+
+	while ((de = readdir(dir))) {
+		if (!strncmp(de->d_name, "event", 5)) {
+			snprintf(o->devpath, sizeof(o->devpath), "/dev/input/%s", de->d_name);
+			break;
+		}
+	}
+	closedir(dir);
+
+	return o->devpath[0] ? 0 : -1;
+}
+
+int output_openUinput(struct output *o)
+{
+	struct uinput_setup us;
+	struct uinput_abs_setup abs;
+	int i;
+
+	o->uinput_fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+	if (o->uinput_fd == -1) {
+		perror("/dev/uinput");
+		return -1;
+	}
+
+	ioctl(o->uinput_fd, UI_SET_EVBIT, EV_KEY);
+	for (i = 0; i < NUM_BUTTONS; i++)
+		ioctl(o->uinput_fd, UI_SET_KEYBIT, out_buttons[i].code);
+	ioctl(o->uinput_fd, UI_SET_EVBIT, EV_ABS);
+	for (i = 0; i < NUM_AXES; i++)
+		ioctl(o->uinput_fd, UI_SET_ABSBIT, out_axes[i]);
+
+	memset(&us, 0, sizeof(us));
+	us.id.bustype = BUS_VIRTUAL;
+	us.id.vendor = 0x289b; // raphnet
+	us.id.product = 0xfffe;
+	strcpy(us.name, OUTPUT_NAME);
+	if (ioctl(o->uinput_fd, UI_DEV_SETUP, &us)) {
+		perror("UI_DEV_SETUP");
+		return -1;
+	}
+
+	for (i = 0; i < NUM_AXES; i++) {
+		memset(&abs, 0, sizeof(abs));
+		abs.code = out_axes[i];
+		abs.absinfo.minimum = 0;
+		abs.absinfo.maximum = 255;
+		ioctl(o->uinput_fd, UI_ABS_SETUP, &abs);
+	}
+
+	if (ioctl(o->uinput_fd, UI_DEV_CREATE)) {
+		perror("UI_DEV_CREATE");
+		return -1;
+	}
+
+	if (out_findNode(o) == 0)
+		fprintf(stderr, "Virtual adapter: %s\n", o->devpath);
+
+	return 0;
+}
+
+int output_openRaw(struct output *o, const char *path)
+{
+	if (!strcmp(path, "-")) {
+		o->raw = stdout;
+		return 0;
+	}
+
+	o->raw = fopen(path, "wb");
+	if (!o->raw) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+void output_setHex(struct output *o, FILE *fp)
+{
+	o->hex = fp;
+}
+
+static void out_emit(struct output *o, int type, int code, int value)
+{
+	struct input_event ie;
+
+	memset(&ie, 0, sizeof(ie));
+	ie.type = type;
+	ie.code = code;
+	ie.value = value;
+
+	if (write(o->uinput_fd, &ie, sizeof(ie)) != sizeof(ie))
+		perror("uinput");
+}
+
+static void out_uinput(struct output *o, const unsigned char *data, int len)
+{
+	struct classic_state s;
+	int i, changed = 0;
+
+	if (classic_decode(data, len, o->mode, &s))
+		return;
+
+	for (i = 0; i < NUM_BUTTONS; i++) {
+		uint16_t bit = out_buttons[i].bit;
+
+		if (!o->have_last || ((s.buttons ^ o->last.buttons) & bit)) {
+			out_emit(o, EV_KEY, out_buttons[i].code, !!(s.buttons & bit));
+			changed = 1;
+		}
+	}
+	for (i = 0; i < NUM_AXES; i++) {
+		if (!o->have_last || s.axes[i] != o->last.axes[i]) {
+			out_emit(o, EV_ABS, out_axes[i], s.axes[i]);
+			changed = 1;
+		}
+	}
+	if (changed)
+		out_emit(o, EV_SYN, SYN_REPORT, 0);
+
+	o->last = s;
+	o->have_last = 1;
+}
+
+void output_report(struct output *o, const unsigned char *data, int len, uint64_t t)
+{
+	int i;
+
+	if (o->uinput_fd != -1)
+		out_uinput(o, data, len);
+
+	if (o->raw)
+		fwrite(data, len, 1, o->raw);
+
+	if (o->hex) {
+		fprintf(o->hex, "%12.3f ", t / 1e6);
+		for (i = 0; i < len; i++)
+			fprintf(o->hex, " %02x", data[i]);
+		fprintf(o->hex, "\n");
+	}
+}
+
+void output_close(struct output *o)
+{
+	if (o->uinput_fd != -1) {
+		ioctl(o->uinput_fd, UI_DEV_DESTROY);
+		close(o->uinput_fd);
+	}
+	if (o->raw && o->raw != stdout)
+		fclose(o->raw);
+	if (o->raw == stdout || o->hex)
+		fflush(stdout);
+}
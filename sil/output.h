@@ -0,0 +1,47 @@
+#ifndef _output_h__
+#define _output_h__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Where the reports go: a uinput joystick, and/or the raw register
+ * image the Wiimote read, as binary frames or hex text. */
+
+#define AX_LX	0
+#define AX_LY	1
+#define AX_RX	2
+#define AX_RY	3
+#define AX_LT	4
+#define AX_RT	5
+#define NUM_AXES	6
+
+struct classic_state {
+	uint8_t axes[NUM_AXES]; // AX_*, scaled to 0-255
+	uint16_t buttons; // CPAD_BTN_*, 1 when pressed
+};
+
+struct output {
+	int mode; // CLASSIC_MODE_* the reports are in
+
+	int uinput_fd;
+	char devpath[300];
+	struct classic_state last;
+	int have_last;
+
+	FILE *raw;
+	FILE *hex;
+};
+
+void output_init(struct output *o, int mode);
+int output_openUinput(struct output *o);
+int output_openRaw(struct output *o, const char *path);
+void output_setHex(struct output *o, FILE *fp);
+
+void output_report(struct output *o, const unsigned char *data, int len, uint64_t t);
+
+void output_close(struct output *o);
+
+/* Decode a report in the given CLASSIC_MODE_*. Returns -1 if too short. */
+int classic_decode(const unsigned char *data, int len, int mode, struct classic_state *s);
+
+#endif // _output_h__
@@ -0,0 +1,324 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../classic.h"
+#include "../gun.h"
+#include "probe.h"
+#include "hw.h"
+
+struct probe probe;
+
+/***** Histograms *****/
+
+static int pr_bucket(uint64_t v)
+{
+	int msb, shift;
+
+	if (v < PR_SUB)
+		return v;
+
+	msb = 63 - __builtin_clzll(v);
+	shift = msb - PR_SUB_BITS;
+
+	return ((shift + 1) << PR_SUB_BITS) + ((v >> shift) & (PR_SUB - 1));
+}
+
+static uint64_t pr_bucketLow(int b)
+{
+	int shift;
+
+	if (b < PR_SUB)
+		return b;
+
+	shift = (b >> PR_SUB_BITS) - 1;
+	return ((uint64_t)(PR_SUB + (b & (PR_SUB - 1)))) << shift;
+}
+
+void pr_histAdd(struct pr_hist *h, uint64_t v)
+{
+	if (!h->count || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->count++;
+	h->sum += v;
+	h->buckets[pr_bucket(v)]++;
+}
+
+uint64_t pr_histPercentile(const struct pr_hist *h, double p)
+{
+	uint64_t target, n = 0;
+	int b;
+
+	if (!h->count)
+		return 0;
+
+	target = (uint64_t)(p / 100.0 * h->count + 0.5);
+	if (target < 1)
+		target = 1;
+
+	for (b = 0; b < PR_BUCKETS; b++) {
+		n += h->buckets[b];
+		if (n >= target) {
+			uint64_t low = pr_bucketLow(b);
+			uint64_t high = b + 1 < PR_BUCKETS ? pr_bucketLow(b + 1) : low;
+			uint64_t v = low + (high - low) / 2;
+
+			if (v < h->min) v = h->min;
+			if (v > h->max) v = h->max;
+			return v;
+		}
+	}
+
+	return h->max;
+}
+
+/***** Event tracking *****/
+
+static uint64_t pr_poll_time;
+static int pr_poll_sampled = 1;
+
+// last sample, and the one in the report the Wiimote sees
+static uint64_t pr_sample_seq;
+static uint64_t pr_report_seq, pr_report_time;
+static uint64_t pr_last_read_seq;
+static int pr_reading;
+
+// the input change not delivered yet
+static int pr_input_pending;
+static uint64_t pr_input_time;
+static uint64_t pr_input_seq; // first sample seeing it, 0 when not sampled yet
+
+static uint64_t pr_cpuNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void probe_input(uint64_t t)
+{
+	probe.inputs++;
+	if (pr_input_pending)
+		probe.overruns++;
+	pr_input_pending = 1;
+	pr_input_time = t;
+	pr_input_seq = 0;
+}
+
+static void probe_poll(uint64_t t)
+{
+	probe.polls++;
+	if (!pr_poll_sampled)
+		probe.restarts++;
+	pr_poll_time = t;
+	pr_poll_sampled = 0;
+}
+
+static void probe_sample(uint64_t t)
+{
+	pr_sample_seq++;
+	probe.samples++;
+
+	if (!pr_poll_sampled) {
+		pr_histAdd(&probe.lat[PR_LAT_DELAY_A], t - pr_poll_time);
+		pr_poll_sampled = 1;
+	}
+
+	if (pr_input_pending && !pr_input_seq) {
+		pr_input_seq = pr_sample_seq;
+		pr_histAdd(&probe.lat[PR_LAT_INPUT], t - pr_input_time);
+	}
+}
+
+static void probe_report(uint64_t t)
+{
+	if (pr_reading)
+		probe.torn++;
+	pr_report_seq = pr_sample_seq;
+	pr_report_time = t;
+}
+
+void probe_readStart(uint64_t t)
+{
+	pr_reading = 1;
+
+	if (!pr_report_seq)
+		return;
+
+	if (pr_report_seq == pr_last_read_seq) {
+		probe.stale++;
+	} else {
+		pr_histAdd(&probe.lat[PR_LAT_AGE], t - pr_report_time);
+		pr_last_read_seq = pr_report_seq;
+	}
+
+	if (pr_input_pending && pr_input_seq && pr_report_seq >= pr_input_seq) {
+		pr_histAdd(&probe.lat[PR_LAT_END_TO_END], t - pr_input_time);
+		pr_input_pending = 0;
+	}
+}
+
+void probe_readEnd(uint64_t t)
+{
+	pr_reading = 0;
+}
+
+/***** Firmware wrappers (ld --wrap) *****/
+
+void __real_wm_init(unsigned char *id, unsigned char *t, unsigned char len,
+					const unsigned char *cal_data, void (*function)(unsigned char));
+void __real_wm_newaction(unsigned char channel, unsigned char *d, unsigned char len);
+void __real_dataToClassic(const gamepad_data *src, classic_pad_data *dst, char first_read);
+void __real_pack_classic_data(classic_pad_data *src, unsigned char dst[PACKED_CLASSIC_DATA_SIZE],
+								int analog_style, int mode);
+Gamepad *__real_gunGetGamepad(void);
+
+static void (*pr_pollfunc)(unsigned char channel);
+static Gamepad pr_gun;
+static char (*pr_gun_update)(void);
+static void (*pr_gun_getReport)(gamepad_data *dst);
+static uint64_t pr_pipeline_start;
+
+static void pr_poll(unsigned char channel)
+{
+	probe_poll(sil_now);
+	hw_pollRequest();
+	pr_pollfunc(channel);
+}
+
+void __wrap_wm_init(unsigned char *id, unsigned char *t, unsigned char len,
+					const unsigned char *cal_data, void (*function)(unsigned char))
+{
+	pr_pollfunc = function;
+	__real_wm_init(id, t, len, cal_data, pr_poll);
+}
+
+static char pr_gunUpdate(void)
+{
+	uint64_t t0 = pr_cpuNow();
+	char ret = pr_gun_update();
+
+	pr_histAdd(&probe.cpu[PR_CPU_UPDATE], pr_cpuNow() - t0);
+	pr_pipeline_start = t0;
+	probe_sample(sil_now);
+
+	return ret;
+}
+
+static void pr_gunGetReport(gamepad_data *dst)
+{
+	uint64_t t0 = pr_cpuNow();
+
+	pr_gun_getReport(dst);
+	pr_histAdd(&probe.cpu[PR_CPU_GETREPORT], pr_cpuNow() - t0);
+}
+
+Gamepad *__wrap_gunGetGamepad(void)
+{
+	Gamepad *g = __real_gunGetGamepad();
+
+	pr_gun = *g;
+	pr_gun_update = g->update;
+	pr_gun_getReport = g->getReport;
+	pr_gun.update = pr_gunUpdate;
+	pr_gun.getReport = pr_gunGetReport;
+
+	return &pr_gun;
+}
+
+void __wrap_dataToClassic(const gamepad_data *src, classic_pad_data *dst, char first_read)
+{
+	uint64_t t0 = pr_cpuNow();
+
+	__real_dataToClassic(src, dst, first_read);
+	pr_histAdd(&probe.cpu[PR_CPU_TOCLASSIC], pr_cpuNow() - t0);
+}
+
+void __wrap_pack_classic_data(classic_pad_data *src, unsigned char dst[PACKED_CLASSIC_DATA_SIZE],
+								int analog_style, int mode)
+{
+	uint64_t t0 = pr_cpuNow();
+
+	__real_pack_classic_data(src, dst, analog_style, mode);
+	pr_histAdd(&probe.cpu[PR_CPU_PACK], pr_cpuNow() - t0);
+}
+
+void __wrap_wm_newaction(unsigned char channel, unsigned char *d, unsigned char len)
+{
+	uint64_t t0 = pr_cpuNow(), t1;
+
+	__real_wm_newaction(channel, d, len);
+	t1 = pr_cpuNow();
+	pr_histAdd(&probe.cpu[PR_CPU_NEWACTION], t1 - t0);
+
+	// the initial report, from main() before the loop, is not a sample
+	if (pr_sample_seq) {
+		pr_histAdd(&probe.cpu[PR_CPU_PIPELINE], t1 - pr_pipeline_start);
+		probe_report(sil_now);
+	}
+}
+
+/***** Output *****/
+
+static void pr_printHist(FILE *fp, const char *name, const struct pr_hist *h, double unit)
+{
+	if (!h->count) {
+		fprintf(fp, "%-20s %10s\n", name, "-");
+		return;
+	}
+	fprintf(fp, "%-20s %10llu %9.3f %9.3f %9.3f %9.3f %9.3f\n", name,
+		(unsigned long long)h->count,
+		h->min / unit,
+		pr_histPercentile(h, 50) / unit,
+		pr_histPercentile(h, 99) / unit,
+		h->max / unit,
+		(double)h->sum / h->count / unit);
+}
+
+void probe_print(FILE *fp)
+{
+	static const char *cpu_names[PR_NUM_CPU] = {
+		"gun update", "gun getReport", "dataToClassic",
+		"pack_classic_data", "wm_newaction", "pipeline",
+	};
+	static const char *lat_names[PR_NUM_LAT] = {
+		"delay A", "report age", "input to sample", "input to read",
+	};
+	int i;
+
+	fprintf(fp, "%-20s %10s %9s %9s %9s %9s %9s\n", "host CPU (us)", "count",
+		"min", "p50", "p99", "max", "mean");
+	for (i = 0; i < PR_NUM_CPU; i++)
+		pr_printHist(fp, cpu_names[i], &probe.cpu[i], 1e3);
+
+	fprintf(fp, "\n%-20s %10s %9s %9s %9s %9s %9s\n", "virtual time (ms)", "count",
+		"min", "p50", "p99", "max", "mean");
+	for (i = 0; i < PR_NUM_LAT; i++)
+		pr_printHist(fp, lat_names[i], &probe.lat[i], 1e6);
+
+	fprintf(fp, "\npolls %llu, samples %llu, restarts %llu, torn %llu, stale %llu, nacks %llu\n",
+		(unsigned long long)probe.polls, (unsigned long long)probe.samples,
+		(unsigned long long)probe.restarts, (unsigned long long)probe.torn,
+		(unsigned long long)probe.stale, (unsigned long long)probe.nacks);
+	fprintf(fp, "input changes %llu, overruns %llu\n",
+		(unsigned long long)probe.inputs, (unsigned long long)probe.overruns);
+}
@@ -0,0 +1,66 @@
+#ifndef _probe_h__
+#define _probe_h__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Latency counters for each stage of the pipeline.
+ *
+ * The firmware functions are wrapped at link time (see the Makefile) to
+ * measure the host CPU time each one takes, and to timestamp samples and
+ * reports in virtual time. The master and the input sources report the
+ * bus and input events. */
+
+#define PR_SUB_BITS		3
+#define PR_SUB			(1 << PR_SUB_BITS)
+#define PR_BUCKETS		((64 - PR_SUB_BITS + 1) << PR_SUB_BITS)
+
+struct pr_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min, max;
+	uint32_t buckets[PR_BUCKETS];
+};
+
+void pr_histAdd(struct pr_hist *h, uint64_t v);
+uint64_t pr_histPercentile(const struct pr_hist *h, double p);
+
+// host CPU time
+#define PR_CPU_UPDATE		0 // gun update
+#define PR_CPU_GETREPORT	1
+#define PR_CPU_TOCLASSIC	2 // dataToClassic
+#define PR_CPU_PACK			3 // pack_classic_data
+#define PR_CPU_NEWACTION	4 // wm_newaction
+#define PR_CPU_PIPELINE		5 // update to wm_newaction
+#define PR_NUM_CPU			6
+
+// virtual time
+#define PR_LAT_DELAY_A		0 // pollfunc to the sample
+#define PR_LAT_AGE			1 // report ready to the read delivering it
+#define PR_LAT_INPUT		2 // input change to the sample seeing it
+#define PR_LAT_END_TO_END	3 // input change to the read delivering it
+#define PR_NUM_LAT			4
+
+struct probe {
+	struct pr_hist cpu[PR_NUM_CPU];
+	struct pr_hist lat[PR_NUM_LAT];
+
+	uint64_t polls;
+	uint64_t samples;
+	uint64_t restarts; // poll while the previous one was not sampled yet
+	uint64_t torn; // report updated while being read
+	uint64_t stale; // read delivering the same report as the previous one
+	uint64_t nacks; // transfer not acknowledged
+	uint64_t inputs;
+	uint64_t overruns; // input change before the previous one was delivered
+};
+
+extern struct probe probe;
+
+void probe_input(uint64_t t);
+void probe_readStart(uint64_t t);
+void probe_readEnd(uint64_t t);
+
+void probe_print(FILE *fp);
+
+#endif // _probe_h__
@@ -0,0 +1,16 @@
+#ifndef _sil_avr_eeprom_h__
+#define _sil_avr_eeprom_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// hw.c: the EEPROM is an array, optionally backed by a file
+#define eeprom_busy_wait()
+#define eeprom_is_ready()	1
+
+uint8_t eeprom_read_byte(const uint8_t *addr);
+void eeprom_update_byte(uint8_t *addr, uint8_t value);
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_update_block(const void *src, void *dst, size_t n);
+
+#endif // _sil_avr_eeprom_h__
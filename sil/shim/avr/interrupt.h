@@ -0,0 +1,12 @@
+#ifndef _sil_avr_interrupt_h__
+#define _sil_avr_interrupt_h__
+
+/* Interrupt handlers are ordinary functions, called by the host between
+ * two firmware steps. The firmware never runs concurrently with them, so
+ * cli() and sei() have nothing to do. */
+#define ISR(vector, ...)	void vector(void); void vector(void)
+
+#define cli()
+#define sei()
+
+#endif // _sil_avr_interrupt_h__
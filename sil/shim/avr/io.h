@@ -0,0 +1,67 @@
+#ifndef _sil_avr_io_h__
+#define _sil_avr_io_h__
+
+/* Host stand-in for <avr/io.h>. The I/O registers are plain variables
+ * (see hw.c). Only what the firmware uses is declared. */
+#include <stdint.h>
+
+#define _BV(bit)	(1 << (bit))
+
+#define SIL_REG(name)	extern volatile uint8_t name;
+
+SIL_REG(PINB) SIL_REG(DDRB) SIL_REG(PORTB)
+SIL_REG(PINC) SIL_REG(DDRC) SIL_REG(PORTC)
+SIL_REG(PIND) SIL_REG(DDRD) SIL_REG(PORTD)
+SIL_REG(SREG)
+
+// TWI
+SIL_REG(TWBR) SIL_REG(TWSR) SIL_REG(TWAR) SIL_REG(TWDR) SIL_REG(TWCR)
+
+#define TWINT	7
+#define TWEA	6
+#define TWSTA	5
+#define TWSTO	4
+#define TWWC	3
+#define TWEN	2
+#define TWIE	0
+
+// pin change interrupts (port D only)
+SIL_REG(PCICR) SIL_REG(PCIFR) SIL_REG(PCMSK2)
+// tested with #ifdef, like in avr-libc
+#define PCMSK2	PCMSK2
+
+#define PCIE2	2
+#define PCIF2	2
+
+// Timer1 (see hw.c): the count follows the virtual time
+SIL_REG(TCCR1A) SIL_REG(TCCR1B) SIL_REG(TIMSK1) SIL_REG(TIFR1)
+extern volatile uint16_t OCR1A, OCR1B;
+volatile uint16_t *sil_tcnt1(void);
+#define TCNT1	(*sil_tcnt1())
+// tested with #ifdef (timebase.h)
+#define TIMSK1	TIMSK1
+
+#define CS11	1
+#define TOIE1	0
+#define OCIE1A	1
+#define OCIE1B	2
+#define TOV1	0
+#define OCF1A	1
+#define OCF1B	2
+
+// ADC
+SIL_REG(ADMUX) SIL_REG(ADCSRA) SIL_REG(ADCSRB) SIL_REG(ADCH) SIL_REG(DIDR0)
+
+#define REFS1	7
+#define REFS0	6
+#define ADLAR	5
+#define ADEN	7
+#define ADSC	6
+#define ADATE	5
+#define ADIF	4
+#define ADIE	3
+#define ADPS2	2
+#define ADPS1	1
+#define ADPS0	0
+
+#endif // _sil_avr_io_h__
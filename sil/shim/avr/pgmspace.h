@@ -0,0 +1,11 @@
+#ifndef _sil_avr_pgmspace_h__
+#define _sil_avr_pgmspace_h__
+
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s)				(s)
+#define pgm_read_byte(addr)	(*(const uint8_t *)(addr))
+#define pgm_read_word(addr)	(*(const uint16_t *)(addr))
+
+#endif // _sil_avr_pgmspace_h__
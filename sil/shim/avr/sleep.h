@@ -0,0 +1,15 @@
+#ifndef _sil_avr_sleep_h__
+#define _sil_avr_sleep_h__
+
+#define SLEEP_MODE_IDLE			0
+#define SLEEP_MODE_EXT_STANDBY	1
+
+// hw.c: returns to the host until a poll wakes the firmware up
+void sil_sleep(void);
+
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_cpu()		sil_sleep()
+#define sleep_disable()
+
+#endif // _sil_avr_sleep_h__
@@ -0,0 +1,10 @@
+#ifndef _sil_util_delay_h__
+#define _sil_util_delay_h__
+
+// hw.c: the host resumes the firmware once the delay is over
+void sil_delay_ns(unsigned long ns);
+
+#define _delay_us(us)	sil_delay_ns((us) * 1000UL)
+#define _delay_ms(ms)	sil_delay_ns((ms) * 1000000UL)
+
+#endif // _sil_util_delay_h__
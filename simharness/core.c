@@ -0,0 +1,803 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "core.h"
+
+#define SMCR_ADDR	0x53
+#define SMCR_SE		0x01
+
+#define X	26
+#define Y	28
+#define Z	30
+
+/***** Cycle timers *****/
+
+static void core_nextTimer(struct core *c)
+{
+	int i;
+
+	c->next_timer = UINT64_MAX;
+	for (i = 0; i < c->num_timers; i++) {
+		if (c->timers[i]->when < c->next_timer)
+			c->next_timer = c->timers[i]->when;
+	}
+}
+
+void core_timerSet(struct core *c, struct core_timer *t, uint64_t when,
+				void (*fn)(struct core *c, void *param), void *param)
+{
+	t->when = when;
+	t->fn = fn;
+	t->param = param;
+	if (!t->active) {
+		if (c->num_timers == CORE_MAX_TIMERS) {
+			fprintf(stderr, "core: too many cycle timers\n");
+			return;
+		}
+		c->timers[c->num_timers++] = t;
+		t->active = 1;
+	}
+	core_nextTimer(c);
+}
+
+void core_timerCancel(struct core *c, struct core_timer *t)
+{
+	int i;
+
+	if (!t->active)
+		return;
+	for (i = 0; i < c->num_timers; i++) {
+		if (c->timers[i] == t) {
+			c->timers[i] = c->timers[--c->num_timers];
+			break;
+		}
+	}
+	t->active = 0;
+	core_nextTimer(c);
+}
+
+// the due ones, earliest first
+static void core_runTimers(struct core *c)
+{
+	while (c->next_timer <= c->cycle) {
+		struct core_timer *t = NULL;
+		uint64_t now;
+		int i;
+
+		for (i = 0; i < c->num_timers; i++) {
+			if (!t || c->timers[i]->when < t->when)
+				t = c->timers[i];
+		}
+		core_timerCancel(c, t);
+
+		/* At its time: the instruction in progress then has run to its
+		 * end, but an event of the outside happens when it happens. */
+		now = c->cycle;
+		c->cycle = t->when;
+		t->fn(c, t->param);
+		c->cycle = now;
+	}
+}
+
+/***** Data space *****/
+
+void core_ioHook(struct core *c, uint16_t addr,
+				uint8_t (*rd)(struct core *c, uint16_t addr, void *p),
+				void (*wr)(struct core *c, uint16_t addr, uint8_t v, uint8_t mask, void *p), void *p)
+{
+	c->io_read[addr] = rd;
+	c->io_write[addr] = wr;
+	c->io_param[addr] = p;
+}
+
+uint8_t core_read(struct core *c, uint16_t addr)
+{
+	if (addr >= 0x20 && addr < 0x100 && c->io_read[addr])
+		return c->io_read[addr](c, addr, c->io_param[addr]);
+	if (addr >= CORE_DATA_SIZE)
+		return 0;
+	return c->data[addr];
+}
+
+static void core_writeBits(struct core *c, uint16_t addr, uint8_t v, uint8_t mask)
+{
+	if (addr >= 0x20 && addr < 0x100 && c->io_write[addr]) {
+		c->io_write[addr](c, addr, v, mask, c->io_param[addr]);
+		return;
+	}
+	if (addr < CORE_DATA_SIZE)
+		c->data[addr] = (c->data[addr] & ~mask) | (v & mask);
+}
+
+void core_write(struct core *c, uint16_t addr, uint8_t v)
+{
+	core_writeBits(c, addr, v, 0xFF);
+}
+
+static uint16_t core_word(struct core *c, int reg)
+{
+	return c->data[reg] | (c->data[reg + 1] << 8);
+}
+
+static void core_setWord(struct core *c, int reg, uint16_t v)
+{
+	c->data[reg] = v;
+	c->data[reg + 1] = v >> 8;
+}
+
+static void core_push(struct core *c, uint8_t v)
+{
+	uint16_t sp = core_word(c, CORE_SPL);
+
+	if (sp < CORE_DATA_SIZE)
+		c->data[sp] = v;
+	core_setWord(c, CORE_SPL, sp - 1);
+}
+
+static uint8_t core_pop(struct core *c)
+{
+	uint16_t sp = core_word(c, CORE_SPL) + 1;
+
+	core_setWord(c, CORE_SPL, sp);
+	return sp < CORE_DATA_SIZE ? c->data[sp] : 0;
+}
+
+// the low byte first, at the higher address
+static void core_pushPc(struct core *c, uint32_t pc)
+{
+	core_push(c, pc);
+	core_push(c, pc >> 8);
+}
+
+static uint32_t core_popPc(struct core *c)
+{
+	uint32_t pc = core_pop(c) << 8;
+
+	return pc | core_pop(c);
+}
+
+/***** Flags *****/
+
+static void core_flags(struct core *c, uint8_t mask, uint8_t s)
+{
+	if (((s & SREG_N) != 0) ^ ((s & SREG_V) != 0))
+		s |= SREG_S;
+	c->data[CORE_SREG] = (c->data[CORE_SREG] & ~mask) | (s & mask);
+}
+
+#define SVNZ	(SREG_S | SREG_V | SREG_N | SREG_Z)
+#define SVNZC	(SVNZ | SREG_C)
+#define HSVNZC	(SVNZC | SREG_H)
+
+static uint8_t core_nz(uint8_t res)
+{
+	return (res & 0x80 ? SREG_N : 0) | (res ? 0 : SREG_Z);
+}
+
+static uint8_t core_add(struct core *c, uint8_t d, uint8_t r, int carry)
+{
+	uint8_t res = d + r + carry;
+	uint8_t cm = (d & r) | (r & ~res) | (~res & d);
+	uint8_t s = core_nz(res);
+
+	if (cm & 0x08)
+		s |= SREG_H;
+	if (cm & 0x80)
+		s |= SREG_C;
+	if (((d & r & ~res) | (~d & ~r & res)) & 0x80)
+		s |= SREG_V;
+	core_flags(c, HSVNZC, s);
+
+	return res;
+}
+
+/* keep_z: Z stays cleared if it was (sbc, sbci, cpc) */
+static uint8_t core_sub(struct core *c, uint8_t d, uint8_t r, int carry, int keep_z)
+{
+	uint8_t res = d - r - carry;
+	uint8_t bm = (~d & r) | (r & res) | (res & ~d);
+	uint8_t s = core_nz(res);
+
+	if (bm & 0x08)
+		s |= SREG_H;
+	if (bm & 0x80)
+		s |= SREG_C;
+	if (((d & ~r & ~res) | (~d & r & res)) & 0x80)
+		s |= SREG_V;
+	if (keep_z && !(c->data[CORE_SREG] & SREG_Z))
+		s &= ~SREG_Z;
+	core_flags(c, HSVNZC, s);
+
+	return res;
+}
+
+static uint8_t core_logic(struct core *c, uint8_t res)
+{
+	core_flags(c, SVNZ, core_nz(res));
+	return res;
+}
+
+// lsr, ror, asr: V is N xor C
+static uint8_t core_shift(struct core *c, uint8_t res, int carry)
+{
+	uint8_t s = core_nz(res);
+
+	if (carry)
+		s |= SREG_C;
+	if (((s & SREG_N) != 0) ^ carry)
+		s |= SREG_V;
+	core_flags(c, SVNZC, s);
+
+	return res;
+}
+
+static void core_mul(struct core *c, int32_t product, int fractional)
+{
+	uint16_t res = product;
+	uint8_t s = 0;
+
+	if (res & 0x8000)
+		s |= SREG_C;
+	if (fractional)
+		res <<= 1;
+	if (!res)
+		s |= SREG_Z;
+	c->data[CORE_SREG] = (c->data[CORE_SREG] & ~(SREG_C | SREG_Z)) | s;
+	core_setWord(c, 0, res);
+}
+
+/***** Instructions *****/
+
+// lds, sts, jmp, call
+static int core_twoWords(uint16_t op)
+{
+	return (op & 0xFC0F) == 0x9000 || (op & 0xFE0C) == 0x940C;
+}
+
+static void core_skip(struct core *c, uint32_t *pc)
+{
+	int n = core_twoWords(c->flash[*pc % (CORE_FLASH_SIZE / 2)]) ? 2 : 1;
+
+	*pc += n;
+	c->cycle += n;
+}
+
+static void core_crash(struct core *c, uint16_t op)
+{
+	fprintf(stderr, "core: unknown instruction %04x at 0x%04x\n", op, c->pc * 2);
+	c->state = CORE_CRASHED;
+}
+
+/* ld and st, but lds and sts: pointer register, pre-decrement or
+ * post-increment */
+static uint16_t core_pointer(struct core *c, uint16_t op, int *ok)
+{
+	int reg, mode = op & 0x0F;
+	uint16_t p;
+
+	*ok = 1;
+	switch (mode)
+	{
+		case 0x1: case 0x2: reg = Z; break;
+		case 0x9: case 0xA: reg = Y; break;
+		case 0xC: case 0xD: case 0xE: reg = X; break;
+		default:
+			*ok = 0;
+			return 0;
+	}
+
+	p = core_word(c, reg);
+	if (mode == 0x2 || mode == 0xA || mode == 0xE)
+		core_setWord(c, reg, --p);
+	else if (mode == 0x1 || mode == 0x9 || mode == 0xD)
+		core_setWord(c, reg, p + 1);
+
+	return p;
+}
+
+static uint8_t core_lpm(struct core *c)
+{
+	uint16_t z = core_word(c, Z) % CORE_FLASH_SIZE;
+	uint16_t w = c->flash[z >> 1];
+
+	return z & 1 ? w >> 8 : w;
+}
+
+static void core_return(struct core *c, int reti)
+{
+	c->pc = core_popPc(c);
+	if (!reti)
+		return;
+
+	c->data[CORE_SREG] |= SREG_I;
+	// one instruction of the interrupted code runs before the next interrupt
+	c->int_delay = 1;
+	if (c->depth > 0) {
+		c->depth--;
+		if (c->depth < CORE_MAX_NESTING && c->on_vector)
+			c->on_vector(c, c->nesting[c->depth], 0, c->ctx);
+	}
+}
+
+/* 0x9000 to 0x9FFF */
+static void core_step9(struct core *c, uint16_t op, uint32_t *pc)
+{
+	uint8_t *r = c->data;
+	int d = (op >> 4) & 0x1F;
+	uint16_t addr;
+	uint8_t v;
+	int ok;
+
+	switch ((op >> 9) & 7)
+	{
+		case 0: // loads
+			c->cycle++;
+			switch (op & 0x0F)
+			{
+				case 0x0: // lds
+					addr = c->flash[*pc % (CORE_FLASH_SIZE / 2)];
+					(*pc)++;
+					r[d] = core_read(c, addr);
+					break;
+				case 0x4: case 0x5: // lpm Rd, Z / Z+
+					c->cycle++;
+					r[d] = core_lpm(c);
+					if (op & 1)
+						core_setWord(c, Z, core_word(c, Z) + 1);
+					break;
+				case 0xF: // pop
+					r[d] = core_pop(c);
+					break;
+				default:
+					addr = core_pointer(c, op, &ok);
+					if (!ok) {
+						core_crash(c, op);
+						return;
+					}
+					r[d] = core_read(c, addr);
+			}
+			return;
+
+		case 1: // stores
+			c->cycle++;
+			switch (op & 0x0F)
+			{
+				case 0x0: // sts
+					addr = c->flash[*pc % (CORE_FLASH_SIZE / 2)];
+					(*pc)++;
+					core_write(c, addr, r[d]);
+					break;
+				case 0xF: // push
+					core_push(c, r[d]);
+					break;
+				default:
+					v = r[d];
+					addr = core_pointer(c, op, &ok);
+					if (!ok) {
+						core_crash(c, op);
+						return;
+					}
+					core_write(c, addr, v);
+			}
+			return;
+
+		case 2:
+			switch (op & 0x0F)
+			{
+				case 0x0: r[d] = core_logic(c, ~r[d]); r[CORE_SREG] |= SREG_C; return; // com
+				case 0x1: // neg
+					v = r[d];
+					r[d] = core_sub(c, 0, v, 0, 0);
+					return;
+				case 0x2: r[d] = (r[d] << 4) | (r[d] >> 4); return; // swap
+				case 0x3: // inc
+					v = ++r[d];
+					core_flags(c, SVNZ, core_nz(v) | (v == 0x80 ? SREG_V : 0));
+					return;
+				case 0x5: r[d] = core_shift(c, (r[d] >> 1) | (r[d] & 0x80), r[d] & 1); return; // asr
+				case 0x6: r[d] = core_shift(c, r[d] >> 1, r[d] & 1); return; // lsr
+				case 0x7: // ror
+					r[d] = core_shift(c, (r[d] >> 1) | (r[CORE_SREG] & SREG_C ? 0x80 : 0), r[d] & 1);
+					return;
+				case 0xA: // dec
+					v = --r[d];
+					core_flags(c, SVNZ, core_nz(v) | (v == 0x7F ? SREG_V : 0));
+					return;
+				case 0xC: case 0xD: // jmp
+					*pc = ((uint32_t)(((op >> 3) & 0x3E) | (op & 1)) << 16) | c->flash[*pc % (CORE_FLASH_SIZE / 2)];
+					c->cycle += 2;
+					return;
+				case 0xE: case 0xF: // call
+					core_pushPc(c, *pc + 1);
+					*pc = ((uint32_t)(((op >> 3) & 0x3E) | (op & 1)) << 16) | c->flash[*pc % (CORE_FLASH_SIZE / 2)];
+					c->cycle += 3;
+					return;
+				case 0x8:
+					if ((op & 0xFF0F) == 0x9408) { // bset, bclr
+						v = 1 << ((op >> 4) & 7);
+						if (op & 0x80) {
+							r[CORE_SREG] &= ~v;
+						} else {
+							// after sei, the next instruction runs before any interrupt
+							if (v == SREG_I && !(r[CORE_SREG] & SREG_I))
+								c->int_delay = 1;
+							r[CORE_SREG] |= v;
+						}
+						return;
+					}
+					switch (op)
+					{
+						case 0x9508: // ret
+						case 0x9518: // reti
+							c->cycle += 3;
+							core_return(c, op == 0x9518);
+							*pc = c->pc;
+							return;
+						case 0x9588: // sleep
+							if (core_read(c, SMCR_ADDR) & SMCR_SE) {
+								c->state = CORE_SLEEPING;
+								if (c->periph.sleep)
+									c->periph.sleep(c, c->periph.p, 1);
+							}
+							return;
+						case 0x9598: // break
+						case 0x95A8: // wdr, the watchdog is not run
+							return;
+						case 0x95C8: // lpm
+							c->cycle += 2;
+							r[0] = core_lpm(c);
+							return;
+					}
+					break;
+				case 0x9:
+					if (op == 0x9409 || op == 0x9509) { // ijmp, icall
+						c->cycle++;
+						if (op == 0x9509) {
+							c->cycle++;
+							core_pushPc(c, *pc);
+						}
+						*pc = core_word(c, Z);
+						return;
+					}
+					break;
+			}
+			break;
+
+		case 3: // adiw, sbiw
+		{
+			int dd = 24 + ((op >> 3) & 6);
+			uint16_t k = (op & 0x0F) | ((op >> 2) & 0x30);
+			uint16_t a = core_word(c, dd), res;
+			uint8_t s;
+
+			c->cycle++;
+			if (op & 0x100) {
+				res = a - k;
+				s = (res & 0x8000) && !(a & 0x8000) ? SREG_C : 0;
+				if ((a & 0x8000) && !(res & 0x8000))
+					s |= SREG_V;
+			} else {
+				res = a + k;
+				s = !(res & 0x8000) && (a & 0x8000) ? SREG_C : 0;
+				if (!(a & 0x8000) && (res & 0x8000))
+					s |= SREG_V;
+			}
+			if (res & 0x8000)
+				s |= SREG_N;
+			if (!res)
+				s |= SREG_Z;
+			core_flags(c, SVNZC, s);
+			core_setWord(c, dd, res);
+			return;
+		}
+
+		case 4: case 5: // cbi, sbic, sbi, sbis
+		{
+			uint8_t bit = 1 << (op & 7);
+
+			addr = 0x20 + ((op >> 3) & 0x1F);
+			if (op & 0x100) {
+				v = core_read(c, addr) & bit;
+				if ((v != 0) == ((op & 0x200) != 0))
+					core_skip(c, pc);
+			} else {
+				c->cycle++;
+				core_writeBits(c, addr, op & 0x200 ? bit : 0, bit);
+			}
+			return;
+		}
+
+		case 6: case 7: // mul
+			c->cycle++;
+			core_mul(c, r[d] * r[(op & 0x0F) | ((op >> 5) & 0x10)], 0);
+			return;
+	}
+
+	core_crash(c, op);
+}
+
+static void core_step(struct core *c)
+{
+	uint8_t *r = c->data;
+	uint16_t op = c->flash[c->pc];
+	uint32_t pc = c->pc + 1;
+	int d = (op >> 4) & 0x1F;
+	int rr = (op & 0x0F) | ((op >> 5) & 0x10);
+	int dh = 16 + ((op >> 4) & 0x0F);
+	uint8_t k = (op & 0x0F) | ((op >> 4) & 0xF0);
+	uint64_t start = c->cycle;
+
+	switch (op >> 12)
+	{
+		case 0x0:
+			switch ((op >> 10) & 3)
+			{
+				case 0:
+					switch (op >> 8)
+					{
+						case 0x00:
+							if (op)
+								core_crash(c, op);
+							break; // nop
+						case 0x01: // movw
+							r[(op >> 3) & 0x1E] = r[(op << 1) & 0x1E];
+							r[((op >> 3) & 0x1E) + 1] = r[((op << 1) & 0x1E) + 1];
+							break;
+						case 0x02: // muls
+							c->cycle++;
+							core_mul(c, (int8_t)r[dh] * (int8_t)r[16 + (op & 0x0F)], 0);
+							break;
+						case 0x03:
+						{
+							// mulsu, fmul, fmuls, fmulsu: r16 to r23
+							int a = 16 + ((op >> 4) & 7), b = 16 + (op & 7);
+
+							c->cycle++;
+							switch (op & 0x88)
+							{
+								case 0x00: core_mul(c, (int8_t)r[a] * r[b], 0); break;
+								case 0x08: core_mul(c, r[a] * r[b], 1); break;
+								case 0x80: core_mul(c, (int8_t)r[a] * (int8_t)r[b], 1); break;
+								case 0x88: core_mul(c, (int8_t)r[a] * r[b], 1); break;
+							}
+							break;
+						}
+					}
+					break;
+				case 1: core_sub(c, r[d], r[rr], r[CORE_SREG] & SREG_C, 1); break; // cpc
+				case 2: r[d] = core_sub(c, r[d], r[rr], r[CORE_SREG] & SREG_C, 1); break; // sbc
+				case 3: r[d] = core_add(c, r[d], r[rr], 0); break; // add
+			}
+			break;
+
+		case 0x1:
+			switch ((op >> 10) & 3)
+			{
+				case 0: // cpse
+					if (r[d] == r[rr])
+						core_skip(c, &pc);
+					break;
+				case 1: core_sub(c, r[d], r[rr], 0, 0); break; // cp
+				case 2: r[d] = core_sub(c, r[d], r[rr], 0, 0); break; // sub
+				case 3: r[d] = core_add(c, r[d], r[rr], r[CORE_SREG] & SREG_C); break; // adc
+			}
+			break;
+
+		case 0x2:
+			switch ((op >> 10) & 3)
+			{
+				case 0: r[d] = core_logic(c, r[d] & r[rr]); break; // and
+				case 1: r[d] = core_logic(c, r[d] ^ r[rr]); break; // eor
+				case 2: r[d] = core_logic(c, r[d] | r[rr]); break; // or
+				case 3: r[d] = r[rr]; break; // mov
+			}
+			break;
+
+		case 0x3: core_sub(c, r[dh], k, 0, 0); break; // cpi
+		case 0x4: r[dh] = core_sub(c, r[dh], k, r[CORE_SREG] & SREG_C, 1); break; // sbci
+		case 0x5: r[dh] = core_sub(c, r[dh], k, 0, 0); break; // subi
+		case 0x6: r[dh] = core_logic(c, r[dh] | k); break; // ori
+		case 0x7: r[dh] = core_logic(c, r[dh] & k); break; // andi
+
+		case 0x8: case 0xA: // ldd, std
+		{
+			int q = (op & 7) | ((op >> 7) & 0x18) | ((op >> 8) & 0x20);
+			uint16_t addr = core_word(c, op & 8 ? Y : Z) + q;
+
+			c->cycle++;
+			if (op & 0x200)
+				core_write(c, addr, r[d]);
+			else
+				r[d] = core_read(c, addr);
+			break;
+		}
+
+		case 0x9:
+			core_step9(c, op, &pc);
+			break;
+
+		case 0xB: // in, out
+		{
+			uint16_t addr = 0x20 + ((op & 0x0F) | ((op >> 5) & 0x30));
+
+			if (op & 0x800)
+				core_write(c, addr, r[d]);
+			else
+				r[d] = core_read(c, addr);
+			break;
+		}
+
+		case 0xC: // rjmp
+			pc += ((int16_t)(op << 4)) >> 4;
+			c->cycle++;
+			break;
+
+		case 0xD: // rcall
+			core_pushPc(c, pc);
+			pc += ((int16_t)(op << 4)) >> 4;
+			c->cycle += 2;
+			break;
+
+		case 0xE: r[dh] = k; break; // ldi
+
+		case 0xF:
+			if (!(op & 0x800)) { // brbs, brbc
+				int set = (r[CORE_SREG] >> (op & 7)) & 1;
+
+				if (set == !(op & 0x400)) {
+					pc += ((int8_t)((op >> 2) & 0xFE)) >> 1;
+					c->cycle++;
+				}
+				break;
+			}
+			if (op & 8) {
+				core_crash(c, op);
+				break;
+			}
+			switch ((op >> 9) & 3)
+			{
+				case 0: // bld
+					if (r[CORE_SREG] & SREG_T)
+						r[d] |= 1 << (op & 7);
+					else
+						r[d] &= ~(1 << (op & 7));
+					break;
+				case 1: // bst
+					if (r[d] & (1 << (op & 7)))
+						r[CORE_SREG] |= SREG_T;
+					else
+						r[CORE_SREG] &= ~SREG_T;
+					break;
+				case 2: case 3: // sbrc, sbrs
+					if (((r[d] >> (op & 7)) & 1) == ((op >> 9) & 1))
+						core_skip(c, &pc);
+					break;
+			}
+			break;
+	}
+
+	if (c->state == CORE_CRASHED) {
+		c->cycle = start;
+		return;
+	}
+	c->cycle++;
+	c->pc = pc % (CORE_FLASH_SIZE / 2);
+}
+
+/***** Interrupts *****/
+
+static void core_interrupt(struct core *c, int vector)
+{
+	core_pushPc(c, c->pc);
+	c->data[CORE_SREG] &= ~SREG_I;
+	c->pc = vector * 2;
+	c->cycle += 4;
+
+	if (c->depth < CORE_MAX_NESTING)
+		c->nesting[c->depth] = vector;
+	c->depth++;
+	if (c->periph.taken)
+		c->periph.taken(c, c->periph.p, vector);
+	if (c->on_vector)
+		c->on_vector(c, vector, 1, c->ctx);
+}
+
+static int core_pending(struct core *c)
+{
+	return c->periph.pending ? c->periph.pending(c, c->periph.p) : 0;
+}
+
+/***** Running *****/
+
+void core_init(struct core *c, double frequency)
+{
+	memset(c, 0, sizeof(struct core));
+	c->frequency = frequency;
+	c->break_pc = UINT32_MAX;
+	c->next_timer = UINT64_MAX;
+	memset(c->flash, 0xFF, sizeof(c->flash));
+	memset(c->eeprom, 0xFF, sizeof(c->eeprom));
+	core_reset(c);
+}
+
+void core_reset(struct core *c)
+{
+	memset(c->data, 0, sizeof(c->data));
+	core_setWord(c, CORE_SPL, CORE_DATA_SIZE - 1);
+	c->sp_min = CORE_DATA_SIZE - 1;
+	c->pc = 0;
+	c->state = CORE_RUNNING;
+	c->int_delay = 0;
+	c->depth = 0;
+}
+
+void core_stop(struct core *c)
+{
+	c->state = CORE_STOPPED;
+}
+
+int core_run(struct core *c, uint64_t end)
+{
+	while (c->cycle < end) {
+		int vector;
+
+		if (c->cycle >= c->next_timer) {
+			core_runTimers(c);
+			continue;
+		}
+		if (c->state != CORE_RUNNING && c->state != CORE_SLEEPING)
+			break;
+
+		if (c->state == CORE_SLEEPING) {
+			uint64_t until = c->next_timer < end ? c->next_timer : end;
+
+			if (!core_pending(c)) {
+				c->sleep_cycles += until - c->cycle;
+				c->cycle = until;
+				continue;
+			}
+			// woken up: the start-up time, then four more cycles before the interrupt
+			c->state = CORE_RUNNING;
+			if (c->periph.sleep)
+				c->cycle += c->periph.sleep(c, c->periph.p, 0);
+			c->cycle += 4;
+		}
+
+		if (c->int_delay) {
+			c->int_delay--;
+		} else if (c->data[CORE_SREG] & SREG_I) {
+			vector = core_pending(c);
+			if (vector) {
+				core_interrupt(c, vector);
+				continue;
+			}
+		}
+
+		if (c->pc == c->break_pc && c->on_break) {
+			c->on_break(c, c->ctx);
+			if (c->state != CORE_RUNNING)
+				continue;
+		}
+		if (core_word(c, CORE_SPL) < c->sp_min)
+			c->sp_min = core_word(c, CORE_SPL);
+		core_step(c);
+	}
+
+	return c->state;
+}
@@ -0,0 +1,126 @@
+#ifndef _core_h__
+#define _core_h__
+
+#include <stdint.h>
+
+/* AVR core of the ATmega168, as its datasheet gives it: the enhanced
+ * instruction set with its cycle counts, the interrupts with their
+ * response time, and sleep. The peripherals are in mega168.c, on the
+ * I/O hooks below.
+ *
+ * Times are in CPU cycles from reset. */
+
+#define CORE_FLASH_SIZE		0x4000 // bytes
+#define CORE_DATA_SIZE		0x500 // registers, I/O, 1K of SRAM
+#define CORE_EEPROM_SIZE	512
+#define CORE_NUM_VECTORS	26
+#define CORE_MAX_TIMERS		32
+#define CORE_MAX_NESTING	16
+
+// data addresses
+#define CORE_SPL			0x5D
+#define CORE_SPH			0x5E
+#define CORE_SREG			0x5F
+
+#define SREG_C	0x01
+#define SREG_Z	0x02
+#define SREG_N	0x04
+#define SREG_V	0x08
+#define SREG_S	0x10
+#define SREG_H	0x20
+#define SREG_T	0x40
+#define SREG_I	0x80
+
+#define CORE_RUNNING		0
+#define CORE_SLEEPING		1
+#define CORE_CRASHED		2 // unknown instruction, or the pc out of the flash
+#define CORE_STOPPED		3 // core_stop(), from a callback
+
+struct core;
+
+/* Cycle timer: fn is called once the cycle reaches when, between two
+ * instructions. The caller owns the struct, and can set it again from
+ * fn. */
+struct core_timer {
+	uint64_t when;
+	void (*fn)(struct core *c, void *param);
+	void *param;
+	int active;
+};
+
+/* The peripherals. pending returns the vector with an interrupt to
+ * serve, enabled and flagged, 0 if none. taken is called when the core
+ * serves it, to clear the flags that the hardware clears. sleep is
+ * called when the core goes to sleep and when it wakes up, and then
+ * returns the start-up time of the sleep mode, in cycles. */
+struct core_periph {
+	int (*pending)(struct core *c, void *p);
+	void (*taken)(struct core *c, void *p, int vector);
+	int (*sleep)(struct core *c, void *p, int entering);
+	void *p;
+};
+
+struct core {
+	uint8_t data[CORE_DATA_SIZE];
+	uint16_t flash[CORE_FLASH_SIZE / 2];
+	uint8_t eeprom[CORE_EEPROM_SIZE];
+
+	uint32_t pc; // in words
+	uint64_t cycle;
+	int state;
+	double frequency;
+
+	/* I/O hooks, by data address: 0x20 to 0xFF. mask has the bits
+	 * written: sbi and cbi write one bit, the others are left alone
+	 * (flags cleared by writing a one, PINx toggling PORTx). */
+	uint8_t (*io_read[0x100])(struct core *c, uint16_t addr, void *p);
+	void (*io_write[0x100])(struct core *c, uint16_t addr, uint8_t v, uint8_t mask, void *p);
+	void *io_param[0x100];
+
+	struct core_periph periph;
+	int int_delay; // instructions to run before an interrupt, after sei and reti
+
+	struct core_timer *timers[CORE_MAX_TIMERS];
+	int num_timers;
+	uint64_t next_timer;
+
+	// vectors being served, for on_vector
+	int nesting[CORE_MAX_NESTING];
+	int depth;
+
+	uint64_t sleep_cycles;
+	uint16_t sp_min; // lowest stack pointer, at an instruction
+
+	/* Called when a vector is entered (its interrupt taken) and when
+	 * the reti ending it runs. */
+	void (*on_vector)(struct core *c, int vector, int entering, void *ctx);
+	// called before the instruction at break_pc (in words) runs
+	uint32_t break_pc;
+	void (*on_break)(struct core *c, void *ctx);
+	void *ctx;
+};
+
+void core_init(struct core *c, double frequency);
+void core_reset(struct core *c);
+
+/* Until the cycle reaches end, or the state changes from running or
+ * sleeping. Returns the state.
+ *
+ * An instruction reads the I/O in its first cycle, and writes in its
+ * last. */
+int core_run(struct core *c, uint64_t end);
+void core_stop(struct core *c);
+
+void core_timerSet(struct core *c, struct core_timer *t, uint64_t when,
+				void (*fn)(struct core *c, void *param), void *param);
+void core_timerCancel(struct core *c, struct core_timer *t);
+
+void core_ioHook(struct core *c, uint16_t addr,
+				uint8_t (*rd)(struct core *c, uint16_t addr, void *p),
+				void (*wr)(struct core *c, uint16_t addr, uint8_t v, uint8_t mask, void *p), void *p);
+
+/* Data space access as an instruction does it, through the I/O hooks */
+uint8_t core_read(struct core *c, uint16_t addr);
+void core_write(struct core *c, uint16_t addr, uint8_t v);
+
+#endif // _core_h__
@@ -0,0 +1,78 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <avr/pgmspace.h>
+
+#include "crypt.h"
+#include "../wm_crypto.h"
+
+static unsigned char ror8(unsigned char a, unsigned char b)
+{
+	return (a >> b) | ((a << (8 - b)) & 0xFF);
+}
+
+/* The reverse of wm_gentabs() in wiimote.c: the key it accepts for idx */
+void crypt_makeKey(const unsigned char rand[10], int idx, unsigned char regs[CRYPT_KEY_LEN], struct wm_crypt *c)
+{
+	const unsigned char *ans = ans_tbl[idx];
+	const unsigned char *s1 = sboxes[idx + 1], *s2 = sboxes[idx + 2];
+	unsigned char t0[10], key[6];
+	int i;
+
+	for (i = 0; i < 10; i++)
+		t0[i] = sboxes[0][rand[i]];
+
+	key[0] = ((ror8((ans[0] ^ t0[5]), (t0[2] % 8)) - t0[9]) ^ t0[4]);
+	key[1] = ((ror8((ans[1] ^ t0[1]), (t0[0] % 8)) - t0[5]) ^ t0[7]);
+	key[2] = ((ror8((ans[2] ^ t0[6]), (t0[8] % 8)) - t0[2]) ^ t0[0]);
+	key[3] = ((ror8((ans[3] ^ t0[4]), (t0[7] % 8)) - t0[3]) ^ t0[2]);
+	key[4] = ((ror8((ans[4] ^ t0[1]), (t0[6] % 8)) - t0[3]) ^ t0[4]);
+	key[5] = ((ror8((ans[5] ^ t0[7]), (t0[8] % 8)) - t0[5]) ^ t0[9]);
+
+	c->ft[0] = s1[key[4]] ^ s2[rand[3]];
+	c->ft[1] = s1[key[2]] ^ s2[rand[5]];
+	c->ft[2] = s1[key[5]] ^ s2[rand[7]];
+	c->ft[3] = s1[key[0]] ^ s2[rand[2]];
+	c->ft[4] = s1[key[1]] ^ s2[rand[4]];
+	c->ft[5] = s1[key[3]] ^ s2[rand[9]];
+	c->ft[6] = s1[rand[0]] ^ s2[rand[6]];
+	c->ft[7] = s1[rand[1]] ^ s2[rand[8]];
+
+	c->sb[0] = s1[key[0]] ^ s2[rand[1]];
+	c->sb[1] = s1[key[5]] ^ s2[rand[4]];
+	c->sb[2] = s1[key[3]] ^ s2[rand[0]];
+	c->sb[3] = s1[key[2]] ^ s2[rand[9]];
+	c->sb[4] = s1[key[4]] ^ s2[rand[7]];
+	c->sb[5] = s1[key[1]] ^ s2[rand[8]];
+	c->sb[6] = s1[rand[3]] ^ s2[rand[5]];
+	c->sb[7] = s1[rand[2]] ^ s2[rand[6]];
+
+	// see wm_slaveRx(): stored in reverse
+	for (i = 0; i < 10; i++)
+		regs[i] = rand[9 - i];
+	for (i = 0; i < 6; i++)
+		regs[10 + i] = key[5 - i];
+}
+
+unsigned char crypt_encrypt(const struct wm_crypt *c, unsigned char addr, unsigned char v)
+{
+	return (v - c->ft[addr % 8]) ^ c->sb[addr % 8];
+}
+
+unsigned char crypt_decrypt(const struct wm_crypt *c, unsigned char addr, unsigned char d)
+{
+	return (d ^ c->sb[addr % 8]) + c->ft[addr % 8];
+}
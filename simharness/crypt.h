@@ -0,0 +1,22 @@
+#ifndef _crypt_h__
+#define _crypt_h__
+
+/* The Wiimote extension encryption, as done by wiimote.c. The key
+ * written at 0x40 selects one of 7 tables, see wm_gentabs(). */
+
+#define CRYPT_KEY_LEN		16 // registers 0x40 to 0x4F
+
+struct wm_crypt {
+	unsigned char ft[8];
+	unsigned char sb[8];
+};
+
+/* The key registers for a random number and a table (0 to 6) */
+void crypt_makeKey(const unsigned char rand[10], int idx, unsigned char regs[CRYPT_KEY_LEN], struct wm_crypt *c);
+
+// byte written by the master to register addr
+unsigned char crypt_encrypt(const struct wm_crypt *c, unsigned char addr, unsigned char v);
+// byte read by the master from register addr
+unsigned char crypt_decrypt(const struct wm_crypt *c, unsigned char addr, unsigned char d);
+
+#endif // _crypt_h__
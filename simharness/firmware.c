@@ -0,0 +1,169 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+
+#include "firmware.h"
+
+#define DATA_OFFSET		0x800000
+#define EEPROM_OFFSET	0x810000
+
+struct image {
+	unsigned char *buf;
+	long size;
+	Elf32_Ehdr *eh;
+};
+
+static int elf_open(const char *elf_path, struct image *im)
+{
+	FILE *fp;
+
+	fp = fopen(elf_path, "rb");
+	if (!fp) {
+		perror(elf_path);
+		return -1;
+	}
+	fseek(fp, 0, SEEK_END);
+	im->size = ftell(fp);
+	rewind(fp);
+
+	im->buf = malloc(im->size > 0 ? im->size : 1);
+	if (!im->buf || fread(im->buf, 1, im->size, fp) != im->size) {
+		fprintf(stderr, "%s: cannot read\n", elf_path);
+		fclose(fp);
+		free(im->buf);
+		return -1;
+	}
+	fclose(fp);
+
+	im->eh = (Elf32_Ehdr *)im->buf;
+	if (im->size < sizeof(Elf32_Ehdr) || memcmp(im->eh->e_ident, ELFMAG, SELFMAG) ||
+			im->eh->e_ident[EI_CLASS] != ELFCLASS32 || im->eh->e_ident[EI_DATA] != ELFDATA2LSB ||
+			im->eh->e_machine != EM_AVR) {
+		fprintf(stderr, "%s: not an AVR ELF file\n", elf_path);
+		free(im->buf);
+		return -1;
+	}
+
+	return 0;
+}
+
+// a table of the file, n entries of size each from off
+static void *elf_table(struct image *im, uint32_t off, int n, int size)
+{
+	if (off > im->size || (long)n * size > im->size - off)
+		return NULL;
+	return im->buf + off;
+}
+
+int fw_load(const char *elf_path, struct core *c)
+{
+	struct image im;
+	Elf32_Phdr *ph;
+	int i, loaded = 0;
+
+	if (elf_open(elf_path, &im))
+		return -1;
+
+	ph = elf_table(&im, im.eh->e_phoff, im.eh->e_phnum, sizeof(Elf32_Phdr));
+	for (i = 0; ph && i < im.eh->e_phnum; i++) {
+		uint32_t addr = ph[i].p_paddr, len = ph[i].p_filesz;
+		unsigned char *src;
+
+		if (ph[i].p_type != PT_LOAD || !len)
+			continue;
+		src = elf_table(&im, ph[i].p_offset, len, 1);
+		if (!src)
+			break;
+
+		// fuses and lock bits, from 0x820000, are not used
+		if (addr < DATA_OFFSET && addr + len <= CORE_FLASH_SIZE) {
+			uint32_t j;
+
+			for (j = 0; j < len; j++) {
+				uint16_t *w = &c->flash[(addr + j) >> 1];
+
+				if ((addr + j) & 1)
+					*w = (*w & 0x00FF) | (src[j] << 8);
+				else
+					*w = (*w & 0xFF00) | src[j];
+			}
+			loaded++;
+		} else if (addr >= EEPROM_OFFSET && addr + len <= EEPROM_OFFSET + CORE_EEPROM_SIZE) {
+			memcpy(c->eeprom + addr - EEPROM_OFFSET, src, len);
+		} else if (addr < DATA_OFFSET) {
+			fprintf(stderr, "%s: 0x%x bytes at 0x%x do not fit in the flash\n", elf_path, len, addr);
+			free(im.buf);
+			return -1;
+		}
+	}
+	free(im.buf);
+
+	if (!loaded) {
+		fprintf(stderr, "%s: nothing for the flash\n", elf_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int64_t fw_symbol(const char *elf_path, const char *name)
+{
+	struct image im;
+	Elf32_Shdr *sh;
+	int64_t addr = -1;
+	int i;
+
+	if (elf_open(elf_path, &im))
+		return -1;
+
+	sh = elf_table(&im, im.eh->e_shoff, im.eh->e_shnum, sizeof(Elf32_Shdr));
+	for (i = 0; sh && addr < 0 && i < im.eh->e_shnum; i++) {
+		Elf32_Shdr *strtab;
+		Elf32_Sym *sym;
+		char *str;
+		int j, n;
+
+		if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= im.eh->e_shnum)
+			continue;
+		strtab = &sh[sh[i].sh_link];
+		n = sh[i].sh_size / sizeof(Elf32_Sym);
+		sym = elf_table(&im, sh[i].sh_offset, n, sizeof(Elf32_Sym));
+		str = elf_table(&im, strtab->sh_offset, strtab->sh_size, 1);
+		// the names end in a nul, the table too
+		if (!sym || !str || !strtab->sh_size || str[strtab->sh_size - 1])
+			continue;
+
+		for (j = 0; j < n; j++) {
+			int type = ELF32_ST_TYPE(sym[j].st_info);
+
+			// the linker symbols (__bss_end...) have no type
+			if (type != STT_FUNC && type != STT_OBJECT &&
+					!(type == STT_NOTYPE && ELF32_ST_BIND(sym[j].st_info) == STB_GLOBAL))
+				continue;
+			if (sym[j].st_name < strtab->sh_size && !strcmp(str + sym[j].st_name, name)) {
+				addr = sym[j].st_value;
+				break;
+			}
+		}
+	}
+	free(im.buf);
+
+	return addr;
+}
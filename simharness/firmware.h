@@ -0,0 +1,20 @@
+#ifndef _firmware_h__
+#define _firmware_h__
+
+#include <stdint.h>
+
+#include "core.h"
+
+/* The ELF file of the firmware, as avr-gcc links it. fw_load copies
+ * the loaded segments to the flash (.text and the initial values of
+ * .data, at their load address) and to the EEPROM (.eeprom, from
+ * 0x810000). Returns -1 on error, with a message. */
+int fw_load(const char *elf_path, struct core *c);
+
+/* Value of a symbol, function or object, from the symbol table (static
+ * ones included), or set by the linker (__bss_end): a byte address in
+ * the flash for a function, an address from 0x800000 for a variable.
+ * Returns -1 if not found. */
+int64_t fw_symbol(const char *elf_path, const char *name);
+
+#endif // _firmware_h__
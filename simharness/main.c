@@ -0,0 +1,498 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../classic.h"
+#include "../prof.h"
+#include "../sil/output.h"
+#include "core.h"
+#include "firmware.h"
+#include "master.h"
+#include "mega168.h"
+#include "pinbus.h"
+#include "series.h"
+
+#define DEFAULT_ELF		"../atmega168_openlightgun_12MHz.elf"
+
+#define NUM_VECTORS		CORE_NUM_VECTORS
+
+// gun.c: trigger on PD7, sensor on PD6, both active low
+#define PIN_TRIGGER		7
+#define PIN_SENSOR		6
+
+// swtwi.h: the software slave of the second channel, on PC2 and PC3
+#define PIN_SWTWI_SCL	2
+#define PIN_SWTWI_SDA	3
+
+#define IN_TRIGGER		0x01
+#define IN_SENSOR		0x02
+
+static const char *vector_names[NUM_VECTORS] = {
+	"RESET", "INT0", "INT1", "PCINT0", "PCINT1", "PCINT2", "WDT",
+	"TIMER2_COMPA", "TIMER2_COMPB", "TIMER2_OVF", "TIMER1_CAPT",
+	"TIMER1_COMPA", "TIMER1_COMPB", "TIMER1_OVF", "TIMER0_COMPA",
+	"TIMER0_COMPB", "TIMER0_OVF", "SPI_STC", "USART_RX", "USART_UDRE",
+	"USART_TX", "ADC", "EE_READY", "ANALOG_COMP", "TWI", "SPM_READY",
+};
+
+struct isr {
+	uint64_t entry;
+	struct series cycles;
+};
+
+struct change {
+	uint64_t t; // cycle
+	int state; // IN_*
+};
+
+struct harness {
+	struct core c;
+	struct m168 mcu;
+	struct master m;
+	int classic_mode;
+
+	// second Wiimote, on the software slave (-2)
+	struct master m2;
+	struct pinbus bus;
+	int second;
+	uint64_t boot_late; // late starts before the first report
+	int reported;
+
+	// input script
+	struct change *script;
+	int script_len, script_pos;
+	struct core_timer script_timer;
+
+	// latency, per input (trigger, sensor)
+	uint64_t changed[2];
+	int value[2], delivered[2];
+	uint64_t dropped;
+
+	uint64_t last_sample, read_sample, samples;
+
+	struct isr isr[NUM_VECTORS];
+	struct series age; // sample to the end of the read delivering it
+	struct series input; // input change to the end of the read delivering it
+
+	// profiling sites read back with -R, see prof.h
+	unsigned char window[PROF_NUM_SITES][PROF_WIN_SIZE];
+	int have_window[PROF_NUM_SITES];
+};
+
+static struct harness h;
+
+static void usage(void)
+{
+	printf("Usage: ./simharness [options] [firmware.elf]\n");
+	printf("\n");
+	printf("Runs the AVR image of the firmware (default: %s)\n", DEFAULT_ELF);
+	printf("on a simulated ATmega168, polled by a virtual Wiimote, and measures in\n");
+	printf("CPU cycles.\n");
+	printf("\n");
+	printf("  -f hz      Clock (default: 12000000)\n");
+	printf("  -S file    Trigger and sensor from a script (sil format, see sil/input.h)\n");
+	printf("  -p ms      Poll period (default: 5)\n");
+	printf("  -b us      Time per bus event, address or byte, without stretching (default: 25)\n");
+	printf("  -l bytes   Bytes per report read (default: 21)\n");
+	printf("  -E         Encrypted handshake (key written at 0x40)\n");
+	printf("  -M mode    Report format written to 0xFE: 1, 2 or 3 (default: none)\n");
+	printf("  -P n       Gun profile to select, written to 0xF8 as n+1 (default: none)\n");
+	printf("  -y name    Function sampling the gun (default: gunUpdate)\n");
+	printf("  -2         Second Wiimote, on the software slave of a firmware built\n");
+	printf("             with -DWITH_SOFT_TWI (PC2 and PC3, see swtwi.c)\n");
+	printf("  -o us      Poll of the second Wiimote after the first (default: 0)\n");
+	printf("  -k khz     Clock of the second Wiimote: 400 or 100 (default: 400)\n");
+	printf("  -R         Read the profiling sites at the end (firmware built with\n");
+	printf("             -DWITH_PROFILING, see prof.h)\n");
+	printf("  -t sec     Virtual time to run (default: 10)\n");
+	printf("  -h         Prints this help\n");
+}
+
+/***** Input *****/
+
+static int loadScript(const char *path, double hz)
+{
+	char line[256];
+	int cap = 0, lineno = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		char state_str[16], *c;
+		double ms;
+		int state = 0;
+
+		lineno++;
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == 0)
+			continue;
+
+		if (sscanf(line, "%lf %15s", &ms, state_str) != 2 || ms < 0) {
+			fprintf(stderr, "%s:%d: expected <ms> <state>\n", path, lineno);
+			goto error;
+		}
+		for (c = state_str; *c; c++) {
+			if (*c == 'T' || *c == 't')
+				state |= IN_TRIGGER;
+			else if (*c == 'S' || *c == 's')
+				state |= IN_SENSOR;
+			else if (*c != '-') {
+				fprintf(stderr, "%s:%d: unknown state '%c'\n", path, lineno, *c);
+				goto error;
+			}
+		}
+
+		if (h.script_len == cap) {
+			struct change *ns;
+
+			cap = cap ? cap * 2 : 64;
+			ns = realloc(h.script, cap * sizeof(struct change));
+			if (!ns) {
+				perror("realloc");
+				goto error;
+			}
+			h.script = ns;
+		}
+		h.script[h.script_len].t = ms * hz / 1000;
+		h.script[h.script_len].state = state;
+		if (h.script_len && h.script[h.script_len].t < h.script[h.script_len - 1].t) {
+			fprintf(stderr, "%s:%d: time goes backwards\n", path, lineno);
+			goto error;
+		}
+		h.script_len++;
+	}
+	fclose(fp);
+
+	return 0;
+
+error:
+	fclose(fp);
+	return -1;
+}
+
+static void setInput(int state)
+{
+	int i;
+
+	m168_setPin(&h.mcu, M168_PORTD, PIN_TRIGGER, !(state & IN_TRIGGER));
+	m168_setPin(&h.mcu, M168_PORTD, PIN_SENSOR, !(state & IN_SENSOR));
+
+	for (i = 0; i < 2; i++) {
+		int v = !!(state & (1 << i));
+
+		if (v == h.value[i])
+			continue;
+		if (!h.delivered[i])
+			h.dropped++;
+		h.changed[i] = h.c.cycle;
+		h.value[i] = v;
+		h.delivered[i] = 0;
+	}
+}
+
+static void scriptTimer(struct core *c, void *param)
+{
+	while (h.script_pos < h.script_len && h.script[h.script_pos].t <= c->cycle)
+		setInput(h.script[h.script_pos++].state);
+
+	if (h.script_pos < h.script_len)
+		core_timerSet(c, &h.script_timer, h.script[h.script_pos].t, scriptTimer, NULL);
+}
+
+/***** Measurements *****/
+
+static void onVector(struct core *c, int vector, int entering, void *ctx)
+{
+	struct isr *isr = &h.isr[vector];
+
+	if (entering)
+		isr->entry = c->cycle;
+	else if (isr->entry)
+		series_add(&isr->cycles, c->cycle - isr->entry);
+}
+
+static void onSample(struct core *c, void *ctx)
+{
+	h.last_sample = c->cycle;
+	h.samples++;
+}
+
+static void onTwint(struct m168 *mcu, int set, void *ctx)
+{
+	master_twint(&h.m, set);
+}
+
+static void onPin(struct m168 *mcu, int port, uint8_t level, uint8_t changed, void *ctx)
+{
+	if (h.second)
+		pinbus_pin(&h.bus, port);
+}
+
+static void onReport2(const unsigned char *data, int len, uint64_t cycle, void *ctx)
+{
+	if (!h.reported)
+		h.boot_late = h.bus.late_starts;
+	h.reported = 1;
+}
+
+static void onReadStart(uint64_t cycle, void *ctx)
+{
+	h.read_sample = h.last_sample;
+}
+
+static void onReport(const unsigned char *data, int len, uint64_t cycle, void *ctx)
+{
+	struct classic_state s;
+	int i;
+
+	if (h.read_sample)
+		series_add(&h.age, cycle - h.read_sample);
+
+	if (classic_decode(data, len, h.classic_mode, &s))
+		return;
+
+	// gun.c: the trigger is A, the sensor is B
+	for (i = 0; i < 2; i++) {
+		int shown = !!(s.buttons & (i ? CPAD_BTN_B : CPAD_BTN_A));
+
+		if (!h.delivered[i] && shown == h.value[i]) {
+			series_add(&h.input, cycle - h.changed[i]);
+			h.delivered[i] = 1;
+		}
+	}
+}
+
+static void onWindow(const unsigned char *data, int len, void *ctx)
+{
+	int site = data[PROF_WIN_SITE] - 1;
+
+	if (len < PROF_WIN_SIZE || data[PROF_WIN_NUM_SITES] != PROF_NUM_SITES)
+		return;
+	if (site < 0 || site >= PROF_NUM_SITES)
+		return;
+	memcpy(h.window[site], data, PROF_WIN_SIZE);
+	h.have_window[site] = 1;
+}
+
+static unsigned long winValue(const unsigned char *w, int pos, int len)
+{
+	unsigned long v = 0;
+	int i;
+
+	for (i = len - 1; i >= 0; i--)
+		v = (v << 8) | w[pos + i];
+	return v;
+}
+
+static void printProfile(void)
+{
+	static const char *names[PROF_NUM_SITES] = PROF_SITE_NAMES;
+	int i, found = 0;
+
+	printf("\nProfiling sites (us, measured by the firmware)\n");
+	printf("%-20s %8s %8s %8s %8s\n", "", "count", "min", "avg", "max");
+	for (i = 0; i < PROF_NUM_SITES; i++) {
+		const unsigned char *w = h.window[i];
+		unsigned long count, sum;
+		double us;
+
+		if (!h.have_window[i]) {
+			printf("%-20s %8s\n", names[i], "-");
+			continue;
+		}
+		found++;
+
+		// ticks are 8 clocks, see timebase.h
+		us = 8.0 / w[PROF_WIN_MHZ];
+		count = winValue(w, PROF_WIN_COUNT, 2);
+		sum = winValue(w, PROF_WIN_SUM, 4);
+		printf("%-20s %8lu %8.1f %8.1f %8.1f\n", names[i], count,
+			winValue(w, PROF_WIN_MIN, 2) * us, count ? sum * us / count : 0,
+			winValue(w, PROF_WIN_MAX, 2) * us);
+	}
+	if (!found)
+		printf("Nothing read back: build the firmware with -DWITH_PROFILING.\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct master *m = &h.m;
+	const char *elf = DEFAULT_ELF, *script = NULL, *sample_fn = "gunUpdate";
+	double hz = 12000000, period_ms = 5, byte_us = 25, duration_s = 10, offset_us = 0;
+	int khz = 400, read_len = 21, encrypted = 0, mode = 0, profile = -1, dump = 0;
+	int64_t sample_pc, bss_end;
+	uint64_t end;
+	int opt, i, state;
+
+	while ((opt = getopt(argc, argv, "f:S:p:b:l:EM:P:y:2o:k:Rt:h")) != -1) {
+		switch (opt)
+		{
+			case 'f': hz = atof(optarg); break;
+			case 'S': script = optarg; break;
+			case 'p': period_ms = atof(optarg); break;
+			case 'b': byte_us = atof(optarg); break;
+			case 'l': read_len = atoi(optarg); break;
+			case 'E': encrypted = 1; break;
+			case 'M': mode = atoi(optarg); break;
+			case 'P': profile = atoi(optarg); break;
+			case 'y': sample_fn = optarg; break;
+			case '2': h.second = 1; break;
+			case 'o': offset_us = atof(optarg); break;
+			case 'k': khz = atoi(optarg); break;
+			case 'R': dump = 1; break;
+			case 't': duration_s = atof(optarg); break;
+			case 'h': usage(); return 0;
+			default:
+				fprintf(stderr, "Unknown argument. Try -h\n");
+				return 1;
+		}
+	}
+	if (optind < argc)
+		elf = argv[optind];
+
+	if (period_ms <= 0 || byte_us <= 0 || read_len < 1 || read_len > 32 || mode < 0 || mode > 3 ||
+			offset_us < 0 || (khz != 400 && khz != 100)) {
+		fprintf(stderr, "Invalid Wiimote parameters\n");
+		return 1;
+	}
+
+	core_init(&h.c, hz);
+	m168_init(&h.mcu, &h.c);
+	if (fw_load(elf, &h.c))
+		return 1;
+
+	if (script && loadScript(script, hz))
+		return 1;
+
+	sample_pc = fw_symbol(elf, sample_fn);
+	if (sample_pc < 0)
+		fprintf(stderr, "%s: no function %s, the sample to read latency is not measured\n", elf, sample_fn);
+	else
+		h.c.break_pc = sample_pc / 2;
+	h.c.on_break = onSample;
+	h.c.on_vector = onVector;
+
+	// reg 0xFE values, see main() in the firmware
+	h.classic_mode = mode == 2 ? CLASSIC_MODE_2 : mode == 3 ? CLASSIC_MODE_3 : CLASSIC_MODE_1;
+
+	setInput(0);
+	h.delivered[0] = h.delivered[1] = 1;
+	if (h.script_len)
+		core_timerSet(&h.c, &h.script_timer, h.script[0].t, scriptTimer, NULL);
+
+	// the handshake starts once the firmware has booted
+	h.mcu.on_twint = onTwint;
+	if (master_init(m, &h.mcu, hz / 100, period_ms * hz / 1000, byte_us * hz / 1e6,
+			read_len, encrypted, mode, profile + 1))
+		return 1;
+	m->on_readStart = onReadStart;
+	m->on_report = onReport;
+	m->on_window = onWindow;
+
+	if (h.second) {
+		h.mcu.on_pin = onPin;
+		pinbus_init(&h.bus, &h.mcu, M168_PORTC, PIN_SWTWI_SCL, PIN_SWTWI_SDA, khz);
+		if (master_init(&h.m2, &h.mcu, hz / 100 + offset_us * hz / 1e6, period_ms * hz / 1000, 0,
+				read_len, encrypted, mode, profile + 1))
+			return 1;
+		master_useBus(&h.m2, &h.bus);
+		h.m2.on_report = onReport2;
+	}
+
+	end = duration_s * hz;
+	state = core_run(&h.c, end);
+
+	if (state == CORE_CRASHED)
+		fprintf(stderr, "The core crashed at pc 0x%04x\n", h.c.pc * 2);
+
+	printf("%s: atmega168 at %.0f Hz, %.3f s, %s handshake\n", elf, hz,
+		h.c.cycle / hz, encrypted ? "encrypted" : "plain");
+	printf("Extension id:");
+	for (i = 0; i < 6; i++)
+		printf(" %02x", m->id[i]);
+	printf("\nPolls: %llu, not acknowledged: %llu, timeouts: %llu, samples: %llu\n",
+		(unsigned long long)m->polls, (unsigned long long)m->nacks,
+		(unsigned long long)m->timeouts, (unsigned long long)h.samples);
+	if (m->handshakes)
+		printf("Handshakes not answered, while booting: %llu\n", (unsigned long long)m->handshakes);
+	printf("Sleep: %.1f%% of the time\n", 100.0 * h.c.sleep_cycles / h.c.cycle);
+	// from the end of the RAM, down to the variables
+	bss_end = fw_symbol(elf, "__bss_end");
+	printf("Stack: %d bytes at the most", CORE_DATA_SIZE - 1 - h.c.sp_min);
+	if (bss_end >= 0)
+		printf(", %d left above the variables", h.c.sp_min + 1 - (int)(bss_end & 0xFFFF));
+	printf("\n");
+
+	series_header(stdout, "Interrupts (cycles)");
+	for (i = 1; i < NUM_VECTORS; i++) {
+		if (h.isr[i].cycles.n)
+			series_print(stdout, vector_names[i], &h.isr[i].cycles, hz);
+	}
+
+	series_header(stdout, "Clock stretching (cycles)");
+	series_print(stdout, "after the address", &m->stretch[MS_STRETCH_ADDR], hz);
+	series_print(stdout, "after a byte written", &m->stretch[MS_STRETCH_RX], hz);
+	series_print(stdout, "after a byte read", &m->stretch[MS_STRETCH_TX], hz);
+	series_print(stdout, "after the stop", &m->stretch[MS_STRETCH_STOP], hz);
+
+	series_header(stdout, "Latency (cycles)");
+	series_print(stdout, "poll start to read end", &m->transfer, hz);
+	series_print(stdout, "sample to read end", &h.age, hz);
+	series_print(stdout, "input to read end", &h.input, hz);
+	if (h.dropped)
+		printf("Input changes never reported: %llu\n", (unsigned long long)h.dropped);
+
+	if (h.second) {
+		struct master *m2 = &h.m2;
+
+		printf("\nSecond Wiimote, software slave at %d kHz, %.1f us after the first\n", khz, offset_us);
+		printf("Extension id:");
+		for (i = 0; i < 6; i++)
+			printf(" %02x", m2->id[i]);
+		printf("\nPolls: %llu, not acknowledged: %llu, timeouts: %llu\n",
+			(unsigned long long)m2->polls, (unsigned long long)m2->nacks,
+			(unsigned long long)m2->timeouts);
+		if (m2->handshakes)
+			printf("Handshakes not answered, while booting: %llu\n", (unsigned long long)m2->handshakes);
+		printf("Starts where SCL was not held within %llu cycles: %llu, before the first report: %llu\n",
+			(unsigned long long)pinbus_startDeadline(&h.bus),
+			(unsigned long long)(h.bus.late_starts - h.boot_late), (unsigned long long)h.boot_late);
+
+		series_header(stdout, "Software slave (cycles)");
+		series_print(stdout, "start to SCL held", &h.bus.start_hold, hz);
+		series_print(stdout, "SCL stretched", &h.bus.stretch, hz);
+		series_print(stdout, "poll start to read end", &m2->transfer, hz);
+	}
+
+	// after the results above, which the dump would change
+	if (dump && state != CORE_CRASHED) {
+		master_dump(m, PROF_NUM_SITES);
+		state = core_run(&h.c, end + (PROF_NUM_SITES + 3) * m->period);
+		if (state == CORE_CRASHED)
+			fprintf(stderr, "The core crashed at pc 0x%04x\n", h.c.pc * 2);
+		printProfile();
+	}
+
+	return state == CORE_CRASHED;
+}
@@ -0,0 +1,345 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "master.h"
+#include "../prof.h"
+
+#define WM_ADDRESS		0x52
+
+// any value works, the key is computed for it (see crypt_makeKey)
+static const unsigned char ms_rand[10] = { 0x4d, 0x21, 0x9a, 0x03, 0xe7, 0x5c, 0x18, 0xb2, 0x66, 0x0f };
+
+static int ms_write(struct master *m, struct master_step *s, int n, const unsigned char *data, int len, int enc)
+{
+	int i;
+
+	s[n++].op = MS_START_W;
+	// the register address is never encrypted
+	s[n].op = MS_WRITE;
+	s[n++].data = data[0];
+	for (i = 1; i < len; i++) {
+		unsigned char reg = data[0] + i - 1;
+
+		s[n].op = MS_WRITE;
+		s[n].reg = reg;
+		s[n++].data = enc ? crypt_encrypt(&m->crypt, reg, data[i]) : data[i];
+	}
+	s[n++].op = MS_STOP;
+
+	return n;
+}
+
+static int ms_read(struct master_step *s, int n, unsigned char reg, int len)
+{
+	int i;
+
+	s[n++].op = MS_START_R;
+	for (i = 0; i < len; i++) {
+		s[n].op = i < len - 1 ? MS_READ : MS_READ_LAST;
+		s[n++].reg = reg + i;
+	}
+	s[n++].op = MS_STOP;
+
+	return n;
+}
+
+static void ms_run(struct master *m);
+
+static void ms_received(struct master *m, struct master_step *s, unsigned char d)
+{
+	if (m->encrypted)
+		d = crypt_decrypt(&m->crypt, s->reg, d);
+	if (m->got < sizeof(m->buf))
+		m->buf[m->got++] = d;
+}
+
+// end of a bus event of the pin level bus
+static void ms_busDone(struct pinbus *b, int status, uint8_t data, void *ctx)
+{
+	struct master *m = ctx;
+	struct master_step *s = &m->steps[m->cur - 1];
+
+	if (status == PB_TIMEOUT) {
+		m->timeouts++;
+		m->aborted = 1;
+	} else if (s->op == MS_START_W || s->op == MS_START_R) {
+		m->acked = status == PB_ACK;
+	} else if (s->op == MS_READ || s->op == MS_READ_LAST) {
+		ms_received(m, s, data);
+	}
+	ms_run(m);
+}
+
+static void ms_timeoutTimer(struct core *c, void *param)
+{
+	struct master *m = param;
+
+	if (m->waiting && m->twint_set && c->cycle - m->twint_set >= m->timeout) {
+		m->timeouts++;
+		m->aborted = 1;
+		m->waiting = 0;
+		ms_run(m);
+	}
+}
+
+static void ms_timer(struct core *c, void *param)
+{
+	struct master *m = param;
+
+	// the slave holds the clock low: go on when it lets go
+	if (m->twint_set) {
+		m->waiting = 1;
+		core_timerSet(c, &m->timeout_timer, m->twint_set + m->timeout, ms_timeoutTimer, m);
+		return;
+	}
+
+	ms_run(m);
+}
+
+static void ms_schedule(struct master *m, uint64_t at)
+{
+	uint64_t now = m->c->cycle;
+
+	core_timerSet(m->c, &m->timer, at > now ? at : now + 1, ms_timer, m);
+}
+
+static void ms_buildDump(struct master *m, int site)
+{
+	static const unsigned char window_ptr[] = { WM_REG_PROF_WINDOW };
+	static const unsigned char report_ptr[] = { 0x00 };
+	unsigned char select[] = { WM_REG_PROF_SITE, site };
+	int n;
+
+	// the site selected by the previous period
+	n = ms_write(m, m->dump, 0, window_ptr, sizeof(window_ptr), 0);
+	n = ms_read(m->dump, n, WM_REG_PROF_WINDOW, PROF_WIN_SIZE);
+	m->dump[n++].op = MS_WINDOW;
+	if (site <= m->dump_sites)
+		n = ms_write(m, m->dump, n, select, sizeof(select), m->encrypted);
+	n = ms_write(m, m->dump, n, report_ptr, sizeof(report_ptr), 0);
+	n = ms_read(m->dump, n, 0x00, m->read_len);
+	m->dump[n++].op = MS_END;
+	m->num_dump = n;
+}
+
+static void ms_end(struct master *m)
+{
+	uint64_t now = m->c->cycle;
+
+	if (m->steps == m->poll && !m->aborted) {
+		series_add(&m->transfer, now - m->poll_start);
+		if (m->on_report)
+			m->on_report(m->buf, m->got, now, m->ctx);
+	}
+	if (m->steps == m->handshake && !m->aborted)
+		memcpy(m->id, m->buf, 6);
+
+	// not answered, while the firmware boots: tried again, as a Wiimote does
+	if (m->steps == m->handshake && m->aborted) {
+		m->handshakes++;
+	} else if (m->dump_sites) {
+		if (m->steps == m->dump)
+			m->dump_site++;
+		if (m->dump_site > m->dump_sites + 1) {
+			m->dump_done = 1;
+			core_stop(m->c);
+			return;
+		}
+		ms_buildDump(m, m->dump_site);
+		m->steps = m->dump;
+		m->num_steps = m->num_dump;
+	} else {
+		m->steps = m->poll;
+		m->num_steps = m->num_poll;
+	}
+	m->cur = 0;
+	m->aborted = 0;
+	m->poll_start += m->period;
+	m->polls++;
+	ms_schedule(m, m->poll_start);
+}
+
+/* Run the steps up to the next one taking bus time */
+static void ms_run(struct master *m)
+{
+	for (;;) {
+		struct master_step *s = &m->steps[m->cur++];
+
+		// an address not acknowledged: the rest of the transfer is skipped
+		if (m->cur >= 2 && (m->steps[m->cur - 2].op == MS_START_W || m->steps[m->cur - 2].op == MS_START_R) &&
+				!m->acked && !m->aborted) {
+			m->nacks++;
+			m->aborted = 1;
+		}
+		if (m->aborted && s->op != MS_STOP && s->op != MS_END)
+			continue;
+
+		switch (s->op)
+		{
+			case MS_START_W:
+			case MS_START_R:
+				if (s->op == MS_START_R)
+					m->got = 0;
+				m->stretch_kind = MS_STRETCH_ADDR;
+				if (m->bus) {
+					pinbus_start(m->bus, (WM_ADDRESS << 1) | (s->op == MS_START_R));
+					return;
+				}
+				m->acked = m168_twiStart(m->mcu, (WM_ADDRESS << 1) | (s->op == MS_START_R));
+				break;
+
+			case MS_WRITE:
+				m->stretch_kind = MS_STRETCH_RX;
+				if (m->bus) {
+					pinbus_write(m->bus, s->data);
+					return;
+				}
+				m168_twiWrite(m->mcu, s->data);
+				break;
+
+			case MS_READ:
+			case MS_READ_LAST:
+				m->stretch_kind = MS_STRETCH_TX;
+				if (m->bus) {
+					pinbus_read(m->bus, s->op == MS_READ);
+					return;
+				}
+				ms_received(m, s, m168_twiRead(m->mcu, s->op == MS_READ));
+				break;
+
+			case MS_STOP:
+				m->stretch_kind = MS_STRETCH_STOP;
+				if (m->bus) {
+					pinbus_stop(m->bus);
+					return;
+				}
+				m168_twiStop(m->mcu);
+				break;
+
+			case MS_READ_REPORT:
+				if (m->on_readStart)
+					m->on_readStart(m->c->cycle, m->ctx);
+				continue;
+
+			case MS_WINDOW:
+				if (m->on_window)
+					m->on_window(m->buf, m->got, m->ctx);
+				continue;
+
+			case MS_END:
+				ms_end(m);
+				return;
+		}
+
+		m->sent = m->c->cycle;
+		ms_schedule(m, m->sent + m->byte);
+		return;
+	}
+}
+
+void master_twint(struct master *m, int set)
+{
+	uint64_t now = m->c->cycle;
+
+	if (set) {
+		m->twint_set = now;
+		return;
+	}
+	if (!m->twint_set)
+		return;
+
+	series_add(&m->stretch[m->stretch_kind], now - m->twint_set);
+	m->twint_set = 0;
+
+	if (m->waiting) {
+		m->waiting = 0;
+		ms_run(m);
+	}
+}
+
+int master_init(struct master *m, struct m168 *mcu, uint64_t start, uint64_t period, uint64_t byte,
+				int read_len, int encrypted, int mode, int profile)
+{
+	static const unsigned char disable_enc1[] = { 0xF0, 0x55 };
+	static const unsigned char disable_enc2[] = { 0xFB, 0x00 };
+	static const unsigned char id_ptr[] = { 0xFA };
+	static const unsigned char report_ptr[] = { 0x00 };
+	unsigned char set_mode[] = { 0xFE, mode };
+	unsigned char set_profile[] = { 0xF8, profile };
+	unsigned char key[1 + CRYPT_KEY_LEN];
+	int n;
+
+	memset(m, 0, sizeof(struct master));
+	m->c = mcu->c;
+	m->mcu = mcu;
+	m->period = period;
+	m->byte = byte;
+	// a Wiimote gives up after a few milliseconds
+	m->timeout = m->c->frequency / 200;
+	m->encrypted = encrypted;
+	m->read_len = read_len;
+
+	if (encrypted) {
+		// the key in three writes, as the Wii does (see wm_slaveRx)
+		crypt_makeKey(ms_rand, 0, key + 1, &m->crypt);
+		key[0] = 0x40;
+		n = ms_write(m, m->handshake, 0, key, 7, 0);
+		key[6] = 0x46;
+		n = ms_write(m, m->handshake, n, key + 6, 7, 0);
+		key[12] = 0x4C;
+		n = ms_write(m, m->handshake, n, key + 12, 5, 0);
+	} else {
+		n = ms_write(m, m->handshake, 0, disable_enc1, sizeof(disable_enc1), 0);
+		n = ms_write(m, m->handshake, n, disable_enc2, sizeof(disable_enc2), 0);
+	}
+	n = ms_write(m, m->handshake, n, id_ptr, sizeof(id_ptr), 0);
+	n = ms_read(m->handshake, n, 0xFA, 6);
+	if (mode)
+		n = ms_write(m, m->handshake, n, set_mode, sizeof(set_mode), encrypted);
+	if (profile)
+		n = ms_write(m, m->handshake, n, set_profile, sizeof(set_profile), encrypted);
+	m->handshake[n++].op = MS_END;
+	m->num_handshake = n;
+
+	n = ms_write(m, m->poll, 0, report_ptr, sizeof(report_ptr), 0);
+	m->poll[n++].op = MS_READ_REPORT;
+	n = ms_read(m->poll, n, 0x00, read_len);
+	m->poll[n++].op = MS_END;
+	m->num_poll = n;
+
+	m->steps = m->handshake;
+	m->num_steps = m->num_handshake;
+	m->poll_start = start;
+	ms_schedule(m, start);
+
+	return 0;
+}
+
+void master_useBus(struct master *m, struct pinbus *bus)
+{
+	m->bus = bus;
+	bus->done = ms_busDone;
+	bus->ctx = m;
+}
+
+void master_dump(struct master *m, int sites)
+{
+	m->dump_sites = sites;
+	m->dump_site = 1;
+	m->dump_done = 0;
+}
@@ -0,0 +1,118 @@
+#ifndef _master_h__
+#define _master_h__
+
+#include <stdint.h>
+
+#include "core.h"
+#include "crypt.h"
+#include "mega168.h"
+#include "pinbus.h"
+#include "series.h"
+
+/* Virtual Wiimote on the TWI pins of the simulated chip. It runs the
+ * extension handshake, plain or encrypted, then reads the report every
+ * period. Like a real master, it waits for the slave to release the
+ * clock (TWINT cleared by the firmware) before the next bus event.
+ *
+ * Times are in CPU cycles. */
+
+#define MASTER_MAX_STEPS	96
+
+// bus events
+#define MS_START_W		1 // start, address for writing
+#define MS_START_R		2 // start, address for reading
+#define MS_WRITE		3
+#define MS_READ			4 // byte read, acknowledged
+#define MS_READ_LAST	5 // byte read, not acknowledged
+#define MS_STOP			6
+// pseudo events, they take no time
+#define MS_READ_REPORT	7 // start of a report read
+#define MS_END			8
+#define MS_WINDOW		9 // the bytes read go to on_window
+
+// kind of the event the slave is stretching the clock after
+#define MS_STRETCH_ADDR		0
+#define MS_STRETCH_RX		1 // byte written by the master
+#define MS_STRETCH_TX		2 // byte read by the master
+#define MS_STRETCH_STOP		3
+#define MS_NUM_STRETCH		4
+
+struct master_step {
+	uint8_t op; // MS_*
+	uint8_t data; // byte written
+	uint8_t reg; // register read or written, for the encryption
+};
+
+struct master {
+	struct core *c;
+	struct m168 *mcu;
+	struct core_timer timer, timeout_timer;
+	struct pinbus *bus; // NULL: on the TWI of the chip
+
+	uint64_t period, byte, timeout;
+	int encrypted;
+	struct wm_crypt crypt;
+
+	struct master_step handshake[MASTER_MAX_STEPS];
+	int num_handshake;
+	struct master_step poll[MASTER_MAX_STEPS];
+	int num_poll;
+	int read_len;
+
+	// profiling dump, see master_dump
+	struct master_step dump[MASTER_MAX_STEPS];
+	int num_dump;
+	int dump_sites, dump_site; // dump_site: next one to select, from 1
+	int dump_done;
+
+	// current program
+	struct master_step *steps;
+	int num_steps, cur;
+	uint64_t poll_start;
+	uint64_t sent; // time of the last bus event
+	int acked, aborted, waiting;
+	uint64_t twint_set; // 0: TWINT is clear
+	int stretch_kind;
+
+	unsigned char buf[64];
+	int got;
+	unsigned char id[6];
+
+	// results
+	struct series stretch[MS_NUM_STRETCH];
+	struct series transfer; // poll start to the end of the read
+	uint64_t polls, nacks, timeouts;
+	uint64_t handshakes; // tried again
+
+	void (*on_readStart)(uint64_t cycle, void *ctx);
+	// called at the end of each report read, decrypted
+	void (*on_report)(const unsigned char *data, int len, uint64_t cycle, void *ctx);
+	// called with the register window of the profiling sites
+	void (*on_window)(const unsigned char *data, int len, void *ctx);
+	void *ctx;
+};
+
+/* mode: value written to register 0xFE, 0 for none. profile: value
+ * written to 0xF8 (gun profile + 1), 0 for none. The handshake starts
+ * after start cycles. */
+int master_init(struct master *m, struct m168 *mcu, uint64_t start, uint64_t period, uint64_t byte,
+				int read_len, int encrypted, int mode, int profile);
+
+/* To be called when the TWINT flag changes (m168 on_twint) */
+void master_twint(struct master *m, int set);
+
+/* Poll a software slave, through bus, instead of the TWI of the chip.
+ * The bus events then take the time the bus gives, and the clock
+ * stretching is measured by the bus (the stretch series above stay
+ * empty). */
+void master_useBus(struct master *m, struct pinbus *bus);
+
+/* From the next period on, read the profiling sites of a firmware built
+ * with WITH_PROFILING instead of polling (see prof.h). Each period reads
+ * the register window, selects the next site and reads the report, so
+ * that the firmware samples and refreshes the window. dump_done is set
+ * after sites + 1 periods, the core is stopped and the bus stays
+ * idle. */
+void master_dump(struct master *m, int sites);
+
+#endif // _master_h__
@@ -0,0 +1,649 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "mega168.h"
+
+// data addresses
+#define PINB		0x23
+#define TIFR1		0x36
+#define PCIFR		0x3B
+#define EECR		0x3F
+#define EEDR		0x40
+#define EEARL		0x41
+#define EEARH		0x42
+#define SMCR		0x53
+#define PCICR		0x68
+#define PCMSK0		0x6B
+#define TIMSK1		0x6F
+#define ADCL		0x78
+#define ADCH		0x79
+#define ADCSRA		0x7A
+#define ADCSRB		0x7B
+#define ADMUX		0x7C
+#define TCCR1B		0x81
+#define TCNT1L		0x84
+#define TCNT1H		0x85
+#define OCR1AL		0x88
+#define OCR1AH		0x89
+#define OCR1BL		0x8A
+#define OCR1BH		0x8B
+#define TWSR		0xB9
+#define TWAR		0xBA
+#define TWDR		0xBB
+#define TWCR		0xBC
+
+// vectors
+#define VECT_PCINT0		3
+#define VECT_T1_COMPA	11
+#define VECT_T1_COMPB	12
+#define VECT_T1_OVF		13
+#define VECT_ADC		21
+#define VECT_EE_READY	22
+#define VECT_TWI		24
+
+#define TOV1		0x01
+#define OCF1A		0x02
+#define OCF1B		0x04
+
+#define TWINT		0x80
+#define TWEA		0x40
+#define TWSTO		0x10
+#define TWEN		0x04
+#define TWIE		0x01
+
+#define EERIE		0x08
+#define EEMPE		0x04
+#define EEPE		0x02
+#define EERE		0x01
+
+#define ADEN		0x80
+#define ADSC		0x40
+#define ADATE		0x20
+#define ADIF		0x10
+#define ADIE		0x08
+#define ADLAR		0x20
+
+#define TWI_IDLE	0
+#define TWI_SR		1 // addressed for a write of the master
+#define TWI_ST		2 // addressed for a read
+
+// with a 5V supply
+#define EE_WRITE_MS		3.4
+#define EE_ERASE_MS		1.8
+
+static const int t1_prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+static uint8_t merge(uint8_t old, uint8_t v, uint8_t mask)
+{
+	return (old & ~mask) | (v & mask);
+}
+
+/***** Ports and pin change interrupts *****/
+
+static uint8_t m168_pins(struct m168 *m, struct m168_port *p)
+{
+	// the value the synchronizer gives
+	if (m->c->cycle - p->changed < M168_SYNC_CYCLES)
+		return p->prev;
+	return p->level;
+}
+
+static void m168_pcint(struct core *c, void *param)
+{
+	struct m168_port *p = param;
+
+	c->data[PCIFR] |= p->pcint_pending;
+	p->pcint_pending = 0;
+}
+
+static void m168_update(struct m168 *m, int port)
+{
+	struct m168_port *p = &m->ports[port];
+	uint8_t pulled = p->ddr & ~p->port;
+	uint8_t level = p->ext & ~pulled;
+	uint8_t changed = level ^ p->level;
+	uint8_t drive = pulled ^ p->pulled;
+
+	if (!changed && !drive)
+		return;
+	p->pulled = pulled;
+
+	if (changed) {
+		p->prev = m168_pins(m, p);
+		p->level = level;
+		p->changed = m->c->cycle;
+
+		if (changed & m->c->data[PCMSK0 + port]) {
+			p->pcint_pending = 1 << port;
+			if (!p->pcint.active)
+				core_timerSet(m->c, &p->pcint, m->c->cycle + M168_PCINT_CYCLES, m168_pcint, p);
+		}
+	}
+	if (m->on_pin)
+		m->on_pin(m, port, level, changed | drive, m->ctx);
+}
+
+static uint8_t port_read(struct core *c, uint16_t addr, void *param)
+{
+	struct m168 *m = param;
+	int port = (addr - PINB) / 3;
+	struct m168_port *p = &m->ports[port];
+
+	switch ((addr - PINB) % 3)
+	{
+		case 0: return m168_pins(m, p);
+		case 1: return p->ddr;
+	}
+	return p->port;
+}
+
+static void port_write(struct core *c, uint16_t addr, uint8_t v, uint8_t mask, void *param)
+{
+	struct m168 *m = param;
+	int port = (addr - PINB) / 3;
+	struct m168_port *p = &m->ports[port];
+
+	switch ((addr - PINB) % 3)
+	{
+		case 0: p->port ^= v & mask; break; // writing PINx toggles PORTx
+		case 1: p->ddr = merge(p->ddr, v, mask); break;
+		case 2: p->port = merge(p->port, v, mask); break;
+	}
+	m168_update(m, port);
+}
+
+void m168_setPin(struct m168 *m, int port, int bit, int level)
+{
+	struct m168_port *p = &m->ports[port];
+
+	if (level)
+		p->ext |= 1 << bit;
+	else
+		p->ext &= ~(1 << bit);
+	m168_update(m, port);
+}
+
+int m168_getPin(struct m168 *m, int port, int bit)
+{
+	return (m->ports[port].level >> bit) & 1;
+}
+
+// the flags of the interrupt flag registers are cleared by writing a one
+static void flags_write(struct core *c, uint16_t addr, uint8_t v, uint8_t mask, void *param)
+{
+	c->data[addr] &= ~(v & mask);
+}
+
+/***** Timer1, normal mode *****/
+
+static uint64_t m168_io(struct m168 *m)
+{
+	uint64_t now = m->io_running ? m->c->cycle : m->stop_start;
+
+	return now - m->io_stopped;
+}
+
+// v among from + 1 to from + ticks
+static int t1_reaches(uint16_t from, uint64_t ticks, uint16_t v)
+{
+	return ticks >= 0x10000 || (uint16_t)(v - from - 1) < ticks;
+}
+
+/* TCNT1 up to now. The compare flags are set when the counter reaches
+ * OCR1x, a write of TCNT1 blocking the match on its value. */
+static void t1_sync(struct m168 *m)
+{
+	int prescaler = t1_prescalers[m->c->data[TCCR1B] & 7];
+	uint64_t io = m168_io(m);
+
+	// a cycle timer runs at its time, which can be before the last access
+	if (io <= m->io_at)
+		return;
+
+	if (prescaler) {
+		uint64_t ticks = io / prescaler - m->io_at / prescaler;
+
+		if (ticks) {
+			if (t1_reaches(m->tcnt, ticks, m->ocra))
+				m->c->data[TIFR1] |= OCF1A;
+			if (t1_reaches(m->tcnt, ticks, m->ocrb))
+				m->c->data[TIFR1] |= OCF1B;
+			if (t1_reaches(m->tcnt, ticks, 0))
+				m->c->data[TIFR1] |= TOV1;
+			m->tcnt += ticks;
+		}
+	}
+	m->io_at = io;
+}
+
+static void t1_event(struct core *c, void *param);
+
+static void t1_schedule(struct m168 *m)
+{
+	int prescaler = t1_prescalers[m->c->data[TCCR1B] & 7];
+	uint32_t n, next;
+
+	if (!prescaler || !m->io_running) {
+		core_timerCancel(m->c, &m->t1);
+		return;
+	}
+
+	// ticks to the next flag
+	next = (uint16_t)(0 - m->tcnt);
+	n = (uint16_t)(m->ocra - m->tcnt);
+	if (n && (!next || n < next))
+		next = n;
+	n = (uint16_t)(m->ocrb - m->tcnt);
+	if (n && (!next || n < next))
+		next = n;
+	if (!next)
+		next = 0x10000;
+
+	core_timerSet(m->c, &m->t1, (m->io_at / prescaler + next) * prescaler + m->io_stopped, t1_event, m);
+}
+
+static void t1_event(struct core *c, void *param)
+{
+	struct m168 *m = param;
+
+	t1_sync(m);
+	t1_schedule(m);
+}
+
+/* The 16 bit registers go through TEMP: the low byte read latches the
+ * high one, the high byte written is kept until the low one is. */
+static uint8_t t1_read(struct core *c, uint16_t addr, void *param)
+{
+	struct m168 *m = param;
+
+	switch (addr)
+	{
+		case TIFR1:
+			t1_sync(m);
+			return c->data[TIFR1];
+		case TCNT1L:
+			t1_sync(m);
+			m->temp = m->tcnt >> 8;
+			return m->tcnt;
+		case TCNT1H:
+			return m->temp;
+		case OCR1AL: return m->ocra;
+		case OCR1AH: return m->ocra >> 8;
+		case OCR1BL: return m->ocrb;
+		case OCR1BH: return m->ocrb >> 8;
+	}
+	return c->data[addr];
+}
+
+static void t1_write(struct core *c, uint16_t addr, uint8_t v, uint8_t mask, void *param)
+{
+	struct m168 *m = param;
+
+	t1_sync(m);
+	switch (addr)
+	{
+		case TIFR1:
+			c->data[TIFR1] &= ~(v & mask);
+			return;
+		case TCNT1H:
+		case OCR1AH:
+		case OCR1BH:
+			m->temp = v;
+			return;
+		case TCNT1L:
+			m->tcnt = (m->temp << 8) | v;
+			break;
+		case OCR1AL:
+			m->ocra = (m->temp << 8) | v;
+			break;
+		case OCR1BL:
+			m->ocrb = (m->temp << 8) | v;
+			break;
+		case TCCR1B:
+			c->data[TCCR1B] = merge(c->data[TCCR1B], v, mask);
+			break;
+	}
+	t1_schedule(m);
+}
+
+/***** Sleep: the I/O clock runs in the idle mode only *****/
+
+static int m168_sleep(struct core *c, void *param, int entering)
+{
+	struct m168 *m = param;
+
+	if (entering) {
+		if (!(c->data[SMCR] & 0x0E))
+			return 0;
+		t1_sync(m);
+		m->io_running = 0;
+		m->stop_start = c->cycle;
+	} else {
+		if (m->io_running)
+			return 0;
+		m->io_stopped += c->cycle - m->stop_start;
+		m->io_running = 1;
+	}
+	t1_schedule(m);
+
+	/* The oscillator keeps running in the standby modes, which wake up
+	 * in six cycles. Power-down and power-save would add its start-up
+	 * time (fuses), the firmware does not use them. */
+	return entering ? 0 : M168_STANDBY_WAKE;
+}
+
+/***** TWI slave *****/
+
+static void twi_setStatus(struct m168 *m, uint8_t status)
+{
+	struct core *c = m->c;
+	int was = c->data[TWCR] & TWINT;
+
+	c->data[TWSR] = status | (c->data[TWSR] & 0x03);
+	c->data[TWCR] |= TWINT;
+	if (!was && m->on_twint)
+		m->on_twint(m, 1, m->ctx);
+}
+
+static void twcr_write(struct core *c, uint16_t addr, uint8_t v, uint8_t mask, void *param)
+{
+	struct m168 *m = param;
+	uint8_t old = c->data[TWCR];
+	// TWWC is read only, TWINT is cleared by writing a one
+	uint8_t n = (merge(old, v, mask) & 0x75) | (old & TWINT);
+
+	if (v & mask & TWINT)
+		n &= ~TWINT;
+	// in slave mode, TWSTO only goes back to the not addressed state
+	if (!(n & TWEN) || (n & TWSTO))
+		m->twi_state = TWI_IDLE;
+	n &= ~TWSTO;
+
+	c->data[TWCR] = n;
+	if ((old & TWINT) && !(n & TWINT) && m->on_twint)
+		m->on_twint(m, 0, m->ctx);
+}
+
+static void twsr_write(struct core *c, uint16_t addr, uint8_t v, uint8_t mask, void *param)
+{
+	c->data[TWSR] = merge(c->data[TWSR], v, mask & 0x03);
+}
+
+int m168_twiStart(struct m168 *m, uint8_t sla_rw)
+{
+	struct core *c = m->c;
+	uint8_t twcr = c->data[TWCR];
+
+	// a repeated start ends a write
+	if (m->twi_state == TWI_SR && !(twcr & TWINT))
+		twi_setStatus(m, 0xA0);
+	m->twi_state = TWI_IDLE;
+
+	if (!(twcr & TWEN) || !(twcr & TWEA) || (twcr & TWINT))
+		return 0;
+	if ((sla_rw >> 1) != (c->data[TWAR] >> 1))
+		return 0;
+
+	if (sla_rw & 1) {
+		m->twi_state = TWI_ST;
+		twi_setStatus(m, 0xA8); // TW_ST_SLA_ACK
+	} else {
+		m->twi_state = TWI_SR;
+		twi_setStatus(m, 0x60); // TW_SR_SLA_ACK
+	}
+
+	return 1;
+}
+
+int m168_twiWrite(struct m168 *m, uint8_t data)
+{
+	struct core *c = m->c;
+	int ack;
+
+	if (m->twi_state != TWI_SR || (c->data[TWCR] & TWINT))
+		return 0;
+
+	c->data[TWDR] = data;
+	ack = !!(c->data[TWCR] & TWEA);
+	if (!ack)
+		m->twi_state = TWI_IDLE;
+	twi_setStatus(m, ack ? 0x80 : 0x88); // TW_SR_DATA_ACK, TW_SR_DATA_NACK
+
+	return ack;
+}
+
+uint8_t m168_twiRead(struct m168 *m, int ack)
+{
+	struct core *c = m->c;
+	uint8_t data = c->data[TWDR];
+	int last;
+
+	if (m->twi_state != TWI_ST || (c->data[TWCR] & TWINT))
+		return 0xFF;
+
+	// TWEA cleared with the byte: the slave has nothing more to send
+	last = !(c->data[TWCR] & TWEA);
+	if (!ack || last)
+		m->twi_state = TWI_IDLE;
+	if (!ack)
+		twi_setStatus(m, 0xC0); // TW_ST_DATA_NACK
+	else
+		twi_setStatus(m, last ? 0xC8 : 0xB8); // TW_ST_LAST_DATA, TW_ST_DATA_ACK
+
+	return data;
+}
+
+void m168_twiStop(struct m168 *m)
+{
+	if (m->twi_state == TWI_SR && !(m->c->data[TWCR] & TWINT))
+		twi_setStatus(m, 0xA0); // TW_SR_STOP
+	m->twi_state = TWI_IDLE;
+}
+
+/***** EEPROM *****/
+
+static void ee_done(struct core *c, void *param)
+{
+	c->data[EECR] &= ~EEPE;
+}
+
+static uint8_t eecr_read(struct core *c, uint16_t addr, void *param)
+{
+	struct m168 *m = param;
+	uint8_t v = c->data[EECR] & ~EEMPE;
+
+	// EEMPE clears itself after four cycles
+	if (m->eempe && c->cycle - m->eempe_at <= 4)
+		v |= EEMPE;
+	return v & ~EERE;
+}
+
+static void eecr_write(struct core *c, uint16_t addr, uint8_t v, uint8_t mask, void *param)
+{
+	struct m168 *m = param;
+	uint16_t a = (c->data[EEARL] | (c->data[EEARH] << 8)) % CORE_EEPROM_SIZE;
+	int mpe = eecr_read(c, addr, param) & EEMPE;
+	int busy = c->data[EECR] & EEPE;
+
+	v &= mask;
+	c->data[EECR] = merge(c->data[EECR], v, mask & 0x38);
+	if (busy)
+		return;
+
+	if ((v & EEPE) && mpe) {
+		int mode = (c->data[EECR] >> 4) & 3;
+
+		if (mode == 0)
+			c->eeprom[a] = c->data[EEDR];
+		else if (mode == 1)
+			c->eeprom[a] = 0xFF;
+		else
+			c->eeprom[a] &= c->data[EEDR];
+		c->data[EECR] |= EEPE;
+		m->eempe = 0;
+		core_timerSet(c, &m->ee, c->cycle + (mode ? EE_ERASE_MS : EE_WRITE_MS) * c->frequency / 1000,
+						ee_done, NULL);
+		// the CPU is halted
+		c->cycle += 2;
+	} else if (v & EEMPE) {
+		m->eempe = 1;
+		m->eempe_at = c->cycle;
+	}
+	if (v & EERE) {
+		c->data[EEDR] = c->eeprom[a];
+		c->cycle += 4;
+	}
+}
+
+/***** ADC, the conversions without the sample and hold *****/
+
+static void adc_done(struct core *c, void *param);
+
+static void adc_start(struct m168 *m, int clocks)
+{
+	struct core *c = m->c;
+	int prescaler = 1 << (c->data[ADCSRA] & 7);
+
+	if (prescaler == 1)
+		prescaler = 2;
+	core_timerSet(c, &m->adc, c->cycle + clocks * prescaler, adc_done, m);
+}
+
+static void adc_done(struct core *c, void *param)
+{
+	struct m168 *m = param;
+	int mux = c->data[ADMUX] & 0x0F;
+	double v = mux < 8 ? m->adc_in[mux] : 0;
+	int res = v <= 0 ? 0 : v >= 5 ? 1023 : v / 5 * 1024;
+
+	if (c->data[ADMUX] & ADLAR) {
+		c->data[ADCH] = res >> 2;
+		c->data[ADCL] = res << 6;
+	} else {
+		c->data[ADCH] = res >> 8;
+		c->data[ADCL] = res;
+	}
+	c->data[ADCSRA] |= ADIF;
+
+	// free running
+	if ((c->data[ADCSRA] & ADATE) && !(c->data[ADCSRB] & 7))
+		adc_start(m, 13);
+	else
+		c->data[ADCSRA] &= ~ADSC;
+}
+
+static void adcsra_write(struct core *c, uint16_t addr, uint8_t v, uint8_t mask, void *param)
+{
+	struct m168 *m = param;
+	uint8_t old = c->data[ADCSRA];
+	uint8_t n = (merge(old, v, mask) & ~ADIF) | (old & ADIF);
+
+	if (v & mask & ADIF)
+		n &= ~ADIF;
+	c->data[ADCSRA] = n;
+
+	if (!(n & ADEN)) {
+		c->data[ADCSRA] &= ~ADSC;
+		core_timerCancel(c, &m->adc);
+	} else if ((n & ADSC) && !m->adc.active) {
+		// the first conversion after enabling takes 25 ADC clocks
+		adc_start(m, (old & ADEN) ? 13 : 25);
+	}
+}
+
+/***** Interrupts *****/
+
+static int m168_pending(struct core *c, void *param)
+{
+	uint8_t *d = c->data;
+	int i;
+
+	for (i = 0; i < M168_NUM_PORTS; i++) {
+		if (d[PCIFR] & d[PCICR] & (1 << i))
+			return VECT_PCINT0 + i;
+	}
+	if (d[TIFR1] & d[TIMSK1] & OCF1A)
+		return VECT_T1_COMPA;
+	if (d[TIFR1] & d[TIMSK1] & OCF1B)
+		return VECT_T1_COMPB;
+	if (d[TIFR1] & d[TIMSK1] & TOV1)
+		return VECT_T1_OVF;
+	if ((d[ADCSRA] & ADIF) && (d[ADCSRA] & ADIE))
+		return VECT_ADC;
+	if ((d[EECR] & EERIE) && !(d[EECR] & EEPE))
+		return VECT_EE_READY;
+	if ((d[TWCR] & TWINT) && (d[TWCR] & TWIE))
+		return VECT_TWI;
+
+	return 0;
+}
+
+// TWINT and EE_READY stay, until the handler acts
+static void m168_taken(struct core *c, void *param, int vector)
+{
+	switch (vector)
+	{
+		case VECT_PCINT0: case VECT_PCINT0 + 1: case VECT_PCINT0 + 2:
+			c->data[PCIFR] &= ~(1 << (vector - VECT_PCINT0));
+			break;
+		case VECT_T1_COMPA: c->data[TIFR1] &= ~OCF1A; break;
+		case VECT_T1_COMPB: c->data[TIFR1] &= ~OCF1B; break;
+		case VECT_T1_OVF: c->data[TIFR1] &= ~TOV1; break;
+		case VECT_ADC: c->data[ADCSRA] &= ~ADIF; break;
+	}
+}
+
+void m168_init(struct m168 *m, struct core *c)
+{
+	uint16_t a;
+	int i;
+
+	memset(m, 0, sizeof(struct m168));
+	m->c = c;
+	m->io_running = 1;
+
+	for (i = 0; i < M168_NUM_PORTS; i++) {
+		m->ports[i].ext = 0xFF;
+		m->ports[i].level = m->ports[i].prev = 0xFF;
+	}
+	for (a = PINB; a < PINB + 3 * M168_NUM_PORTS; a++)
+		core_ioHook(c, a, port_read, port_write, m);
+	core_ioHook(c, PCIFR, NULL, flags_write, m);
+
+	core_ioHook(c, TIFR1, t1_read, t1_write, m);
+	core_ioHook(c, TCCR1B, NULL, t1_write, m);
+	for (a = TCNT1L; a <= OCR1BH; a++) {
+		// ICR1, plain memory
+		if (a != TCNT1H + 1 && a != TCNT1H + 2)
+			core_ioHook(c, a, t1_read, t1_write, m);
+	}
+
+	core_ioHook(c, TWCR, NULL, twcr_write, m);
+	core_ioHook(c, TWSR, NULL, twsr_write, m);
+	c->data[TWSR] = 0xF8; // TW_NO_INFO
+	c->data[TWAR] = 0xFE;
+
+	core_ioHook(c, EECR, eecr_read, eecr_write, m);
+	core_ioHook(c, ADCSRA, NULL, adcsra_write, m);
+
+	c->periph.pending = m168_pending;
+	c->periph.taken = m168_taken;
+	c->periph.sleep = m168_sleep;
+	c->periph.p = m;
+}
@@ -0,0 +1,93 @@
+#ifndef _mega168_h__
+#define _mega168_h__
+
+#include <stdint.h>
+
+#include "core.h"
+
+/* The peripherals of the ATmega168 the firmware uses: the ports and
+ * their pin change interrupts, Timer1 in normal mode, the TWI slave,
+ * the EEPROM, the ADC and the sleep modes. The other registers are
+ * plain memory, and their interrupts never happen (the watchdog is not
+ * run).
+ *
+ * The pins are wired-AND with the outside: a pin is low when the chip
+ * drives it low or the outside pulls it low (m168_setPin), high
+ * otherwise. As on the chip, the PINx registers and the pin change
+ * interrupts see a level through the synchronizer.
+ *
+ * The TWI is at the level of the bus events, for a master calling
+ * m168_twi*: the slave answers at once (address and data
+ * acknowledge, byte read), and sets TWINT as it would after the
+ * acknowledge. A real master waits for TWINT to be cleared before the
+ * next event, the slave holding SCL low until then. */
+
+#define M168_PORTB		0
+#define M168_PORTC		1
+#define M168_PORTD		2
+#define M168_NUM_PORTS	3
+
+// cycles from a pin change to the value read in PINx, and to the PCIFR flag
+#define M168_SYNC_CYCLES	1
+#define M168_PCINT_CYCLES	3
+// start-up time, waking up from a sleep mode other than idle
+#define M168_STANDBY_WAKE	6
+
+struct m168;
+
+struct m168_port {
+	uint8_t ddr, port;
+	uint8_t ext; // 0: pulled low by the outside
+	uint8_t pulled; // 1: pulled low by the chip
+	uint8_t level, prev; // pin levels, prev before the last change
+	uint64_t changed;
+	struct core_timer pcint;
+	uint8_t pcint_pending;
+};
+
+struct m168 {
+	struct core *c;
+	struct m168_port ports[M168_NUM_PORTS];
+
+	// Timer1: TCNT1 at io_at, in I/O clock cycles
+	uint16_t tcnt, ocra, ocrb, temp;
+	uint64_t io_at;
+	struct core_timer t1;
+
+	// I/O clock, stopped in the deep sleep modes
+	uint64_t io_stopped, stop_start;
+	int io_running;
+
+	// TWI
+	int twi_state;
+	void (*on_twint)(struct m168 *m, int set, void *ctx);
+
+	// EEPROM write in progress, write enabled by EEMPE at eempe_at
+	struct core_timer ee;
+	int eempe;
+	uint64_t eempe_at;
+
+	// ADC: inputs in volts, against the 5V reference
+	double adc_in[8];
+	struct core_timer adc;
+
+	/* called when a pin changes its level, the outside included, or the
+	 * chip starts or stops pulling it low */
+	void (*on_pin)(struct m168 *m, int port, uint8_t level, uint8_t changed, void *ctx);
+	void *ctx;
+};
+
+void m168_init(struct m168 *m, struct core *c);
+
+/* bit of the port: level 0 pulls the pin low, 1 releases it */
+void m168_setPin(struct m168 *m, int port, int bit, int level);
+int m168_getPin(struct m168 *m, int port, int bit);
+
+/* The bus events of a TWI master. Start and write return 1 when the
+ * slave acknowledges. */
+int m168_twiStart(struct m168 *m, uint8_t sla_rw);
+int m168_twiWrite(struct m168 *m, uint8_t data);
+uint8_t m168_twiRead(struct m168 *m, int ack);
+void m168_twiStop(struct m168 *m);
+
+#endif // _mega168_h__
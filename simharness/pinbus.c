@@ -0,0 +1,267 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include "pinbus.h"
+
+#define PB_IDLE		0
+#define PB_BYTE		1 // address, byte written or read
+#define PB_STOP		2
+
+static uint64_t pb_after(struct pinbus *b, uint64_t at)
+{
+	uint64_t now = b->c->cycle;
+
+	return at > now ? at : now + 1;
+}
+
+static void pb_scl(struct pinbus *b, int level)
+{
+	b->held = !level;
+	m168_setPin(b->mcu, b->port, b->scl, level);
+}
+
+static void pb_sda(struct pinbus *b, int level)
+{
+	m168_setPin(b->mcu, b->port, b->sda, level);
+}
+
+static void pb_done(struct pinbus *b, int status, uint8_t data)
+{
+	b->op = PB_IDLE;
+	if (b->done)
+		b->done(b, status, data, b->ctx);
+}
+
+static void pb_data(struct core *c, void *param);
+
+// SCL just went low, the bit before counted
+static void pb_fall(struct pinbus *b)
+{
+	b->fall = b->c->cycle;
+
+	if (b->bit == 9) {
+		b->start_open = 0;
+		pb_done(b, (b->in & 1) ? PB_NACK : PB_ACK, b->in >> 1);
+		return;
+	}
+	core_timerSet(b->c, &b->timer, b->fall + b->vd_dat, pb_data, b);
+}
+
+// end of the high time: the bit is read, SCL pulled
+static void pb_sample(struct pinbus *b)
+{
+	b->in_high = 0;
+	b->in = (b->in << 1) | m168_getPin(b->mcu, b->port, b->sda);
+	b->bit++;
+	pb_scl(b, 0);
+	pb_fall(b);
+}
+
+static void pb_pull(struct core *c, void *param)
+{
+	pb_sample(param);
+}
+
+static void pb_stopEnd(struct core *c, void *param)
+{
+	struct pinbus *b = param;
+
+	pb_sda(b, 1);
+	b->free = c->cycle;
+	pb_done(b, PB_ACK, 0);
+}
+
+static void pb_timeout(struct core *c, void *param)
+{
+	struct pinbus *b = param;
+
+	if (!b->wait_high)
+		return;
+
+	b->wait_high = 0;
+	b->start_open = 0;
+	core_timerCancel(c, &b->timer);
+	pb_sda(b, 1);
+	b->free = c->cycle;
+	pb_done(b, PB_TIMEOUT, 0);
+}
+
+static void pb_release(struct core *c, void *param)
+{
+	struct pinbus *b = param;
+
+	// first release after the start
+	if (b->start_open && b->bit == 0 && !(b->mcu->ports[b->port].pulled & (1 << b->scl)))
+		b->late_starts++;
+
+	b->release = c->cycle;
+	b->wait_high = 1;
+	core_timerSet(c, &b->timeout_timer, c->cycle + b->timeout, pb_timeout, b);
+	// pinbus_pin goes on at once if the slave does not hold SCL
+	pb_scl(b, 1);
+}
+
+static void pb_data(struct core *c, void *param)
+{
+	struct pinbus *b = param;
+
+	pb_sda(b, (b->out >> (8 - b->bit)) & 1);
+	core_timerSet(c, &b->timer, b->fall + b->low, pb_release, b);
+}
+
+static void pb_stopSda(struct core *c, void *param)
+{
+	struct pinbus *b = param;
+
+	pb_sda(b, 0);
+	core_timerSet(c, &b->timer, b->fall + b->low, pb_release, b);
+}
+
+static void pb_startScl(struct core *c, void *param)
+{
+	struct pinbus *b = param;
+
+	pb_scl(b, 0);
+	pb_fall(b);
+}
+
+static void pb_startSda(struct core *c, void *param)
+{
+	struct pinbus *b = param;
+
+	pb_sda(b, 0);
+	b->start = c->cycle;
+	b->start_open = 1;
+	core_timerSet(c, &b->timer, c->cycle + b->hd_sta, pb_startScl, b);
+}
+
+static void pb_released(struct core *c, void *param)
+{
+	pb_done(param, PB_ACK, 0);
+}
+
+void pinbus_pin(struct pinbus *b, int port)
+{
+	struct m168_port *p = &b->mcu->ports[port];
+	uint64_t now = b->c->cycle;
+	int scl;
+
+	if (port != b->port)
+		return;
+	scl = (p->level >> b->scl) & 1;
+
+	if (b->start_open && (p->pulled & (1 << b->scl))) {
+		series_add(&b->start_hold, now - b->start);
+		b->start_open = 0;
+	}
+
+	if (b->wait_high && scl) {
+		b->wait_high = 0;
+		core_timerCancel(b->c, &b->timeout_timer);
+		if (now > b->release)
+			series_add(&b->stretch, now - b->release);
+
+		if (b->op == PB_STOP) {
+			core_timerSet(b->c, &b->timer, now + b->su_sto, pb_stopEnd, b);
+		} else {
+			b->in_high = 1;
+			core_timerSet(b->c, &b->timer, now + b->high, pb_pull, b);
+		}
+	} else if (b->in_high && !scl) {
+		// pulled by the slave first: the bit ends here
+		core_timerCancel(b->c, &b->timer);
+		pb_sample(b);
+	}
+}
+
+static void pb_byte(struct pinbus *b, uint16_t out)
+{
+	b->op = PB_BYTE;
+	b->out = out;
+	b->in = 0;
+	b->bit = 0;
+}
+
+void pinbus_start(struct pinbus *b, uint8_t sla_rw)
+{
+	pb_byte(b, (sla_rw << 1) | 1);
+	core_timerSet(b->c, &b->timer, pb_after(b, b->free + b->buf), pb_startSda, b);
+}
+
+void pinbus_write(struct pinbus *b, uint8_t data)
+{
+	pb_byte(b, (data << 1) | 1);
+	core_timerSet(b->c, &b->timer, pb_after(b, b->fall + b->vd_dat), pb_data, b);
+}
+
+void pinbus_read(struct pinbus *b, int ack)
+{
+	pb_byte(b, 0x1FE | !ack);
+	core_timerSet(b->c, &b->timer, pb_after(b, b->fall + b->vd_dat), pb_data, b);
+}
+
+void pinbus_stop(struct pinbus *b)
+{
+	b->op = PB_STOP;
+
+	// after a timeout, the bus is already released
+	if (!b->held) {
+		core_timerSet(b->c, &b->timer, pb_after(b, 0), pb_released, b);
+		return;
+	}
+	core_timerSet(b->c, &b->timer, pb_after(b, b->fall + b->vd_dat), pb_stopSda, b);
+}
+
+uint64_t pinbus_startDeadline(struct pinbus *b)
+{
+	return b->hd_sta + b->low;
+}
+
+void pinbus_init(struct pinbus *b, struct m168 *mcu, int port, int scl, int sda, int khz)
+{
+	double us = mcu->c->frequency / 1e6;
+
+	memset(b, 0, sizeof(struct pinbus));
+	b->c = mcu->c;
+	b->mcu = mcu;
+	b->port = port;
+	b->scl = scl;
+	b->sda = sda;
+
+	// the minimums of the I2C specification, rounded up
+	if (khz >= 400) {
+		b->hd_sta = 0.6 * us + 0.999;
+		b->low = 1.3 * us + 0.999;
+		b->high = 0.6 * us + 0.999;
+		b->vd_dat = 0.9 * us + 0.999;
+		b->su_sto = 0.6 * us + 0.999;
+		b->buf = 1.3 * us + 0.999;
+	} else {
+		b->hd_sta = 4.0 * us + 0.999;
+		b->low = 4.7 * us + 0.999;
+		b->high = 4.0 * us + 0.999;
+		b->vd_dat = 3.45 * us + 0.999;
+		b->su_sto = 4.0 * us + 0.999;
+		b->buf = 4.7 * us + 0.999;
+	}
+	// as the master of master.c
+	b->timeout = b->c->frequency / 200;
+
+	// both lines released
+	pb_scl(b, 1);
+	pb_sda(b, 1);
+}
@@ -0,0 +1,73 @@
+#ifndef _pinbus_h__
+#define _pinbus_h__
+
+#include <stdint.h>
+
+#include "core.h"
+#include "mega168.h"
+#include "series.h"
+
+/* I2C master on two pins of the simulated chip, for a slave the
+ * firmware runs in software (swtwi.c). Unlike the TWI of the chip, the
+ * bus is clocked bit by bit, at the minimum times of the mode: the
+ * master sets SDA its data valid time after its SCL fall, releases SCL
+ * after the low time, waits for the slave to let SCL go, and pulls it
+ * again after the high time. SCL pulled low by the slave during the
+ * high time ends the bit early, as the clock synchronization of a real
+ * master does.
+ *
+ * Each call is a bus event, as with m168_twi*, and done is called at
+ * its end. A start is only sent on a free bus: master.c always ends a
+ * transfer with a stop.
+ *
+ * Times are in CPU cycles. */
+
+#define PB_ACK		0
+#define PB_NACK		1
+#define PB_TIMEOUT	2 // SCL held by the slave too long, both lines released
+
+struct pinbus {
+	struct core *c;
+	struct m168 *mcu;
+	int port, scl, sda;
+
+	// times of the mode
+	uint64_t hd_sta, low, high, vd_dat, su_sto, buf;
+	uint64_t timeout;
+
+	// event in progress
+	int op;
+	uint16_t out, in; // 9 bits, the acknowledge last
+	int bit;
+	int held; // SCL pulled low by the master
+	int wait_high, in_high;
+	int start_open; // start sent, SCL not held by the slave yet
+	uint64_t fall, release, start, free;
+	struct core_timer timer, timeout_timer;
+
+	// results
+	struct series start_hold; // start condition to SCL held by the slave, within the address
+	struct series stretch; // master releasing SCL to SCL high, when held
+	uint64_t late_starts; // SCL not held by the end of the first low time
+
+	void (*done)(struct pinbus *b, int status, uint8_t data, void *ctx);
+	void *ctx;
+};
+
+/* SCL and SDA are bits of port. khz: 400 or 100 */
+void pinbus_init(struct pinbus *b, struct m168 *mcu, int port, int scl, int sda, int khz);
+
+/* To be called from the on_pin callback of the chip */
+void pinbus_pin(struct pinbus *b, int port);
+
+void pinbus_start(struct pinbus *b, uint8_t sla_rw);
+void pinbus_write(struct pinbus *b, uint8_t data);
+/* done gets the byte */
+void pinbus_read(struct pinbus *b, int ack);
+void pinbus_stop(struct pinbus *b);
+
+/* Latest time, from the start condition, for the slave to hold SCL: the
+ * end of the first low time */
+uint64_t pinbus_startDeadline(struct pinbus *b);
+
+#endif // _pinbus_h__
@@ -0,0 +1,77 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012,2013  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "series.h"
+
+void series_add(struct series *s, uint64_t v)
+{
+	if (s->n == s->cap) {
+		size_t cap = s->cap ? s->cap * 2 : 256;
+		uint64_t *nv = realloc(s->v, cap * sizeof(uint64_t));
+
+		if (!nv) {
+			perror("realloc");
+			return;
+		}
+		s->v = nv;
+		s->cap = cap;
+	}
+	s->v[s->n++] = v;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t series_pct(const struct series *s, double p)
+{
+	size_t i = p / 100.0 * (s->n - 1) + 0.5;
+
+	return s->v[i];
+}
+
+void series_header(FILE *fp, const char *title)
+{
+	fprintf(fp, "\n%-28s %9s %10s %10s %10s %10s %10s\n", title, "count",
+		"min", "p50", "p99", "max", "max us");
+}
+
+void series_print(FILE *fp, const char *label, struct series *s, double hz)
+{
+	if (!s->n) {
+		fprintf(fp, "  %-26s %9d\n", label, 0);
+		return;
+	}
+
+	qsort(s->v, s->n, sizeof(uint64_t), cmp_u64);
+	fprintf(fp, "  %-26s %9zu %10llu %10llu %10llu %10llu %10.1f\n", label, s->n,
+		(unsigned long long)s->v[0], (unsigned long long)series_pct(s, 50),
+		(unsigned long long)series_pct(s, 99), (unsigned long long)s->v[s->n - 1],
+		s->v[s->n - 1] * 1e6 / hz);
+}
+
+void series_free(struct series *s)
+{
+	free(s->v);
+	memset(s, 0, sizeof(struct series));
+}
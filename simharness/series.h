@@ -0,0 +1,20 @@
+#ifndef _series_h__
+#define _series_h__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Every value of a measurement, in CPU cycles, for the percentiles */
+struct series {
+	uint64_t *v;
+	size_t n, cap;
+};
+
+void series_add(struct series *s, uint64_t v);
+void series_header(FILE *fp, const char *title);
+/* Printed in cycles and in us at hz */
+void series_print(FILE *fp, const char *label, struct series *s, double hz);
+void series_free(struct series *s);
+
+#endif // _series_h__
@@ -0,0 +1,438 @@
+/* Software TWI slave for the second Wiimote channel.
+ *
+ * A pin change on SDA while SCL is high is a start condition. From
+ * there the whole transaction is handled inside the interrupt by
+ * polling the pins, and the register file, encryption and report logic
+ * are reached through the wm_bus* functions of wiimote.c, so this
+ * channel behaves exactly like the hardware one.
+ *
+ * Timing, in cycles at 12MHz and for the 400kHz minimums:
+ *
+ * Every bit is stretched. After each SCL fall the slave holds SCL low,
+ * samples or sets SDA, then releases SCL; the master counts its high
+ * time from when it sees SCL high. What is left to the polling loops of
+ * sw_clock(), with SCL released:
+ *  - SCL high lasts 0.6us (7 cycles). It is checked at most 6 cycles
+ *    apart.
+ *  - SCL low lasts 1.3us (15 cycles). The fall is checked at most 4
+ *    cycles apart and SCL held 5 cycles after the check: 9 cycles, 11
+ *    with the input synchronizer.
+ *  - The data of the master is valid 0.9us after its fall. It is
+ *    sampled 1us after SCL is held.
+ * A start or stop condition is a change of SDA while SCL is high, seen
+ * by the same loop.
+ *
+ * Only the start condition needs the interrupt. The master pulls SCL
+ * low 0.6us after it and releases it 1.3us later: SCL must be held
+ * within 1.9us (22 cycles). The vector cannot tell a start from SCL,
+ * which is low after 7 cycles, before the vector even runs: it holds SCL
+ * on any SDA fall, 15 cycles after the edge (synchronizer 2, instruction
+ * in progress up to 3, interrupt response 4, vector jump 3, the test and
+ * sbi 3). That leaves 7 cycles for code running with the interrupts
+ * disabled, or more for a master slower than the minimums. So in this
+ * build:
+ *  - the hardware TWI handler, the longest one, runs with the
+ *    interrupts enabled (see TWI_vect in wiimote.c), after a 12 cycle
+ *    vector,
+ *  - the other handlers and the atomic sections are short, down to 7
+ *    or 8 cycles in the TWI handler (twi_watch and twi_program in
+ *    wiimote.c), except the sensor pin change handler (gun.c), which
+ *    only runs on flashes.
+ * A start seen too late reads a shifted address, which is counted as
+ * unexpected in the wm_faults of the channel (register 0xF5), together
+ * with the timeouts and bus errors. The Wiimote polls again 5ms later.
+ *
+ * Interrupts stay disabled during a transaction. If the hardware TWI
+ * is addressed at the same time, it simply holds its own bus until we
+ * are done. A transaction where the master stops clocking is abandoned
+ * after SWTWI_TIMEOUT_LOOPS (about 2ms).
+ *
+ * Measured with simharness -2 (see simharness/README), two Wiimotes
+ * polling every 5ms, for every offset of one to the other, 7us apart
+ * (25us encrypted or at 100kHz, 50us both), 2s each:
+ *  - SCL is held within 18 cycles of the start for 99% of them, the
+ *    others being the late ones below and those of the boot, with the
+ *    interrupts off in the EEPROM writes. The Timer1 overflow handler
+ *    (timebase.c, 40 cycles with the interrupts off, every 43.7ms)
+ *    delays the start past the deadline when the two line up: 19
+ *    starts in 284340 polls (5 in 79534 encrypted, none at 100kHz).
+ *  - A poll of this channel, from its start to the end of the read,
+ *    takes 1.61ms at 400kHz (2.34ms at 100kHz), each bit stretched by
+ *    up to 31us.
+ *  - A poll of the hardware channel meeting it is stretched by as
+ *    much: up to 2.29ms from its start to the end of the read, instead
+ *    of 0.65ms (2.64ms encrypted, 3.02ms with this channel at 100kHz,
+ *    3.58ms both).
+ * Neither channel missed a sample or a poll, other than the late
+ * starts above.
+ */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "wiimote.h"
+#include "swtwi.h"
+
+#define SCL_IS_HIGH()	(SWTWI_PIN & _BV(SWTWI_SCL_PIN))
+#define SDA_IS_HIGH()	(SWTWI_PIN & _BV(SWTWI_SDA_PIN))
+
+// open drain: the port bits are 0, only the direction changes
+#define SCL_HOLD()		SWTWI_DDR |= _BV(SWTWI_SCL_PIN)
+#define SCL_RELEASE()	SWTWI_DDR &= ~_BV(SWTWI_SCL_PIN)
+#define SDA_PULL()		SWTWI_DDR |= _BV(SWTWI_SDA_PIN)
+#define SDA_RELEASE()	SWTWI_DDR &= ~_BV(SWTWI_SDA_PIN)
+
+// 8 to 12 cycles per wait loop pass, about 2ms
+#define SWTWI_TIMEOUT_LOOPS	(F_CPU / 5000)
+// 10 cycles per pass, 100us: the wait for a read after a write
+#define SWTWI_RESTART_LOOPS	(F_CPU / 100000)
+
+// data valid time of the master after its SCL fall (0.9us), rounded up
+#define SW_DATA_VALID_US	1
+/* The vector may hold SCL before the master pulls it low, up to 0.6us
+ * after the start condition at 400kHz. Its first bit is valid 0.9us
+ * later. */
+#define SW_FIRST_BIT_US		2
+
+// bus conditions
+#define SW_OK		0
+#define SW_START	1 // (repeated) start
+#define SW_STOP		2
+#define SW_NACK		3
+#define SW_TIMEOUT	4
+#define SW_RESTART	5 // stop, then start with SCL held
+
+#define SW_ASM_PINS \
+	[pin] "I" (_SFR_IO_ADDR(SWTWI_PIN)), \
+	[ddr] "I" (_SFR_IO_ADDR(SWTWI_DDR)), \
+	[scl] "I" (SWTWI_SCL_PIN), \
+	[sda] "I" (SWTWI_SDA_PIN)
+
+void swtwi_init(void)
+{
+	// released, no pull-ups
+	SWTWI_PORT &= ~(_BV(SWTWI_SCL_PIN) | _BV(SWTWI_SDA_PIN));
+	SWTWI_DDR &= ~(_BV(SWTWI_SCL_PIN) | _BV(SWTWI_SDA_PIN));
+}
+
+void swtwi_start(void)
+{
+	// only SDA edges are interesting, the rest is polled
+	SWTWI_PCMSK |= _BV(SWTWI_SDA_PCINT);
+	PCIFR = _BV(SWTWI_PCIF);
+	PCICR |= _BV(SWTWI_PCIE);
+}
+
+/* Hold SCL at its next fall, SCL being high. A pass of the loop is 10
+ * cycles, with SCL tested at 0, 2 and 6. */
+static inline unsigned char sw_holdAtFall(void)
+{
+	unsigned int n = SWTWI_TIMEOUT_LOOPS;
+
+	asm volatile(
+		"1:	sbis %[pin], %[scl]	\n\t"
+		"	rjmp 2f				\n\t"
+		"	sbis %[pin], %[scl]	\n\t"
+		"	rjmp 2f				\n\t"
+		"	sbiw %[n], 1		\n\t"
+		"	sbis %[pin], %[scl]	\n\t"
+		"	rjmp 2f				\n\t"
+		"	brne 1b				\n\t"
+		"	rjmp 3f				\n\t"
+		"2:	sbi %[ddr], %[scl]	\n\t"
+		"3:						\n\t"
+		: [n] "+w" (n)
+		: SW_ASM_PINS
+	);
+
+	return (SWTWI_DDR & _BV(SWTWI_SCL_PIN)) ? SW_OK : SW_TIMEOUT;
+}
+
+/* Release SCL, wait for the master to clock it and hold it again at the
+ * fall. same is the skip instruction testing that SDA kept its level,
+ * cond the condition if it did not. Sets r to SW_OK with SCL held, to
+ * cond with SCL high, or leaves it on a timeout.
+ *
+ * Waiting for SCL high, a pass is 8 cycles with SCL tested at 0 and 2.
+ * Waiting for the fall, a pass is 12 cycles with SCL tested at 0, 4 and
+ * 8, SDA at 2. An SDA change just after the fall is the next data bit,
+ * not a condition: SCL is tested again.
+ *
+ * tail runs after the condition, SW_TAIL or SW_TAIL_RESTART. */
+#define SW_CLOCK(same, cond, r, n, tail) \
+	asm volatile( \
+		"	cbi %[ddr], %[scl]	\n\t" \
+		"1:	sbic %[pin], %[scl]	\n\t" \
+		"	rjmp 2f				\n\t" \
+		"	sbic %[pin], %[scl]	\n\t" \
+		"	rjmp 2f				\n\t" \
+		"	sbiw %[n], 1		\n\t" \
+		"	brne 1b				\n\t" \
+		"	rjmp 6f				\n\t" \
+		"2:	sbis %[pin], %[scl]	\n\t" \
+		"	rjmp 5f				\n\t" \
+		"	" same " %[pin], %[sda]	\n\t" \
+		"	rjmp 4f				\n\t" \
+		"	sbis %[pin], %[scl]	\n\t" \
+		"	rjmp 5f				\n\t" \
+		"	sbiw %[n], 1		\n\t" \
+		"	sbis %[pin], %[scl]	\n\t" \
+		"	rjmp 5f				\n\t" \
+		"	brne 2b				\n\t" \
+		"	rjmp 6f				\n\t" \
+		"4:	sbis %[pin], %[scl]	\n\t" \
+		"	rjmp 5f				\n\t" \
+		"	ldi %[r], %[c]		\n\t" \
+		tail \
+		"5:	sbi %[ddr], %[scl]	\n\t" \
+		"	ldi %[r], %[ok]		\n\t" \
+		"6:						\n\t" \
+		: [r] "+d" (r), [n] "+w" (n) \
+		: SW_ASM_PINS, [c] "M" (cond), [ok] "M" (SW_OK), \
+		  [rl] "i" (SWTWI_RESTART_LOOPS), [rs] "M" (SW_RESTART) \
+	)
+
+#define SW_TAIL \
+		"	rjmp 6f				\n\t"
+
+/* After a stop, hold SCL at the next start: the master reads right
+ * after writing the register address, its start following the stop by
+ * as little as 1.3us, too soon for the vector once the write is handled
+ * and the interrupt returns. A pass is 10 cycles with SDA tested at 0, 2
+ * and 6. Sets r to SW_RESTART with SCL held, leaves SW_STOP if the bus
+ * stays idle for SWTWI_RESTART_LOOPS. */
+#define SW_TAIL_RESTART \
+		"	ldi %A[n], lo8(%[rl])	\n\t" \
+		"	ldi %B[n], hi8(%[rl])	\n\t" \
+		"7:	sbis %[pin], %[sda]	\n\t" \
+		"	rjmp 8f				\n\t" \
+		"	sbis %[pin], %[sda]	\n\t" \
+		"	rjmp 8f				\n\t" \
+		"	sbiw %[n], 1		\n\t" \
+		"	sbis %[pin], %[sda]	\n\t" \
+		"	rjmp 8f				\n\t" \
+		"	brne 7b				\n\t" \
+		"	rjmp 6f				\n\t" \
+		"8:	sbi %[ddr], %[scl]	\n\t" \
+		"	ldi %[r], %[rs]		\n\t" \
+		"	rjmp 6f				\n\t"
+
+/* One bit. Called with SCL held low, after SDA was set for a bit we
+ * send. The bit on SDA is sampled once valid, then clocked. Returns
+ * SW_OK with SCL held again, SW_START or SW_STOP if SDA changed while
+ * SCL was high, or SW_TIMEOUT. With restart, a stop is followed by the
+ * wait for the next start (SW_TAIL_RESTART). */
+static unsigned char sw_clock(unsigned char *bit, unsigned char restart)
+{
+	unsigned int n = SWTWI_TIMEOUT_LOOPS;
+	unsigned char r = SW_TIMEOUT;
+
+	_delay_us(SW_DATA_VALID_US);
+
+	if (SDA_IS_HIGH()) {
+		*bit = 1;
+		SW_CLOCK("sbis", SW_START, r, n, SW_TAIL);
+	}
+	else {
+		*bit = 0;
+		if (restart)
+			SW_CLOCK("sbic", SW_STOP, r, n, SW_TAIL_RESTART);
+		else
+			SW_CLOCK("sbic", SW_STOP, r, n, SW_TAIL);
+	}
+
+	return r;
+}
+
+// Receive a byte. Called and returns with SCL held low.
+static unsigned char sw_rxByte(unsigned char *dst)
+{
+	unsigned char i, bit, r;
+	unsigned char b = 0;
+
+	for (i = 0; i < 8; i++) {
+		r = sw_clock(&bit, i == 0);
+		if (r) {
+			// a start or stop is only legal in place of the first bit
+			if (i && r != SW_TIMEOUT)
+				wm_busFault(SWTWI_CHANNEL, WM_FAULT_BUS_ERROR);
+			return r;
+		}
+
+		b <<= 1;
+		b |= bit;
+	}
+
+	*dst = b;
+
+	return SW_OK;
+}
+
+// Acknowledge a received byte. Called and returns with SCL held low.
+static unsigned char sw_ack(void)
+{
+	unsigned char bit, r;
+
+	SDA_PULL();
+	r = sw_clock(&bit, 0);
+	SDA_RELEASE();
+
+	return r;
+}
+
+// Send a byte. Called with SCL held low. Returns SW_OK (with SCL held low)
+// if the master wants more data, SW_NACK (also held) if not.
+static unsigned char sw_txByte(unsigned char d)
+{
+	unsigned char i, bit, r;
+
+	for (i = 0; i < 8; i++) {
+		if (d & 0x80) {
+			SDA_RELEASE();
+		} else {
+			SDA_PULL();
+		}
+		d <<= 1;
+
+		r = sw_clock(&bit, 0);
+		if (r) {
+			SDA_RELEASE();
+			return r;
+		}
+	}
+	SDA_RELEASE();
+
+	// acknowledge from the master
+	r = sw_clock(&bit, 0);
+	if (r)
+		return r;
+
+	return bit ? SW_NACK : SW_OK;
+}
+
+static unsigned char sw_transaction(void)
+{
+	unsigned char b, r;
+
+held:
+	// SCL is held low since the start condition
+	_delay_us(SW_FIRST_BIT_US);
+
+start:
+	r = sw_rxByte(&b);
+	if (r == SW_START)
+		goto restart;
+	if (r == SW_RESTART)
+		goto held;
+	if (r)
+		return r;
+
+	if ((b >> 1) != SWTWI_ADDR) {
+		// not for us, no ack. Also what a start seen too late gives.
+		wm_busFault(SWTWI_CHANNEL, WM_FAULT_UNEXPECTED);
+		return SW_OK;
+	}
+
+	if (b & 1) {
+		// slave transmit
+		wm_busTxStart(SWTWI_CHANNEL);
+		r = sw_ack();
+
+		while (r == SW_OK) {
+			b = wm_busTxByte(SWTWI_CHANNEL);
+			r = sw_txByte(b);
+		}
+
+		if (r != SW_NACK)
+			return r;
+
+		// the master ends the read with a stop or a repeated start
+		r = sw_clock(&b, 0);
+		if (r == SW_START)
+			goto restart;
+		if (r == SW_OK)
+			wm_busFault(SWTWI_CHANNEL, WM_FAULT_BUS_ERROR);
+		return r;
+	}
+	else {
+		// slave receive
+		wm_busRxStart(SWTWI_CHANNEL);
+		r = sw_ack();
+		if (r)
+			return r;
+
+		while (1) {
+			r = sw_rxByte(&b);
+			if (r)
+				break;
+
+			wm_busRxByte(SWTWI_CHANNEL, b);
+			r = sw_ack();
+			if (r)
+				return r;
+		}
+
+		if (r != SW_TIMEOUT)
+			wm_busRxStop(SWTWI_CHANNEL);
+		if (r == SW_START)
+			goto restart;
+		if (r == SW_RESTART)
+			goto held;
+		return r;
+	}
+
+restart:
+	// SCL is high after the repeated start, hold it at its fall
+	r = sw_holdAtFall();
+	if (r)
+		return r;
+	goto start;
+}
+
+/* Body of the interrupt, entered from the naked vector below with SCL
+ * already held if SDA fell. The __vector prefix keeps the compiler from
+ * complaining about a misspelled signal handler. */
+void __vector_swtwi_body(void) __attribute__((signal, used, externally_visible));
+void __vector_swtwi_body(void)
+{
+	unsigned char r;
+
+	if ((SWTWI_DDR & _BV(SWTWI_SCL_PIN)) == 0) {
+		// SDA rose: a stop, or a bit of a transaction we are not in
+		return;
+	}
+
+	/* SDA fell, with SCL high for a start. A fall with SCL low (the
+	 * master preparing a stop after the address we did not acknowledge)
+	 * is sorted out by sw_transaction: the first bit ends in a stop. */
+
+	r = sw_transaction();
+
+	SDA_RELEASE();
+	SCL_RELEASE();
+
+	if (r == SW_TIMEOUT)
+		wm_busFault(SWTWI_CHANNEL, WM_FAULT_TIMEOUT);
+
+	/* The SDA edges of this transaction left the flag set: the vector
+	 * runs again and returns at once, unless the master started the
+	 * next transaction meanwhile. Clearing the flag here would lose that
+	 * start. */
+}
+
+/* A start condition is SDA falling while SCL is high, but at 400kHz
+ * SCL is already low by the time the vector could test it. So SCL is
+ * held on any SDA fall, and the body sorts out the falls that were not a
+ * start: the first bit then ends in a stop, or the address is wrong. */
+ISR(SWTWI_vect, ISR_NAKED)
+{
+	asm volatile(
+		"sbis %[pin], %[sda]	\n\t"
+		"sbi %[ddr], %[scl]		\n\t"
+		"%~jmp __vector_swtwi_body	\n\t"
+		::
+		[pin] "I" (_SFR_IO_ADDR(SWTWI_PIN)),
+		[ddr] "I" (_SFR_IO_ADDR(SWTWI_DDR)),
+		[sda] "I" (SWTWI_SDA_PIN),
+		[scl] "I" (SWTWI_SCL_PIN)
+	);
+}
@@ -0,0 +1,26 @@
+#ifndef _swtwi_h__
+#define _swtwi_h__
+
+/* Software TWI slave, used for the second Wiimote channel.
+ *
+ * Both pins must be on the same port and have a pin change interrupt.
+ * No internal pull-ups, the Wiimote provides them. */
+#define SWTWI_PORT		PORTC
+#define SWTWI_DDR		DDRC
+#define SWTWI_PIN		PINC
+#define SWTWI_SCL_PIN	2	// PC2 / PCINT10
+#define SWTWI_SDA_PIN	3	// PC3 / PCINT11
+
+#define SWTWI_SDA_PCINT	PCINT11
+#define SWTWI_PCMSK		PCMSK1
+#define SWTWI_PCIE		PCIE1
+#define SWTWI_PCIF		PCIF1
+#define SWTWI_vect		PCINT1_vect
+
+#define SWTWI_CHANNEL	1
+#define SWTWI_ADDR		0x52
+
+void swtwi_init(void);
+void swtwi_start(void);
+
+#endif // _swtwi_h__
@@ -0,0 +1,69 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2014  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "timebase.h"
+
+#ifdef HAVE_TIMEBASE
+
+static volatile unsigned short timebase_wraps;
+
+/* Not ISR_NOBLOCK: TOV1 is cleared on entry, a reader nested before the
+ * increment would get the old wraps with the new TCNT1, 43.7ms in the
+ * past. The handler is a few cycles, the TWI handlers wait no longer. */
+ISR(TIMER1_OVF_vect)
+{
+	timebase_wraps++;
+}
+
+void timebase_init(void)
+{
+	unsigned char sreg;
+
+	sreg = SREG;
+	cli();
+	TCCR1A = 0;
+	TCCR1B = _BV(CS11);
+	TCNT1 = 0;
+	timebase_wraps = 0;
+	TIFR1 = _BV(TOV1);
+	TIMSK1 |= _BV(TOIE1);
+	SREG = sreg;
+}
+
+unsigned long timebase_time(void)
+{
+	unsigned char sreg;
+	unsigned short t;
+	unsigned long time;
+
+	sreg = SREG;
+	cli();
+	t = TCNT1;
+	// a wrap the interrupt has not counted, before or after reading TCNT1
+	if (TIFR1 & _BV(TOV1)) {
+		TIFR1 = _BV(TOV1);
+		timebase_wraps++;
+		t = TCNT1;
+	}
+	time = ((unsigned long)timebase_wraps << 16) | t;
+	SREG = sreg;
+
+	return time;
+}
+
+#endif // HAVE_TIMEBASE
@@ -0,0 +1,49 @@
+#ifndef _timebase_h__
+#define _timebase_h__
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/* Shared time base on Timer1, free running at F_CPU/8: 1.5 ticks per
+ * microsecond at 12MHz, 1 at 8MHz. Nothing else may change the Timer1
+ * mode. The compare units time events relative to TCNT1: A for the
+ * sensor filter (gun.c), B for the TWI timeout (wiimote.c).
+ *
+ * The 16 bit count wraps every 43.7ms at 12MHz. The difference of two
+ * timebase_now() is right for anything shorter, with unsigned
+ * arithmetic. timebase_time() also counts the wraps.
+ *
+ * Timer1 runs from the I/O clock, which extended standby stops: the time
+ * does not advance while the main loop sleeps in that mode. */
+#ifdef TIMSK1
+#define HAVE_TIMEBASE
+#endif
+
+#define TIMEBASE_PRESCALE		8
+#define TIMEBASE_TICKS_PER_MS	(F_CPU / TIMEBASE_PRESCALE / 1000L)
+#define TIMEBASE_TICKS_TO_US(t)	((unsigned long)(t) * TIMEBASE_PRESCALE / (F_CPU / 1000000L))
+#define TIMEBASE_US_TO_TICKS(us)	((unsigned long)(us) * (F_CPU / 1000000L) / TIMEBASE_PRESCALE)
+
+#ifdef HAVE_TIMEBASE
+void timebase_init(void);
+
+/* Atomic: an interrupt reading Timer1 between the two bytes would
+ * change the high byte read here. Interrupt handlers can read TCNT1
+ * directly. */
+static inline unsigned short timebase_now(void)
+{
+	unsigned char sreg = SREG;
+	unsigned short t;
+
+	cli();
+	t = TCNT1;
+	SREG = sreg;
+
+	return t;
+}
+
+// also works with interrupts off, if called at least once per wrap
+unsigned long timebase_time(void);
+#endif
+
+#endif // _timebase_h__
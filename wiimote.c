@@ -10,6 +10,8 @@
 #include <string.h>
 #include "wiimote.h"
 #include "wm_crypto.h"
+#include "prof.h"
+#include "timebase.h"
 
 // The following adapted from libOGC wiiuse_internal.h
 #define WM_EXP_ID                   0xFA
@@ -19,58 +21,266 @@
 #define WM_EXP_MEM_ENABLE2          0xFB
 #define WM_EXP_MEM_ENABLE1          0xF0
 
+// bus faults seen on the hardware TWI, see struct wm_faults
+#define WM_REG_BUS_FAULTS			0xF5
+
 
 // pointer to user function
-static void (*wm_sample_event)();
+static void (*wm_sample_event)(unsigned char channel);
+
+/* Everything the Wiimote sees through one extension port. Each channel
+ * has its own register file and key schedule so that two Wiimotes can
+ * be served independently. */
+struct wm_channel {
+	unsigned char enc_on;
+
+	// crypto data, from the random bytes and the key at 0x40 (WM_RAND, WM_KEY)
+	unsigned char ft[8];
+	unsigned char sb[8];
 
-static volatile unsigned char g_enc_on = 0;
+	// virtual register
+	unsigned char reg[256];
+	unsigned char reg_addr;
 
-// crypto data
-static volatile unsigned char wm_rand[10];
-static volatile unsigned char wm_key[6];
-static volatile unsigned char wm_ft[8];
-static volatile unsigned char wm_sb[8];
+	unsigned char first_addr_flag; // set address flag
+	unsigned char rw_len; // length of most recent operation
 
-// virtual register
-static volatile unsigned char twi_reg[256];
-static volatile unsigned int twi_reg_addr;
+	unsigned char alt_id_enabled;
+};
+
+static volatile struct wm_channel wm_channels[WM_NUM_CHANNELS];
+
+/* Hardware TWI units: unit n serves channel n. The second one is the
+ * TWI1 of the ATmega328PB. */
+#ifdef WITH_DUAL_TWI
+#define TWI_UNITS		2
+#else
+#define TWI_UNITS		1
+#endif
 
-static volatile unsigned char twi_first_addr_flag; // set address flag
-static volatile unsigned char twi_rw_len; // length of most recent operation
+static volatile struct wm_faults wm_faults[WM_NUM_CHANNELS];
 
 static volatile unsigned char alt_id_set;
-static volatile unsigned char alt_id_enabled;
 static volatile unsigned char alt_id[6];
 static volatile unsigned char default_id[6];
 
-unsigned char wm_getReg(unsigned char reg)
+unsigned char wm_getReg(unsigned char channel, unsigned char reg)
+{
+	return wm_channels[channel].reg[reg];
+}
+
+void wm_setRegs(unsigned char channel, unsigned char reg, const unsigned char *d, unsigned char len)
+{
+	unsigned char sreg;
+
+	sreg = SREG;
+	cli();
+	memcpy((void*)&wm_channels[channel].reg[reg], d, len);
+	SREG = sreg;
+}
+
+static volatile uint8_t *twi_twcr(unsigned char unit)
 {
-	return twi_reg[reg];
+#ifdef WITH_DUAL_TWI
+	if (unit)
+		return &TWCR1;
+#endif
+	return &TWCR;
 }
 
-static void twi_slave_init(unsigned char addr)
+static void twi_slave_init(unsigned char unit, unsigned char addr)
 {
 	// initialize stuff
-	twi_reg_addr = 0;
+	wm_channels[unit].reg_addr = 0;
 
 	// set slave address
+#ifdef WITH_DUAL_TWI
+	if (unit)
+		TWAR1 = addr << 1;
+	else
+#endif
 	TWAR = addr << 1;
 	
 	// enable twi module, acks, and twi interrupt
-	TWCR = _BV(TWIE) | _BV(TWEA);
+	*twi_twcr(unit) = _BV(TWIE) | _BV(TWEA);
 }
 
-void twi_clear_int(unsigned char ack)
+static inline void twi_clearInt(volatile uint8_t *twcr, unsigned char ack)
 {
 	// get ready by clearing interrupt, with or without ack
 	if(ack != 0)
 	{
-		TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA);
+		*twcr = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA);
 	}
 	else
 	{
-		TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT);
+		*twcr = _BV(TWEN) | _BV(TWIE) | _BV(TWINT);
+	}
+}
+
+void twi_clear_int(unsigned char ack)
+{
+	twi_clearInt(&TWCR, ack);
+}
+
+static void wm_countFault(unsigned char channel, volatile unsigned char *counter)
+{
+	if (*counter != 0xFF)
+		(*counter)++;
+	memcpy((void*)(wm_channels[channel].reg + WM_REG_BUS_FAULTS), (void*)&wm_faults[channel], sizeof(struct wm_faults));
+}
+
+void wm_busFault(unsigned char channel, unsigned char fault)
+{
+	wm_countFault(channel, (volatile unsigned char*)&wm_faults[channel] + fault);
+}
+
+/* Back to the not addressed slave state, as after a stop. TWAR, the
+ * register file and the keys are kept: the Wiimote goes on polling
+ * without a new handshake. Turning TWEN off releases SCL and SDA at
+ * once, whatever the state of the peripheral. */
+static void twi_recover(unsigned char unit)
+{
+	volatile struct wm_channel *c = &wm_channels[unit];
+	volatile uint8_t *twcr = twi_twcr(unit);
+
+	*twcr = 0;
+	c->first_addr_flag = 0;
+	c->rw_len = 0;
+	twi_clearInt(twcr, 1);
+}
+
+/* A transfer in progress must see its next bus event within
+ * TWI_TIMEOUT_TICKS. A Wiimote sends a byte every 25 to 90us, and polls
+ * every 5ms: after a hot plug or a glitch, the next poll finds the
+ * peripheral ready. Timed by Timer1 compare B (see timebase.h), set on
+ * the nearest deadline of the units. Not available without the time
+ * base. */
+#define TWI_TIMEOUT_TICKS		TIMEBASE_US_TO_TICKS(1000)
+
+#ifdef HAVE_TIMEBASE
+static unsigned short twi_deadline[TWI_UNITS];
+#endif
+// one bit per unit with a transfer in progress
+static volatile unsigned char twi_busy;
+
+#ifdef HAVE_TIMEBASE
+static void twi_program(void)
+{
+	unsigned short now = timebase_now();
+	unsigned short left, nearest = 0xFFFF;
+	unsigned char u, sreg;
+
+	if (!twi_busy) {
+		sreg = SREG;
+		cli();
+		TIMSK1 &= ~_BV(OCIE1B);
+		SREG = sreg;
+		return;
 	}
+
+	for (u = 0; u < TWI_UNITS; u++) {
+		if (!(twi_busy & (1 << u)))
+			continue;
+		left = twi_deadline[u] - now;
+		if (left < nearest)
+			nearest = left;
+	}
+	// the compare must be ahead of the counter to match
+	if (nearest < 4 || nearest > 0x8000)
+		nearest = 4;
+
+	/* In short atomic sections (see twi_watch). The flag is cleared
+	 * first: a match of the old value before the new one is set only
+	 * runs the handler for nothing, and the new match is never lost. */
+	TIFR1 = _BV(OCF1B);
+	now += nearest;
+	sreg = SREG;
+	cli();
+	OCR1B = now;
+	SREG = sreg;
+	sreg = SREG;
+	cli();
+	TIMSK1 |= _BV(OCIE1B);
+	SREG = sreg;
+}
+#endif
+
+/* Also called with the interrupts enabled (see TWI_vect): the timeout
+ * handler must not run between the updates. Each atomic section is a
+ * few cycles, for the start of the software slave (see swtwi.c): the
+ * deadline is stored before the busy bit, the handler ignoring it until
+ * then. */
+static void twi_watch(unsigned char unit, unsigned char busy)
+{
+	unsigned char sreg;
+
+#ifdef HAVE_TIMEBASE
+	if (busy) {
+		unsigned short deadline = timebase_now() + TWI_TIMEOUT_TICKS;
+
+		sreg = SREG;
+		cli();
+		twi_deadline[unit] = deadline;
+		SREG = sreg;
+	}
+#endif
+
+	sreg = SREG;
+	cli();
+	if (busy)
+		twi_busy |= 1 << unit;
+	else
+		twi_busy &= ~(1 << unit);
+	SREG = sreg;
+
+#ifdef HAVE_TIMEBASE
+	twi_program();
+#endif
+}
+
+#ifdef HAVE_TIMEBASE
+ISR(TIMER1_COMPB_vect)
+{
+	unsigned short now = TCNT1;
+	unsigned char u;
+
+	for (u = 0; u < TWI_UNITS; u++) {
+		if (!(twi_busy & (1 << u)) || (short)(now - twi_deadline[u]) < 0)
+			continue;
+
+		// an event waiting for us: we are the ones holding the bus
+		if (*twi_twcr(u) & _BV(TWINT)) {
+			twi_deadline[u] = now + TWI_TIMEOUT_TICKS;
+			continue;
+		}
+
+		twi_busy &= ~(1 << u);
+		twi_recover(u);
+		wm_countFault(u, &wm_faults[u].timeouts);
+	}
+
+	twi_program();
+}
+#endif
+
+char wm_busBusy(void)
+{
+	return twi_busy ? 1 : 0;
+}
+
+void wm_getFaults(unsigned char channel, struct wm_faults *f)
+{
+	unsigned char sreg;
+
+	memset(f, 0, sizeof(struct wm_faults));
+	if (channel >= WM_NUM_CHANNELS)
+		return;
+
+	sreg = SREG;
+	cli();
+	memcpy(f, (void*)&wm_faults[channel], sizeof(struct wm_faults));
+	SREG = sreg;
 }
 
 /*
@@ -87,136 +297,233 @@ unsigned char wm_ror8(unsigned char a, unsigned char b)
 	return (a >> b) | ((a << (8 - b)) & 0xFF);
 }
 
-void wm_gentabs()
+/* The random bytes and the key, as written at 0x40 to 0x4F, in the
+ * reverse order */
+#define WM_RAND(c, i)	((c)->reg[0x49 - (i)])
+#define WM_KEY(c, i)	((c)->reg[0x4F - (i)])
+#define WM_T0(c, i)		pgm_read_byte(&(sboxes[0][WM_RAND(c, i)]))
+
+// one byte of the key matching an answer byte
+static unsigned char wm_keyByte(volatile struct wm_channel *c, unsigned char ans,
+								unsigned char x, unsigned char r, unsigned char s, unsigned char y)
+{
+	return (wm_ror8(ans ^ WM_T0(c, x), WM_T0(c, r) % 8) - WM_T0(c, s)) ^ WM_T0(c, y);
+}
+
+/* Out of line, and without tables on the stack: it runs in the
+ * interrupts, and in a build serving two Wiimotes, the one of the
+ * software slave nests in the one of the TWI, where RAM is short. */
+static void __attribute__((noinline)) wm_gentabs(volatile struct wm_channel *c)
 {
 	unsigned char idx;
-	unsigned char i;
 
 	// check all idx
 	for(idx = 0; idx < 7; idx++)
 	{
-		// generate test key
-		unsigned char ans[6];
-		unsigned char tkey[6];
-		unsigned char t0[10];
-		
-		for(i = 0; i < 6; i++)
-		{
-			ans[i] = pgm_read_byte(&(ans_tbl[idx][i]));
-		}	
-		for(i = 0; i < 10; i++)
-		{
-			t0[i] = pgm_read_byte(&(sboxes[0][wm_rand[i]]));
-		}
-	
-		tkey[0] = ((wm_ror8((ans[0] ^ t0[5]), (t0[2] % 8)) - t0[9]) ^ t0[4]);
-		tkey[1] = ((wm_ror8((ans[1] ^ t0[1]), (t0[0] % 8)) - t0[5]) ^ t0[7]);
-		tkey[2] = ((wm_ror8((ans[2] ^ t0[6]), (t0[8] % 8)) - t0[2]) ^ t0[0]);
-		tkey[3] = ((wm_ror8((ans[3] ^ t0[4]), (t0[7] % 8)) - t0[3]) ^ t0[2]);
-		tkey[4] = ((wm_ror8((ans[4] ^ t0[1]), (t0[6] % 8)) - t0[3]) ^ t0[4]);
-		tkey[5] = ((wm_ror8((ans[5] ^ t0[7]), (t0[8] % 8)) - t0[5]) ^ t0[9]);
-
-		// compare with actual key
-		if(memcmp(tkey, (void*)wm_key, 6) == 0) break; // if match, then use this idx
+		const unsigned char *ans = ans_tbl[idx];
+
+		// generate test key, compare with actual key: if match, then use this idx
+		if (wm_keyByte(c, pgm_read_byte(&ans[0]), 5, 2, 9, 4) == WM_KEY(c, 0) &&
+			wm_keyByte(c, pgm_read_byte(&ans[1]), 1, 0, 5, 7) == WM_KEY(c, 1) &&
+			wm_keyByte(c, pgm_read_byte(&ans[2]), 6, 8, 2, 0) == WM_KEY(c, 2) &&
+			wm_keyByte(c, pgm_read_byte(&ans[3]), 4, 7, 3, 2) == WM_KEY(c, 3) &&
+			wm_keyByte(c, pgm_read_byte(&ans[4]), 1, 6, 3, 4) == WM_KEY(c, 4) &&
+			wm_keyByte(c, pgm_read_byte(&ans[5]), 7, 8, 5, 9) == WM_KEY(c, 5))
+			break;
 	}
 	if (idx == 7) {
-		g_enc_on = 0;
+		c->enc_on = 0;
 		return;
 	}
 
 	// generate encryption from idx key and rand
-	wm_ft[0] = pgm_read_byte(&(sboxes[idx + 1][wm_key[4]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[3]]));
-	wm_ft[1] = pgm_read_byte(&(sboxes[idx + 1][wm_key[2]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[5]]));
-	wm_ft[2] = pgm_read_byte(&(sboxes[idx + 1][wm_key[5]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[7]]));
-	wm_ft[3] = pgm_read_byte(&(sboxes[idx + 1][wm_key[0]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[2]]));
-	wm_ft[4] = pgm_read_byte(&(sboxes[idx + 1][wm_key[1]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[4]]));
-	wm_ft[5] = pgm_read_byte(&(sboxes[idx + 1][wm_key[3]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[9]]));
-	wm_ft[6] = pgm_read_byte(&(sboxes[idx + 1][wm_rand[0]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[6]]));
-	wm_ft[7] = pgm_read_byte(&(sboxes[idx + 1][wm_rand[1]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[8]]));
+	c->ft[0] = pgm_read_byte(&(sboxes[idx + 1][WM_KEY(c, 4)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 3)]));
+	c->ft[1] = pgm_read_byte(&(sboxes[idx + 1][WM_KEY(c, 2)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 5)]));
+	c->ft[2] = pgm_read_byte(&(sboxes[idx + 1][WM_KEY(c, 5)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 7)]));
+	c->ft[3] = pgm_read_byte(&(sboxes[idx + 1][WM_KEY(c, 0)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 2)]));
+	c->ft[4] = pgm_read_byte(&(sboxes[idx + 1][WM_KEY(c, 1)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 4)]));
+	c->ft[5] = pgm_read_byte(&(sboxes[idx + 1][WM_KEY(c, 3)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 9)]));
+	c->ft[6] = pgm_read_byte(&(sboxes[idx + 1][WM_RAND(c, 0)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 6)]));
+	c->ft[7] = pgm_read_byte(&(sboxes[idx + 1][WM_RAND(c, 1)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 8)]));
 	
-	wm_sb[0] = pgm_read_byte(&(sboxes[idx + 1][wm_key[0]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[1]]));
-	wm_sb[1] = pgm_read_byte(&(sboxes[idx + 1][wm_key[5]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[4]]));
-	wm_sb[2] = pgm_read_byte(&(sboxes[idx + 1][wm_key[3]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[0]]));
-	wm_sb[3] = pgm_read_byte(&(sboxes[idx + 1][wm_key[2]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[9]]));
-	wm_sb[4] = pgm_read_byte(&(sboxes[idx + 1][wm_key[4]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[7]]));
-	wm_sb[5] = pgm_read_byte(&(sboxes[idx + 1][wm_key[1]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[8]]));
-	wm_sb[6] = pgm_read_byte(&(sboxes[idx + 1][wm_rand[3]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[5]]));
-	wm_sb[7] = pgm_read_byte(&(sboxes[idx + 1][wm_rand[2]])) ^ pgm_read_byte(&(sboxes[idx + 2][wm_rand[6]]));
-	g_enc_on = 1;
+	c->sb[0] = pgm_read_byte(&(sboxes[idx + 1][WM_KEY(c, 0)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 1)]));
+	c->sb[1] = pgm_read_byte(&(sboxes[idx + 1][WM_KEY(c, 5)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 4)]));
+	c->sb[2] = pgm_read_byte(&(sboxes[idx + 1][WM_KEY(c, 3)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 0)]));
+	c->sb[3] = pgm_read_byte(&(sboxes[idx + 1][WM_KEY(c, 2)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 9)]));
+	c->sb[4] = pgm_read_byte(&(sboxes[idx + 1][WM_KEY(c, 4)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 7)]));
+	c->sb[5] = pgm_read_byte(&(sboxes[idx + 1][WM_KEY(c, 1)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 8)]));
+	c->sb[6] = pgm_read_byte(&(sboxes[idx + 1][WM_RAND(c, 3)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 5)]));
+	c->sb[7] = pgm_read_byte(&(sboxes[idx + 1][WM_RAND(c, 2)])) ^ pgm_read_byte(&(sboxes[idx + 2][WM_RAND(c, 6)]));
+	c->enc_on = 1;
 }
 
-void wm_slaveTxStart(unsigned char addr)
+static void wm_slaveTxStart(volatile struct wm_channel *c, unsigned char addr)
 {
 	if(addr >= 0x00 && addr < 0x06)
 	{
 		// call user event
-		wm_sample_event();
+		wm_sample_event(c - wm_channels);
 	}
 }
 
-void wm_slaveRx(unsigned char addr, unsigned char l)
+static void wm_slaveRx(volatile struct wm_channel *c, unsigned char addr, unsigned char l)
 {
-	unsigned int i;
-
-	// if encryption data is sent, store them accordingly
-	if(addr >= 0x40 && addr < 0x46)
+	// the random bytes and the key are sent in three writes, from 0x40
+	if(addr >= 0x4C && addr < 0x50 && addr + l == 0x50)
 	{
-		for(i = 0; i < 6; i++)
-		{
-			wm_rand[9 - i] = twi_reg[0x40 + i];
-		}
-		//	wm_gentabs();
+		PROF_START(t);
+
+		// generate decryption once all data is loaded
+		wm_gentabs(c);
+		PROF_END(PROF_GENTABS, t);
 	}
-	else if(addr >= 0x46 && addr < 0x4C)
+}
+
+/* Bus events, common to every transport (hardware TWI or software slave) */
+
+// addressed for writing
+static inline void wm_rxStart(volatile struct wm_channel *c)
+{
+	// get ready to receive pointer
+	c->first_addr_flag = 0;
+}
+
+// data byte received
+static inline void wm_rxByte(volatile struct wm_channel *c, unsigned char t)
+{
+	if(c->first_addr_flag != 0)
 	{
-		for(i = 6; i < 10; i++)
+		unsigned char a = c->reg_addr;
+
+		// put byte in register
+		if ((a == 0xF0) && (t == 0x55 || t == 0xAA)) {
+			c->enc_on = 0;
+			memcpy((void*)(c->reg + WM_EXP_ID), (void*)default_id, 6);
+			c->alt_id_enabled = 0;
+		}
+
+		// Writing 0x64 to register 0x00 after disabling encryption but
+		// before reading the extension id enables an alternate extension
+		// id. Adapted controller data is the reported as is.
+		if ((a == 0x00) && (t == 0x64) && alt_id_set) {
+			memcpy((void*)(c->reg + WM_EXP_ID), (void*)alt_id, 6);
+			c->alt_id_enabled = 1;
+		}
+		
+		if(c->enc_on) // if encryption is on
 		{
-			wm_rand[9 - i] = twi_reg[0x40 + i];
+			// decrypt
+			c->reg[a] = (t ^ c->sb[a % 8]) + c->ft[a % 8];
 		}
-		for(i = 0; i < 2; i++)
+		else
 		{
-			wm_key[5 - i] = twi_reg[0x40 + 10 + i];
+			c->reg[a] = t;
 		}
-		//	wm_gentabs();
+		c->reg_addr = a + 1;
+		c->rw_len++;
 	}
-	else if(addr >= 0x4C && addr < 0x50)
+	else
 	{
-		for(i = 2; i < 6; i++)
-		{
-			wm_key[5 - i] = twi_reg[0x40 + 10 + i];
-		}
-		if (addr + l == 0x50) {
-			// generate decryption once all data is loaded
-			wm_gentabs();
-		}
+		// set address
+		c->reg_addr = t;
+		c->first_addr_flag = 1;
+		c->rw_len = 0;
 	}
 }
 
-void wm_newaction(unsigned char * d, unsigned char len)
+// stop or repeated start after a write
+static inline void wm_rxStop(volatile struct wm_channel *c)
+{
+	// run user defined function
+	wm_slaveRx(c, c->reg_addr - c->rw_len, c->rw_len);
+}
+
+// addressed for reading
+static inline void wm_txStart(volatile struct wm_channel *c)
+{
+	// run user defined function
+	wm_slaveTxStart(c, c->reg_addr);
+	c->rw_len = 0;
+}
+
+// next byte to send
+static inline unsigned char wm_txByte(volatile struct wm_channel *c)
+{
+	unsigned char a = c->reg_addr;
+	unsigned char d;
+
+	if(c->enc_on) // encryption is on
+	{
+		// encrypt
+		d = (c->reg[a] - c->ft[a % 8]) ^ c->sb[a % 8];
+	}
+	else
+	{
+		d = c->reg[a];
+	}
+	c->reg_addr = a + 1;
+	c->rw_len++;
+
+	return d;
+}
+
+void wm_busRxStart(unsigned char channel)
+{
+	wm_rxStart(&wm_channels[channel]);
+}
+
+void wm_busRxByte(unsigned char channel, unsigned char b)
+{
+	wm_rxByte(&wm_channels[channel], b);
+}
+
+void wm_busRxStop(unsigned char channel)
+{
+	wm_rxStop(&wm_channels[channel]);
+}
+
+void wm_busTxStart(unsigned char channel)
+{
+	wm_txStart(&wm_channels[channel]);
+}
+
+unsigned char wm_busTxByte(unsigned char channel)
+{
+	return wm_txByte(&wm_channels[channel]);
+}
+
+void wm_newaction(unsigned char channel, unsigned char * d, unsigned char len)
 {
 	// load button data from user application
-	memcpy((void*)twi_reg, d, len);
+	memcpy((void*)wm_channels[channel].reg, d, len);
 }
 
-void wm_init(unsigned char * id, unsigned char * t, unsigned char len, unsigned char * cal_data, void (*function)(void))
+void wm_init(unsigned char * id, unsigned char * t, unsigned char len, const unsigned char * cal_data, void (*function)(unsigned char))
 {
 	unsigned int i,j;
+	unsigned char ch;
 
 	// link user function
 	wm_sample_event = function;
 
-	// start state
-	wm_newaction(t, len);
-	twi_reg[WM_EXP_MEM_ENABLE1] = 0; // disable encryption
-
 	// set id
-	memcpy(default_id, id, 6);
-	memcpy(twi_reg + WM_EXP_ID, default_id, 6);
+	memcpy((void*)default_id, id, 6);
 
-	// set calibration data
-	for(i = 0, j = WM_EXP_MEM_CALIBR; i < 32; i++, j++)
+	for (ch = 0; ch < WM_NUM_CHANNELS; ch++)
 	{
-		twi_reg[j] = cal_data[i];
+		volatile struct wm_channel *c = &wm_channels[ch];
+
+		// start state
+		wm_newaction(ch, t, len);
+		c->reg[WM_EXP_MEM_ENABLE1] = 0; // disable encryption
+
+		memcpy((void*)(c->reg + WM_EXP_ID), (void*)default_id, 6);
+
+		// set calibration data
+		for(i = 0, j = WM_EXP_MEM_CALIBR; i < 32; i++, j++)
+		{
+			c->reg[j] = pgm_read_byte(&cal_data[i]);
+		}
 	}
 
 #ifdef USE_DEV_DETECT_PIN
@@ -232,7 +539,18 @@ void wm_init(unsigned char * id, unsigned char * t, unsigned char len, unsigned
 //	twi_ddr |= _BV(twi_scl_pin); // test: Pull clk while busy initializing
 
 	// start twi slave, link events
-	twi_slave_init(0x52);
+	twi_slave_init(0, 0x52);
+
+#ifdef WITH_DUAL_TWI
+	// second channel, on TWI1. No pull-ups either.
+	twi1_port &= ~(_BV(twi1_scl_pin) | _BV(twi1_sda_pin));
+	twi_slave_init(1, 0x52);
+#endif
+
+#ifdef WITH_SOFT_TWI
+	// second channel
+	swtwi_init();
+#endif
 
 #ifdef USE_DEV_DETECT_PIN
 	// make the wiimote think something is connected
@@ -252,118 +570,173 @@ void wm_start(void)
 	if (!wm_started) {
 		// Start I2C
 		TWCR |= _BV(TWEN);
+#ifdef WITH_DUAL_TWI
+		TWCR1 |= _BV(TWEN);
+#endif
+#ifdef WITH_SOFT_TWI
+		swtwi_start();
+#endif
 		wm_started = 1;
 	}
 }
 
-char wm_altIdEnabled(void)
+char wm_altIdEnabled(unsigned char channel)
 {
-	return alt_id_enabled;
+	return wm_channels[channel].alt_id_enabled;
 }
 
 void wm_setAltId(unsigned char id[6])
 {
-	memcpy(alt_id, id, 6);
+	memcpy((void*)alt_id, id, 6);
 	alt_id_set = 1;
 }
 
-ISR(TWI_vect)
+#ifdef WITH_PROFILING
+// start of the current read transfer
+static unsigned short prof_read_start;
+
+static unsigned char twiSite(unsigned char status)
 {
-	switch(TW_STATUS)
+	switch (status)
+	{
+		case TW_SR_SLA_ACK:
+		case TW_SR_GCALL_ACK:
+		case TW_SR_ARB_LOST_SLA_ACK:
+		case TW_SR_ARB_LOST_GCALL_ACK:
+			return PROF_TWI_RX_START;
+		case TW_SR_DATA_ACK:
+		case TW_SR_GCALL_DATA_ACK:
+			return PROF_TWI_RX_BYTE;
+		case TW_SR_STOP:
+			return PROF_TWI_RX_STOP;
+		case TW_ST_SLA_ACK:
+		case TW_ST_ARB_LOST_SLA_ACK:
+			prof_read_start = timebase_now();
+			return PROF_TWI_TX_START;
+		case TW_ST_DATA_ACK:
+			return PROF_TWI_TX_BYTE;
+		case TW_ST_DATA_NACK:
+		case TW_ST_LAST_DATA:
+			prof_record(PROF_TWI_READ, timebase_now() - prof_read_start);
+			return PROF_TWI_TX_END;
+	}
+	return PROF_TWI_OTHER;
+}
+#endif
+
+/* One event of a hardware TWI unit. Inlined with constant registers in
+ * each handler. */
+static inline void twi_event(unsigned char unit, volatile uint8_t *twcr, volatile uint8_t *twdr,
+								unsigned char status)
+{
+	volatile struct wm_channel *c = &wm_channels[unit];
+	unsigned char busy = 1; // a transfer is in progress after this event
+
+	switch(status)
 	{
 		// Slave Rx
 		case TW_SR_SLA_ACK: // addressed, returned ack
 		case TW_SR_GCALL_ACK: // addressed generally, returned ack
 		case TW_SR_ARB_LOST_SLA_ACK: // lost arbitration, returned ack
 		case TW_SR_ARB_LOST_GCALL_ACK: // lost arbitration generally, returned ack
-			// get ready to receive pointer
-			twi_first_addr_flag = 0;
-			// ack
-			twi_clear_int(1);
+			wm_rxStart(c);
 			break;
 		case TW_SR_DATA_ACK: // data received, returned ack
 		case TW_SR_GCALL_DATA_ACK: // data received generally, returned ack
-		if(twi_first_addr_flag != 0)
-		{
-			// put byte in register
-			unsigned char t = TWDR;
-
-			if ((twi_reg_addr == 0xF0) && (t == 0x55 || t == 0xAA)) {
-				g_enc_on = 0;
-				memcpy(twi_reg + WM_EXP_ID, default_id, 6);
-				alt_id_enabled = 0;
-			}
-
-			// Writing 0x64 to register 0x00 after disabling encryption but
-			// before reading the extension id enables an alternate extension
-			// id. Adapted controller data is the reported as is.
-			if ((twi_reg_addr == 0x00) && (t == 0x64) && alt_id_set) {
-				memcpy(twi_reg + WM_EXP_ID, alt_id, 6);
-				alt_id_enabled = 1;
-			}
-			
-			if(g_enc_on ) // if encryption is on
-			{
-				// decrypt
-				twi_reg[twi_reg_addr] = (t ^ wm_sb[twi_reg_addr % 8]) + wm_ft[twi_reg_addr % 8];
-			}
-			else
-			{
-				twi_reg[twi_reg_addr] = t;
-			}
-			twi_reg_addr++;
-			twi_rw_len++;
-		}
-		else
-		{
-			// set address
-			twi_reg_addr = TWDR;
-			twi_first_addr_flag = 1;
-			twi_rw_len = 0;
-		}
-		twi_clear_int(1); // ack
+			wm_rxByte(c, *twdr);
 			break;
 		case TW_SR_STOP: // stop or repeated start condition received
-			// run user defined function
-			wm_slaveRx(twi_reg_addr - twi_rw_len, twi_rw_len);
-			twi_clear_int(1); // ack future responses
+			wm_rxStop(c);
+			busy = 0;
 			break;
 		case TW_SR_DATA_NACK: // data received, returned nack
 		case TW_SR_GCALL_DATA_NACK: // data received generally, returned nack
-			twi_clear_int(0); // nack back at master
+			// not addressed from now on. TWEA must stay set, or our own
+			// address is not recognised anymore.
+			busy = 0;
 			break;
 		
 		// Slave Tx
 		case TW_ST_SLA_ACK:	// addressed, returned ack
 		case TW_ST_ARB_LOST_SLA_ACK: // arbitration lost, returned ack
-			// run user defined function
-			wm_slaveTxStart(twi_reg_addr);
-			twi_rw_len = 0;
+			wm_txStart(c);
 		case TW_ST_DATA_ACK: // byte sent, ack returned
 			// ready output byte
-			if(g_enc_on) // encryption is on
-			{
-				// encrypt
-				TWDR = (twi_reg[twi_reg_addr] - wm_ft[twi_reg_addr % 8]) ^ wm_sb[twi_reg_addr % 8];
-			}
-			else
-			{
-				TWDR = twi_reg[twi_reg_addr];
-			}
-			twi_reg_addr++;
-			twi_rw_len++;
-			twi_clear_int(1); // ack
+			*twdr = wm_txByte(c);
 			break;
 		case TW_ST_DATA_NACK: // received nack, we are done 
 		case TW_ST_LAST_DATA: // received ack, but we are done already!
-			// ack future responses
-			twi_clear_int(1);
+			busy = 0;
 			break;
+		case TW_BUS_ERROR: // illegal start or stop, a glitch on the bus
+			twi_watch(unit, 0);
+			twi_recover(unit);
+			wm_countFault(unit, &wm_faults[unit].bus_errors);
+			return;
 		default:
-			twi_clear_int(0);
+			wm_countFault(unit, &wm_faults[unit].unexpected);
 			break;
 	}
+
+	// before TWINT is cleared, the next event may follow right away
+	twi_watch(unit, busy);
+	// ack future responses, and keep recognising our address
+	twi_clearInt(twcr, 1);
 }
 
+#ifdef WITH_SOFT_TWI
+/* The software slave must see its start condition within a microsecond
+ * (see swtwi.c), while an event here takes up to milliseconds with a key
+ * exchange. The vector only turns TWIE off, writing TWINT as 0 leaves
+ * the event pending and the bus stretched, and the body runs with the
+ * interrupts enabled. twi_clearInt() turns TWIE back on.
+ *
+ * Both masters poll at the same rate, so a start of the software bus
+ * keeps coming as this vector is entered, which delays the pin change
+ * vector past the start. The vector first holds SCL of the software bus
+ * as that one does, on SDA low. */
+void __vector_twi_body(void) __attribute__((signal, used, externally_visible));
 
+ISR(TWI_vect, ISR_NAKED)
+{
+	asm volatile(
+		"sbis %[pin], %[sda]	\n\t"
+		"sbi %[ddr], %[scl]		\n\t"
+		"push r24				\n\t"
+		"ldi r24, %[twcr]		\n\t"
+		"sts %[reg], r24		\n\t"
+		"pop r24				\n\t"
+		"sei					\n\t"
+		"%~jmp __vector_twi_body	\n\t"
+		::
+		[twcr] "M" (_BV(TWEN) | _BV(TWEA)),
+		[reg] "n" (_SFR_MEM_ADDR(TWCR)),
+		[pin] "I" (_SFR_IO_ADDR(SWTWI_PIN)),
+		[ddr] "I" (_SFR_IO_ADDR(SWTWI_DDR)),
+		[sda] "I" (SWTWI_SDA_PIN),
+		[scl] "I" (SWTWI_SCL_PIN)
+	);
+}
 
+#define TWI_HANDLER()	void __vector_twi_body(void)
+#else
+#define TWI_HANDLER()	ISR(TWI_vect)
+#endif
+
+// the profiling sites are for the first unit
+TWI_HANDLER()
+{
+	unsigned char status = TW_STATUS;
+	PROF_START(t);
+
+	twi_event(0, &TWCR, &TWDR, status);
+
+	PROF_END(twiSite(status), t);
+}
+
+#ifdef WITH_DUAL_TWI
+ISR(TWI1_vect)
+{
+	twi_event(1, &TWCR1, &TWDR1, TWSR1 & TW_STATUS_MASK);
+}
+#endif
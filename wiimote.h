@@ -16,19 +16,81 @@
 #define dev_detect_ddr DDRD
 #define dev_detect_pin 4
 
+// Channel 0 is the hardware TWI. With WITH_SOFT_TWI, channel 1 is
+// served by a software slave on a second pin pair (see swtwi.c). With
+// WITH_DUAL_TWI (ATmega328PB), by the second TWI unit.
+#if defined(WITH_SOFT_TWI) && defined(WITH_DUAL_TWI)
+#error WITH_SOFT_TWI and WITH_DUAL_TWI both serve channel 1
+#endif
+#ifdef WITH_SOFT_TWI
+#include "swtwi.h"
+#define WM_NUM_CHANNELS	2
+#elif defined(WITH_DUAL_TWI)
+#define WM_NUM_CHANNELS	2
+#else
+#define WM_NUM_CHANNELS	1
+#endif
+
+#ifdef WITH_DUAL_TWI
+// TWI1 of the ATmega328PB: SDA1 on PE0, SCL1 on PE1
+#define twi1_port PORTE
+#define twi1_scl_pin 1
+#define twi1_sda_pin 0
+
+// the first unit is named TWI0 on this chip
+#ifndef TWCR
+#define TWCR	TWCR0
+#define TWSR	TWSR0
+#define TWDR	TWDR0
+#define TWAR	TWAR0
+#define TWBR	TWBR0
+#define TWI_vect	TWI0_vect
+#endif
+#endif
+
 // initialize wiimote interface with id, starting data, and calibration data
-void wm_init(unsigned char *id, unsigned char *t, unsigned char len, unsigned char *, void (*)(void));
+// (32 bytes, in the flash). The function is called with the channel number
+// when the report is read.
+void wm_init(unsigned char *id, unsigned char *t, unsigned char len, const unsigned char *, void (*)(unsigned char));
 
 void wm_start(void);
 char wm_isStarted(void);
 
-char wm_altIdEnabled(void);
+char wm_altIdEnabled(unsigned char channel);
 void wm_setAltId(unsigned char id[6]);
 
 // set button data
-void wm_newaction(unsigned char *, unsigned char len);
+void wm_newaction(unsigned char channel, unsigned char *, unsigned char len);
+
+unsigned char wm_getReg(unsigned char channel, unsigned char reg);
+// for registers the Wiimote does not use, see prof.h
+void wm_setRegs(unsigned char channel, unsigned char reg, const unsigned char *d, unsigned char len);
+
+/* Bus faults of a channel since power up, counts up to 255. A hardware
+ * TWI unit is reset after each one, the register file and the keys are
+ * kept. Also readable at register 0xF5 of the channel. */
+struct wm_faults {
+	unsigned char bus_errors; // illegal start or stop
+	unsigned char timeouts; // transfer abandoned by the master, or a stuck line
+	unsigned char unexpected; // status without a handler, or not our address
+};
+
+void wm_getFaults(unsigned char channel, struct wm_faults *f);
+
+// a transfer is in progress on a hardware TWI unit, timed by Timer1
+char wm_busBusy(void);
 
-unsigned char wm_getReg(unsigned char reg);
+// bus events, for transports other than the hardware TWI
+void wm_busRxStart(unsigned char channel);
+void wm_busRxByte(unsigned char channel, unsigned char b);
+void wm_busRxStop(unsigned char channel);
+void wm_busTxStart(unsigned char channel);
+unsigned char wm_busTxByte(unsigned char channel);
+// a fault seen by such a transport, counted in its struct wm_faults
+#define WM_FAULT_BUS_ERROR	0
+#define WM_FAULT_TIMEOUT	1
+#define WM_FAULT_UNEXPECTED	2
+void wm_busFault(unsigned char channel, unsigned char fault);
 
 #define wiimote_h
 #endif